@@ -0,0 +1,50 @@
+/*===========================================================================
+
+  BUTE version 2
+
+  highlight.h
+
+  Syntax colouring for Lua. How a line is coloured depends on whether
+  it starts inside a long string or comment, or a string continued
+  from the line before, so the lexer's state at the start of each line
+  is cached. A change to the text makes the states after it stale;
+  they're worked out again only as far as a line that needs colouring,
+  and only until a line's state comes out the same as it was before
+  the change, after which the rest of the cache is still right.
+
+  The cache holds a byte for each line, but only as far down the text
+  as has been coloured.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+===========================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include <klib/defs.h>
+#include <bute2/textbuf.h>
+#include <bute2/lineindex.h>
+
+struct _Highlight;
+typedef struct _Highlight Highlight;
+
+BEGIN_DECLS
+
+/** Create an empty cache. Returns NULL if there isn't enough memory. */
+extern Highlight *highlight_create (void);
+
+extern void       highlight_destroy (Highlight *self);
+
+/** Record a change to the text, within line, that erased 'erased'
+    newlines and inserted 'inserted' of them. */
+extern void       highlight_change (Highlight *self, int line, int erased,
+                    int inserted);
+
+/** Set the ScreenAttr of each of the first count characters of a line.
+    The line must exist, and count must be no more than its length. */
+extern void       highlight_line (Highlight *self, TextBuf *text,
+                    LineIndex *index, int line, uint8_t *attrs, int count);
+
+END_DECLS
+
@@ -0,0 +1,61 @@
+/*===========================================================================
+
+  BUTE version 2
+
+  lineindex.h
+
+  An index of where each line of the text starts, so that the editor
+  can convert between line numbers and positions without scanning the
+  text. The index holds the length of every line, including its
+  newline, in blocks of a few dozen lines; a Fenwick tree over the
+  block totals finds the block holding a given line or position in
+  logarithmic time. The index is kept up to date by telling it about
+  every insertion and erasure.
+
+  Lines are numbered from zero. A text with n newlines has n+1 lines,
+  the last of which has no newline, and may be empty.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+===========================================================================*/
+
+#pragma once
+
+#include <klib/defs.h>
+#include <shell/errcodes.h>
+
+struct _LineIndex;
+typedef struct _LineIndex LineIndex;
+
+BEGIN_DECLS
+
+/** Create an index of an empty text, which has a single, empty, line.
+    Returns NULL if there isn't enough memory. */
+extern LineIndex *lineindex_create (void);
+
+extern void       lineindex_destroy (LineIndex *self);
+
+/** Record that len characters of text have been inserted at pos.
+    Returns ERR_NOMEM if the index could not be extended, in which case
+    it is left as it was. */
+extern ErrCode    lineindex_insert (LineIndex *self, int pos,
+                    const char *text, int len);
+
+/** Record that len characters have been erased from pos. */
+extern void       lineindex_erase (LineIndex *self, int pos, int len);
+
+/** The number of lines in the text. */
+extern int        lineindex_lines (const LineIndex *self);
+
+/** The line containing pos. A position at or beyond the end of the
+    text is in the last line. */
+extern int        lineindex_line_at (LineIndex *self, int pos);
+
+/** The position of the start of a line, which must exist. */
+extern int        lineindex_line_start (LineIndex *self, int line);
+
+/** The length of a line, not counting its newline. */
+extern int        lineindex_line_length (LineIndex *self, int line);
+
+END_DECLS
+
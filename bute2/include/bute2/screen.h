@@ -0,0 +1,89 @@
+/*===========================================================================
+
+  BUTE version 2
+
+  screen.h
+
+  A copy of what the terminal is showing, so that the editor can
+  compose the whole screen each time, and only the characters that
+  have changed are sent. Each row is a line of characters, each with
+  an attribute that selects its colour. A hash of each row makes it
+  quick to see which rows are unchanged, and which have moved up or
+  down, so that moves can be made by scrolling the terminal.
+
+  The editor writes rows into the next frame, using screen_chars() and
+  screen_attrs(), and calls screen_update() to send the differences.
+  Anything that writes to the terminal other than through the screen
+  must call screen_invalidate() for the rows it changes.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+===========================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include <klib/defs.h>
+
+typedef enum _ScreenAttr
+  {
+  SCREEN_ATTR_TEXT = 0,
+  SCREEN_ATTR_SELECT = 1,
+  SCREEN_ATTR_STATUS = 2,
+  // Syntax colours, which only change the foreground
+  SCREEN_ATTR_KEYWORD = 3,
+  SCREEN_ATTR_STRING = 4,
+  SCREEN_ATTR_COMMENT = 5,
+  SCREEN_ATTR_NUMBER = 6
+  } ScreenAttr;
+
+struct _Screen;
+typedef struct _Screen Screen;
+
+BEGIN_DECLS
+
+/** Create a screen of rows x cols characters, of which the top
+    scroll_rows can be scrolled together. The screen starts out
+    invalid, so the first update draws all of it. Returns NULL if
+    there isn't enough memory. */
+extern Screen   *screen_create (int rows, int cols, int scroll_rows);
+
+extern void      screen_destroy (Screen *self);
+
+/** The characters of a row in the next frame. The frame starts out as
+    a copy of the last one sent, so callers need only change what
+    has changed. */
+extern char     *screen_chars (Screen *self, int row);
+
+/** The attributes of a row in the next frame, one ScreenAttr for
+    each character. */
+extern uint8_t  *screen_attrs (Screen *self, int row);
+
+/** Write a string into the next frame, from col to the end of the row,
+    filling any space after it with blanks. */
+extern void      screen_put (Screen *self, int row, int col, const char *s,
+                   ScreenAttr attr);
+
+/** Work out what has changed since the last update, and send it. The
+    output is buffered until screen_flush(). */
+extern void      screen_update (Screen *self);
+
+/** Move the terminal cursor, if it isn't already there. */
+extern void      screen_move_cursor (Screen *self, int row, int col);
+
+/** Set the terminal attribute, if it isn't already set, for output
+    that doesn't go through the screen. */
+extern void      screen_set_attr (Screen *self, ScreenAttr attr);
+
+/** Send any buffered output. */
+extern void      screen_flush (Screen *self);
+
+/** Forget what row is showing, so that the next update sends all of
+    it. A row of -1 means the whole screen. */
+extern void      screen_invalidate (Screen *self, int row);
+
+/** The number of bytes sent so far. */
+extern uint32_t  screen_bytes_sent (const Screen *self);
+
+END_DECLS
+
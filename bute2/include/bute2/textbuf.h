@@ -0,0 +1,82 @@
+/*===========================================================================
+
+  BUTE version 2
+
+  textbuf.h
+
+  The text being edited, divided into pages of about BUTE_PAGE_SIZE
+  characters. When the text comes from a file, a page that hasn't
+  been changed is read from the file when it's needed, and up to
+  BUTE_CACHE_PAGES of these are kept in memory; the rest are dropped,
+  oldest first. So only the pages that are being looked at, and those
+  that have been changed, take up memory, and a file can be edited
+  that is too big to load. Changed pages stay in memory until the text
+  is saved.
+
+  Each page is contiguous, so code that looks at a lot of the text --
+  drawing, searching -- can work a segment at a time, using
+  textbuf_segment(), rather than a character at a time.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+===========================================================================*/
+
+#pragma once
+
+#include <klib/defs.h>
+#include <shell/errcodes.h>
+
+struct _TextBuf;
+typedef struct _TextBuf TextBuf;
+
+BEGIN_DECLS
+
+/** Create an empty text, not backed by any file. Returns NULL if there
+    isn't enough memory. */
+extern TextBuf *textbuf_create (void);
+
+/** Open a file for editing. The file is kept open, to read pages from,
+    until the text is destroyed. A compressed file can only be read
+    efficiently from the start, so one of those is read into memory
+    all at once. */
+extern ErrCode  textbuf_open (const char *filename, TextBuf **result);
+
+extern void     textbuf_destroy (TextBuf *self);
+
+extern int      textbuf_length (const TextBuf *self);
+
+/** The character at pos, or -1 if pos is at or beyond the end of the
+    text, or the page could not be read. */
+extern int      textbuf_get_char (TextBuf *self, int pos);
+
+/** Set *text to point to the text at pos, and return the number of
+    characters that follow it contiguously, which is zero at the end of
+    the text. The pointer is valid until the next call on this TextBuf. */
+extern int      textbuf_segment (TextBuf *self, int pos, const char **text);
+
+/** Copy up to len characters from pos into buf, and return the number
+    copied. */
+extern int      textbuf_copy (TextBuf *self, char *buf, int pos, int len);
+
+/** Find str, of length len, which must not be zero, at or after pos.
+    Returns its position, or -1 if it isn't there. */
+extern int      textbuf_find (TextBuf *self, int pos, const char *str, int len);
+
+/** Erase len characters at pos, and insert bufsize characters from buf
+    in their place. If this fails, for lack of memory or because a page
+    could not be read, the text is unchanged. */
+extern ErrCode  textbuf_replace (TextBuf *self, int pos, int len,
+                  const char *buf, int bufsize);
+
+/** Write the text to a file. It's written to a temporary file first,
+    which then replaces the original, so that the pages that haven't
+    changed can still be read while writing. Afterwards, the text is
+    backed by the new file. If a page can't be read, the original file
+    is left as it was. */
+extern ErrCode  textbuf_save (TextBuf *self, const char *filename);
+
+/** The number of bytes of text held in memory. */
+extern int      textbuf_resident (const TextBuf *self);
+
+END_DECLS
+
@@ -0,0 +1,85 @@
+/*===========================================================================
+
+  BUTE version 2
+
+  undolog.h
+
+  The editor's record of changes, for undo and redo. The records are
+  kept one after another in an arena of fixed size, which is allocated
+  when the first change is recorded. When it's full, the oldest records
+  are dropped to make room, so the memory the history takes up never
+  grows beyond the size given. Typing, or deleting, a character at a
+  time adds to the newest record, rather than making a new one. Changes
+  recorded between undolog_begin_step and undolog_end_step make a
+  single step, that is undone and redone as a whole.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+===========================================================================*/
+
+#pragma once
+
+#include <klib/defs.h>
+#include <bute2/textbuf.h>
+
+struct _UndoLog;
+typedef struct _UndoLog UndoLog;
+
+/** A change to undo or redo: erase 'erase' characters at pos, and
+    insert 'insert' characters from text in their place. If more is
+    TRUE, the change is part of a step that the next undo (or redo)
+    carries on with. */
+typedef struct _UndoChange
+  {
+  int pos;
+  int erase;
+  const char *text;
+  int insert;
+  BOOL more;
+  } UndoChange;
+
+BEGIN_DECLS
+
+/** Create an empty log, that will use at most size bytes for records.
+    Returns NULL if there isn't enough memory. */
+extern UndoLog *undolog_create (int size);
+
+extern void     undolog_destroy (UndoLog *self);
+
+/** Record a change that is about to be made to the text: len
+    characters at pos are to be replaced by bufsize characters from buf.
+    Anything that had been undone can no longer be redone. If the change
+    is too big to record, the whole history is dropped. */
+extern void     undolog_record (UndoLog *self, TextBuf *text, int pos,
+                  int len, const char *buf, int bufsize);
+
+/** Make the changes recorded from now until undolog_end_step a single
+    step. If they don't all fit in the log, none of them is kept, and
+    the whole history is dropped. */
+extern void     undolog_begin_step (UndoLog *self);
+
+extern void     undolog_end_step (UndoLog *self);
+
+/** Get the change that undoes the newest change that hasn't been
+    undone, and step back past it. Returns FALSE if there is none. The
+    text in change is valid until the next change is recorded. */
+extern BOOL     undolog_undo (UndoLog *self, UndoChange *change);
+
+/** Get the change that redoes the oldest change that has been undone,
+    and step forward past it. Returns FALSE if there is none. */
+extern BOOL     undolog_redo (UndoLog *self, UndoChange *change);
+
+/** Returns TRUE if every change since the log was cleared has been
+    undone, and none had been dropped to make room. */
+extern BOOL     undolog_at_start (const UndoLog *self);
+
+/** Drop the whole history, and free the arena, as after the text has
+    been saved. */
+extern void     undolog_clear (UndoLog *self);
+
+/** Drop the whole history, after something that made the text
+    different from what the records say. */
+extern void     undolog_forget (UndoLog *self);
+
+END_DECLS
+
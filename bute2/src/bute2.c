@@ -26,17 +26,26 @@
 #include <storage/storage.h>
 #include <interface/interface.h>
 #include <shell/shell.h>
+#include <lua/lauxlib.h>
+#include <bute2/screen.h>
+#include <bute2/lineindex.h>
+#include <bute2/textbuf.h>
+#include <bute2/undolog.h>
+#include <bute2/highlight.h>
 
 // Environment variable for turning auto-indent off 
 #define ENV_NO_INDENT "EDITOR_NO_INDENT"
 
-// Smallest memory allocation for the main buffer
-#define MINTEXTBUFFER      8192 
+// Environment variable for turning syntax colouring off 
+#define ENV_NO_HIGHLIGHT "EDITOR_NO_HIGHLIGHT"
 
 // Extra space at the end of the general line buffer, to allow for
 //   inserting format characters, etc.
 #define LINEBUF_EXTRA  32
 
+// Longest text that can be searched for, as in prompt()
+#define SEARCH_MAX     50
+
 #ifndef TABSIZE
 #define TABSIZE        8
 #endif
@@ -46,18 +55,6 @@
 #define INDENT "  "
 #endif
 
-// Terminal codes
-// This is nasty -- these really ought to changed to functions interm.c. 
-// However, by building them into a line buffer along with the text,
-//  it does speed up some display operations considerable. 
-// Of course, if we ever support anything except ANSI/VT100 terminals,
-//  there's going to be a lot of work to do here.
-
-#define TEXT_COLOR       "\033[0m"
-#define SELECT_COLOR     "\033[7m\033[1m"
-#define STATUS_COLOR     "\033[1m\033[7m"
-#define CLREOL           "\033[K"
-
 // Not implemented yet
 #define KEY_CTRL_TAB         0x115
 
@@ -67,15 +64,10 @@
 //
 // Editor data block
 //
-// The editor uses a buffer that can be split in memory. The structure
-//  of the buffer is as follows: 
-//
-//    +------------------+------------------+------------------+
-//    | text before gap  |        gap       |  text after gap  |
-//    +------------------+------------------+------------------+
-//    ^                  ^                  ^                  ^     
-//    |                  |                  |                  |
-//  start               gap                rest               end
+// The text is held in a TextBuf, which divides it into pages that are
+//  read from the file as they're needed (see textbuf.h). The editor
+//  reads it a character at a time with get_char(), or a segment at a
+//  time where it has a lot to look at, and changes it only in replace().
 //
 
 /*===========================================================================
@@ -86,23 +78,10 @@
 
 struct _ButeEnv;
 
-struct undo 
-  {
-  int pos;                 // Editor position
-  int erased;              // Size of erased contents
-  int inserted;            // Size of inserted contents
-  char *undobuf;           // Erased contents for undo
-  char *redobuf;           // Inserted contents for redo
-  struct undo *next;       // Next undo buffer
-  struct undo *prev;       // Previous undo buffer
-  };
-
 typedef struct _BUTE
   {
-  char *start;              // Start of text buffer
-  char *gap;                // Start of gap
-  char *rest;               // End of gap
-  char *end;                // End of text buffer
+  TextBuf *text;            // The text being edited
+  LineIndex *index;         // Where each line starts
 
   int toppos;                // Text position for current top screen line
   int topline;               // Line number for top of screen
@@ -114,9 +93,8 @@ typedef struct _BUTE
   int lastcol;               // Column from last horizontal navigation
   int anchor;                // Anchor position for selection
   
-  struct undo *undohead;     // Start of undo buffer list
-  struct undo *undotail;     // End of undo buffer list
-  struct undo *undo;         // Undo/redo boundary
+  UndoLog *undolog;          // Changes, for undo and redo
+  Highlight *highlight;      // Syntax colouring, or NULL if none
 
   BOOL refresh;              // Flag to trigger screen redraw
   BOOL lineupdate;           // Flag to trigger redraw of current line
@@ -140,14 +118,23 @@ typedef struct _ButeEnv
 
   char *search;             // Search text
   char *linebuf;            // General-purpose buffer
+  uint8_t *attrbuf;         // Syntax colours of the line being drawn
+  int attrsize;             // Size of attrbuf
+  Screen *screen;           // What the terminal is showing
 
   uint8_t cols;             // Console columns
   uint8_t lines;            // Console lines
  
   int untitled;             // Counter for untitled files
+
+#if BUTE_COUNT_BYTES
+  uint32_t keys;            // Keystrokes so far
+  uint32_t last_bytes;      // Bytes sent before the last keystroke
+  uint32_t max_bytes;       // Most bytes sent for one keystroke
+#endif
   } ButeEnv;
 
-void free_undo (BUTE *ed); // FWD
+void display_message (BUTE *ed, const char *fmt, ...); // FWD
 
 /*==========================================================================
 
@@ -237,8 +224,10 @@ void bute_destroy (BUTE *self)
     }
   self->next->prev = self->prev;
   self->prev->next = self->next;
-  if (self->start) free (self->start);
-  free_undo (self);
+  if (self->text) textbuf_destroy (self->text);
+  if (self->index) lineindex_destroy (self->index);
+  if (self->undolog) undolog_destroy (self->undolog);
+  if (self->highlight) highlight_destroy (self->highlight);
   free (self);
   }
 
@@ -247,52 +236,6 @@ void bute_destroy (BUTE *self)
   Editor buffer manipulation functions
 
 ==========================================================================*/
-/*==========================================================================
-
-  free_undo 
-
-  Clear memory associated with the undo buffer chain
-
-==========================================================================*/
-void free_undo (BUTE *ed) 
-  {
-  struct undo *undo = ed->undohead;
-  while (undo) 
-    {
-    struct undo *next = undo->next;
-    free(undo->undobuf);
-    free(undo->redobuf);
-    free(undo);
-    undo = next;
-    }
-  ed->undohead = ed->undotail = ed->undo = NULL;
-  }
-
-/*==========================================================================
-
-  reset_undo
-
-==========================================================================*/
-void reset_undo (BUTE *ed) 
-  {
-  while (ed->undotail != ed->undo) 
-    {
-    struct undo *undo = ed->undotail;
-    if (!undo) 
-      {
-      ed->undohead = NULL;
-      ed->undotail = NULL;
-      break;
-      }
-    ed->undotail = undo->prev;
-    if (undo->prev) undo->prev->next = NULL;
-    free (undo->undobuf);
-    free (undo->redobuf);
-    free (undo);
-    }
-  ed->undo = ed->undotail;
-  }
-
 /*==========================================================================
 
   find_editor
@@ -317,6 +260,24 @@ BUTE *find_editor (ButeEnv *env, char *filename)
   return NULL;  
   }
 
+/*==========================================================================
+
+  set_highlight
+
+  Turn on syntax colouring if the file is Lua, unless it's been turned
+  off. If there isn't the memory, the text is just left plain.
+
+==========================================================================*/
+static void set_highlight (BUTE *ed) 
+  {
+  if (ed->highlight) return;
+  char *env_no_highlight = getenv (ENV_NO_HIGHLIGHT);
+  if (env_no_highlight && env_no_highlight[0] == '1') return;
+  int len = strlen (ed->filename);
+  if (len >= 4 && strcmp (ed->filename + len - 4, ".lua") == 0)
+    ed->highlight = highlight_create ();
+  }
+
 /*==========================================================================
 
   new_file
@@ -338,11 +299,14 @@ ErrCode new_file (BUTE *ed, const char *filename)
     ed->newfile = 1;
     }
 
-  ed->start = (char *) malloc(MINTEXTBUFFER);
-  if (!ed->start) return ERR_NOMEM;
+  ed->text = textbuf_create ();
+  if (!ed->text) return ERR_NOMEM;
+  ed->index = lineindex_create ();
+  if (!ed->index) return ERR_NOMEM;
+  ed->undolog = undolog_create (BUTE_UNDO_SIZE);
+  if (!ed->undolog) return ERR_NOMEM;
+  set_highlight (ed);
 
-  ed->gap = ed->start;
-  ed->rest = ed->end = ed->gap + MINTEXTBUFFER;
   ed->anchor = -1;
   
   return 0;
@@ -358,18 +322,28 @@ ErrCode new_file (BUTE *ed, const char *filename)
 ==========================================================================*/
 ErrCode load_file (BUTE *ed, const char *filename) 
   {
-  int length;
-  char *buff;
-  ErrCode ret = storage_read_file (filename, (uint8_t**) &buff, &length);
+  ErrCode ret = textbuf_open (filename, &ed->text);
   if (ret == 0)
     {
-    buff = realloc (buff, length + MINTEXTBUFFER); 
-    ed->start = buff;
-    ed->gap = ed->start + length;
-    ed->rest = ed->end = ed->gap + MINTEXTBUFFER;
     ed->anchor = -1;
     strncpy (ed->filename, filename, sizeof (ed->filename));
+    ed->index = lineindex_create ();
+    ed->undolog = undolog_create (BUTE_UNDO_SIZE);
+    if (!ed->index || !ed->undolog) ret = ERR_NOMEM;
+    set_highlight (ed);
     }
+
+  // Index the lines a page at a time, so that no more of the file
+  //   needs to be in memory than the pages that are cached
+  int pos = 0;
+  const char *text;
+  int n;
+  while (ret == 0 && (n = textbuf_segment (ed->text, pos, &text)) > 0)
+    {
+    ret = lineindex_insert (ed->index, pos, text, n);
+    pos += n;
+    }
+  if (ret == 0 && pos < textbuf_length (ed->text)) ret = ERR_IO;
   return ret;
   }
 
@@ -382,26 +356,11 @@ ErrCode load_file (BUTE *ed, const char *filename)
 ==========================================================================*/
 ErrCode save_file (BUTE *ed) 
   {
-  ErrCode ret = 0;
-  int size1 = ed->gap - ed->start;
-  int size2 = ed->end - ed->rest;
-  int total = size1 + size2;
-  char *buff = malloc (total);
-  if (buff)
-    {
-    memcpy (buff, ed->start, size1);
-    memcpy (buff + size1, ed->rest, size2);
-
-    ret = storage_write_file (ed->filename, (uint8_t**) buff, total);
-    free (buff);
-    }
-  else
-    ret = ERR_NOMEM;
-
+  ErrCode ret = textbuf_save (ed->text, ed->filename);
   if (ret == 0)
     {
     ed->dirty = FALSE;
-    free_undo (ed);
+    undolog_clear (ed->undolog);
     }
   return ret;
   }
@@ -410,112 +369,20 @@ ErrCode save_file (BUTE *ed)
 
   text_length
 
-  Returns the total length of text in the editor, allowing for the
-  split buffer
+  Returns the total length of text in the editor
 
 ==========================================================================*/
 static int text_length (const BUTE *ed) 
   {
-  return (ed->gap - ed->start) + (ed->end - ed->rest);
-  }
-
-/*==========================================================================
-
-  text_ptr
-
-  Find the location in the buffer that corresponds to a specific
-  character position, bearing in mind that that buffer might be
-  split
-
-==========================================================================*/
-static char *text_ptr (const BUTE *ed, int pos) 
-  {
-  char *p = ed->start + pos;
-  if (p >= ed->gap) p += (ed->rest - ed->gap);
-  return p;
-  }
-
-/*==========================================================================
-
-  move_gap
-
-==========================================================================*/
-void move_gap (BUTE *ed, int pos, int minsize) 
-  {
-  int gapsize = ed->rest - ed->gap;
-  char *p = text_ptr(ed, pos);
-  if (minsize < 0) minsize = 0;
-
-  if (minsize <= gapsize) 
-    {
-    if (p != ed->rest) 
-      {
-      if (p < ed->gap) 
-        {
-        memmove(p + gapsize, p, ed->gap - p);
-        } 
-      else 
-        {
-        memmove(ed->gap, ed->rest, p - ed->rest);
-        }
-      ed->gap = ed->start + pos;
-      ed->rest = ed->gap + gapsize;
-      }
-    } 
-  else 
-    {
-    int newsize;
-    char *start;
-    char *gap;
-    char *rest;
-    char *end;
-
-    if (gapsize + MINTEXTBUFFER > minsize) minsize = gapsize + MINTEXTBUFFER;
-    newsize = (ed->end - ed->start) - gapsize + minsize;
-    start = (char *) malloc(newsize); // TODO check for out of memory
-    gap = start + pos;
-    rest = gap + minsize;
-    end = start + newsize;
-
-    if (p < ed->gap) 
-      {
-      memcpy(start, ed->start, pos);
-      memcpy(rest, p, ed->gap - p);
-      memcpy(end - (ed->end - ed->rest), ed->rest, ed->end - ed->rest);
-      } 
-    else 
-      {
-      memcpy(start, ed->start, ed->gap - ed->start);
-      memcpy(start + (ed->gap - ed->start), ed->rest, p - ed->rest);
-      memcpy(rest, p, ed->end - p);
-      }
-
-    free(ed->start);
-    ed->start = start;
-    ed->gap = gap;
-    ed->rest = rest;
-    ed->end = end;
-    }
-  }
-
-/*==========================================================================
-
-  close_gap 
-
-==========================================================================*/
-void close_gap (BUTE *ed) 
-  {
-  int len = text_length (ed);
-  move_gap (ed, len, 1);
-  ed->start[len] = 0;
+  return textbuf_length (ed->text);
   }
 
 /*==========================================================================
 
   get_char
 
-  Get the character at the specific position in the buffer, allowing 
-  for the split.
+  Get the character at the specific position in the buffer, or -1
+  at the end.
 
   NOTE: there's something odd about signed character tests in the
   ARM compiler. This function should really return a char, but setting
@@ -527,9 +394,7 @@ void close_gap (BUTE *ed)
 ==========================================================================*/
 int get_char (const BUTE *ed, int pos) 
   {
-  char *p = text_ptr (ed, pos);
-  if (p >= ed->end) return -1;
-  return *p;
+  return textbuf_get_char (ed->text, pos);
   }
 
 /*==========================================================================
@@ -542,16 +407,16 @@ int get_char (const BUTE *ed, int pos)
 ==========================================================================*/
 BOOL compare (const BUTE *ed, char *buf, int pos, int len) 
   {
-  char *bufptr = buf;
-  char *p = ed->start + pos;
-  if (p >= ed->gap) p += (ed->rest - ed->gap);
-
   while (len > 0) 
     {
-    if (p == ed->end) return FALSE;
-    if (*bufptr++ != *p) return FALSE;
-    len--;
-    if (++p == ed->gap) p = ed->rest;
+    const char *text;
+    int n = textbuf_segment (ed->text, pos, &text);
+    if (n == 0) return FALSE;
+    if (n > len) n = len;
+    if (memcmp (buf, text, n) != 0) return FALSE;
+    buf += n;
+    pos += n;
+    len -= n;
     }
 
   return TRUE;
@@ -561,113 +426,82 @@ BOOL compare (const BUTE *ed, char *buf, int pos, int len)
 
   copy
 
-  Copy the specified text into the buffer, allowing for the gap
+  Copy the specified text into the buffer
 
 ==========================================================================*/
 int copy (const BUTE *ed, char *buf, int pos, int len) 
   {
-  char *bufptr = buf;
-  char *p = ed->start + pos;
-  if (p >= ed->gap) p += (ed->rest - ed->gap);
-
-  while (len > 0) 
-    {
-    if (p == ed->end) break;
-    *bufptr++ = *p;
-    len--;
-    if (++p == ed->gap) p = ed->rest;
-    }
-
-  return bufptr - buf;
+  return textbuf_copy (ed->text, buf, pos, len);
   }
 
 /*==========================================================================
 
   replace
 
+  Returns the error, if the text couldn't be changed, having already
+  shown it.
+
 ==========================================================================*/
-static void replace (BUTE *ed, int pos, int len, char *buf, 
+static ErrCode replace (BUTE *ed, int pos, int len, const char *buf, 
        int bufsize, BOOL do_undo) 
   {
-  char *p;
-
   // Store undo information
   if (do_undo) 
+    undolog_record (ed->undolog, ed->text, pos, len, buf, bufsize);
+
+  // Note which lines are going, for the syntax colouring
+  int line = 0;
+  int erased_lines = 0;
+  if (ed->highlight)
     {
-    reset_undo (ed);
-    struct undo *undo = ed->undotail;
-    if (undo && len == 0 && bufsize == 1 
-          && undo->erased == 0 && pos == undo->pos + undo->inserted) 
-      {
-      // Insert character at end of current redo buffer
-      undo->redobuf = realloc(undo->redobuf, undo->inserted + 1);
-      undo->redobuf[undo->inserted] = *buf;
-      undo->inserted++;
-      } 
-    else if (undo && len == 1 && bufsize == 0 && undo->inserted == 0 
-           && pos == undo->pos) 
-      {
-      // Erase character at end of current undo buffer
-      undo->undobuf = realloc(undo->undobuf, undo->erased + 1);
-      undo->undobuf[undo->erased] = get_char(ed, pos);
-      undo->erased++;
-      } 
-    else if (undo && len == 1 && bufsize == 0 && undo->inserted == 0 
-         && pos == undo->pos - 1) 
+    line = lineindex_line_at (ed->index, pos);
+    erased_lines = lineindex_line_at (ed->index, pos + len) - line;
+    }
+
+  // As in textbuf_replace(), the new text goes in after the old, and 
+  //   then the old comes out, but the line index is kept in step after
+  //   each part. An index that can't be extended is left as it was, 
+  //   and taking back an insertion can't fail, so if either the text
+  //   or the index can't be changed, both are left as they were
+  ErrCode err = 0;
+  if (bufsize > 0)
+    {
+    err = textbuf_replace (ed->text, pos + len, 0, buf, bufsize);
+    if (err == 0)
       {
-      // Erase character at beginning of current undo buffer
-      undo->pos--;
-      undo->undobuf = realloc(undo->undobuf, undo->erased + 1);
-      memmove(undo->undobuf + 1, undo->undobuf, undo->erased);
-      undo->undobuf[0] = get_char(ed, pos);
-      undo->erased++;
-      } 
-    else 
+      err = lineindex_insert (ed->index, pos + len, buf, bufsize);
+      if (err) textbuf_replace (ed->text, pos + len, bufsize, NULL, 0);
+      }
+    }
+  if (err == 0 && len > 0)
+    {
+    err = textbuf_replace (ed->text, pos, len, NULL, 0);
+    if (err == 0)
+      lineindex_erase (ed->index, pos, len);
+    else if (bufsize > 0)
       {
-      // Create new undo buffer
-      undo = (struct undo *) malloc(sizeof(struct undo));
-      if (ed->undotail) ed->undotail->next = undo;
-      undo->prev = ed->undotail;
-      undo->next = NULL;
-      ed->undotail = ed->undo = undo;
-      if (!ed->undohead) ed->undohead = undo;
-
-      undo->pos = pos;
-      undo->erased = len;
-      undo->inserted = bufsize;
-      undo->undobuf = undo->redobuf = NULL;
-      if (len > 0) 
-        {
-        undo->undobuf = malloc(len);
-        copy(ed, undo->undobuf, pos, len);      
-        }
-      if (bufsize > 0) 
-        {
-        undo->redobuf = malloc(bufsize);
-        memcpy(undo->redobuf, buf, bufsize);
-        }
+      textbuf_replace (ed->text, pos + len, bufsize, NULL, 0);
+      lineindex_erase (ed->index, pos + len, bufsize);
       }
     }
 
-  p = ed->start + pos;
-  if (bufsize == 0 && p <= ed->gap && p + len >= ed->gap)  
-    {
-    // Handle deletions at the edges of the gap
-    ed->rest += len - (ed->gap - p);
-    ed->gap = p;
-    } 
-  else 
+  // The undo information we just stored no longer matches the text
+  if (err)
     {
-    // Move the gap
-    move_gap(ed, pos + len, bufsize - len);
-
-    // Replace contents
-    memcpy(ed->start + pos, buf, bufsize);
-    ed->gap = ed->start + pos + bufsize;
+    undolog_forget (ed->undolog);
+    display_message (ed, mystrerror (err));
+    pause_after_message ();
+    ed->refresh = TRUE;
+    return err;
     }
 
+  if (ed->highlight)
+    highlight_change (ed->highlight, line, erased_lines,
+      lineindex_line_at (ed->index, pos + bufsize) - line);
+
     // Mark buffer as dirty
   ed->dirty = 1;
+  return 0;
   }
 
 /*==========================================================================
@@ -726,14 +560,7 @@ int line_length (const BUTE *ed, int linepos)
 ==========================================================================*/
 int line_start (const BUTE *ed, int pos) 
   {
-  while (1) 
-    {
-    if (pos == 0) break;
-    if (get_char(ed, pos - 1) == '\n') break;
-    pos--;
-    }
-
-  return pos;
+  return lineindex_line_start (ed->index, lineindex_line_at (ed->index, pos));
   }
 
 /*==========================================================================
@@ -746,13 +573,9 @@ int line_start (const BUTE *ed, int pos)
 ==========================================================================*/
 int next_line (const BUTE *ed, int pos) 
   {
-  while (1) 
-    {
-    int ch = get_char (ed, pos);
-    if (ch < 0) return -1;
-    pos++;
-    if (ch == '\n') return pos;
-    }
+  int line = lineindex_line_at (ed->index, pos);
+  if (line + 1 >= lineindex_lines (ed->index)) return -1;
+  return lineindex_line_start (ed->index, line + 1);
   }
 
 /*==========================================================================
@@ -766,20 +589,9 @@ int next_line (const BUTE *ed, int pos)
 int prev_line (const BUTE *ed, int pos) 
   {
   if (pos == 0) return -1;
-
-  while (pos > 0) 
-    {
-    int ch = get_char(ed, --pos);
-    if (ch == '\n') break;
-    }
-
-  while (pos > 0) 
-    {
-    int ch = get_char(ed, --pos);
-    if (ch == '\n') return pos + 1;
-    }
-
-  return 0;
+  int line = lineindex_line_at (ed->index, pos);
+  if (line == 0) return 0;
+  return lineindex_line_start (ed->index, line - 1);
   }
 
 /*==========================================================================
@@ -792,11 +604,13 @@ int prev_line (const BUTE *ed, int pos)
 ==========================================================================*/
 int column (const BUTE *ed, int linepos, int col) 
   {
-  char *p = text_ptr (ed, linepos);
   int c = 0;
+  const char *p;
+  int n = 0;
   while (col > 0) 
     {
-    if (p == ed->end) break;
+    if (n == 0) n = textbuf_segment (ed->text, linepos, &p);
+    if (n == 0) break;
     if (*p == '\t') 
       {
       int spaces = TABSIZE - c % TABSIZE;
@@ -807,7 +621,9 @@ int column (const BUTE *ed, int linepos, int col)
       c++;
       }
     col--;
-    if (++p == ed->gap) p = ed->rest;
+    p++;
+    n--;
+    linepos++;
     }
   return c;
   }
@@ -822,85 +638,31 @@ int column (const BUTE *ed, int linepos, int col)
 ==========================================================================*/
 void moveto (BUTE *ed, int pos, int center) 
   {
-  int scroll = 0;
-  for (;;) 
-    {
-    int cur = ed->linepos + ed->col;
-    if (pos < cur) 
-      {
-      if (pos >= ed->linepos) 
-        {
-        ed->col = pos - ed->linepos;
-        } 
-      else 
-        {
-        ed->col = 0;
-        ed->linepos = prev_line(ed, ed->linepos);
-        ed->line--;
-
-        if (ed->topline > ed->line) 
-          {
-          ed->toppos = ed->linepos;
-          ed->topline--;
-          ed->refresh = 1;
-          scroll = 1;
-          }
-        }
-      } 
-    else if (pos > cur) 
-      {
-      int next = next_line(ed, ed->linepos);
-      if (next == -1) 
-        {
-        ed->col = line_length(ed, ed->linepos);
-        break;
-        } 
-      else if (pos < next) 
-        {
-        ed->col = pos - ed->linepos;
-        } 
-      else 
-        {
-        ed->col = 0;
-        ed->linepos = next;
-        ed->line++;
-
-        if (ed->line >= ed->topline + ed->env->lines) 
-          {
-          ed->toppos = next_line(ed, ed->toppos);
-          ed->topline++;
-          ed->refresh = 1;
-          scroll = 1;
-          }
-        }
-      } 
-    else 
-      {
-      break;
-      }
-    }
+  int line = lineindex_line_at (ed->index, pos);
+  ed->line = line;
+  ed->linepos = lineindex_line_start (ed->index, line);
+  ed->col = pos - ed->linepos;
+  int len = lineindex_line_length (ed->index, line);
+  if (ed->col > len) ed->col = len;
+
+  // Scroll only as far as needed to bring the line into view, unless
+  //   we're asked to center it
+  int topline = ed->topline;
+  if (line < topline) 
+    topline = line;
+  else if (line >= topline + ed->env->lines) 
+    topline = line - ed->env->lines + 1;
 
-  if (scroll && center) 
+  if (topline != ed->topline) 
     {
-    int tl = ed->line - ed->env->lines / 2;
-    if (tl < 0) tl = 0;
-    for (;;) 
+    if (center) 
       {
-      if (ed->topline > tl) 
-        {
-        ed->toppos = prev_line(ed, ed->toppos);
-        ed->topline--;
-        } 
-      else if (ed->topline < tl) 
-        {
-        ed->toppos = next_line(ed, ed->toppos);
-        ed->topline++;
-        } 
-      else 
-        {
-        break;
-        }
+      topline = line - ed->env->lines / 2;
+      if (topline < 0) topline = 0;
       }
+    ed->topline = topline;
+    ed->toppos = lineindex_line_start (ed->index, topline);
+    ed->refresh = 1;
     }
   }
 
@@ -1026,15 +788,19 @@ static void select_all (BUTE *ed)
 ==========================================================================*/
 BOOL prompt (const BUTE *ed, char *msg) 
   {
-  char *buf = ed->env->linebuf;
+  ButeEnv *env = ed->env;
+  char *buf = env->linebuf;
 
-  term_set_cursor (ed->env->lines, 0);
-  interface_write_string (STATUS_COLOR);
-  interface_write_string (msg);
-  term_clear_eol();
+  screen_put (env->screen, env->lines, 0, msg, SCREEN_ATTR_STATUS);
+  screen_update (env->screen);
+  screen_move_cursor (env->screen, env->lines, strlen (msg));
+  screen_set_attr (env->screen, SCREEN_ATTR_STATUS);
+  screen_flush (env->screen);
 
   BOOL interrupt = FALSE;
   BOOL ret = term_get_line (buf, 50, &interrupt, 0, NULL);
+  // The line editor wrote over the status line
+  screen_invalidate (env->screen, env->lines);
 
   if (!ret) return FALSE;
   if (interrupt) return FALSE;
@@ -1060,20 +826,23 @@ int says_yes()
 
   display_message
 
-  Writes a message on the status line
+  Writes a message on the status line, and shows it straight away. 
 
 ==========================================================================*/
 void display_message (BUTE *ed, const char *fmt, ...) 
   {
+  ButeEnv *env = ed->env;
   va_list args;
 
   va_start (args, fmt);
-  term_set_cursor (ed->env->lines, 0);
-  interface_write_string (STATUS_COLOR);
-  vprintf (fmt, args);
-  term_clear_eol();
-  interface_write_string (TEXT_COLOR);
+  vsnprintf (env->linebuf, env->cols + 1, fmt, args);
   va_end (args);
+  screen_put (env->screen, env->lines, 0, env->linebuf, SCREEN_ATTR_STATUS);
+  screen_update (env->screen);
+  int col = strlen (env->linebuf);
+  screen_move_cursor (env->screen, env->lines, 
+    col < env->cols ? col : env->cols - 1);
+  screen_flush (env->screen);
   }
 
 /*==========================================================================
@@ -1087,17 +856,11 @@ void draw_full_statusline (BUTE *ed)
   {
   ButeEnv *env = ed->env;
   int namewidth = env->cols - 32;
-  term_set_cursor (env->lines, 0);
-  term_hide_cursor();
-  interface_write_string (STATUS_COLOR);
   sprintf (env->linebuf,
     "%*.*sHelp:ctrl-@ %c Ln %-6dCol %-4d", -namewidth, 
     namewidth, ed->filename, ed->dirty ? '*' : ' ', ed->line + 1, 
     column (ed, ed->linepos, ed->col) + 1);
-  interface_write_string (env->linebuf);
-  term_clear_eol(); 
-  interface_write_string (TEXT_COLOR);
-  term_show_cursor(); 
+  screen_put (env->screen, env->lines, 0, env->linebuf, SCREEN_ATTR_STATUS);
   }
 
 /*==========================================================================
@@ -1109,120 +872,95 @@ void draw_full_statusline (BUTE *ed)
 ==========================================================================*/
 void draw_statusline(BUTE *ed) 
   {
-  term_hide_cursor();
-  interface_write_string (STATUS_COLOR);
-  term_set_cursor (ed->env->lines, ed->env->cols - 20);
-  sprintf (ed->env->linebuf, "%c Ln %-6dCol %-4d" , 
+  ButeEnv *env = ed->env;
+  sprintf (env->linebuf, "%c Ln %-6dCol %-4d" , 
       ed->dirty ? '*' : ' ', ed->line + 1, 
       column (ed, ed->linepos, ed->col) + 1);
-  interface_write_string(ed->env->linebuf);
-  term_clear_eol(); 
-  interface_write_string (TEXT_COLOR);
-  term_show_cursor(); 
+  screen_put (env->screen, env->lines, env->cols - 20, env->linebuf, 
+    SCREEN_ATTR_STATUS);
   }
 
 /*==========================================================================
 
   display_line
 
-  Draws a line, including selection highlight where appropriate.
+  Composes the line starting at pos into a row of the screen, including
+  selection highlight and syntax colouring where appropriate.
 
 ==========================================================================*/
-void display_line (const BUTE *ed, int pos, int fullline) 
+void display_line (const BUTE *ed, int pos, int row) 
   {
-  BOOL highlight = FALSE;
-  int col = 0;
+  ButeEnv *env = ed->env;
+  Screen *screen = env->screen;
+  char *chars = screen_chars (screen, row);
+  uint8_t *attrs = screen_attrs (screen, row);
   int margin = ed->margin;
-  int maxcol = ed->env->cols + margin;
-  char *bufptr = ed->env->linebuf;
-  char *p = text_ptr(ed, pos);
-  char *s;
-
-  int selstart, selend, ch;
-  get_selection (ed, &selstart, &selend);
-  while (col < maxcol) 
-    {
-    if (margin == 0) 
+  int maxcol = env->cols + margin;
+  int col = 0;
+  const char *p;
+  int n = textbuf_segment (ed->text, pos, &p);
+
+  // Every character takes at least one column, so no more than maxcol
+  //   of them can be on the screen
+  const uint8_t *colours = NULL;
+  int linepos = pos;
+  if (ed->highlight)
+    {
+    int line = lineindex_line_at (ed->index, pos);
+    int count = lineindex_line_length (ed->index, line);
+    if (count > maxcol) count = maxcol;
+    if (count > env->attrsize)
       {
-      if (!highlight && pos >= selstart && pos < selend) 
-        {
-        for (s = SELECT_COLOR; *s; s++) *bufptr++ = *s;
-        highlight = TRUE;
-        } 
-      else if (highlight && pos >= selend) 
+      uint8_t *attrbuf = realloc (env->attrbuf, maxcol);
+      if (attrbuf)
         {
-        for (s = TEXT_COLOR; *s; s++) *bufptr++ = *s;
-        highlight = FALSE;
+        env->attrbuf = attrbuf;
+        env->attrsize = maxcol;
         }
       }
-
-    if (p == ed->end) break;
-    ch = *p;
-    if (ch == '\n') break;
-
-    if (ch == '\t') 
+    if (count <= env->attrsize)
       {
-      int spaces = TABSIZE - col % TABSIZE;
-      while (spaces > 0 && col < maxcol) 
-        {
-        if (margin > 0) 
-          {
-          margin--;
-          } 
-        else 
-          {
-          *bufptr++ = ' ';
-          }
-        col++;
-        spaces--;
-        }
-      } 
-    else 
-      {
-      if (margin > 0) 
-        {
-        margin--;
-        } 
-      else 
-        {
-        *bufptr++ = ch;
-        }
-      col++;
+      highlight_line (ed->highlight, ed->text, ed->index, line, 
+        env->attrbuf, count);
+      colours = env->attrbuf;
       }
-
-    if (++p == ed->gap) p = ed->rest;
-    pos++;
     }
 
-  if (highlight) 
+  int selstart, selend;
+  get_selection (ed, &selstart, &selend);
+  while (col < maxcol && n > 0 && *p != '\n') 
     {
-    while (col < maxcol) 
+    uint8_t attr = (pos >= selstart && pos < selend) ? SCREEN_ATTR_SELECT 
+      : colours ? colours[pos - linepos] : SCREEN_ATTR_TEXT;
+    char ch = *p;
+    int width = 1;
+    if (ch == '\t') 
       {
-      *bufptr++ = ' ';
-      col++;
+      ch = ' ';
+      width = TABSIZE - col % TABSIZE;
       }
-    } 
-  else 
-    {
-    if (col == margin) *bufptr++ = ' ';
-    }
-
-  if (col < maxcol) 
-    {
-    for (s = CLREOL; *s; s++) *bufptr++ = *s;
-    if (fullline) 
+    for (; width > 0 && col < maxcol; width--, col++) 
       {
-      memcpy (bufptr, "\n", 2);
-      bufptr += 2;
+      if (col >= margin) 
+        {
+        chars[col - margin] = ch;
+        attrs[col - margin] = attr;
+        }
       }
+
+    p++;
+    pos++;
+    if (--n == 0) n = textbuf_segment (ed->text, pos, &p);
     }
 
-  if (highlight) 
+  // If the end of the line is selected, highlight the rest of the row
+  uint8_t attr = (n > 0 && pos >= selstart && pos < selend) 
+      ? SCREEN_ATTR_SELECT : SCREEN_ATTR_TEXT;
+  for (col = col > margin ? col - margin : 0; col < ed->env->cols; col++)
     {
-    for (s = TEXT_COLOR; *s; s++) *bufptr++ = *s;
+    chars[col] = ' ';
+    attrs[col] = attr;
     }
-
-  interface_write_buff (ed->env->linebuf, bufptr - ed->env->linebuf);
   }
 
 /*==========================================================================
@@ -1232,8 +970,7 @@ void display_line (const BUTE *ed, int pos, int fullline)
 ==========================================================================*/
 void update_line (const BUTE *ed) 
   {
-  term_set_cursor (ed->line - ed->topline, 0);
-  display_line (ed, ed->linepos, 0);
+  display_line (ed, ed->linepos, ed->line - ed->topline);
   }
 
 /*==========================================================================
@@ -1243,37 +980,37 @@ void update_line (const BUTE *ed)
 ==========================================================================*/
 void draw_screen (const BUTE *ed) 
   {
-  term_set_cursor (0, 0);
-  interface_write_string (TEXT_COLOR);
   int pos = ed->toppos;
 
   for (int i = 0; i < ed->env->lines; i++) 
     {
     if (pos < 0) 
       {
-      term_clear_eol();
-      interface_write_endl();
+      screen_put (ed->env->screen, i, 0, "", SCREEN_ATTR_TEXT);
       } 
     else 
       {
-      display_line (ed, pos, 1);
+      display_line (ed, pos, i);
       pos = next_line (ed, pos);
       }
     }
-  term_show_cursor();
   }
 
 /*==========================================================================
 
   position_cursor 
 
-  Position the terminal cursor on the basis of the file line and column
+  Send whatever has changed on the screen, and position the terminal 
+  cursor on the basis of the file line and column
 
 ==========================================================================*/
 void position_cursor (const BUTE *ed) 
   {
+  Screen *screen = ed->env->screen;
   int col = column (ed, ed->linepos, ed->col);
-  term_set_cursor (ed->line - ed->topline, col - ed->margin);
+  screen_update (screen);
+  screen_move_cursor (screen, ed->line - ed->topline, col - ed->margin);
+  screen_flush (screen);
   }
 
 /*==========================================================================
@@ -1549,20 +1286,13 @@ void top (BUTE *ed, int select)
 void bottom (BUTE *ed, int select) 
   {
   update_selection (ed, select);
-  for (;;) 
+  ed->line = lineindex_lines (ed->index) - 1;
+  ed->linepos = lineindex_line_start (ed->index, ed->line);
+  if (ed->line >= ed->topline + ed->env->lines) 
     {
-    int newpos = next_line (ed, ed->linepos);
-    if (newpos < 0) break;
-
-    ed->linepos = newpos;
-    ed->line++;
-
-    if (ed->line >= ed->topline + ed->env->lines) 
-      {
-      ed->toppos = next_line (ed, ed->toppos);
-      ed->topline++;
-      ed->refresh = TRUE;
-      }
+    ed->topline = ed->line - ed->env->lines + 1;
+    ed->toppos = lineindex_line_start (ed->index, ed->topline);
+    ed->refresh = TRUE;
     }
   ed->col = ed->lastcol = line_length (ed, ed->linepos);
   adjust_layout(ed);
@@ -1583,20 +1313,11 @@ void pageup (BUTE *ed, int select)
     } 
    else 
     {
-    for (int i = 0; i < ed->env->lines; i++) 
-      {
-      int newpos = prev_line (ed, ed->linepos);
-      if (newpos < 0) return;
-
-      ed->linepos = newpos;
-      ed->line--;
-
-      if (ed->topline > 0) 
-        {
-        ed->toppos = prev_line(ed, ed->toppos);
-        ed->topline--;
-        }
-      }
+    ed->line -= ed->env->lines;
+    ed->topline -= ed->env->lines;
+    if (ed->topline < 0) ed->topline = 0;
+    ed->linepos = lineindex_line_start (ed->index, ed->line);
+    ed->toppos = lineindex_line_start (ed->index, ed->topline);
     }
 
   ed->refresh = TRUE;
@@ -1611,17 +1332,12 @@ void pageup (BUTE *ed, int select)
 void pagedown (BUTE *ed, int select) 
   {
   update_selection (ed, select);
-  for (int i = 0; i < ed->env->lines; i++) 
-    {
-    int newpos = next_line(ed, ed->linepos);
-    if (newpos < 0) break;
-
-    ed->linepos = newpos;
-    ed->line++;
-
-    ed->toppos = next_line(ed, ed->toppos);
-    ed->topline++;
-    }
+  int n = lineindex_lines (ed->index) - 1 - ed->line;
+  if (n > ed->env->lines) n = ed->env->lines;
+  ed->line += n;
+  ed->topline += n;
+  ed->linepos = lineindex_line_start (ed->index, ed->line);
+  ed->toppos = lineindex_line_start (ed->index, ed->topline);
 
   ed->refresh = TRUE;
   adjust_layout(ed);
@@ -1890,11 +1606,13 @@ void unindent (BUTE *ed, char *indentation)
   }
 
 void undo(BUTE *ed) {
-  if (!ed->undo) return;
-  moveto(ed, ed->undo->pos, 0);
-  replace(ed, ed->undo->pos, ed->undo->inserted, ed->undo->undobuf, ed->undo->erased, 0);
-  ed->undo = ed->undo->prev;
-  if (!ed->undo) ed->dirty = 0;
+  UndoChange change;
+  change.more = TRUE;
+  while (change.more && undolog_undo (ed->undolog, &change)) {
+    moveto(ed, change.pos, 0);
+    replace(ed, change.pos, change.erase, change.text, change.insert, 0);
+  }
+  if (undolog_at_start (ed->undolog)) ed->dirty = 0;
   ed->anchor = -1;
   ed->lastcol = ed->col;
   ed->refresh = 1;
@@ -1902,19 +1620,12 @@ void undo(BUTE *ed) {
 
 void redo (BUTE *ed) 
   {
-  if (ed->undo) 
-    {
-    if (!ed->undo->next) return;
-    ed->undo = ed->undo->next;
-    } 
-  else 
-    {
-    if (!ed->undohead) return;
-    ed->undo = ed->undohead;
-    }
-  replace (ed, ed->undo->pos, ed->undo->erased, ed->undo->redobuf, 
-     ed->undo->inserted, 0);
-  moveto(ed, ed->undo->pos, 0);
+  UndoChange change;
+  if (!undolog_redo (ed->undolog, &change)) return;
+  replace (ed, change.pos, change.erase, change.text, change.insert, 0);
+  while (change.more && undolog_redo (ed->undolog, &change))
+    replace (ed, change.pos, change.erase, change.text, change.insert, 0);
+  moveto(ed, change.pos, 0);
   ed->dirty = 1;
   ed->anchor = -1;
   ed->lastcol = ed->col;
@@ -2026,6 +1737,7 @@ ErrCode save_editor (BUTE *ed)
       }
     strcpy(ed->filename, ed->env->linebuf);
     ed->newfile = 0;
+    set_highlight (ed);
     }
 
   ErrCode err = save_file(ed);
@@ -2103,49 +1815,199 @@ static BOOL quit_editor (ButeEnv *env)
 
 /*==========================================================================
 
-  prompt_find_text 
+  search
+
+  Find str, of length len, at or after pos, and select it. Returns 
+  FALSE if it isn't there.
+
+==========================================================================*/
+static BOOL search (BUTE *ed, int pos, const char *str, int len)
+  {
+  int match = textbuf_find (ed->text, pos, str, len);
+  if (match < 0) return FALSE;
+  ed->anchor = match;
+  moveto (ed, match + len, 1);
+  ed->refresh = TRUE;
+  return TRUE;
+  }
+
+/*==========================================================================
+
+  find_text 
 
-  if next == TRUE, try to find another instance of the previous
-  search text. Otherwise, prompt and try to find first instance of 
-  the text entered by the user.
+  If next == TRUE, find the next instance of the previous search text.
+  Otherwise, search as the user types: each character is added to the
+  search text, and the first match from the cursor is selected straight
+  away. Backspace takes a character off, and Ctrl+F or Ctrl+G moves on
+  to the next match. Enter, or any other key, ends the search at the 
+  match; Esc or Ctrl+C goes back to where it started.
 
 ==========================================================================*/
 void find_text (BUTE *ed, BOOL next) 
   {
-  if (!next) 
+  ButeEnv *env = ed->env;
+  ed->refresh = TRUE;
+
+  if (next) 
     {
-    if (!prompt (ed, "Find: ")) 
-      {
-      ed->refresh = 1;
-      return;
-      }    
-    if (ed->env->search) free (ed->env->search);
-    ed->env->search = strdup (ed->env->linebuf);
+    if (env->search && env->search[0]) 
+      search (ed, ed->linepos + ed->col, env->search, strlen (env->search));
+    return;
     }
 
-  if (!ed->env->search) return;
+  int start = ed->linepos + ed->col;
+  int anchor = ed->anchor;
+  int match = -1;
+  BOOL found = TRUE;
+  char text [SEARCH_MAX + 1];
+  int len = 0;
+  text[0] = 0;
 
-  int slen = strlen(ed->env->search);
-  if (slen > 0) 
+  for (;;)
     {
-    char *match;
-    
-    close_gap(ed);
+    if (ed->refresh)
+      {
+      draw_screen (ed);
+      ed->refresh = FALSE;
+      }
+    snprintf (env->linebuf, env->cols + 1, "%s: %s", 
+      found ? "Find" : "Not found", text);
+    screen_put (env->screen, env->lines, 0, env->linebuf, SCREEN_ATTR_STATUS);
+    position_cursor (ed);
 
-    match = strstr (ed->start + ed->linepos + ed->col, ed->env->search);
+    int key = term_get_key ();
+    int from;
+    if (key >= ' ' && key < 0x7F)
+      {
+      if (len == SEARCH_MAX) continue;
+      text[len++] = key;
+      text[len] = 0;
+      from = match >= 0 ? match : start;
+      }
+    else if (key == VK_BACK || key == VK_DEL)
+      {
+      if (len == 0) continue;
+      text[--len] = 0;
+      from = start;
+      }
+    else if (key == CTRL('f') || key == CTRL('g'))
+      {
+      if (match < 0) continue;
+      from = match + 1;
+      }
+    else if (key == VK_ESC || key == VK_INTR)
+      {
+      ed->anchor = anchor;
+      moveto (ed, start, 0);
+      len = 0;
+      break;
+      }
+    else
+      break;
 
-    if (match != NULL) 
+    if (len == 0)
       {
-      int pos = match - ed->start;
-      ed->anchor = pos;
-      moveto (ed, pos + slen, 1);
-      } 
-    else 
+      match = -1;
+      found = TRUE;
+      ed->anchor = anchor;
+      moveto (ed, start, 0);
+      ed->refresh = TRUE;
+      }
+    else
       {
-      // TODO signal error
+      found = search (ed, from, text, len);
+      if (found) match = ed->anchor;
       }
     }
+
+  if (len > 0)
+    {
+    if (env->search) free (env->search);
+    env->search = strdup (text);
+    }
+  ed->refresh = TRUE;
+  }
+
+/*==========================================================================
+
+  replace_all 
+
+  Prompt for text to find, and what to replace it with, and replace
+  every instance of it. The instances are replaced a page at a time,
+  each page's worth as one change, so that the text is changed as few
+  times as possible without needing a copy of all of it; the changes
+  are recorded as a single step, so they are undone together.
+
+==========================================================================*/
+void replace_all (BUTE *ed) 
+  {
+  ButeEnv *env = ed->env;
   ed->refresh = TRUE;
+  if (!prompt (ed, "Replace all: ") || !env->linebuf[0]) return;
+  char *from = strdup (env->linebuf);
+  if (!from) return;
+  char *to = NULL;
+  if (prompt (ed, "With: ")) to = strdup (env->linebuf);
+  if (!to)
+    {
+    free (from);
+    return;
+    }
+  int flen = strlen (from);
+  int tlen = strlen (to);
+
+  ErrCode err = 0;
+  int first = textbuf_find (ed->text, 0, from, flen);
+  // A page, or at least one replacement, is made at a time
+  char *buf = NULL;
+  if (first >= 0)
+    {
+    buf = malloc (BUTE_PAGE_SIZE + tlen);
+    if (!buf) 
+      {
+      display_message (ed, mystrerror (ERR_NOMEM));
+      pause_after_message ();
+      }
+    }
+  else
+    {
+    display_message (ed, "Not found");
+    pause_after_message ();
+    }
+
+  if (buf)
+    {
+    ed->anchor = -1;
+    undolog_begin_step (ed->undolog);
+    int match = first;
+    while (err == 0 && match >= 0)
+      {
+      // Gather as many instances as fit in a page, both as they are and
+      //   as they will be
+      int start = match;
+      int pos = start;
+      int size = 0;
+      do
+        {
+        size += textbuf_copy (ed->text, buf + size, pos, match - pos);
+        memcpy (buf + size, to, tlen);
+        size += tlen;
+        pos = match + flen;
+        match = textbuf_find (ed->text, pos, from, flen);
+        } while (match >= 0 && match + flen - start <= BUTE_PAGE_SIZE
+                   && size + match - pos + tlen <= BUTE_PAGE_SIZE);
+
+      err = replace (ed, start, pos - start, buf, size, TRUE);
+      // The text after the change has moved
+      if (match >= 0) match += size - (pos - start);
+      }
+    undolog_end_step (ed->undolog);
+    moveto (ed, first, 1);
+    }
+
+  free (buf);
+  free (from);
+  free (to);
   }
 
 /*==========================================================================
@@ -2157,21 +2019,16 @@ void find_text (BUTE *ed, BOOL next)
 ==========================================================================*/
 void goto_line (BUTE *ed) 
   {
-  int lineno, l, pos;
+  int lineno, pos;
 
   ed->anchor = -1;
   if (prompt(ed, "Go to line: ")) 
     {
     lineno = atoi (ed->env->linebuf);
     // atoi() works here because "0" is not a valid line number
-    if (lineno > 0) 
+    if (lineno > 0 && lineno <= lineindex_lines (ed->index)) 
       {
-      pos = 0;
-      for (l = 0; l < lineno - 1; l++) 
-        {
-        pos = next_line(ed, pos);
-        if (pos < 0) break;
-        } 
+      pos = lineindex_line_start (ed->index, lineno - 1);
       } 
     else 
       {
@@ -2217,11 +2074,33 @@ BUTE *next_buffer (BUTE *ed)
 ==========================================================================*/
 void redraw_screen (BUTE *ed) 
   {
-  get_console_size (ed->env);
-  ed->env->linebuf = realloc 
-    (ed->env->linebuf, ed->env->cols + LINEBUF_EXTRA);
-  draw_screen(ed);
+  ButeEnv *env = ed->env;
+  get_console_size (env);
+  env->linebuf = realloc (env->linebuf, env->cols + LINEBUF_EXTRA);
+  screen_destroy (env->screen);
+  env->screen = screen_create (env->lines + 1, env->cols, env->lines);
+  ed->refresh = TRUE;
+  }
+
+#if BUTE_COUNT_BYTES
+/*==========================================================================
+
+  count_bytes
+
+  Keep count of the bytes sent to the terminal for each keystroke. This
+  counts only what goes through the screen, not what the line editor 
+  sends in prompts, nor the help and run screens.
+
+==========================================================================*/
+static void count_bytes (ButeEnv *env)
+  {
+  uint32_t bytes = screen_bytes_sent (env->screen);
+  if (bytes - env->last_bytes > env->max_bytes)
+    env->max_bytes = bytes - env->last_bytes;
+  env->last_bytes = bytes;
+  env->keys++;
   }
+#endif
 
 /*==========================================================================
 
@@ -2235,29 +2114,70 @@ static void intr (BUTE *ed)
   draw_full_statusline (ed);
   }
 
+/*==========================================================================
+
+  run_reader
+
+  The lua_Reader that hands the text to Lua a page at a time, straight
+  from the TextBuf. Lua has finished with each piece before it asks
+  for the next, so the pointer that textbuf_segment() gives is still 
+  good. If a page can't be read, that's an error, rather than the end
+  of the program.
+
+==========================================================================*/
+typedef struct _RunReader
+  {
+  TextBuf *text;
+  int pos;
+  } RunReader;
+
+static const char *run_reader (lua_State *L, void *data, size_t *size)
+  {
+  RunReader *reader = data;
+  const char *text;
+  int n = textbuf_segment (reader->text, reader->pos, &text);
+  if (n == 0 && reader->pos < textbuf_length (reader->text))
+    luaL_error (L, "%s", shell_strerror (ERR_IO));
+  reader->pos += n;
+  *size = n;
+  return n ? text : NULL;
+  }
+
 /*==========================================================================
 
   run 
 
+  Run the text as a Lua program, without saving it first. If the 
+  program fails at one of its own lines, move to that line. As when
+  Lua runs a file, a first line that starts with '#' is skipped, but
+  not the end of it, so the line numbers still match.
+
 ==========================================================================*/
 static void run (BUTE *ed) 
   {
-  ErrCode err = save_editor (ed);
-  if (err == 0)
+  char chunkname [MAX_PATH + 1];
+  RunReader reader;
+  reader.text = ed->text;
+  reader.pos = 0;
+  if (textbuf_get_char (ed->text, 0) == '#')
     {
-    term_clear_and_home();
-    shell_runlua (ed->filename);
-    interface_write_string ("Press any key...");
-    term_get_key();
-    ed->refresh = TRUE;
-    draw_full_statusline (ed);
+    reader.pos = lineindex_lines (ed->index) > 1 
+      ? lineindex_line_start (ed->index, 1) - 1 : textbuf_length (ed->text);
     }
-  else
+  chunkname[0] = '@';
+  strcpy (chunkname + 1, ed->filename);
+
+  term_clear_and_home();
+  int line = shell_runlua_reader (run_reader, &reader, chunkname);
+  interface_write_string ("Press any key...");
+  term_get_key();
+  if (line > 0 && line <= lineindex_lines (ed->index))
     {
-    display_message (ed, shell_strerror (err));
-    pause_after_message();
-    draw_full_statusline (ed);
-    } 
+    ed->anchor = -1;
+    moveto (ed, lineindex_line_start (ed->index, line - 1), 1);
+    }
+  screen_invalidate (ed->env->screen, -1);
+  ed->refresh = TRUE;
   }
 
 /*==========================================================================
@@ -2294,7 +2214,7 @@ static void help (BUTE *ed)
   interface_write_stringln 
   ("Ctrl+Y             Copy            Ctrl+Z             Undo"); 
   interface_write_stringln 
-  ("Ctrl+\\             Run Lua"); 
+  ("Ctrl+P             Replace all     Ctrl+\\             Run Lua"); 
   interface_write_endl();
   interface_write_stringln 
   ("In a selection, <tab> indents and Shift-<tab> unindents");
@@ -2302,8 +2222,8 @@ static void help (BUTE *ed)
   ("Press any key to continue...");
 
   term_get_key();
-  draw_screen (ed);
-  draw_full_statusline (ed);
+  screen_invalidate (ed->env->screen, -1);
+  ed->refresh = TRUE;
   }
 
 
@@ -2347,6 +2267,9 @@ static void edit (BUTE *ed)
 
     // Line up the screen cursor with the editor state
     position_cursor (ed);
+#if BUTE_COUNT_BYTES
+    count_bytes (ed->env);
+#endif
 
     int key = term_get_key();
 
@@ -2403,6 +2326,7 @@ static void edit (BUTE *ed)
         case CTRL('l'): goto_line(ed); break;
         case CTRL('n'): new_editor(ed); ed = ed->env->current; break;
         case CTRL('o'): prompt_open_editor(ed); ed = ed->env->current; break;
+        case CTRL('p'): replace_all (ed); break;
         case CTRL('q'): done = quit_editor (ed->env); break;
         case CTRL('r'): redo (ed); break;
         case CTRL('s'): save_editor (ed); break;
@@ -2430,6 +2354,7 @@ ButeEnv *buteenv_create (void)
     memset (self, 0, sizeof (ButeEnv));
     get_console_size (self);
     self->linebuf = realloc (self->linebuf, self->cols + LINEBUF_EXTRA);
+    self->screen = screen_create (self->lines + 1, self->cols, self->lines);
     }
   return self;
   }
@@ -2472,6 +2397,16 @@ void buteenv_run (ButeEnv *self)
   self->current = self->current->next;
   edit (self->current);
   term_clear_and_home();
+#if BUTE_COUNT_BYTES
+  if (self->keys > 0)
+    {
+    printf ("%lu keys, %lu bytes, %lu bytes/key, most %lu", 
+      (unsigned long)self->keys, (unsigned long)self->last_bytes, 
+      (unsigned long)(self->last_bytes / self->keys), 
+      (unsigned long)self->max_bytes);
+    interface_write_endl();
+    }
+#endif
   }
 
 /*==========================================================================
@@ -2485,6 +2420,8 @@ void buteenv_destroy (ButeEnv *self)
   if (self->clipboard) free (self->clipboard);
   if (self->search) free (self->search);
   if (self->linebuf) free (self->linebuf);
+  if (self->attrbuf) free (self->attrbuf);
+  if (self->screen) screen_destroy (self->screen);
   free (self);
   }
 
@@ -0,0 +1,499 @@
+/*===========================================================================
+
+  BUTE version 2
+
+  highlight.c
+
+  See highlight.h. The lexer reads a line a character at a time, with
+  no lookahead: where it can't tell what something is until later --
+  a name that may be a keyword, a '[' that may open a long string --
+  it colours the characters as plain text, and goes back over them
+  when it finds out.
+
+  The cache entry for a line is the state at its start, which is the
+  state at the end of the line before. Entries from 'valid' to 'known'
+  were worked out before the text changed, and shifted up or down with
+  the lines; once we're past the lines that changed, and the entries
+  after that agree with each other, finding a state the same as the 
+  old one means the rest are still right.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+===========================================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <bute2/screen.h>
+#include <bute2/highlight.h>
+
+// Room for this many more lines is added to the cache at a time
+#define HIGHLIGHT_GROW 64
+
+// The longest keyword
+#define HIGHLIGHT_NAME_MAX 8
+
+// The states a line can end in. A long string or comment keeps its
+//   level -- the number of '=' in its brackets -- in the low bits;
+//   higher levels are treated as HL_LEVEL_MAX.
+#define HL_NORMAL        0x00
+#define HL_QUOTE_SINGLE  0x01   // In a '...' string, continued by '\'
+#define HL_QUOTE_DOUBLE  0x02   // In a "..." string, continued by '\'
+#define HL_LONG_STRING   0x40
+#define HL_LONG_COMMENT  0x80
+#define HL_LEVEL_MAX     0x3F
+
+typedef enum _LexMode
+  {
+  LEX_NORMAL = 0,
+  LEX_NAME,           // In a name, which may be a keyword
+  LEX_NUMBER,
+  LEX_STRING,         // In a quoted string
+  LEX_DASH,           // After a '-', which may start a comment
+  LEX_COMMENT_START,  // After '--', which may open a long comment
+  LEX_COMMENT,        // In a comment that ends with the line
+  LEX_OPEN,           // After '[' and any '=', which may open a long one
+  LEX_LONG,           // In a long string or comment
+  LEX_CLOSE           // After ']' and any '=', which may close it
+  } LexMode;
+
+static const char *const highlight_keywords[] =
+  {
+  "and", "break", "do", "else", "elseif", "end", "false", "for",
+  "function", "goto", "if", "in", "local", "nil", "not", "or",
+  "repeat", "return", "then", "true", "until", "while", NULL
+  };
+
+struct _Highlight
+  {
+  uint8_t *states;    // The state at the start of each line
+  int size;           // Lines there is room for
+  int known;          // Lines whose states have been worked out
+  int valid;          // Lines whose states are still right
+  int changed;        // States after this line can be compared
+  };
+
+/*===========================================================================
+
+  highlight_create
+
+===========================================================================*/
+Highlight *highlight_create (void)
+  {
+  Highlight *self = malloc (sizeof (Highlight));
+  if (self)
+    {
+    self->states = malloc (HIGHLIGHT_GROW);
+    if (!self->states)
+      {
+      free (self);
+      return NULL;
+      }
+    self->size = HIGHLIGHT_GROW;
+    self->states[0] = HL_NORMAL;
+    self->known = self->valid = 1;
+    self->changed = -1;
+    }
+  return self;
+  }
+
+/*===========================================================================
+
+  highlight_destroy
+
+===========================================================================*/
+void highlight_destroy (Highlight *self)
+  {
+  free (self->states);
+  free (self);
+  }
+
+/*===========================================================================
+
+  highlight_grow
+
+  Make room for at least n lines. Returns FALSE if there isn't the
+  memory, in which case the cache is as it was.
+
+===========================================================================*/
+static BOOL highlight_grow (Highlight *self, int n)
+  {
+  uint8_t *states = realloc (self->states, n + HIGHLIGHT_GROW);
+  if (!states) return FALSE;
+  self->states = states;
+  self->size = n + HIGHLIGHT_GROW;
+  return TRUE;
+  }
+
+/*===========================================================================
+
+  highlight_change
+
+===========================================================================*/
+void highlight_change (Highlight *self, int line, int erased, int inserted)
+  {
+  // Nothing known depends on text after the last line known
+  if (line >= self->known) return;
+
+  // Lines after the ones that changed keep their old states, for
+  //   comparison. If some states were already out of date, they can
+  //   only be compared with each other, so not before the first of them.
+  int changed = line + inserted;
+  if (self->valid < self->known)
+    {
+    int older = self->valid - 1 > self->changed 
+      ? self->valid - 1 : self->changed;
+    if (older > line)
+      {
+      int moved = older > line + erased ? older + inserted - erased : changed;
+      if (moved > changed) changed = moved;
+      }
+    }
+  self->changed = changed;
+  if (self->valid > line + 1) self->valid = line + 1;
+
+  int from = line + 1 + erased;
+  int to = line + 1 + inserted;
+  int tail = self->known - from;
+  if (tail <= 0 
+       || (to + tail > self->size && !highlight_grow (self, to + tail)))
+    self->known = line + 1;
+  else
+    {
+    memmove (self->states + to, self->states + from, tail);
+    self->known = to + tail;
+    }
+  }
+
+/*===========================================================================
+
+  highlight_paint
+
+  Set the attributes of characters from..to-1, as far as they're wanted
+
+===========================================================================*/
+static void highlight_paint (uint8_t *attrs, int count, int from, int to,
+    uint8_t attr)
+  {
+  if (to > count) to = count;
+  for (int i = from; i < to; i++)
+    attrs[i] = attr;
+  }
+
+/*===========================================================================
+
+  highlight_name
+
+  Colour the name that starts at start, if it's a keyword
+
+===========================================================================*/
+static void highlight_name (uint8_t *attrs, int count, int start,
+    const char *name, int len)
+  {
+  if (len > HIGHLIGHT_NAME_MAX || start >= count) return;
+  for (const char *const *k = highlight_keywords; *k; k++)
+    {
+    if (strncmp (*k, name, len) == 0 && (*k)[len] == 0)
+      {
+      highlight_paint (attrs, count, start, start + len, SCREEN_ATTR_KEYWORD);
+      return;
+      }
+    }
+  }
+
+/*===========================================================================
+
+  highlight_lex
+
+  Lex a line of len characters at pos, that starts in the given state,
+  setting the attributes of the first count characters. Returns the
+  state at the end of the line.
+
+===========================================================================*/
+static uint8_t highlight_lex (uint8_t state, TextBuf *text, int pos,
+    int len, uint8_t *attrs, int count)
+  {
+  LexMode mode = LEX_NORMAL;
+  int level = 0;          // Of the long string or comment we're in
+  int close = 0;          // Count of '=' after a ']'
+  BOOL comment = FALSE;   // Whether a long bracket is a comment
+  BOOL escape = FALSE;    // After a '\' in a string
+  BOOL hex = FALSE;       // In a hexadecimal number
+  int quote = 0;
+  int start = 0;          // Where the name or long bracket started
+  char name[HIGHLIGHT_NAME_MAX];
+  int namelen = 0;
+  int prev = 0;
+
+  if (state & (HL_LONG_STRING | HL_LONG_COMMENT))
+    {
+    mode = LEX_LONG;
+    level = state & HL_LEVEL_MAX;
+    comment = (state & HL_LONG_COMMENT) != 0;
+    }
+  else if (state == HL_QUOTE_SINGLE || state == HL_QUOTE_DOUBLE)
+    {
+    mode = LEX_STRING;
+    quote = state == HL_QUOTE_SINGLE ? '\'' : '"';
+    }
+
+  const char *p = NULL;
+  int n = 0;
+  int i;
+  for (i = 0; i < len; i++)
+    {
+    if (n == 0 && (n = textbuf_segment (text, pos + i, &p)) == 0) break;
+    int c = (uint8_t)*p++;
+    n--;
+
+    uint8_t attr = SCREEN_ATTR_TEXT;
+    BOOL done = TRUE;
+    switch (mode)
+      {
+      case LEX_NAME:
+        if (isalnum (c) || c == '_')
+          {
+          if (namelen < HIGHLIGHT_NAME_MAX) name[namelen] = c;
+          namelen++;
+          }
+        else
+          {
+          highlight_name (attrs, count, start, name, namelen);
+          done = FALSE;
+          }
+        break;
+
+      case LEX_NUMBER:
+        if (isalnum (c) || c == '.' || ((c == '+' || c == '-')
+             && (hex ? (prev == 'p' || prev == 'P')
+                     : (prev == 'e' || prev == 'E'))))
+          {
+          if (c == 'x' || c == 'X') hex = TRUE;
+          attr = SCREEN_ATTR_NUMBER;
+          }
+        else
+          done = FALSE;
+        break;
+
+      case LEX_STRING:
+        attr = SCREEN_ATTR_STRING;
+        if (escape)
+          escape = FALSE;
+        else if (c == '\\')
+          escape = TRUE;
+        else if (c == quote)
+          mode = LEX_NORMAL;
+        break;
+
+      case LEX_DASH:
+        if (c == '-')
+          {
+          highlight_paint (attrs, count, start, i, SCREEN_ATTR_COMMENT);
+          attr = SCREEN_ATTR_COMMENT;
+          mode = LEX_COMMENT_START;
+          }
+        else
+          done = FALSE;
+        break;
+
+      case LEX_COMMENT_START:
+        attr = SCREEN_ATTR_COMMENT;
+        if (c == '[')
+          {
+          mode = LEX_OPEN;
+          start = i;
+          level = 0;
+          comment = TRUE;
+          }
+        else
+          mode = LEX_COMMENT;
+        break;
+
+      case LEX_COMMENT:
+        attr = SCREEN_ATTR_COMMENT;
+        break;
+
+      case LEX_OPEN:
+        if (c == '=')
+          {
+          if (level < HL_LEVEL_MAX) level++;
+          attr = comment ? SCREEN_ATTR_COMMENT : SCREEN_ATTR_TEXT;
+          }
+        else if (c == '[')
+          {
+          attr = comment ? SCREEN_ATTR_COMMENT : SCREEN_ATTR_STRING;
+          highlight_paint (attrs, count, start, i, attr);
+          mode = LEX_LONG;
+          }
+        else if (comment)
+          {
+          attr = SCREEN_ATTR_COMMENT;
+          mode = LEX_COMMENT;
+          }
+        else
+          done = FALSE;
+        break;
+
+      case LEX_LONG:
+        attr = comment ? SCREEN_ATTR_COMMENT : SCREEN_ATTR_STRING;
+        if (c == ']')
+          {
+          mode = LEX_CLOSE;
+          close = 0;
+          }
+        break;
+
+      case LEX_CLOSE:
+        attr = comment ? SCREEN_ATTR_COMMENT : SCREEN_ATTR_STRING;
+        if (c == '=')
+          {
+          if (close < HL_LEVEL_MAX) close++;
+          }
+        else if (c == ']' && close == level)
+          mode = LEX_NORMAL;
+        else if (c == ']')
+          close = 0;
+        else
+          mode = LEX_LONG;
+        break;
+
+      default:
+        done = FALSE;
+      }
+
+    // Whatever ended here, see what this character starts
+    if (!done)
+      {
+      mode = LEX_NORMAL;
+      attr = SCREEN_ATTR_TEXT;
+      if (isalpha (c) || c == '_')
+        {
+        mode = LEX_NAME;
+        start = i;
+        name[0] = c;
+        namelen = 1;
+        }
+      else if (isdigit (c))
+        {
+        mode = LEX_NUMBER;
+        hex = FALSE;
+        attr = SCREEN_ATTR_NUMBER;
+        }
+      else if (c == '\'' || c == '"')
+        {
+        mode = LEX_STRING;
+        quote = c;
+        escape = FALSE;
+        attr = SCREEN_ATTR_STRING;
+        }
+      else if (c == '-')
+        {
+        mode = LEX_DASH;
+        start = i;
+        }
+      else if (c == '[')
+        {
+        mode = LEX_OPEN;
+        start = i;
+        level = 0;
+        comment = FALSE;
+        }
+      }
+
+    if (i < count) attrs[i] = attr;
+    prev = c;
+    }
+
+  // Anything that couldn't be read is left plain
+  highlight_paint (attrs, count, i, count, SCREEN_ATTR_TEXT);
+
+  switch (mode)
+    {
+    case LEX_NAME:
+      highlight_name (attrs, count, start, name, namelen);
+      return HL_NORMAL;
+    case LEX_LONG:
+    case LEX_CLOSE:
+      return (comment ? HL_LONG_COMMENT : HL_LONG_STRING) | level;
+    case LEX_STRING:
+      if (escape) return quote == '\'' ? HL_QUOTE_SINGLE : HL_QUOTE_DOUBLE;
+      return HL_NORMAL;
+    default:
+      return HL_NORMAL;
+    }
+  }
+
+/*===========================================================================
+
+  highlight_store
+
+  Record the state at the start of a line, which must be the first
+  one that isn't valid. Returns FALSE if there isn't the memory to.
+
+===========================================================================*/
+static BOOL highlight_store (Highlight *self, int line, uint8_t state)
+  {
+  if (line < self->known)
+    {
+    if (line > self->changed && self->states[line] == state)
+      {
+      // The same as before the change, so the rest are too
+      self->valid = self->known;
+      return TRUE;
+      }
+    }
+  else
+    {
+    if (line >= self->size && !highlight_grow (self, line + 1))
+      return FALSE;
+    self->known = line + 1;
+    }
+  self->states[line] = state;
+  self->valid = line + 1;
+  return TRUE;
+  }
+
+/*===========================================================================
+
+  highlight_state
+
+  The state at the start of a line, working out any that aren't valid
+  on the way to it
+
+===========================================================================*/
+static uint8_t highlight_state (Highlight *self, TextBuf *text,
+    LineIndex *index, int line)
+  {
+  while (self->valid <= line)
+    {
+    int i = self->valid - 1;
+    uint8_t state = highlight_lex (self->states[i], text,
+      lineindex_line_start (index, i), lineindex_line_length (index, i),
+      NULL, 0);
+    if (!highlight_store (self, i + 1, state))
+      {
+      // Without room to keep them, work out the rest each time
+      for (i++; i < line; i++)
+        state = highlight_lex (state, text, lineindex_line_start (index, i),
+          lineindex_line_length (index, i), NULL, 0);
+      return state;
+      }
+    }
+  return self->states[line];
+  }
+
+/*===========================================================================
+
+  highlight_line
+
+===========================================================================*/
+void highlight_line (Highlight *self, TextBuf *text, LineIndex *index,
+    int line, uint8_t *attrs, int count)
+  {
+  uint8_t state = highlight_state (self, text, index, line);
+  state = highlight_lex (state, text, lineindex_line_start (index, line),
+    lineindex_line_length (index, line), attrs, count);
+  // Lines are usually coloured in order, so keep the next one's state
+  if (self->valid == line + 1) highlight_store (self, line + 1, state);
+  }
+
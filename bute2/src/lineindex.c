@@ -0,0 +1,501 @@
+/*===========================================================================
+
+  BUTE version 2
+
+  lineindex.c
+
+  See lineindex.h. The blocks are kept in an array, in text order. Each
+  block records how many lines it holds, and their total length, and
+  the Fenwick trees sum these, so that the trees can be searched for
+  the block in which the running count of lines or characters passes
+  a given value. Changing the length of a line only needs the trees
+  to be updated, but splitting or merging blocks changes the numbering
+  of the blocks, so the trees are marked stale, and rebuilt when they
+  are next needed.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+===========================================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <bute2/lineindex.h>
+
+// Most lines in a block. A block that fills up is split in two, and
+//   neighbouring blocks that would fit in half a block are merged.
+#define LINEINDEX_BLOCK 32
+
+typedef struct _LineBlock
+  {
+  int count;                  // Lines in the block
+  int chars;                  // Total length of those lines
+  int len[LINEINDEX_BLOCK];   // Length of each line, with its newline
+  } LineBlock;
+
+struct _LineIndex
+  {
+  LineBlock **blocks;
+  int nblocks;
+  int size;           // Entries allocated in blocks, and in the trees
+  int *tree_lines;    // Fenwick trees of the block counts and lengths,
+  int *tree_chars;    //   indexed from 1
+  BOOL stale;         // Set when the trees need to be rebuilt
+  int lines;          // Totals for the whole text
+  int chars;
+  };
+
+/*===========================================================================
+
+  lineindex_grow
+
+  Make room for more blocks
+
+===========================================================================*/
+static ErrCode lineindex_grow (LineIndex *self)
+  {
+  int size = self->size ? 2 * self->size : 8;
+  LineBlock **blocks = realloc (self->blocks, size * sizeof (LineBlock *));
+  if (!blocks) return ERR_NOMEM;
+  self->blocks = blocks;
+  int *tree = realloc (self->tree_lines, (size + 1) * sizeof (int));
+  if (!tree) return ERR_NOMEM;
+  self->tree_lines = tree;
+  tree = realloc (self->tree_chars, (size + 1) * sizeof (int));
+  if (!tree) return ERR_NOMEM;
+  self->tree_chars = tree;
+  self->size = size;
+  return 0;
+  }
+
+/*===========================================================================
+
+  lineindex_create
+
+===========================================================================*/
+LineIndex *lineindex_create (void)
+  {
+  LineIndex *self = malloc (sizeof (LineIndex));
+  if (self)
+    {
+    memset (self, 0, sizeof (LineIndex));
+    LineBlock *block = NULL;
+    if (lineindex_grow (self) == 0)
+      block = malloc (sizeof (LineBlock));
+    if (block)
+      {
+      block->count = 1;
+      block->chars = 0;
+      block->len[0] = 0;
+      self->blocks[0] = block;
+      self->nblocks = 1;
+      self->lines = 1;
+      self->stale = TRUE;
+      }
+    else
+      {
+      lineindex_destroy (self);
+      self = NULL;
+      }
+    }
+  return self;
+  }
+
+/*===========================================================================
+
+  lineindex_destroy
+
+===========================================================================*/
+void lineindex_destroy (LineIndex *self)
+  {
+  for (int i = 0; i < self->nblocks; i++)
+    free (self->blocks[i]);
+  free (self->blocks);
+  free (self->tree_lines);
+  free (self->tree_chars);
+  free (self);
+  }
+
+/*===========================================================================
+
+  lineindex_rebuild
+
+===========================================================================*/
+static void lineindex_rebuild (LineIndex *self)
+  {
+  int n = self->nblocks;
+  for (int i = 1; i <= n; i++)
+    {
+    self->tree_lines[i] = self->blocks[i - 1]->count;
+    self->tree_chars[i] = self->blocks[i - 1]->chars;
+    }
+  for (int i = 1; i <= n; i++)
+    {
+    int j = i + (i & -i);
+    if (j <= n)
+      {
+      self->tree_lines[j] += self->tree_lines[i];
+      self->tree_chars[j] += self->tree_chars[i];
+      }
+    }
+  self->stale = FALSE;
+  }
+
+/*===========================================================================
+
+  lineindex_tree_add
+
+  Record a change in the count and length of block b
+
+===========================================================================*/
+static void lineindex_tree_add (LineIndex *self, int b, int lines,
+    int chars)
+  {
+  if (self->stale) return;
+  for (int i = b + 1; i <= self->nblocks; i += i & -i)
+    {
+    self->tree_lines[i] += lines;
+    self->tree_chars[i] += chars;
+    }
+  }
+
+/*===========================================================================
+
+  lineindex_tree_prefix
+
+  The total of the first b blocks
+
+===========================================================================*/
+static int lineindex_tree_prefix (const int *tree, int b)
+  {
+  int sum = 0;
+  for (int i = b; i > 0; i -= i & -i)
+    sum += tree[i];
+  return sum;
+  }
+
+/*===========================================================================
+
+  lineindex_tree_find
+
+  Find the block in which the running total passes target, and the
+  total of the blocks before it. Returns nblocks if the target is
+  beyond the last block.
+
+===========================================================================*/
+static int lineindex_tree_find (const LineIndex *self, const int *tree,
+    int target, int *before)
+  {
+  int n = self->nblocks;
+  int step = 1;
+  while (step * 2 <= n) step *= 2;
+  int b = 0;
+  int sum = 0;
+  for (; step > 0; step >>= 1)
+    {
+    if (b + step <= n && sum + tree[b + step] <= target)
+      {
+      b += step;
+      sum += tree[b];
+      }
+    }
+  *before = sum;
+  return b;
+  }
+
+/*===========================================================================
+
+  lineindex_find_line
+
+  Find the block holding a line, and the line's place in it. The line
+  after the last is placed at the end of the last block.
+
+===========================================================================*/
+static LineBlock *lineindex_find_line (LineIndex *self, int line, int *b,
+    int *i)
+  {
+  if (self->stale) lineindex_rebuild (self);
+  int before;
+  *b = lineindex_tree_find (self, self->tree_lines, line, &before);
+  if (*b == self->nblocks)
+    {
+    *b = self->nblocks - 1;
+    before = self->lines - self->blocks[*b]->count;
+    }
+  *i = line - before;
+  return self->blocks[*b];
+  }
+
+/*===========================================================================
+
+  lineindex_length
+
+  The length of a line, with its newline
+
+===========================================================================*/
+static int lineindex_length (LineIndex *self, int line)
+  {
+  int b, i;
+  return lineindex_find_line (self, line, &b, &i)->len[i];
+  }
+
+/*===========================================================================
+
+  lineindex_adjust
+
+  Change the length of a line
+
+===========================================================================*/
+static void lineindex_adjust (LineIndex *self, int line, int delta)
+  {
+  int b, i;
+  LineBlock *block = lineindex_find_line (self, line, &b, &i);
+  block->len[i] += delta;
+  block->chars += delta;
+  self->chars += delta;
+  lineindex_tree_add (self, b, 0, delta);
+  }
+
+/*===========================================================================
+
+  lineindex_insert_line
+
+  Insert a line of length len, so that it becomes line number line
+
+===========================================================================*/
+static ErrCode lineindex_insert_line (LineIndex *self, int line, int len)
+  {
+  int b, i;
+  LineBlock *block = lineindex_find_line (self, line, &b, &i);
+  if (block->count == LINEINDEX_BLOCK)
+    {
+    // Split the block, and move the second half into a new one
+    if (self->nblocks == self->size && lineindex_grow (self))
+      return ERR_NOMEM;
+    LineBlock *next = malloc (sizeof (LineBlock));
+    if (!next) return ERR_NOMEM;
+    int half = LINEINDEX_BLOCK / 2;
+    next->count = LINEINDEX_BLOCK - half;
+    next->chars = 0;
+    for (int k = 0; k < next->count; k++)
+      {
+      next->len[k] = block->len[half + k];
+      next->chars += next->len[k];
+      }
+    block->count = half;
+    block->chars -= next->chars;
+    memmove (self->blocks + b + 2, self->blocks + b + 1,
+      (self->nblocks - b - 1) * sizeof (LineBlock *));
+    self->blocks[b + 1] = next;
+    self->nblocks++;
+    self->stale = TRUE;
+    if (i > half)
+      {
+      block = next;
+      b++;
+      i -= half;
+      }
+    }
+  memmove (block->len + i + 1, block->len + i,
+    (block->count - i) * sizeof (int));
+  block->len[i] = len;
+  block->count++;
+  block->chars += len;
+  self->lines++;
+  self->chars += len;
+  lineindex_tree_add (self, b, 1, len);
+  return 0;
+  }
+
+/*===========================================================================
+
+  lineindex_merge
+
+  Move the lines of block b + 1 to the end of block b, which must have
+  room for them
+
+===========================================================================*/
+static void lineindex_merge (LineIndex *self, int b)
+  {
+  LineBlock *block = self->blocks[b];
+  LineBlock *next = self->blocks[b + 1];
+  memcpy (block->len + block->count, next->len, next->count * sizeof (int));
+  block->count += next->count;
+  block->chars += next->chars;
+  free (next);
+  memmove (self->blocks + b + 1, self->blocks + b + 2,
+    (self->nblocks - b - 2) * sizeof (LineBlock *));
+  self->nblocks--;
+  self->stale = TRUE;
+  }
+
+/*===========================================================================
+
+  lineindex_remove_line
+
+  Remove a line, other than the only one
+
+===========================================================================*/
+static void lineindex_remove_line (LineIndex *self, int line)
+  {
+  int b, i;
+  LineBlock *block = lineindex_find_line (self, line, &b, &i);
+  int len = block->len[i];
+  memmove (block->len + i, block->len + i + 1,
+    (block->count - i - 1) * sizeof (int));
+  block->count--;
+  block->chars -= len;
+  self->lines--;
+  self->chars -= len;
+  lineindex_tree_add (self, b, -1, -len);
+
+  // Don't leave an empty block, nor lots of small ones
+  if (b + 1 < self->nblocks && (block->count == 0
+       || block->count + self->blocks[b + 1]->count <= LINEINDEX_BLOCK / 2))
+    lineindex_merge (self, b);
+  else if (b > 0 && (block->count == 0
+       || block->count + self->blocks[b - 1]->count <= LINEINDEX_BLOCK / 2))
+    lineindex_merge (self, b - 1);
+  }
+
+/*===========================================================================
+
+  lineindex_lines
+
+===========================================================================*/
+int lineindex_lines (const LineIndex *self)
+  {
+  return self->lines;
+  }
+
+/*===========================================================================
+
+  lineindex_line_at
+
+===========================================================================*/
+int lineindex_line_at (LineIndex *self, int pos)
+  {
+  if (self->stale) lineindex_rebuild (self);
+  int before;
+  int b = lineindex_tree_find (self, self->tree_chars, pos, &before);
+  if (b == self->nblocks)
+    {
+    b = self->nblocks - 1;
+    before = self->chars - self->blocks[b]->chars;
+    }
+  LineBlock *block = self->blocks[b];
+  int i = 0;
+  while (i < block->count - 1 && before + block->len[i] <= pos)
+    before += block->len[i++];
+  return lineindex_tree_prefix (self->tree_lines, b) + i;
+  }
+
+/*===========================================================================
+
+  lineindex_line_start
+
+===========================================================================*/
+int lineindex_line_start (LineIndex *self, int line)
+  {
+  int b, i;
+  LineBlock *block = lineindex_find_line (self, line, &b, &i);
+  int pos = lineindex_tree_prefix (self->tree_chars, b);
+  for (int k = 0; k < i; k++)
+    pos += block->len[k];
+  return pos;
+  }
+
+/*===========================================================================
+
+  lineindex_line_length
+
+===========================================================================*/
+int lineindex_line_length (LineIndex *self, int line)
+  {
+  int len = lineindex_length (self, line);
+  // Every line but the last ends with a newline
+  return line < self->lines - 1 ? len - 1 : len;
+  }
+
+/*===========================================================================
+
+  lineindex_insert
+
+===========================================================================*/
+ErrCode lineindex_insert (LineIndex *self, int pos, const char *text,
+    int len)
+  {
+  int line = lineindex_line_at (self, pos);
+  const char *nl = memchr (text, '\n', len);
+  if (!nl)
+    {
+    lineindex_adjust (self, line, len);
+    return 0;
+    }
+
+  // The line is split where the text goes in. The first part ends at
+  //   the first newline inserted, and the rest of the line is added to
+  //   the last line inserted.
+  int first = line;
+  int offset = pos - lineindex_line_start (self, line);
+  int full = lineindex_length (self, line);
+  int cut = offset + (nl - text) + 1 - full;
+  lineindex_adjust (self, line, cut);
+
+  ErrCode ret = 0;
+  const char *p = nl + 1;
+  const char *end = text + len;
+  while (ret == 0 && (nl = memchr (p, '\n', end - p)))
+    {
+    ret = lineindex_insert_line (self, line + 1, nl - p + 1);
+    if (ret == 0) line++;
+    p = nl + 1;
+    }
+  if (ret == 0)
+    ret = lineindex_insert_line (self, line + 1, (end - p) + full - offset);
+
+  if (ret)
+    {
+    // Take out the lines that did go in, and put the first one back 
+    //   together, so the index is as it was
+    for (; line > first; line--)
+      lineindex_remove_line (self, first + 1);
+    lineindex_adjust (self, first, -cut);
+    }
+  return ret;
+  }
+
+/*===========================================================================
+
+  lineindex_erase
+
+===========================================================================*/
+void lineindex_erase (LineIndex *self, int pos, int len)
+  {
+  if (len <= 0) return;
+  int line = lineindex_line_at (self, pos);
+  int offset = pos - lineindex_line_start (self, line);
+  int full = lineindex_length (self, line);
+  if (offset + len < full)
+    {
+    lineindex_adjust (self, line, -len);
+    return;
+    }
+
+  // The erasure takes the newline at the end of the line, so what is
+  //   left of the line joins up with what is left of the lines after
+  //   it. Those lines that are erased completely just go.
+  len -= full - offset;
+  lineindex_adjust (self, line, offset - full);
+  while (line + 1 < self->lines)
+    {
+    int next = lineindex_length (self, line + 1);
+    lineindex_remove_line (self, line + 1);
+    if (len < next)
+      {
+      lineindex_adjust (self, line, next - len);
+      break;
+      }
+    len -= next;
+    }
+  }
+
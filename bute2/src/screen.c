@@ -0,0 +1,470 @@
+/*===========================================================================
+
+  BUTE version 2
+
+  screen.c
+
+  See screen.h. The screen keeps two copies of every row: the next
+  frame, which the editor writes into, and what the terminal is
+  showing. An update first looks for a scroll -- a shift of the rows
+  that would bring the most of them into line with what is showing --
+  using the row hashes. If it's worth it, it scrolls the terminal,
+  and the copy of it. Then, for each row that is still different, it
+  sends the characters from the first that has changed to the last,
+  moving the cursor over long runs that haven't changed, and clearing
+  to the end of the line rather than sending trailing blanks.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+===========================================================================*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <interface/interface.h>
+#include <bute2/screen.h>
+
+// Size of the output buffer
+#define SCREEN_OUT_SIZE 128
+
+// A run of unchanged characters at least this long is skipped by
+//   moving the cursor, which takes about this many bytes
+#define SCREEN_SKIP_MIN 8
+
+// Clear to end-of-line rather than send more trailing blanks than this
+#define SCREEN_CLEAR_MIN 3
+
+// Scroll only if it saves redrawing at least this many rows
+#define SCREEN_SCROLL_MIN 2
+
+#define SCREEN_CLREOL "\033[K"
+
+// Escape sequences for each ScreenAttr. Each starts from the plain
+//   attribute, so they don't depend on what went before.
+static const char *const screen_attr_codes[] =
+  {
+  "\033[0m",      // SCREEN_ATTR_TEXT
+  "\033[0;7;1m",  // SCREEN_ATTR_SELECT
+  "\033[0;1;7m",  // SCREEN_ATTR_STATUS
+  "\033[0;36m",   // SCREEN_ATTR_KEYWORD
+  "\033[0;32m",   // SCREEN_ATTR_STRING
+  "\033[0;34m",   // SCREEN_ATTR_COMMENT
+  "\033[0;35m"    // SCREEN_ATTR_NUMBER
+  };
+
+// Shorter sequences for the syntax colours, which can be used when
+//   only the foreground is set -- that is, when the plain attribute, or 
+//   another colour, is set. Syntax colouring changes attribute often, 
+//   so it's worth saving the bytes.
+static const char *const screen_attr_colours[] =
+  {
+  NULL,           // SCREEN_ATTR_TEXT
+  NULL,           // SCREEN_ATTR_SELECT
+  NULL,           // SCREEN_ATTR_STATUS
+  "\033[36m",     // SCREEN_ATTR_KEYWORD
+  "\033[32m",     // SCREEN_ATTR_STRING
+  "\033[34m",     // SCREEN_ATTR_COMMENT
+  "\033[35m"      // SCREEN_ATTR_NUMBER
+  };
+
+struct _Screen
+  {
+  int rows;
+  int cols;
+  int scroll_rows;
+  char *chars;          // Next frame
+  uint8_t *attrs;
+  char *shown_chars;    // What the terminal is showing
+  uint8_t *shown_attrs;
+  uint32_t *hash;       // Hash of each row that is showing
+  uint32_t *new_hash;   // Hash of each row of the next frame
+  uint8_t *valid;       // Set when we know what a row is showing
+  uint32_t blank_hash;
+  int cur_row;          // Terminal cursor, or -1 if we don't know
+  int cur_col;
+  int cur_attr;         // Terminal attribute, or -1 if we don't know
+  uint32_t bytes;
+  int out_len;
+  char out[SCREEN_OUT_SIZE];
+  };
+
+/*===========================================================================
+
+  screen_hash_row
+
+  FNV-1a, over the characters and attributes
+
+===========================================================================*/
+static uint32_t screen_hash_row (const char *chars, const uint8_t *attrs,
+    int cols)
+  {
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < cols; i++)
+    {
+    h ^= (uint8_t)chars[i];
+    h *= 16777619u;
+    h ^= attrs[i];
+    h *= 16777619u;
+    }
+  return h;
+  }
+
+/*===========================================================================
+
+  screen_create
+
+===========================================================================*/
+Screen *screen_create (int rows, int cols, int scroll_rows)
+  {
+  int cells = rows * cols;
+  Screen *self = malloc (sizeof (Screen) + 4 * cells
+    + rows * (2 * sizeof (uint32_t) + 1));
+  if (self)
+    {
+    self->rows = rows;
+    self->cols = cols;
+    self->scroll_rows = scroll_rows;
+    uint32_t *p = (uint32_t *)(self + 1);
+    self->hash = p;
+    self->new_hash = p + rows;
+    self->chars = (char *)(p + 2 * rows);
+    self->shown_chars = self->chars + cells;
+    self->attrs = (uint8_t *)self->shown_chars + cells;
+    self->shown_attrs = self->attrs + cells;
+    self->valid = self->shown_attrs + cells;
+    memset (self->chars, ' ', 2 * cells);
+    memset (self->attrs, SCREEN_ATTR_TEXT, 2 * cells);
+    self->blank_hash = screen_hash_row (self->chars, self->attrs, cols);
+    self->bytes = 0;
+    self->out_len = 0;
+    screen_invalidate (self, -1);
+    }
+  return self;
+  }
+
+/*===========================================================================
+
+  screen_destroy
+
+===========================================================================*/
+void screen_destroy (Screen *self)
+  {
+  free (self);
+  }
+
+/*===========================================================================
+
+  screen_chars
+
+===========================================================================*/
+char *screen_chars (Screen *self, int row)
+  {
+  return self->chars + row * self->cols;
+  }
+
+/*===========================================================================
+
+  screen_attrs
+
+===========================================================================*/
+uint8_t *screen_attrs (Screen *self, int row)
+  {
+  return self->attrs + row * self->cols;
+  }
+
+/*===========================================================================
+
+  screen_put
+
+===========================================================================*/
+void screen_put (Screen *self, int row, int col, const char *s,
+    ScreenAttr attr)
+  {
+  char *chars = screen_chars (self, row);
+  uint8_t *attrs = screen_attrs (self, row);
+  for (; col < self->cols; col++)
+    {
+    chars[col] = *s ? *s++ : ' ';
+    attrs[col] = attr;
+    }
+  }
+
+/*===========================================================================
+
+  screen_invalidate
+
+===========================================================================*/
+void screen_invalidate (Screen *self, int row)
+  {
+  if (row < 0)
+    memset (self->valid, 0, self->rows);
+  else
+    self->valid[row] = 0;
+  // Whatever wrote to the terminal will have moved the cursor too
+  self->cur_row = -1;
+  self->cur_attr = -1;
+  }
+
+/*===========================================================================
+
+  screen_bytes_sent
+
+===========================================================================*/
+uint32_t screen_bytes_sent (const Screen *self)
+  {
+  return self->bytes;
+  }
+
+/*===========================================================================
+
+  screen_flush
+
+===========================================================================*/
+void screen_flush (Screen *self)
+  {
+  if (self->out_len > 0)
+    interface_write_buff (self->out, self->out_len);
+  self->out_len = 0;
+  }
+
+/*===========================================================================
+
+  screen_out
+
+===========================================================================*/
+static void screen_out (Screen *self, const char *s, int len)
+  {
+  if (self->out_len + len > SCREEN_OUT_SIZE) screen_flush (self);
+  memcpy (self->out + self->out_len, s, len);
+  self->out_len += len;
+  self->bytes += len;
+  }
+
+/*===========================================================================
+
+  screen_set_attr
+
+===========================================================================*/
+void screen_set_attr (Screen *self, ScreenAttr attr)
+  {
+  if ((int)attr == self->cur_attr) return;
+  const char *code = screen_attr_codes[attr];
+  if (screen_attr_colours[attr] && self->cur_attr >= 0
+       && (self->cur_attr == SCREEN_ATTR_TEXT 
+           || screen_attr_colours[self->cur_attr]))
+    code = screen_attr_colours[attr];
+  screen_out (self, code, strlen (code));
+  self->cur_attr = attr;
+  }
+
+/*===========================================================================
+
+  screen_move_cursor
+
+===========================================================================*/
+void screen_move_cursor (Screen *self, int row, int col)
+  {
+  if (row == self->cur_row && col == self->cur_col) return;
+  if (row == self->cur_row && col == 0)
+    screen_out (self, "\r", 1);
+  else
+    {
+    char buff[32];
+    int len = sprintf (buff, "\033[%d;%dH", row + 1, col + 1);
+    screen_out (self, buff, len);
+    }
+  self->cur_row = row;
+  self->cur_col = col;
+  }
+
+/*===========================================================================
+
+  screen_send_char
+
+===========================================================================*/
+static void screen_send_char (Screen *self, int row, int col)
+  {
+  screen_move_cursor (self, row, col);
+  screen_set_attr (self, (ScreenAttr)screen_attrs (self, row)[col]);
+  screen_out (self, screen_chars (self, row) + col, 1);
+  // After the last column, where the cursor is depends on the terminal
+  if (++self->cur_col == self->cols) self->cur_row = -1;
+  }
+
+/*===========================================================================
+
+  screen_scroll
+
+  Scroll the top scroll_rows rows of the terminal, and our copy of
+  them, up by n rows, or down if n is negative.
+
+===========================================================================*/
+static void screen_scroll (Screen *self, int n)
+  {
+  int rows = self->scroll_rows;
+  int cols = self->cols;
+  int count = n > 0 ? n : -n;
+  char buff[32];
+
+  // The new rows are cleared with the current attribute
+  screen_set_attr (self, SCREEN_ATTR_TEXT);
+  int len = sprintf (buff, "\033[1;%dr", rows);
+  screen_out (self, buff, len);
+  len = sprintf (buff, n > 0 ? "\033[%dS" : "\033[%dT", count);
+  screen_out (self, buff, len);
+  screen_out (self, "\033[r", 3);
+  self->cur_row = -1;
+
+  int keep = rows - count;
+  int from = n > 0 ? count : 0;
+  int to = n > 0 ? 0 : count;
+  int blank = n > 0 ? keep : 0;
+  memmove (self->shown_chars + to * cols, self->shown_chars + from * cols,
+    keep * cols);
+  memmove (self->shown_attrs + to * cols, self->shown_attrs + from * cols,
+    keep * cols);
+  memmove (self->hash + to, self->hash + from, keep * sizeof (uint32_t));
+  memmove (self->valid + to, self->valid + from, keep);
+  memset (self->shown_chars + blank * cols, ' ', count * cols);
+  memset (self->shown_attrs + blank * cols, SCREEN_ATTR_TEXT, count * cols);
+  for (int i = blank; i < blank + count; i++)
+    {
+    self->hash[i] = self->blank_hash;
+    self->valid[i] = 1;
+    }
+  }
+
+/*===========================================================================
+
+  screen_find_scroll
+
+  Returns the number of rows to scroll up (or down, if negative) to
+  bring the most rows into line with the next frame, or zero if
+  scrolling wouldn't help enough. Blank rows don't count, because
+  there's nothing to gain by moving them.
+
+===========================================================================*/
+static int screen_find_scroll (const Screen *self)
+  {
+  int rows = self->scroll_rows;
+  int best = 0;
+  int best_matches = 0;
+  for (int n = -(rows - 1); n < rows; n++)
+    {
+    int matches = 0;
+    for (int i = 0; i < rows; i++)
+      {
+      int j = i + n;
+      if (j >= 0 && j < rows && self->valid[j]
+           && self->new_hash[i] == self->hash[j]
+           && self->new_hash[i] != self->blank_hash)
+        matches++;
+      }
+    if (n == 0)
+      {
+      if (matches + SCREEN_SCROLL_MIN > best_matches)
+        {
+        best = 0;
+        best_matches = matches + SCREEN_SCROLL_MIN;
+        }
+      }
+    else if (matches > best_matches)
+      {
+      best = n;
+      best_matches = matches;
+      }
+    }
+  return best;
+  }
+
+/*===========================================================================
+
+  screen_update_row
+
+===========================================================================*/
+static void screen_update_row (Screen *self, int row)
+  {
+  int cols = self->cols;
+  const char *nc = screen_chars (self, row);
+  const uint8_t *na = screen_attrs (self, row);
+  char *oc = self->shown_chars + row * cols;
+  uint8_t *oa = self->shown_attrs + row * cols;
+  BOOL valid = self->valid[row];
+
+  if (valid && self->new_hash[row] == self->hash[row]
+       && memcmp (nc, oc, cols) == 0 && memcmp (na, oa, cols) == 0)
+    return;
+
+  #define SCREEN_SAME(i) (nc[i] == oc[i] && na[i] == oa[i])
+
+  // Find the part of the row that has changed
+  int first = 0;
+  int last = cols - 1;
+  if (valid)
+    {
+    while (first < cols && SCREEN_SAME (first)) first++;
+    while (last > first && SCREEN_SAME (last)) last--;
+    }
+
+  // Where the new row ends in blanks, we may be able to clear them
+  int len = cols;
+  while (len > 0 && nc[len - 1] == ' ' && na[len - 1] == SCREEN_ATTR_TEXT)
+    len--;
+  int end = last + 1;
+  BOOL clear = FALSE;
+  if (end > len && (!valid || end - len > SCREEN_CLEAR_MIN))
+    {
+    end = len;
+    clear = TRUE;
+    }
+
+  int i = first;
+  while (i < end)
+    {
+    if (valid && SCREEN_SAME (i))
+      {
+      int j = i;
+      while (j < end && SCREEN_SAME (j)) j++;
+      if (j - i >= SCREEN_SKIP_MIN)
+        {
+        i = j;
+        continue;
+        }
+      }
+    screen_send_char (self, row, i);
+    i++;
+    }
+
+  if (clear)
+    {
+    screen_move_cursor (self, row, first > len ? first : len);
+    screen_set_attr (self, SCREEN_ATTR_TEXT);
+    screen_out (self, SCREEN_CLREOL, sizeof (SCREEN_CLREOL) - 1);
+    }
+
+  #undef SCREEN_SAME
+
+  memcpy (oc, nc, cols);
+  memcpy (oa, na, cols);
+  self->hash[row] = self->new_hash[row];
+  self->valid[row] = 1;
+  }
+
+/*===========================================================================
+
+  screen_update
+
+===========================================================================*/
+void screen_update (Screen *self)
+  {
+  for (int i = 0; i < self->rows; i++)
+    self->new_hash[i] = screen_hash_row (screen_chars (self, i),
+      screen_attrs (self, i), self->cols);
+
+  int n = screen_find_scroll (self);
+  if (n != 0) screen_scroll (self, n);
+
+  for (int i = 0; i < self->rows; i++)
+    screen_update_row (self, i);
+  }
+
@@ -0,0 +1,825 @@
+/*===========================================================================
+
+  BUTE version 2
+
+  textbuf.c
+
+  See textbuf.h. The pages are kept in an array, in text order. A page
+  that hasn't changed records where it is in the file, so that its
+  memory can be freed, and the page read again later; a page that has
+  changed, or that didn't come from a file, has an offset of -1, and
+  stays in memory. There is always at least one page, which is empty
+  only if the text is.
+
+  An edit within a page just moves the text in the page along. A page
+  that grows to twice BUTE_PAGE_SIZE is split up, and neighbouring
+  pages that would fit in one are joined. Edits are made in an order
+  that means they can't fail half-way: anything that needs reading
+  or allocating is done before the text is changed.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+===========================================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <config.h>
+#include <shell/errcodes.h>
+#include <storage/storage.h>
+#include <bute2/textbuf.h>
+
+// Strings at least this long are found with Boyer-Moore-Horspool
+#define TEXTBUF_BMH_MIN 4
+
+typedef struct _TextPage
+  {
+  char *data;         // The text, if it's in memory
+  int len;            // Length of the text
+  int cap;            // Space allocated at data
+  int offset;         // Where the page is in the file, or -1
+  uint32_t used;      // When the page was last used
+  } TextPage;
+
+struct _TextBuf
+  {
+  TextPage *pages;
+  int npages;
+  int size;           // Entries allocated in pages
+  StorageFile *file;  // The file that unchanged pages are read from
+  char path [MAX_PATH + 1];
+  int length;
+  int cached;         // Unchanged pages in memory
+  BOOL keep;          // Don't drop pages from memory
+  uint32_t clock;
+  int hint;           // The page found last, and where it starts
+  int hint_start;
+  };
+
+/*===========================================================================
+
+  textbuf_grow
+
+  Make room for n more pages
+
+===========================================================================*/
+static ErrCode textbuf_grow (TextBuf *self, int n)
+  {
+  if (self->npages + n <= self->size) return 0;
+  int size = self->size ? 2 * self->size : 8;
+  while (size < self->npages + n) size *= 2;
+  TextPage *pages = realloc (self->pages, size * sizeof (TextPage));
+  if (!pages) return ERR_NOMEM;
+  self->pages = pages;
+  self->size = size;
+  return 0;
+  }
+
+/*===========================================================================
+
+  textbuf_create
+
+===========================================================================*/
+TextBuf *textbuf_create (void)
+  {
+  TextBuf *self = malloc (sizeof (TextBuf));
+  if (self)
+    {
+    memset (self, 0, sizeof (TextBuf));
+    if (textbuf_grow (self, 1) == 0)
+      {
+      memset (self->pages, 0, sizeof (TextPage));
+      self->pages[0].offset = -1;
+      self->npages = 1;
+      }
+    else
+      {
+      free (self);
+      self = NULL;
+      }
+    }
+  return self;
+  }
+
+/*===========================================================================
+
+  textbuf_destroy
+
+===========================================================================*/
+void textbuf_destroy (TextBuf *self)
+  {
+  for (int i = 0; i < self->npages; i++)
+    free (self->pages[i].data);
+  free (self->pages);
+  if (self->file) storage_file_close (self->file);
+  free (self);
+  }
+
+/*===========================================================================
+
+  textbuf_evict
+
+  Free the memory of the unchanged page that was used longest ago.
+  Returns FALSE if there are none in memory.
+
+===========================================================================*/
+static BOOL textbuf_evict (TextBuf *self)
+  {
+  TextPage *oldest = NULL;
+  for (int i = 0; i < self->npages; i++)
+    {
+    TextPage *page = &self->pages[i];
+    if (page->data && page->offset >= 0
+         && (!oldest || page->used < oldest->used))
+      oldest = page;
+    }
+  if (!oldest) return FALSE;
+  free (oldest->data);
+  oldest->data = NULL;
+  oldest->cap = 0;
+  self->cached--;
+  return TRUE;
+  }
+
+/*===========================================================================
+
+  textbuf_alloc
+
+  realloc(), but if there isn't enough memory, free cached pages
+  until there is, or there are no more
+
+===========================================================================*/
+static char *textbuf_alloc (TextBuf *self, char *data, int size)
+  {
+  char *result;
+  while (!(result = realloc (data, size)) && textbuf_evict (self))
+    ;
+  return result;
+  }
+
+/*===========================================================================
+
+  textbuf_load
+
+  Make sure a page is in memory
+
+===========================================================================*/
+static ErrCode textbuf_load (TextBuf *self, TextPage *page)
+  {
+  page->used = ++self->clock;
+  if (page->data || page->offset < 0) return 0;
+  if (!self->file) return ERR_IO;
+
+  if (!self->keep)
+    {
+    while (self->cached >= BUTE_CACHE_PAGES && textbuf_evict (self))
+      ;
+    }
+  char *data = textbuf_alloc (self, NULL, page->len);
+  ErrCode ret = data ? 0 : ERR_NOMEM;
+  if (ret == 0) ret = storage_file_seek (self->file, page->offset);
+  int done = 0;
+  while (ret == 0 && done < page->len)
+    {
+    int n = 0;
+    ret = storage_file_read (self->file, data + done, page->len - done, &n);
+    // If the file is shorter than it was, something else has changed it
+    if (ret == 0 && n == 0) ret = ERR_IO;
+    done += n;
+    }
+  if (ret == 0)
+    {
+    page->data = data;
+    page->cap = page->len;
+    self->cached++;
+    }
+  else
+    free (data);
+  return ret;
+  }
+
+/*===========================================================================
+
+  textbuf_modify
+
+  Load a page, ready to change it, after which it can't be dropped
+  from memory
+
+===========================================================================*/
+static ErrCode textbuf_modify (TextBuf *self, TextPage *page)
+  {
+  ErrCode ret = textbuf_load (self, page);
+  if (ret == 0 && page->offset >= 0)
+    {
+    page->offset = -1;
+    self->cached--;
+    }
+  return ret;
+  }
+
+/*===========================================================================
+
+  textbuf_find_page
+
+  Find the page holding pos, or the last page if pos is at the end,
+  and where it starts. Most lookups are close to the last one, so we
+  start from there.
+
+===========================================================================*/
+static int textbuf_find_page (TextBuf *self, int pos, int *start)
+  {
+  int p = self->hint;
+  int s = self->hint_start;
+  while (p > 0 && pos < s)
+    {
+    p--;
+    s -= self->pages[p].len;
+    }
+  while (p < self->npages - 1 && pos >= s + self->pages[p].len)
+    {
+    s += self->pages[p].len;
+    p++;
+    }
+  self->hint = p;
+  self->hint_start = s;
+  *start = s;
+  return p;
+  }
+
+/*===========================================================================
+
+  textbuf_remove_page
+
+===========================================================================*/
+static void textbuf_remove_page (TextBuf *self, int p)
+  {
+  TextPage *page = &self->pages[p];
+  if (page->data && page->offset >= 0) self->cached--;
+  free (page->data);
+  if (self->npages == 1)
+    {
+    memset (page, 0, sizeof (TextPage));
+    page->offset = -1;
+    }
+  else
+    {
+    memmove (page, page + 1, (self->npages - p - 1) * sizeof (TextPage));
+    self->npages--;
+    }
+  self->hint = 0;
+  self->hint_start = 0;
+  }
+
+/*===========================================================================
+
+  textbuf_split
+
+  Split a page that has grown too big into pages of BUTE_PAGE_SIZE. If
+  there isn't the memory, the page is left as it is, which does no
+  harm.
+
+===========================================================================*/
+static void textbuf_split (TextBuf *self, int p)
+  {
+  int count = (self->pages[p].len + BUTE_PAGE_SIZE - 1) / BUTE_PAGE_SIZE;
+  if (textbuf_grow (self, count - 1)) return;
+  TextPage *page = &self->pages[p];
+  memmove (page + count, page + 1,
+    (self->npages - p - 1) * sizeof (TextPage));
+  // Clear the new entries first, in case making room for them frees
+  //   cached pages
+  for (int i = 1; i < count; i++)
+    {
+    page[i].data = NULL;
+    page[i].offset = -1;
+    }
+  int i;
+  for (i = 1; i < count; i++)
+    {
+    int off = i * BUTE_PAGE_SIZE;
+    int len = page->len - off;
+    if (len > BUTE_PAGE_SIZE) len = BUTE_PAGE_SIZE;
+    char *data = textbuf_alloc (self, NULL, len);
+    if (!data) break;
+    memcpy (data, page->data + off, len);
+    page[i].data = data;
+    page[i].len = page[i].cap = len;
+    page[i].offset = -1;
+    page[i].used = page->used;
+    }
+  if (i < count)
+    {
+    while (--i > 0) free (page[i].data);
+    memmove (page + 1, page + count,
+      (self->npages - p - 1) * sizeof (TextPage));
+    return;
+    }
+  self->npages += count - 1;
+  page->len = BUTE_PAGE_SIZE;
+  char *data = realloc (page->data, BUTE_PAGE_SIZE);
+  if (data)
+    {
+    page->data = data;
+    page->cap = BUTE_PAGE_SIZE;
+    }
+  self->hint = 0;
+  self->hint_start = 0;
+  }
+
+/*===========================================================================
+
+  textbuf_join
+
+  Join page p and the page after it, if they'd fit in one page.
+  Failing to do so does no harm.
+
+===========================================================================*/
+static void textbuf_join (TextBuf *self, int p)
+  {
+  if (p < 0 || p + 1 >= self->npages) return;
+  TextPage *page = &self->pages[p];
+  TextPage *next = page + 1;
+  int len = page->len + next->len;
+  if (len > BUTE_PAGE_SIZE) return;
+  if (textbuf_modify (self, page) || textbuf_modify (self, next)) return;
+  if (len > page->cap)
+    {
+    char *data = textbuf_alloc (self, page->data, len);
+    if (!data) return;
+    page->data = data;
+    page->cap = len;
+    }
+  if (next->len) memcpy (page->data + page->len, next->data, next->len);
+  page->len = len;
+  next->len = 0;
+  textbuf_remove_page (self, p + 1);
+  }
+
+/*===========================================================================
+
+  textbuf_insert
+
+===========================================================================*/
+static ErrCode textbuf_insert (TextBuf *self, int pos, const char *buf,
+    int n)
+  {
+  int start;
+  int p = textbuf_find_page (self, pos, &start);
+  TextPage *page = &self->pages[p];
+  ErrCode ret = textbuf_modify (self, page);
+  if (ret == 0 && page->len + n > page->cap)
+    {
+    // Leave a little room, so that typing doesn't realloc every time
+    int cap = (page->len + n + 63) & ~63;
+    char *data = textbuf_alloc (self, page->data, cap);
+    if (data)
+      {
+      page->data = data;
+      page->cap = cap;
+      }
+    else
+      ret = ERR_NOMEM;
+    }
+  if (ret == 0)
+    {
+    int off = pos - start;
+    memmove (page->data + off + n, page->data + off, page->len - off);
+    memcpy (page->data + off, buf, n);
+    page->len += n;
+    self->length += n;
+    if (page->len > 2 * BUTE_PAGE_SIZE) textbuf_split (self, p);
+    }
+  return ret;
+  }
+
+/*===========================================================================
+
+  textbuf_erase
+
+===========================================================================*/
+static ErrCode textbuf_erase (TextBuf *self, int pos, int len)
+  {
+  // Pages that are erased completely can just go, but those at the
+  //   ends may be erased only in part, so read those in first
+  int start;
+  int p = textbuf_find_page (self, pos, &start);
+  ErrCode ret = 0;
+  if (pos > start || pos + len < start + self->pages[p].len)
+    ret = textbuf_modify (self, &self->pages[p]);
+  if (ret == 0)
+    {
+    p = textbuf_find_page (self, pos + len - 1, &start);
+    if (pos + len < start + self->pages[p].len)
+      ret = textbuf_modify (self, &self->pages[p]);
+    }
+  if (ret) return ret;
+
+  while (len > 0)
+    {
+    p = textbuf_find_page (self, pos, &start);
+    TextPage *page = &self->pages[p];
+    int off = pos - start;
+    int n = page->len - off;
+    if (n > len) n = len;
+    if (n == 0) break;
+    if (n == page->len)
+      textbuf_remove_page (self, p);
+    else
+      {
+      memmove (page->data + off, page->data + off + n, page->len - off - n);
+      page->len -= n;
+      }
+    len -= n;
+    self->length -= n;
+    }
+
+  // Don't leave lots of small pages behind
+  p = textbuf_find_page (self, pos, &start);
+  textbuf_join (self, p);
+  textbuf_join (self, p - 1);
+  return 0;
+  }
+
+/*===========================================================================
+
+  textbuf_replace
+
+  The new text is inserted after the text to be erased, so that, if
+  the erasure fails, the insertion can be taken back. That can't fail,
+  as it involves only pages that are in memory.
+
+===========================================================================*/
+ErrCode textbuf_replace (TextBuf *self, int pos, int len, const char *buf,
+    int bufsize)
+  {
+  ErrCode ret = 0;
+  if (bufsize > 0) ret = textbuf_insert (self, pos + len, buf, bufsize);
+  if (ret == 0 && len > 0)
+    {
+    ret = textbuf_erase (self, pos, len);
+    if (ret && bufsize > 0) textbuf_erase (self, pos + len, bufsize);
+    }
+  return ret;
+  }
+
+/*===========================================================================
+
+  textbuf_length
+
+===========================================================================*/
+int textbuf_length (const TextBuf *self)
+  {
+  return self->length;
+  }
+
+/*===========================================================================
+
+  textbuf_segment
+
+===========================================================================*/
+int textbuf_segment (TextBuf *self, int pos, const char **text)
+  {
+  if (pos < 0 || pos >= self->length) return 0;
+  int start;
+  TextPage *page = &self->pages[textbuf_find_page (self, pos, &start)];
+  if (textbuf_load (self, page)) return 0;
+  *text = page->data + (pos - start);
+  return page->len - (pos - start);
+  }
+
+/*===========================================================================
+
+  textbuf_get_char
+
+===========================================================================*/
+int textbuf_get_char (TextBuf *self, int pos)
+  {
+  const char *text;
+  if (textbuf_segment (self, pos, &text) == 0) return -1;
+  return (uint8_t)*text;
+  }
+
+/*===========================================================================
+
+  textbuf_copy
+
+===========================================================================*/
+int textbuf_copy (TextBuf *self, char *buf, int pos, int len)
+  {
+  int done = 0;
+  while (done < len)
+    {
+    const char *text;
+    int n = textbuf_segment (self, pos + done, &text);
+    if (n == 0) break;
+    if (n > len - done) n = len - done;
+    memcpy (buf + done, text, n);
+    done += n;
+    }
+  return done;
+  }
+
+/*===========================================================================
+
+  textbuf_match
+
+  Returns TRUE if the text at pos matches str, which may span pages
+
+===========================================================================*/
+static BOOL textbuf_match (TextBuf *self, int pos, const char *str, int len)
+  {
+  while (len > 0)
+    {
+    const char *text;
+    int n = textbuf_segment (self, pos, &text);
+    if (n == 0) return FALSE;
+    if (n > len) n = len;
+    if (memcmp (text, str, n) != 0) return FALSE;
+    pos += n;
+    str += n;
+    len -= n;
+    }
+  return TRUE;
+  }
+
+/*===========================================================================
+
+  textbuf_find_short
+
+===========================================================================*/
+static int textbuf_find_short (TextBuf *self, int pos, const char *str, 
+    int len)
+  {
+  for (;;)
+    {
+    const char *text;
+    int n = textbuf_segment (self, pos, &text);
+    if (n == 0) return -1;
+    const char *p = memchr (text, str[0], n);
+    if (!p)
+      {
+      pos += n;
+      continue;
+      }
+    pos += p - text;
+    if (textbuf_match (self, pos, str, len)) return pos;
+    pos++;
+    }
+  }
+
+/*===========================================================================
+
+  textbuf_find
+
+  Boyer-Moore-Horspool. The last character of the window is looked up
+  in a table of how far the window can move on, if it doesn't match,
+  without passing a possible match. Where a window fits inside a page,
+  this works directly on the page. Only the few windows that straddle
+  the end of a page are looked at a character at a time.
+
+  A very short string doesn't let the window move far enough to be
+  worth it, so for those we just look for the first character, with
+  memchr().
+
+===========================================================================*/
+int textbuf_find (TextBuf *self, int pos, const char *str, int len)
+  {
+  if (len < TEXTBUF_BMH_MIN) return textbuf_find_short (self, pos, str, len);
+
+  // A shorter move than the table should allow is always safe, so
+  //   the moves can be stored in a byte
+  uint8_t skip [256];
+  int last = len - 1;
+  memset (skip, len < 255 ? len : 255, sizeof (skip));
+  for (int i = 0; i < last; i++)
+    {
+    int n = last - i;
+    skip[(uint8_t)str[i]] = n < 255 ? n : 255;
+    }
+  uint8_t end_char = (uint8_t)str[last];
+
+  if (pos < 0) pos = 0;
+  while (pos + len <= self->length)
+    {
+    const char *text;
+    int n = textbuf_segment (self, pos, &text);
+    if (n == 0) return -1;
+    int seg_end = pos + n;
+
+    const char *p = text;
+    const char *limit = text + n - len;
+    while (p <= limit)
+      {
+      uint8_t c = (uint8_t)p[last];
+      if (c == end_char && p[0] == str[0] && memcmp (p, str, last) == 0)
+        return pos + (p - text);
+      p += skip[c];
+      }
+    pos += p - text;
+
+    while (pos < seg_end && pos + len <= self->length)
+      {
+      int c = textbuf_get_char (self, pos + last);
+      if (c < 0) return -1;
+      if (c == end_char && textbuf_match (self, pos, str, len)) return pos;
+      pos += skip[c];
+      }
+    }
+  return -1;
+  }
+
+/*===========================================================================
+
+  textbuf_map
+
+  Set up pages for a file of the given size, none of them in memory
+
+===========================================================================*/
+static ErrCode textbuf_map (TextBuf *self, int size)
+  {
+  int count = (size + BUTE_PAGE_SIZE - 1) / BUTE_PAGE_SIZE;
+  if (count == 0) return 0;
+  if (textbuf_grow (self, count - 1)) return ERR_NOMEM;
+  for (int i = 0; i < count; i++)
+    {
+    TextPage *page = &self->pages[i];
+    page->data = NULL;
+    page->len = size - i * BUTE_PAGE_SIZE;
+    if (page->len > BUTE_PAGE_SIZE) page->len = BUTE_PAGE_SIZE;
+    page->cap = 0;
+    page->offset = i * BUTE_PAGE_SIZE;
+    page->used = 0;
+    }
+  self->npages = count;
+  self->length = size;
+  return 0;
+  }
+
+/*===========================================================================
+
+  textbuf_read_all
+
+  Read the whole file into pages in memory, and close it
+
+===========================================================================*/
+static ErrCode textbuf_read_all (TextBuf *self)
+  {
+  ErrCode ret = 0;
+  int n;
+  do
+    {
+    char *data = malloc (BUTE_PAGE_SIZE);
+    if (!data)
+      {
+      ret = ERR_NOMEM;
+      break;
+      }
+    n = 0;
+    int got;
+    do
+      {
+      got = 0;
+      ret = storage_file_read (self->file, data + n, BUTE_PAGE_SIZE - n,
+        &got);
+      n += got;
+      } while (ret == 0 && got > 0 && n < BUTE_PAGE_SIZE);
+    if (ret == 0 && n > 0) ret = textbuf_grow (self, 1);
+    if (ret || n == 0)
+      free (data);
+    else
+      {
+      // The first page read replaces the empty one
+      TextPage *page = &self->pages[self->length ? self->npages++ : 0];
+      page->data = data;
+      page->len = n;
+      page->cap = BUTE_PAGE_SIZE;
+      page->offset = -1;
+      page->used = 0;
+      self->length += n;
+      }
+    } while (ret == 0 && n == BUTE_PAGE_SIZE);
+  storage_file_close (self->file);
+  self->file = NULL;
+  return ret;
+  }
+
+/*===========================================================================
+
+  textbuf_open
+
+===========================================================================*/
+ErrCode textbuf_open (const char *filename, TextBuf **result)
+  {
+  FileInfo info;
+  ErrCode ret = storage_info (filename, &info);
+  if (ret == 0 && info.type == STORAGE_TYPE_DIR) ret = ERR_ISDIR;
+  if (ret) return ret;
+
+  TextBuf *self = textbuf_create ();
+  if (!self) return ERR_NOMEM;
+  strncpy (self->path, filename, MAX_PATH);
+  ret = storage_file_open (filename, STORAGE_OPEN_READ, &self->file);
+  if (ret == 0)
+    {
+    if (info.compressed)
+      ret = textbuf_read_all (self);
+    else
+      ret = textbuf_map (self, info.size);
+    }
+  if (ret)
+    {
+    textbuf_destroy (self);
+    self = NULL;
+    }
+  *result = self;
+  return ret;
+  }
+
+/*===========================================================================
+
+  textbuf_save
+
+  The file we're reading from has to be closed before it can be
+  replaced, and opened again afterwards -- either the new one or, if
+  that couldn't be put in place, the old one.
+
+  If the new file is compressed, reading pages from it would be slow,
+  so all the pages are kept in memory, as if there were no file.
+
+===========================================================================*/
+ErrCode textbuf_save (TextBuf *self, const char *filename)
+  {
+  char temp [MAX_PATH + 1];
+  if (strlen (filename) + 1 > MAX_PATH) return ERR_NAMETOOLONG;
+  strcpy (temp, filename);
+  strcat (temp, "~");
+
+  StorageFile *file;
+  ErrCode ret = storage_file_open (temp, STORAGE_OPEN_WRITE, &file);
+  if (ret) return ret;
+  BOOL keep = self->keep;
+  if (storage_get_compression ()) self->keep = TRUE;
+  for (int i = 0; i < self->npages && ret == 0; i++)
+    {
+    TextPage *page = &self->pages[i];
+    ret = textbuf_load (self, page);
+    if (ret == 0 && page->len > 0)
+      ret = storage_file_write (file, page->data, page->len);
+    }
+  ErrCode err = storage_file_close (file);
+  if (ret == 0) ret = err;
+
+  if (ret == 0 && self->file)
+    {
+    storage_file_close (self->file);
+    self->file = NULL;
+    }
+  if (ret == 0) ret = storage_rename (temp, filename);
+  if (ret)
+    {
+    storage_rm (temp);
+    self->keep = keep;
+    if (!self->file && self->path[0])
+      storage_file_open (self->path, STORAGE_OPEN_READ, &self->file);
+    return ret;
+    }
+
+  int offset = 0;
+  for (int i = 0; i < self->npages; i++)
+    {
+    TextPage *page = &self->pages[i];
+    if (self->keep)
+      page->offset = -1;
+    else
+      {
+      if (page->data && page->offset < 0) self->cached++;
+      page->offset = offset;
+      }
+    offset += page->len;
+    }
+  if (self->keep)
+    self->cached = 0;
+  else
+    {
+    // The pages that were changed are now cached, so there may be more
+    //   of those than we want to keep
+    while (self->cached > BUTE_CACHE_PAGES && textbuf_evict (self))
+      ;
+    strncpy (self->path, filename, MAX_PATH);
+    ret = storage_file_open (filename, STORAGE_OPEN_READ, &self->file);
+    }
+  return ret;
+  }
+
+/*===========================================================================
+
+  textbuf_resident
+
+===========================================================================*/
+int textbuf_resident (const TextBuf *self)
+  {
+  int total = 0;
+  for (int i = 0; i < self->npages; i++)
+    if (self->pages[i].data) total += self->pages[i].cap;
+  return total;
+  }
+
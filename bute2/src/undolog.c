@@ -0,0 +1,366 @@
+/*===========================================================================
+
+  BUTE version 2
+
+  undolog.c
+
+  See undolog.h. Each record is a header, then the characters the
+  change erased, then those it inserted, so either can be passed
+  straight to the editor to undo or redo the change. Records are
+  padded to a multiple of four bytes, to keep the headers aligned.
+  Each header records how far back the previous record starts, so the
+  log can be stepped through in both directions. A record that is
+  'joined' is part of the same step as the one before it, so undo and
+  redo carry on through it.
+
+  The records in use run from 'first' to 'end'. New records go at the
+  end; when there's no room, records are dropped from the start, and
+  the rest moved down to the start of the arena.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+===========================================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <bute2/undolog.h>
+
+typedef struct _UndoRecord
+  {
+  int pos;
+  int erased;         // Characters erased by the change
+  int inserted;       // Characters inserted by it
+  int back;           // How far back the previous record is, or 0
+  int joined;         // Part of the same step as the previous record
+  } UndoRecord;
+
+#define UNDOLOG_RECORD_SIZE(erased, inserted) \
+  ((sizeof (UndoRecord) + (erased) + (inserted) + 3) & ~3)
+
+struct _UndoLog
+  {
+  char *data;         // The arena, or NULL if nothing is recorded
+  int size;
+  int first;          // Where the oldest record starts
+  int last;           // Where the newest record starts, or -1
+  int end;            // Where the newest record ends
+  int current;        // The record the next undo undoes, or -1
+  BOOL complete;      // No records dropped since the log was cleared
+  int step;           // Where the newest step's first record starts
+  BOOL in_step;       // Between undolog_begin_step and undolog_end_step
+  BOOL step_open;     // A record has been made since undolog_begin_step
+  BOOL step_lost;     // The step was too big, and has been dropped
+  BOOL no_merge;      // The next change must not add to the newest record
+  };
+
+/*===========================================================================
+
+  undolog_record_at
+
+===========================================================================*/
+static UndoRecord *undolog_record_at (const UndoLog *self, int offset)
+  {
+  return (UndoRecord *)(self->data + offset);
+  }
+
+/*===========================================================================
+
+  undolog_create
+
+===========================================================================*/
+UndoLog *undolog_create (int size)
+  {
+  UndoLog *self = malloc (sizeof (UndoLog));
+  if (self)
+    {
+    self->data = NULL;
+    self->size = size & ~3;
+    self->in_step = FALSE;
+    undolog_clear (self);
+    }
+  return self;
+  }
+
+/*===========================================================================
+
+  undolog_destroy
+
+===========================================================================*/
+void undolog_destroy (UndoLog *self)
+  {
+  free (self->data);
+  free (self);
+  }
+
+/*===========================================================================
+
+  undolog_clear
+
+===========================================================================*/
+void undolog_clear (UndoLog *self)
+  {
+  free (self->data);
+  self->data = NULL;
+  self->first = 0;
+  self->last = -1;
+  self->end = 0;
+  self->current = -1;
+  self->complete = TRUE;
+  self->step = 0;
+  self->step_open = FALSE;
+  self->no_merge = FALSE;
+  }
+
+/*===========================================================================
+
+  undolog_forget
+
+===========================================================================*/
+void undolog_forget (UndoLog *self)
+  {
+  undolog_clear (self);
+  self->complete = FALSE;
+  // The rest of a step can't be undone without the start of it
+  if (self->in_step) self->step_lost = TRUE;
+  }
+
+/*===========================================================================
+
+  undolog_begin_step
+
+===========================================================================*/
+void undolog_begin_step (UndoLog *self)
+  {
+  self->in_step = TRUE;
+  self->step_open = FALSE;
+  self->step_lost = FALSE;
+  self->no_merge = TRUE;
+  }
+
+/*===========================================================================
+
+  undolog_end_step
+
+===========================================================================*/
+void undolog_end_step (UndoLog *self)
+  {
+  self->in_step = FALSE;
+  self->no_merge = TRUE;
+  }
+
+/*===========================================================================
+
+  undolog_room
+
+  Make room for n more bytes at the end of the records, dropping the
+  oldest records before 'keep' if need be. Returns FALSE if there still
+  isn't room.
+
+===========================================================================*/
+static BOOL undolog_room (UndoLog *self, int n, int keep)
+  {
+  if (!self->data)
+    {
+    self->data = malloc (self->size);
+    if (!self->data) return FALSE;
+    }
+  if (self->end + n <= self->size) return TRUE;
+
+  while (self->first < keep && self->end - self->first + n > self->size)
+    {
+    UndoRecord *rec = undolog_record_at (self, self->first);
+    self->first += UNDOLOG_RECORD_SIZE (rec->erased, rec->inserted);
+    if (self->first < self->end)
+      undolog_record_at (self, self->first)->back = 0;
+    self->complete = FALSE;
+    }
+  if (self->end - self->first + n > self->size) return FALSE;
+
+  if (self->first == self->end)
+    {
+    self->last = self->current = -1;
+    self->end = self->step = 0;
+    }
+  else
+    {
+    memmove (self->data, self->data + self->first, self->end - self->first);
+    self->last -= self->first;
+    if (self->current >= 0) self->current -= self->first;
+    self->end -= self->first;
+    self->step = self->step > self->first ? self->step - self->first : 0;
+    }
+  self->first = 0;
+  return TRUE;
+  }
+
+/*===========================================================================
+
+  undolog_grow
+
+  Make the newest record big enough for n more characters. Returns
+  the record, which may have moved, or NULL if there isn't room, in
+  which case the history has been dropped.
+
+===========================================================================*/
+static UndoRecord *undolog_grow (UndoLog *self, int n)
+  {
+  UndoRecord *rec = undolog_record_at (self, self->last);
+  int size = UNDOLOG_RECORD_SIZE (rec->erased, rec->inserted);
+  int new_size = UNDOLOG_RECORD_SIZE (rec->erased, rec->inserted + n);
+  if (!undolog_room (self, new_size - size, self->step))
+    {
+    undolog_forget (self);
+    return NULL;
+    }
+  self->end = self->last + new_size;
+  return undolog_record_at (self, self->last);
+  }
+
+/*===========================================================================
+
+  undolog_record
+
+===========================================================================*/
+void undolog_record (UndoLog *self, TextBuf *text, int pos, int len,
+    const char *buf, int bufsize)
+  {
+  if (self->in_step && self->step_lost) return;
+
+  // Drop whatever has been undone
+  if (self->current != self->last)
+    {
+    if (self->current < 0)
+      {
+      self->first = self->end = 0;
+      self->last = -1;
+      }
+    else
+      {
+      UndoRecord *rec = undolog_record_at (self, self->current);
+      self->last = self->current;
+      self->end = self->current
+        + UNDOLOG_RECORD_SIZE (rec->erased, rec->inserted);
+      }
+    self->no_merge = TRUE;
+    }
+
+  UndoRecord *rec = self->last >= 0 && !self->no_merge
+    ? undolog_record_at (self, self->last) : NULL;
+  if (rec && len == 0 && bufsize == 1 && rec->erased == 0
+        && pos == rec->pos + rec->inserted)
+    {
+    // Insert character at end of newest record
+    if ((rec = undolog_grow (self, 1)))
+      {
+      ((char *)(rec + 1))[rec->inserted] = *buf;
+      rec->inserted++;
+      }
+    }
+  else if (rec && len == 1 && bufsize == 0 && rec->inserted == 0
+        && pos == rec->pos)
+    {
+    // Erase character at end of newest record
+    if ((rec = undolog_grow (self, 1)))
+      {
+      textbuf_copy (text, (char *)(rec + 1) + rec->erased, pos, 1);
+      rec->erased++;
+      }
+    }
+  else if (rec && len == 1 && bufsize == 0 && rec->inserted == 0
+        && pos == rec->pos - 1)
+    {
+    // Erase character at start of newest record
+    if ((rec = undolog_grow (self, 1)))
+      {
+      char *p = (char *)(rec + 1);
+      memmove (p + 1, p, rec->erased);
+      textbuf_copy (text, p, pos, 1);
+      rec->pos--;
+      rec->erased++;
+      }
+    }
+  else
+    {
+    // A record that joins a step mustn't drop the start of it
+    BOOL joined = self->in_step && self->step_open && self->last >= 0;
+    int size = UNDOLOG_RECORD_SIZE (len, bufsize);
+    if (!undolog_room (self, size, joined ? self->step : self->end))
+      {
+      undolog_forget (self);
+      return;
+      }
+    rec = undolog_record_at (self, self->end);
+    rec->pos = pos;
+    rec->erased = len;
+    rec->inserted = bufsize;
+    rec->back = self->last >= 0 ? self->end - self->last : 0;
+    rec->joined = joined;
+    char *p = (char *)(rec + 1);
+    textbuf_copy (text, p, pos, len);
+    memcpy (p + len, buf, bufsize);
+    if (!joined) self->step = self->end;
+    self->last = self->current = self->end;
+    self->end += size;
+    self->step_open = self->in_step;
+    self->no_merge = FALSE;
+    }
+  }
+
+/*===========================================================================
+
+  undolog_undo
+
+===========================================================================*/
+BOOL undolog_undo (UndoLog *self, UndoChange *change)
+  {
+  if (self->current < 0) return FALSE;
+  UndoRecord *rec = undolog_record_at (self, self->current);
+  change->pos = rec->pos;
+  change->erase = rec->inserted;
+  change->text = (const char *)(rec + 1);
+  change->insert = rec->erased;
+  change->more = rec->joined && rec->back;
+  self->current = rec->back ? self->current - rec->back : -1;
+  return TRUE;
+  }
+
+/*===========================================================================
+
+  undolog_redo
+
+===========================================================================*/
+BOOL undolog_redo (UndoLog *self, UndoChange *change)
+  {
+  if (self->current == self->last) return FALSE;
+  if (self->current < 0)
+    self->current = self->first;
+  else
+    {
+    UndoRecord *rec = undolog_record_at (self, self->current);
+    self->current += UNDOLOG_RECORD_SIZE (rec->erased, rec->inserted);
+    }
+  UndoRecord *rec = undolog_record_at (self, self->current);
+  change->pos = rec->pos;
+  change->erase = rec->erased;
+  change->text = (const char *)(rec + 1) + rec->erased;
+  change->insert = rec->inserted;
+  change->more = FALSE;
+  if (self->current != self->last)
+    {
+    UndoRecord *next = undolog_record_at (self, self->current
+      + UNDOLOG_RECORD_SIZE (rec->erased, rec->inserted));
+    change->more = next->joined;
+    }
+  return TRUE;
+  }
+
+/*===========================================================================
+
+  undolog_at_start
+
+===========================================================================*/
+BOOL undolog_at_start (const UndoLog *self)
+  {
+  return self->current < 0 && self->complete;
+  }
+
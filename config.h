@@ -31,3 +31,50 @@
 //   runaway sender eating the entire storage.
 #define XMODEM_MAX 100000
 
+// If set, df also counts the used blocks the slow way, by walking the
+//   whole filesystem, and reports any difference from the running count
+//   that storage keeps. For debugging only.
+#define STORAGE_CHECK_DF 0
+
+// Number of entries in the index of which metadata block holds each
+//   filename, in directories big enough to need more than one. Each
+//   takes 8 bytes, allocated when a directory first gets that big. For
+//   best results, it should be larger than the number of files in the
+//   biggest directory.
+//   Set to 0 to disable the index.
+#define STORAGE_NAME_INDEX 512
+
+// Size in bytes of the filesystem in RAM that is mounted on /tmp at 
+//   boot. Files in /tmp are lost at reset. Set to 0 to keep /tmp on
+//   flash, like any other directory.
+#define STORAGE_TMP_SIZE 16384
+
+// If set, the editor counts the bytes it sends to the terminal for
+//   each keystroke, and reports the average and the most when it
+//   exits. For measuring screen updates only.
+#define BUTE_COUNT_BYTES 0
+
+// The editor holds the text in pages of about this many bytes. Pages
+//   that haven't been changed are read from the file as they're needed,
+//   so a file can be edited that is bigger than the memory available.
+#define BUTE_PAGE_SIZE 1024
+
+// The most unchanged pages the editor keeps in memory at once. More
+//   means fewer reads while moving around a big file.
+#define BUTE_CACHE_PAGES 16
+
+// Most memory, in bytes, each editor buffer uses to record changes for
+//   undo. When it's full, the oldest changes are forgotten. A change
+//   bigger than this can't be undone.
+#define BUTE_UNDO_SIZE 8192
+
+// How long, in msec, the shell waits at its prompt for a key before
+//   saving the map of blocks in use, if the filesystem has changed
+//   since it was last saved. See storage_sync(). Set to 0 to save it 
+//   only with the sync command, and at shutdown.
+#define SHELL_SYNC_IDLE 3000
+
+// Most bytes of terminal output that "replay -o" keeps, to write to a 
+//   file when the replay is over. Anything more is counted, but not 
+//   kept. The buffer is allocated only while replaying.
+#define REPLAY_CAPTURE_SIZE 16384
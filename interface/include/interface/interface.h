@@ -69,12 +69,34 @@
 #define INTERFACE_STORAGE_BLOCK_SIZE 4096
 //TODO
 #define INTERFACE_STORAGE_BLOCK_COUNT 300 
+// Storage also uses a few more blocks, after the filesystem, for 
+//   allocator checkpoints (see storage.c)
+
+// A keystroke to be replayed: the character the terminal sends, and
+//   how many milliseconds after the key before it the key is typed
+typedef struct _InterfaceKey
+  {
+  uint16_t delay;
+  uint8_t c;
+  } InterfaceKey;
+
+// What happened after a key was replayed, up to the next attempt to
+//   read a key: the bytes written to the terminal, and the time taken
+typedef struct _InterfaceKeyStats
+  {
+  uint32_t bytes;
+  uint32_t us;
+  } InterfaceKeyStats;
 
 BEGIN_DECLS
 
 extern void  interface_init (void);
 extern int   interface_get_char (void);
 extern int   interface_get_char_timeout (int msec);
+
+// While interface_get_char() is waiting for a key, call fn once, if 
+//   none has come for msec. Set fn to NULL to stop.
+extern void  interface_set_idle (void (*fn)(void), int msec);
 extern void  interface_write_endl (void);
 extern void  interface_write_char (char c);
 extern void  interface_write_buff (const char *s, int len);
@@ -112,7 +134,37 @@ extern void interface_gpio_set_function (uint8_t pin, uint8_t function);
 extern void interface_gpio_pull_up (uint8_t pin);
 
 extern void interface_sleep_ms (uint32_t val);
-extern uint32_t interface_time_ms ();
+extern uint32_t interface_time_ms (void);
+extern uint64_t interface_time_us (void);
+
+// Bytes sent to, and received from, the terminal since boot. Everything
+//   written to stdout is counted, however it was written.
+extern uint32_t interface_bytes_out (void);
+extern uint32_t interface_bytes_in (void);
+
+// Reads, programs and erases of blocks of flash since boot
+extern void interface_block_counts (uint32_t *reads, uint32_t *progs, 
+              uint32_t *erases);
+
+// Keep a copy of what is written to the terminal in buf, as well as
+//   sending it, until interface_capture_stop(), which returns how many
+//   bytes were kept. Anything that doesn't fit is sent but not kept.
+extern void interface_capture_start (char *buf, int size);
+extern int  interface_capture_stop (void);
+
+// Take the terminal's input from an array of keystrokes, rather than
+//   from the terminal, until they have all been read. stats, which must
+//   have room for count entries, is filled in as each key is dealt with.
+//   Keys are typed no sooner than their delays say, but no sooner than
+//   they are asked for, either. Ctrl+C on the real terminal stops the 
+//   replay, and is read as if it were the next key.
+extern void interface_replay_start (const InterfaceKey *keys, int count,
+              InterfaceKeyStats *stats);
+// Stop replaying, if it hasn't stopped already, and return the number 
+//   of keys that were typed
+extern int  interface_replay_stop (void);
+// Returns the number of keys still to be typed, or 0 if not replaying
+extern int  interface_replay_remaining (void);
 
 extern void interface_i2c_init (uint8_t port, uint32_t baud);
 extern ErrCode interface_i2c_write_read (uint8_t port, uint8_t addr, 
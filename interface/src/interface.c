@@ -1,7 +1,10 @@
+#define _GNU_SOURCE // For fopencookie() in the host build
 #include <stdio.h> 
+#include <string.h> 
 
 #if PICO_ON_DEVICE
 #include "pico/stdlib.h" 
+#include "pico/stdio/driver.h" 
 #include "hardware/gpio.h" 
 #include "hardware/flash.h" 
 #include "hardware/sync.h" 
@@ -27,11 +30,319 @@ extern uint32_t __flash_binary_start;
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <time.h>
 struct termios orig_termios;
 #define BLOCKFILE "/tmp/picolua.blockdev"
 int blockfd = -1;
+
+/*===========================================================================
+
+  host_getchar
+
+  Read one character from stdin, or return -1 if none is waiting. The
+  terminal is set up with VMIN=VTIME=0, so this never blocks, and the
+  callers do their own timing, as on the Pico. We don't use getchar() 
+  here, because once it has seen the zero-length read that signals 
+  "no data", stdin is at EOF, and it never returns anything else.
+
+===========================================================================*/
+static int host_getchar (void)
+  {
+  unsigned char c;
+  if (read (STDIN_FILENO, &c, 1) == 1) return c;
+  return -1;
+  }
 #endif 
 
+// Counts of terminal traffic and flash operations, and the capture 
+//   buffer, if any
+static uint32_t bytes_out = 0;
+static uint32_t bytes_in = 0;
+static uint32_t block_reads = 0;
+static uint32_t block_progs = 0;
+static uint32_t block_erases = 0;
+static char *capture = NULL;
+static int capture_size = 0;
+static int capture_len = 0;
+
+// The keys being replayed, if any
+typedef struct _InterfaceReplay
+  {
+  const InterfaceKey *keys;
+  InterfaceKeyStats *stats;
+  int count;
+  int next;             // The next key to type
+  uint64_t due;         // When it is due to be typed, in usec
+  uint64_t typed;       // When the last key was read
+  uint32_t typed_bytes; // bytes_out at that time
+  BOOL open;            // The last key's stats aren't finished
+  } InterfaceReplay;
+
+static InterfaceReplay *replay = NULL;
+static InterfaceReplay replay_state;
+
+// What to do while waiting a long time for a key
+static void (*idle_fn)(void) = NULL;
+static int idle_msec = 0;
+
+/*===========================================================================
+
+  interface_count_output
+
+  Everything written to stdout ends up here, on its way to the 
+  terminal. 
+
+===========================================================================*/
+static void interface_count_output (const char *buf, int len)
+  {
+  bytes_out += (uint32_t)len;
+  if (capture && capture_len < capture_size)
+    {
+    int n = capture_size - capture_len;
+    if (n > len) n = len;
+    memcpy (capture + capture_len, buf, n);
+    capture_len += n;
+    }
+  }
+
+#if PICO_ON_DEVICE
+/*===========================================================================
+
+  An extra stdio driver, that sends nothing anywhere, but sees 
+  everything that is written to the other drivers, after any CR/LF 
+  translation.
+
+===========================================================================*/
+static void interface_driver_out_chars (const char *buf, int len)
+  {
+  interface_count_output (buf, len);
+  }
+
+static stdio_driver_t interface_driver =
+  {
+  .out_chars = interface_driver_out_chars,
+#if PICO_STDIO_ENABLE_CRLF_SUPPORT
+  .crlf_enabled = PICO_STDIO_DEFAULT_CRLF
+#endif
+  };
+#else
+/*===========================================================================
+
+  host_write
+
+  stdout is replaced with a stream that writes with this function, so
+  that everything written to it can be counted. 
+
+===========================================================================*/
+static ssize_t host_write (void *cookie, const char *buf, size_t size)
+  {
+  (void)cookie;
+  interface_count_output (buf, (int)size);
+  size_t done = 0;
+  while (done < size)
+    {
+    ssize_t n = write (STDOUT_FILENO, buf + done, size - done);
+    if (n < 0 && errno != EINTR) return -1;
+    if (n > 0) done += (size_t)n;
+    }
+  return (ssize_t)size;
+  }
+#endif
+
+/*===========================================================================
+
+  interface_live_char
+
+  Read one character from the terminal, or return -1 if none is
+  waiting.
+
+===========================================================================*/
+static int interface_live_char (void)
+  {
+#if PICO_ON_DEVICE
+  return getchar_timeout_us (0);
+#else
+  return host_getchar ();
+#endif
+  }
+
+/*===========================================================================
+
+  interface_replay_finish_key
+
+  Fill in the stats of the last key typed, if they're not done.
+
+===========================================================================*/
+static void interface_replay_finish_key (void)
+  {
+  if (replay->open)
+    {
+    fflush (stdout);
+    InterfaceKeyStats *stats = &replay->stats[replay->next - 1];
+    stats->bytes = bytes_out - replay->typed_bytes;
+    stats->us = (uint32_t)(interface_time_us () - replay->typed);
+    replay->open = FALSE;
+    }
+  }
+
+/*===========================================================================
+
+  interface_replay_type
+
+  Type the next key. 
+
+===========================================================================*/
+static int interface_replay_type (void)
+  {
+  int c = replay->keys[replay->next].c;
+  replay->next++;
+  if (replay->next < replay->count)
+    replay->due += replay->keys[replay->next].delay * 1000ULL;
+  replay->open = TRUE;
+  replay->typed_bytes = bytes_out;
+  replay->typed = interface_time_us ();
+  return c;
+  }
+
+/*===========================================================================
+
+  interface_replay_char
+
+  Get the next replayed key, waiting for up to msec for it to be 
+  typed, or for ever if msec is negative. Returns -1 on a timeout, 
+  or -2 if the replay has stopped, and the terminal should be read 
+  instead.
+
+===========================================================================*/
+static int interface_replay_char (int msec)
+  {
+  interface_replay_finish_key ();
+  if (replay->next >= replay->count)
+    {
+    interface_replay_stop ();
+    return -2;
+    }
+  uint64_t now = interface_time_us ();
+  uint64_t wake = replay->due;
+  if (msec >= 0 && wake > now + msec * 1000ULL)
+    wake = now + msec * 1000ULL;
+  while (now < wake)
+    {
+    if (interface_live_char () == I_INTR)
+      {
+      interface_replay_stop ();
+      return I_INTR;
+      }
+    uint64_t us = wake - now;
+    interface_sleep_ms (us > 10000 ? 10 : (uint32_t)(us + 999) / 1000);
+    now = interface_time_us ();
+    }
+  if (now < replay->due) return -1;
+  return interface_replay_type ();
+  }
+
+/*===========================================================================
+
+  interface_replay_start
+
+===========================================================================*/
+void interface_replay_start (const InterfaceKey *keys, int count,
+      InterfaceKeyStats *stats)
+  {
+  replay = &replay_state;
+  replay->keys = keys;
+  replay->stats = stats;
+  replay->count = count;
+  replay->next = 0;
+  replay->open = FALSE;
+  replay->due = interface_time_us ();
+  if (count > 0) replay->due += keys[0].delay * 1000ULL;
+  }
+
+/*===========================================================================
+
+  interface_replay_stop
+
+===========================================================================*/
+int interface_replay_stop (void)
+  {
+  if (replay)
+    {
+    interface_replay_finish_key ();
+    replay = NULL;
+    }
+  return replay_state.next;
+  }
+
+/*===========================================================================
+
+  interface_replay_remaining
+
+===========================================================================*/
+int interface_replay_remaining (void)
+  {
+  return replay ? replay->count - replay->next : 0;
+  }
+
+/*===========================================================================
+
+  interface_capture_start
+
+===========================================================================*/
+void interface_capture_start (char *buf, int size)
+  {
+  fflush (stdout);
+  capture = buf;
+  capture_size = size;
+  capture_len = 0;
+  }
+
+/*===========================================================================
+
+  interface_capture_stop
+
+===========================================================================*/
+int interface_capture_stop (void)
+  {
+  fflush (stdout);
+  capture = NULL;
+  return capture_len;
+  }
+
+/*===========================================================================
+
+  interface_bytes_out
+
+===========================================================================*/
+uint32_t interface_bytes_out (void)
+  {
+  fflush (stdout);
+  return bytes_out;
+  }
+
+/*===========================================================================
+
+  interface_bytes_in
+
+===========================================================================*/
+uint32_t interface_bytes_in (void)
+  {
+  return bytes_in;
+  }
+
+/*===========================================================================
+
+  interface_block_counts
+
+===========================================================================*/
+void interface_block_counts (uint32_t *reads, uint32_t *progs, 
+      uint32_t *erases)
+  {
+  *reads = block_reads;
+  *progs = block_progs;
+  *erases = block_erases;
+  }
+
 /*===========================================================================
 
   interface_get_char
@@ -39,24 +350,52 @@ int blockfd = -1;
 ===========================================================================*/
 int interface_get_char (void)
   {
-#if PICO_ON_DEVICE
   int c;
+  if (replay && (c = interface_replay_char (-1)) != -2)
+    {
+    bytes_in++;
+    return c;
+    }
+  void (*idle)(void) = idle_fn;
+  uint32_t since = idle ? interface_time_ms () : 0;
+#if PICO_ON_DEVICE
   while ((c = getchar_timeout_us (0)) < 0)
     {
     // gpio_put (LED_PIN, 1);
     // sleep_ms (50);
     // gpio_put (LED_PIN, 0);
     sleep_ms (1); 
+    if (idle && interface_time_ms () - since >= (uint32_t)idle_msec)
+      {
+      idle ();
+      idle = NULL;
+      }
     }
-  return c;
 #else
-  int c;
-  while ((c = getchar ()) < 0)
+  fflush (stdout);
+  while ((c = host_getchar ()) < 0)
     {
     usleep (10000); 
+    if (idle && interface_time_ms () - since >= (uint32_t)idle_msec)
+      {
+      idle ();
+      idle = NULL;
+      }
     }
-  return c;
 #endif
+  bytes_in++;
+  return c;
+  }
+
+/*===========================================================================
+
+  interface_set_idle
+
+===========================================================================*/
+void interface_set_idle (void (*fn)(void), int msec)
+  {
+  idle_fn = fn;
+  idle_msec = msec;
   }
 
 /*===========================================================================
@@ -66,26 +405,30 @@ int interface_get_char (void)
 ===========================================================================*/
 int interface_get_char_timeout (int msec)
   {
-#if PICO_ON_DEVICE
   int c;
+  if (replay && (c = interface_replay_char (msec)) != -2)
+    {
+    if (c >= 0) bytes_in++;
+    return c;
+    }
+#if PICO_ON_DEVICE
   int loops = 0;
   while ((c = getchar_timeout_us (0)) < 0 && loops < msec)
     {
     sleep_us (1000);
     loops++;
     }
-  return c;
 #else
-  (void)msec;
-  int c;
   int loops = 0;
-  while ((c = getchar ()) < 0 && loops < msec)
+  fflush (stdout);
+  while ((c = host_getchar ()) < 0 && loops < msec)
     {
     usleep (1000);
     loops++;
     }
-  return c;
 #endif
+  if (c >= 0) bytes_in++;
+  return c;
   }
 
 /*===========================================================================
@@ -98,12 +441,21 @@ void interface_init (void)
 #if PICO_ON_DEVICE
   gpio_init (LED_PIN);
   gpio_set_dir (LED_PIN, GPIO_OUT);
+  stdio_set_driver_enabled (&interface_driver, true);
 #else
+  cookie_io_functions_t io = { NULL, host_write, NULL, NULL };
+  FILE *out = fopencookie (NULL, "w", io);
+  if (out)
+    {
+    fflush (stdout);
+    setvbuf (out, NULL, _IOLBF, BUFSIZ);
+    stdout = out;
+    }
   tcgetattr (STDIN_FILENO, &orig_termios);
   struct termios raw = orig_termios;
   raw.c_iflag &= (unsigned int) ~(IXON);
   raw.c_lflag &= (unsigned int) ~(ECHO | ICANON | IEXTEN | ISIG);
-  raw.c_cc[VTIME] = 1;
+  raw.c_cc[VTIME] = 0;
   raw.c_cc[VMIN] = 0;
   tcsetattr (STDIN_FILENO, TCSAFLUSH, &raw);
 #endif
@@ -179,8 +531,8 @@ void interface_write_buff (const char *s, int len)
   fwrite (s, len, 1, stdout);
   fflush (stdout);
 #else
-  for (int i = 0; i < len; i++)
-    interface_write_char (s[i]);
+  fwrite (s, len, 1, stdout);
+  fflush (stdout);
 #endif
   }
 
@@ -250,6 +602,7 @@ int interface_block_sync (const struct lfs_config *cfg)
 extern int  interface_block_erase (const struct lfs_config *cfg, 
     lfs_block_t block)
   {
+  block_erases++;
 #if PICO_ON_DEVICE
   (void)cfg;
   uint32_t ints = save_and_disable_interrupts();
@@ -270,6 +623,7 @@ extern int interface_block_prog (const struct lfs_config *cfg,
         lfs_block_t block, lfs_off_t off, const void *buffer, 
 	lfs_size_t size)
   {
+  block_progs++;
 #if PICO_ON_DEVICE
   (void)block; (void)cfg;
   //interface_block_erase (cfg, block);
@@ -311,6 +665,7 @@ extern int interface_block_prog (const struct lfs_config *cfg,
 extern int interface_block_read (const struct lfs_config *cfg, 
         lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size)
   {
+  block_reads++;
 #if PICO_ON_DEVICE
   (void)cfg; (void)block;
   //char *mem = (char *)FLASH_STORAGE_START_MEM + off;
@@ -427,12 +782,28 @@ void interface_sleep_ms (uint32_t val)
   interface_time_ms
 
 ===========================================================================*/
-uint32_t interface_time_ms (uint32_t val)
+uint32_t interface_time_ms (void)
   {
 #if PICO_ON_DEVICE
   return to_ms_since_boot(get_absolute_time());
 #else
-  usleep (val * 1000);
+  return (uint32_t)(interface_time_us () / 1000);
+#endif
+  }
+
+/*===========================================================================
+
+  interface_time_us
+
+===========================================================================*/
+uint64_t interface_time_us (void)
+  {
+#if PICO_ON_DEVICE
+  return time_us_64 ();
+#else
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
 #endif
   }
 
@@ -490,13 +861,30 @@ void interface_pwm_pin_set_level (uint8_t pin, uint16_t level)
 ===========================================================================*/
 BOOL interface_is_interrupt_key (void)
   {
-#if PICO_ON_DEVICE
-  if (getchar_timeout_us (0) == I_INTR) return TRUE;
-  return FALSE;
-#else
-  if (getchar() == I_INTR) return TRUE;
-  return FALSE;
-#endif
+  if (replay)
+    {
+    // Only a key that's due, and is Ctrl+C, is typed here
+    if (interface_live_char () == I_INTR)
+      {
+      interface_replay_stop ();
+      bytes_in++;
+      return TRUE;
+      }
+    if (replay->next < replay->count 
+         && replay->keys[replay->next].c == I_INTR
+         && replay->due <= interface_time_us ())
+      {
+      interface_replay_finish_key ();
+      interface_replay_type ();
+      bytes_in++;
+      return TRUE;
+      }
+    return FALSE;
+    }
+  int c = interface_live_char ();
+  if (c < 0) return FALSE;
+  bytes_in++;
+  return c == I_INTR;
   }
 
 /*===========================================================================
@@ -0,0 +1,37 @@
+/*============================================================================
+
+  boilerplate 
+  arena.h
+  Copyright (c)2021 Kevin Boone, GPL v3.0
+
+  A simple bump allocator. Memory is taken from large chunks, a piece
+  at a time, and can't be freed individually -- it is all released
+  together when the arena is destroyed. This suits data that is built
+  up in many small pieces, and then thrown away in one go, like the
+  arguments of a shell command.
+
+============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include "defs.h" 
+
+struct _Arena;
+typedef struct _Arena Arena;
+
+/** Create an arena, whose memory is allocated in chunks of (at least)
+    chunk_size bytes. The first chunk is allocated immediately. Returns 
+    NULL if there is not enough memory. */
+Arena  *arena_create (size_t chunk_size);
+
+/** Free the arena, and everything allocated from it. */
+void    arena_destroy (Arena *self);
+
+/** Allocate size bytes, suitably aligned for any type. Returns NULL 
+    if there is not enough memory. */
+void   *arena_alloc (Arena *self, size_t size);
+
+/** Copy a string into the arena. */
+char   *arena_strdup (Arena *self, const char *s);
+
@@ -11,13 +11,15 @@
 #include <stdint.h>
 #include "defs.h"
 #include "list.h"
+#include "vector.h"
 
 struct _String;
 typedef struct _String String;
 
-typedef void (*StringTokGlobber) (String *token, List *list);
-
-extern StringTokGlobber string_tok_globber;
+/** Called by string_tokenize_fn for each token. quoted is TRUE if the 
+    token was in double quotes, and so should not be globbed. */
+typedef void (*StringTokFn) (const char *token, BOOL quoted, 
+               void *user_data);
 
 BEGIN_DECLS
 
@@ -48,7 +50,9 @@ BOOL        string_ends_with (const String *self, const char *test);
 int         string_alpha_sort_fn (const void *p1, const void*p2, 
                void *user_data);
 List       *string_split (const String *self, const char *delim);
-List       *string_tokenize (const String *self);
+Vector     *string_tokenize (const String *self);
+void        string_tokenize_fn (const char *s, char *buff, 
+               StringTokFn fn, void *user_data);
 void        string_delete_last (String *self);
 void        string_insert_c_at (String *self, int pos, char c);
 void        string_delete_c_at (String *self, int pos);
@@ -10,7 +10,7 @@
 
 #pragma once
 
-#include <klib/list.h>
+#include <klib/vector.h>
 
 // Key codes for cursor movement, etc
 #define VK_BACK     8
@@ -91,7 +91,7 @@ extern uint8_t term_get_displayed_length (const char *line, uint8_t col);
     be one character smaller, to allow for the string to be 
     zero-terminated*/
 BOOL term_get_line (char *buff, int len, BOOL *interrupt, 
-       int max_history, List *history);
+       int max_history, Vector *history);
 
 void term_enable (BOOL enable);
 
@@ -0,0 +1,52 @@
+/*============================================================================
+
+  boilerplate 
+  vector.h
+  Copyright (c)2021 Kevin Boone, GPL v3.0
+
+  A growable array of pointers. Unlike List, getting an item by its
+  index, and finding the length, take the same time however many
+  items there are, and appending is quick on average, because the 
+  array grows in steps. Items are owned by the vector, and freed by
+  the function supplied when it is created.
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h" 
+
+struct _Vector;
+typedef struct _Vector Vector;
+
+typedef void (*VectorItemFreeFn) (void *);
+
+// A comparison function for vector_sort. As with ListSortFn, i1 and i2
+//   are the addresses of the pointers in the vector, not the pointers
+//   themselves, because that is the way qsort() works. user_data is the
+//   value passed to vector_sort
+typedef int (*VectorSortFn) (const void *i1, const void *i2, 
+          void *user_data);
+
+
+Vector *vector_create (VectorItemFreeFn free_fn);
+
+/** Helper for creating a vector of C strings -- not String objects. */
+Vector *vector_create_strings (void);
+
+void    vector_destroy (Vector *self);
+
+/** Add an item to the end. Returns FALSE if there is not enough memory
+    to do so, in which case the item is not freed. */
+BOOL    vector_append (Vector *self, void *item);
+
+void   *vector_get (const Vector *self, int index);
+int     vector_length (const Vector *self);
+
+/** Remove the item at index, freeing it, and move the following items
+    down. */
+void    vector_remove (Vector *self, int index);
+
+void    vector_sort (Vector *self, VectorSortFn fn, void *user_data);
+
+
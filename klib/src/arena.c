@@ -0,0 +1,123 @@
+/*============================================================================
+
+  klib
+  arena.c
+  Copyright (c)2021 Kevin Boone, GPL v3.0
+
+  A bump allocator. See arena.h.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/klib/arena.h"
+
+// All allocations are rounded up to a multiple of this
+#define ARENA_ALIGN (sizeof (void *) > sizeof (double) ? \
+   sizeof (void *) : sizeof (double))
+
+typedef struct _ArenaChunk
+  {
+  struct _ArenaChunk *next;
+  size_t size;
+  size_t used;
+  } ArenaChunk;
+
+// The data in each chunk follows the header, starting at an aligned
+//   offset
+#define ARENA_HEADER \
+  ((sizeof (ArenaChunk) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+struct _Arena
+  {
+  ArenaChunk *head; // The chunk we are currently allocating from
+  size_t chunk_size;
+  };
+
+/*==========================================================================
+  arena_add_chunk
+*==========================================================================*/
+static BOOL arena_add_chunk (Arena *self, size_t size)
+  {
+  ArenaChunk *chunk = malloc (ARENA_HEADER + size);
+  if (!chunk) return FALSE;
+  chunk->next = self->head;
+  chunk->size = size;
+  chunk->used = 0;
+  self->head = chunk;
+  return TRUE;
+  }
+
+/*==========================================================================
+  arena_create
+*==========================================================================*/
+Arena *arena_create (size_t chunk_size)
+  {
+  Arena *self = malloc (sizeof (Arena));
+  if (self)
+    {
+    self->head = NULL;
+    self->chunk_size = chunk_size;
+    if (!arena_add_chunk (self, chunk_size))
+      {
+      free (self);
+      self = NULL;
+      }
+    }
+  return self;
+  }
+
+/*==========================================================================
+  arena_destroy
+*==========================================================================*/
+void arena_destroy (Arena *self)
+  {
+  if (self)
+    {
+    ArenaChunk *chunk = self->head;
+    while (chunk)
+      {
+      ArenaChunk *next = chunk->next;
+      free (chunk);
+      chunk = next;
+      }
+    free (self);
+    }
+  }
+
+/*==========================================================================
+  arena_alloc
+
+  If the request doesn't fit in the current chunk, start a new one,
+  big enough for it. What is left of the old chunk is wasted, but 
+  arenas are meant to be short-lived.
+*==========================================================================*/
+void *arena_alloc (Arena *self, size_t size)
+  {
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  ArenaChunk *chunk = self->head;
+  if (chunk->size - chunk->used < size)
+    {
+    if (!arena_add_chunk (self, size > self->chunk_size ? 
+        size : self->chunk_size))
+      return NULL;
+    chunk = self->head;
+    }
+  void *p = (char *)chunk + ARENA_HEADER + chunk->used;
+  chunk->used += size;
+  return p;
+  }
+
+/*==========================================================================
+  arena_strdup
+*==========================================================================*/
+char *arena_strdup (Arena *self, const char *s)
+  {
+  size_t l = strlen (s) + 1;
+  char *p = arena_alloc (self, l);
+  if (p) memcpy (p, s, l);
+  return p;
+  }
+
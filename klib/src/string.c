@@ -31,21 +31,78 @@
 #include "string.h" 
 #include "../include/klib/defs.h"
 #include "../include/klib/list.h"
+#include "../include/klib/vector.h"
 #include "../include/klib/string.h"
 
+// Strings of up to this many bytes are stored in the String itself, 
+//   so creating one takes a single malloc(). Longer strings are moved 
+//   to the heap, and their capacity doubles each time it runs out, so 
+//   building a string a character at a time is not quadratic
+#define STRING_INLINE 24
+
 struct _String
   {
-  char *str;
+  char *str; // Either inline, or allocated
+  int length; 
+  int capacity; // Not including the terminating zero
+  char inline_str[STRING_INLINE + 1];
   }; 
 
-StringTokGlobber string_tok_globber = NULL;
+/*==========================================================================
+string_reserve
+
+Make sure there is room for a string of length bytes, plus the 
+terminator. Returns FALSE, leaving the string unchanged, if there is
+not enough memory.
+*==========================================================================*/
+static BOOL string_reserve (String *self, int length)
+  {
+  if (length <= self->capacity) return TRUE;
+  int capacity = self->capacity * 2;
+  if (capacity < length) capacity = length;
+  char *str;
+  if (self->str == self->inline_str)
+    {
+    str = malloc (capacity + 1);
+    if (str) memcpy (str, self->str, self->length + 1);
+    }
+  else
+    str = realloc (self->str, capacity + 1);
+  if (!str) return FALSE;
+  self->str = str;
+  self->capacity = capacity;
+  return TRUE;
+  }
+
+
+/*==========================================================================
+string_create_len
+*==========================================================================*/
+static String *string_create_len (const char *s, int length)
+  {
+  String *self = malloc (sizeof (String));
+  if (self)
+    {
+    self->str = self->inline_str;
+    self->capacity = STRING_INLINE;
+    self->length = 0;
+    if (string_reserve (self, length))
+      {
+      memcpy (self->str, s, length);
+      self->length = length;
+      }
+    self->str[self->length] = 0;
+    }
+  return self;
+  }
+
 
 /*==========================================================================
 string_create_empty 
 *==========================================================================*/
 String *string_create_empty (void)
   {
-  return string_create ("");
+  return string_create_len ("", 0);
   }
 
 
@@ -54,9 +111,7 @@ string_create
 *==========================================================================*/
 String *string_create (const char *s)
   {
-  String *self = malloc (sizeof (String));
-  self->str = strdup (s);
-  return self;
+  return string_create_len (s, strlen (s));
   }
 
 
@@ -67,7 +122,7 @@ void string_destroy (String *self)
   {
   if (self)
     {
-    if (self->str) free (self->str);
+    if (self->str != self->inline_str) free (self->str);
     free (self);
     }
   }
@@ -88,12 +143,7 @@ string_cstr_safe
 const char *string_cstr_safe (const String *self)
   {
   if (self)
-    {
-    if (self->str) 
-      return self->str;
-    else
-      return "";
-    }
+    return self->str;
   else
     return "";
   }
@@ -105,10 +155,10 @@ string_append
 void string_append (String *self, const char *s) 
   {
   if (!s) return;
-  if (self->str == NULL) self->str = strdup ("");
-  int newlen = strlen (self->str) + strlen (s) + 2;
-  self->str = realloc (self->str, newlen);
-  strcat (self->str, s);
+  int l = strlen (s);
+  if (!string_reserve (self, self->length + l)) return;
+  memcpy (self->str + self->length, s, l + 1);
+  self->length += l;
   }
 
 
@@ -118,29 +168,33 @@ string_prepend
 void string_prepend (String *self, const char *s) 
   {
   if (!s) return;
-  if (self->str == NULL) self->str = strdup ("");
-  int newlen = strlen (self->str) + strlen (s) + 2;
-  char *temp = strdup (self->str); 
-  free (self->str);
-  self->str = malloc (newlen);
-  strcpy (self->str, s);
-  strcat (self->str, temp);
-  free (temp);
+  string_insert (self, 0, s);
   }
 
 
 /*==========================================================================
 string_append_printf
+
+Format directly into the space at the end of the string. Only if it
+doesn't fit do we have to make room, and format again.
 *==========================================================================*/
 void string_append_printf (String *self, const char *fmt,...) 
   {
-  if (self->str == NULL) self->str = strdup ("");
-  va_list ap;
+  va_list ap, ap2;
   va_start (ap, fmt);
-  char *s;
-  vasprintf (&s, fmt, ap);
-  string_append (self, s);
-  free (s);
+  va_copy (ap2, ap);
+  int spare = self->capacity - self->length;
+  int l = vsnprintf (self->str + self->length, spare + 1, fmt, ap);
+  if (l > spare)
+    {
+    if (string_reserve (self, self->length + l))
+      vsnprintf (self->str + self->length, l + 1, fmt, ap2);
+    else
+      l = spare; // vsnprintf() truncated it 
+    }
+  if (l > 0) self->length += l;
+  self->str[self->length] = 0;
+  va_end (ap2);
   va_end (ap);
   }
 
@@ -151,8 +205,7 @@ string_length
 int string_length (const String *self)
   {
   if (self == NULL) return 0;
-  if (self->str == NULL) return 0;
-  return strlen (self->str);
+  return self->length;
   }
 
 
@@ -161,8 +214,7 @@ string_clone
 *==========================================================================*/
 String *string_clone (const String *self)
   {
-  if (!self->str) return string_create_empty();
-  return string_create (string_cstr (self));
+  return string_create_len (self->str, self->length);
   }
 
 
@@ -185,16 +237,11 @@ string_find_last
 int string_find_last (const String *self, const char *search)
   {
   int lsearch = strlen (search); 
-  int lself = strlen (self->str);
+  int lself = self->length;
   if (lsearch > lself) return -1; // Can't find a long string in short one
   for (int i = lself - lsearch; i >= 0; i--)
     {
-    BOOL diff = FALSE;
-    for (int j = 0; j < lsearch && !diff; j++)
-      {
-      if (search[j] != self->str[i + j]) diff = TRUE;
-      }
-    if (!diff) return i;
+    if (memcmp (self->str + i, search, lsearch) == 0) return i;
     }
   return -1;
   }
@@ -205,17 +252,11 @@ string_delete
 *==========================================================================*/
 void string_delete (String *self, const int pos, const int len)
   {
-  char *str = self->str;
-  if (pos + len > (int)strlen (str))
-    string_delete (self, pos, strlen(str) - len);
-  else
-    {
-    char *buff = malloc (strlen (str) - len + 2);
-    strncpy (buff, str, pos); 
-    strcpy (buff + pos, str + pos + len);
-    free (self->str);
-    self->str = buff;
-    }
+  if (pos < 0 || pos >= self->length || len <= 0) return;
+  int n = len;
+  if (pos + n > self->length) n = self->length - pos;
+  memmove (self->str + pos, self->str + pos + n, self->length - pos - n + 1);
+  self->length -= n;
   }
 
 
@@ -225,14 +266,12 @@ string_insert
 void string_insert (String *self, const int pos, 
     const char *replace)
   {
-  char *buff = malloc (strlen (self->str) + strlen (replace) + 2);
-  char *str = self->str;
-  strncpy (buff, str, pos);
-  buff[pos] = 0;
-  strcat (buff, replace);
-  strcat (buff, str + pos); 
-  free (self->str);
-  self->str = buff;
+  int l = strlen (replace);
+  if (pos < 0 || pos > self->length) return;
+  if (!string_reserve (self, self->length + l)) return;
+  memmove (self->str + pos + l, self->str + pos, self->length - pos + 1);
+  memcpy (self->str + pos, replace, l);
+  self->length += l;
   }
 
 /*==========================================================================
@@ -309,10 +348,10 @@ String *string_encode_url (const char *str)
 *==========================================================================*/
 void string_append_byte (String *self, const BYTE byte)
   {
-  char buff[2];
-  buff[0] = byte;
-  buff[1] = 0;
-  string_append (self, buff);
+  if (byte == 0) return; // As strcat() would do
+  if (!string_reserve (self, self->length + 1)) return;
+  self->str[self->length++] = (char)byte;
+  self->str[self->length] = 0;
   }
 
 
@@ -352,24 +391,10 @@ void string_append_c (String *self, const uint32_t ch)
 void string_trim_left (String *self)
   {
   const char *s = self->str;
-  int l = strlen (s);
-  int i = 0;
   int pos = 0;
-  BOOL stop = FALSE;
-  while (i < l && !stop)
-    {
-    char c = s[i];
-    if (c == ' ' || c == '\n' || c == '\t')
-      {
-      pos++;
-      }
-    else
-      stop = TRUE;
-    i++;
-    }
-  char *s_new = strdup (s + pos);
-  free (self->str);
-  self->str = s_new;
+  while (s[pos] == ' ' || s[pos] == '\n' || s[pos] == '\t')
+    pos++;
+  string_delete (self, 0, pos);
   }
 
 
@@ -379,20 +404,11 @@ void string_trim_left (String *self)
 void string_trim_right (String *self)
   {
   char *s = self->str;
-  int l = strlen (s);
-  int i = l - 1;
-  BOOL stop = FALSE;
-  while (i >= 0 && !stop)
-    {
-    char c = s[i];
-    if (c == ' ' || c == '\n' || c == '\t')
-      {
-      s[i] = 0;
-      }
-    else
-      stop = TRUE;
-    i--;
-    }
+  int l = self->length;
+  while (l > 0 && (s[l - 1] == ' ' || s[l - 1] == '\n' || s[l - 1] == '\t'))
+    l--;
+  s[l] = 0;
+  self->length = l;
   }
 
 /*==========================================================================
@@ -467,8 +483,10 @@ List *string_split (const String *self, const char *delim)
  * quoted block -- "fred\"s" parses correctly with a " in the middle.
  * Parsing rules are similar to the shell, but not identical. In particular,
  * we don't support nested quotes
- * Caller must unref the list, which will always be valid
- * (but may be empty) */
+ * string_tokenize() returns a Vector of String objects; the caller must 
+ * destroy the vector, which will always be valid (but may be empty).
+ * string_tokenize_fn() passes each token to a function instead, and
+ * doesn't allocate any memory */
 
 // Dunno state -- usually start of line where nothing has been read
 #define STATE_DUNNO 0
@@ -493,33 +511,32 @@ List *string_split (const String *self, const char *delim)
 // Hash comment
 #define CHAR_HASH 4
 
-void string_tok_append (List *args, String *token, BOOL quoted)
-  {
-  if (quoted)
-    list_append (args, token);
-  else
-    {
-    if (string_tok_globber)
-      string_tok_globber (token, args);
-    else
-      list_append (args, token);
-    }
-  }
+/*==========================================================================
+  string_tokenize_fn
+
+  Tokens are written one after another into buff, each with its 
+  terminating zero, and passed to fn as they are completed. Escapes
+  and quotes mean that no token can be longer than the input that 
+  produced it, and a token's terminator always takes the place of
+  a space, quote, or hash, except at the very end. So the tokens
+  never need more than strlen(s) + 1 bytes.
+*==========================================================================*/
+#define STRING_TOK_EMIT(quoted) \
+  { buff[n++] = 0; fn (buff + start, quoted, user_data); start = n; }
 
-List *string_tokenize (const String *s)
+void string_tokenize_fn (const char *s, char *buff, StringTokFn fn, 
+       void *user_data)
   {
-  List *argv = list_create ((ListItemFreeFn)string_destroy);
-
-  int i, l = strlen (string_cstr(s));
-
-  String *buff = string_create_empty();
+  int i, l = strlen (s);
+  int n = 0; // Where the next byte of the token goes 
+  int start = 0; // Where the current token started
 
   int state = STATE_DUNNO;
   int last_state = STATE_DUNNO;
 
   for (i = 0; i < l; i++)
     {
-    char c = s->str[i];
+    char c = s[i];
     int chartype = CHAR_GENERAL;
     switch (c)
       {
@@ -550,7 +567,7 @@ List *string_tokenize (const String *s)
       {
       // --- Dunno states ---
       case 1000 * STATE_DUNNO + CHAR_GENERAL:
-        string_append_byte (buff, c);
+        buff[n++] = c;
         state = STATE_GENERAL;
         break;
 
@@ -577,7 +594,7 @@ List *string_tokenize (const String *s)
       // --- White states ---
       case 1000 * STATE_WHITE + CHAR_GENERAL:
         // Got a char while in ws
-        string_append_byte (buff, c);
+        buff[n++] = c;
         state = STATE_GENERAL;
         break;
 
@@ -603,15 +620,13 @@ List *string_tokenize (const String *s)
       // --- General states ---
       case 1000 * STATE_GENERAL + CHAR_GENERAL:
         // Eat normal char 
-        string_append_byte (buff, c);
+        buff[n++] = c;
         break;
 
       case 1000 * STATE_GENERAL + CHAR_WHITE:
         //Hit ws while eating characters -- this is a token
-        if (strlen (buff->str))
-          //list_append (argv, buff);
-          string_tok_append (argv, buff, FALSE);
-        buff = string_create_empty();
+        if (n > start)
+          STRING_TOK_EMIT (FALSE);
         state = STATE_WHITE;
         break;
 
@@ -627,10 +642,8 @@ List *string_tokenize (const String *s)
 
       case 1000 * STATE_GENERAL + CHAR_HASH:
         //Hit hash while eating characters -- this is a token
-        if (strlen (buff->str))
-          //list_append (argv, buff);
-          string_tok_append (argv, buff, FALSE);
-        buff = string_create_empty();
+        if (n > start)
+          STRING_TOK_EMIT (FALSE);
         state = STATE_COMMENT;
         break;
 
@@ -638,56 +651,54 @@ List *string_tokenize (const String *s)
       // --- Dquote states ---
       case 1000 * STATE_DQUOTE + CHAR_GENERAL:
         // Store the char, but remain in dquote mode
-        string_append_byte (buff, c);
+        buff[n++] = c;
         break;
 
       case 1000 * STATE_DQUOTE + CHAR_WHITE:
         // Store the ws, and remain in dquote mode
-        string_append_byte (buff, c);
+        buff[n++] = c;
         break;
 
       case 1000 * STATE_DQUOTE + CHAR_DQUOTE:
         // Leave duote mode and store token (which might be empty) 
-        string_tok_append (argv, buff, TRUE);
-        //list_append (argv, buff);
-        buff = string_create_empty();
+        STRING_TOK_EMIT (TRUE);
         state = STATE_DUNNO;
         break;
 
       case 1000 * STATE_DQUOTE + CHAR_ESC:
         last_state = state;
         state = STATE_ESC;
-        //string_append_byte (buff, c);
+        //buff[n++] = c;
         break;
 
       case 1000 * STATE_DQUOTE + CHAR_HASH:
         // Keep this hash char -- it is quoted 
-        string_append_byte (buff, c);
+        buff[n++] = c;
         break;
 
       // --- Esc states ---
       case 1000 * STATE_ESC + CHAR_GENERAL:
-        string_append_byte (buff, c);
+        buff[n++] = c;
         state = last_state; 
         break;
 
       case 1000 * STATE_ESC + CHAR_WHITE:
-        string_append_byte (buff, c);
+        buff[n++] = c;
         state = last_state; 
         break;
 
       case 1000 * STATE_ESC + CHAR_DQUOTE:
-        string_append_byte (buff, '"');
+        buff[n++] = '"';
         state = last_state; 
         break;
 
       case 1000 * STATE_ESC + CHAR_ESC:
-        string_append_byte (buff, '\\');
+        buff[n++] = '\\';
         state = last_state; 
         break;
 
       case 1000 * STATE_ESC + CHAR_HASH:
-        string_append_byte (buff, '#');
+        buff[n++] = '#';
         state = last_state; 
         break;
 
@@ -714,15 +725,29 @@ List *string_tokenize (const String *s)
       }
     }
 
-  if (buff)
-    {
-    if (string_length (buff) > 0)
-      string_tok_append (argv, buff, FALSE);
-     // list_append (argv, buff);
-    else
-      string_destroy (buff);
-    }
+  if (n > start)
+    STRING_TOK_EMIT (FALSE);
+  }
 
+/*==========================================================================
+  string_tokenize
+*==========================================================================*/
+static void string_tok_append (const char *s, BOOL quoted, void *user_data)
+  {
+  Vector *args = user_data;
+  (void)quoted;
+  String *token = string_create (s);
+  if (!vector_append (args, token))
+    string_destroy (token);
+  }
+
+Vector *string_tokenize (const String *s)
+  {
+  Vector *argv = vector_create ((VectorItemFreeFn)string_destroy);
+  char *buff = malloc (s->length + 1);
+  if (argv && buff)
+    string_tokenize_fn (s->str, buff, string_tok_append, argv);
+  free (buff);
   return argv;
   }
 
@@ -731,9 +756,8 @@ List *string_tokenize (const String *s)
 *==========================================================================*/
 void string_delete_last (String *self)
   {
-  int l = strlen (self->str);
-  if (l > 0)
-    self->str[l - 1] = 0;  
+  if (self->length > 0)
+    self->str[--self->length] = 0;  
   }
 
 /*==========================================================================
@@ -741,9 +765,11 @@ void string_delete_last (String *self)
 *==========================================================================*/
 void string_insert_c_at (String *self, int pos, char c)
   {
-  static char s[2] = " ";
-  s[0] = c;
-  string_insert (self, pos, s);
+  if (pos < 0 || pos > self->length) return;
+  if (!string_reserve (self, self->length + 1)) return;
+  memmove (self->str + pos + 1, self->str + pos, self->length - pos + 1);
+  self->str[pos] = c;
+  self->length++;
   }
 
 /*==========================================================================
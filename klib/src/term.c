@@ -12,7 +12,7 @@
 #include <interface/interface.h>
 #include <interface/compat.h>
 #include <klib/string.h>
-#include <klib/list.h>
+#include <klib/vector.h>
 #include "../include/klib/term.h"
 
 // ANSI/VT100 control codes
@@ -24,23 +24,28 @@
 #define TERM_SET_CURSOR "\033[%d;%dH"
 #define TERM_SHOW_CURSOR "\033[?25h"
 #define TERM_HIDE_CURSOR "\033[?25l"
+#define TERM_INSERT_CHAR "\033[@"
+#define TERM_DELETE_CHAR "\033[P"
+#define TERM_CUR_LEFT "\033[%dD"
+#define TERM_CUR_RIGHT "\033[%dC"
 
 #define TERM_ROWS 23
 #define TERM_COLS 80
 
 #define TAB_SIZE 8
 
-static BOOL enabled = TRUE;
+// Size of the buffer that holds the line editor's output for a keystroke
+#define TERM_OUT_SIZE 64
 
-/*==========================================================================
+// Moving the cursor this many columns, or fewer, is done with 
+//   backspaces, or by writing the characters again, rather than
+//   with an escape, which is at least this long
+#define TERM_MOVE_MIN 4
 
-  term_write_char
+static BOOL enabled = TRUE;
 
-==========================================================================*/
-static void term_write_char (char c)
-  {
-  interface_write_char (c);
-  }
+static char term_out[TERM_OUT_SIZE];
+static int term_out_len = 0;
 
 /*==========================================================================
 
@@ -364,16 +369,16 @@ uint8_t term_get_displayed_length (const char *line, uint8_t col)
   term_add_list_to_history
 
 =========================================================================*/
-void term_add_line_to_history (List *history, int max_history, 
+void term_add_line_to_history (Vector *history, int max_history, 
         const char *buff)
   {
   BOOL should_add = TRUE;
-  int l = list_length (history);
+  int l = vector_length (history);
   if (l < max_history)
     {
     for (int i = 0; i < l && should_add; i++)
       {
-      if (strcmp (buff, list_get (history, i)) == 0)
+      if (strcmp (buff, vector_get (history, i)) == 0)
         should_add = FALSE;
       }
     }
@@ -382,20 +387,136 @@ void term_add_line_to_history (List *history, int max_history,
     {
     if (l >= max_history)
       {
-      const char *s = list_get (history, 0);
-      list_remove_object (history, s);
+      vector_remove (history, 0);
       }
-    list_append (history, strdup (buff));
+    vector_append (history, strdup (buff));
+    }
+  }
+
+/*=========================================================================
+
+  term_flush
+
+  Send what the line editor has written since the last keystroke, all
+  at once
+
+=========================================================================*/
+static void term_flush (void)
+  {
+  if (term_out_len > 0)
+    interface_write_buff (term_out, term_out_len);
+  term_out_len = 0;
+  }
+
+/*=========================================================================
+
+  term_put_buff
+
+=========================================================================*/
+static void term_put_buff (const char *s, int len)
+  {
+  while (len > 0)
+    {
+    if (term_out_len == TERM_OUT_SIZE) term_flush ();
+    int n = TERM_OUT_SIZE - term_out_len;
+    if (n > len) n = len;
+    memcpy (term_out + term_out_len, s, n);
+    term_out_len += n;
+    s += n;
+    len -= n;
+    }
+  }
+
+/*=========================================================================
+
+  term_put_string
+
+=========================================================================*/
+static void term_put_string (const char *s)
+  {
+  term_put_buff (s, strlen (s));
+  }
+
+/*=========================================================================
+
+  term_put_char
+
+=========================================================================*/
+static void term_put_char (char c)
+  {
+  term_put_buff (&c, 1);
+  }
+
+/*=========================================================================
+
+  term_move_left
+
+  Move the cursor n columns to the left
+
+=========================================================================*/
+static void term_move_left (int n)
+  {
+  if (n <= TERM_MOVE_MIN)
+    {
+    for (int i = 0; i < n; i++)
+      term_put_char (O_BACKSPACE);
     }
+  else
+    {
+    char buff[16];
+    sprintf (buff, TERM_CUR_LEFT, n);
+    term_put_string (buff);
+    }
+  }
+
+/*=========================================================================
+
+  term_move_right
+
+  Move the cursor n columns to the right, over the characters s, 
+  which are already showing
+
+=========================================================================*/
+static void term_move_right (const char *s, int n)
+  {
+  if (n <= TERM_MOVE_MIN)
+    term_put_buff (s, n);
+  else
+    {
+    char buff[16];
+    sprintf (buff, TERM_CUR_RIGHT, n);
+    term_put_string (buff);
+    }
+  }
+
+/*=========================================================================
+
+  term_replace_line
+
+  Replace the line showing, with the cursor at pos, by a new one, 
+  leaving the cursor at the end of it
+
+=========================================================================*/
+static void term_replace_line (int pos, int oldlen, const char *newline)
+  {
+  int newlen = strlen (newline);
+  term_move_left (pos);
+  term_put_buff (newline, newlen);
+  if (newlen < oldlen) term_put_string (TERM_CLEAREOL);
   }
 
 /*=========================================================================
 
   term_get_line
 
+  Everything written for a keystroke is collected, and sent in one go
+  before waiting for the next. Characters are inserted and deleted
+  in the middle of the line using the terminal's ICH and DCH 
+  functions, rather than by writing out the rest of the line again.
+
 =========================================================================*/
 BOOL term_get_line (char *buff, int len, BOOL *interrupt, 
-       int max_history, List *history)
+       int max_history, Vector *history)
   {
   int pos = 0;
   BOOL done = 0;
@@ -410,6 +531,7 @@ BOOL term_get_line (char *buff, int len, BOOL *interrupt,
 
   while (!done)
     {
+    term_flush ();
     int c = term_get_key();
     if (c == VK_INTR)
       {
@@ -428,18 +550,14 @@ BOOL term_get_line (char *buff, int len, BOOL *interrupt,
         {
         pos--;
         string_delete_c_at (sbuff, pos);
-        term_write_char (O_BACKSPACE);
-        const char *s = string_cstr (sbuff);
-        int l = string_length (sbuff);
-        for (int i = pos; i < l; i++)
+        term_put_char (O_BACKSPACE);
+        if (pos == string_length (sbuff))
           {
-          term_write_char (s[i]);
-          }
-        term_write_char (' ');
-        for (int i = pos; i <= l; i++)
-          {
-          term_write_char (O_BACKSPACE);
+          term_put_char (' ');
+          term_put_char (O_BACKSPACE);
           }
+        else
+          term_put_string (TERM_DELETE_CHAR);
         }
       }
     else if (c == VK_ENTER)
@@ -452,45 +570,28 @@ BOOL term_get_line (char *buff, int len, BOOL *interrupt,
       if (pos > 0)
         {
         pos--;
-        term_write_char (O_BACKSPACE);
+        term_put_char (O_BACKSPACE);
         }
       }
     else if (c == VK_CTRLLEFT)
       {
-      if (pos == 1)
-        {
-        pos = 0;
-        term_write_char (O_BACKSPACE);
-        }
-      else
-        {
-        const char *s = string_cstr (sbuff);
-        while (pos > 0 && isspace (s[(pos - 1)]))
-          {
-          pos--;
-          term_write_char (O_BACKSPACE);
-          }
-        while (pos > 0 && !isspace (s[pos - 1]))
-          {
-          pos--;
-          term_write_char (O_BACKSPACE);
-          }
-        }
+      const char *s = string_cstr (sbuff);
+      int start = pos;
+      while (pos > 0 && isspace (s[(pos - 1)]))
+        pos--;
+      while (pos > 0 && !isspace (s[pos - 1]))
+        pos--;
+      term_move_left (start - pos);
       }
     else if (c == VK_CTRLRIGHT)
       {
       const char *s = string_cstr (sbuff);
-
+      int start = pos;
       while (s[pos] != 0 && !isspace (s[pos]))
-        {
-        term_write_char (s[pos]);
         pos++;
-        }
       while (s[pos] != 0 && isspace (s[pos]))
-        {
-        term_write_char (s[pos]);
         pos++;
-        }
+      term_move_right (s + start, pos - start);
       }
     else if (c == VK_RIGHT)
       {
@@ -498,7 +599,7 @@ BOOL term_get_line (char *buff, int len, BOOL *interrupt,
       int l = string_length (sbuff);
       if (pos < l)
         {
-        term_write_char (s[pos]);
+        term_put_char (s[pos]);
         pos++;
         }
       }
@@ -506,7 +607,7 @@ BOOL term_get_line (char *buff, int len, BOOL *interrupt,
       {
       if (!history) continue;
       if (histpos == 0) continue;
-      int histlen = list_length (history);
+      int histlen = vector_length (history);
       if (histlen == 0) continue;
       //printf ("histlen=%d histpos=%d\n", histlen, histpos);
 
@@ -523,28 +624,16 @@ BOOL term_get_line (char *buff, int len, BOOL *interrupt,
         histpos --;
         }
 
-      int oldlen = string_length (sbuff);
-      const char *newline = list_get (history, histpos); 
-      int newlen = strlen (newline);
-      // Move to the start of the line 
-       for (int i = 0; i < pos; i++)
-        term_write_char (O_BACKSPACE);
-      // Write the new line
-      for (int i = 0; i < newlen; i++)
-        term_write_char (newline[i]);
-      // Erase from the end of the new line to the end of the old 
-      for (int i = newlen; i < oldlen; i++)
-        term_write_char (' ');
-      for (int i = newlen; i < oldlen; i++)
-        term_write_char (O_BACKSPACE);
-      pos = newlen;
+      const char *newline = vector_get (history, histpos); 
+      term_replace_line (pos, string_length (sbuff), newline);
+      pos = strlen (newline);
       string_destroy (sbuff);
       sbuff = string_create (newline);
       }
     else if (c == VK_DOWN)
       {
       if (!history) continue;
-      int histlen = list_length (history);
+      int histlen = vector_length (history);
       if (histpos < 0) continue; 
       char *newline = "";
       BOOL restored_temp = FALSE;
@@ -564,23 +653,11 @@ BOOL term_get_line (char *buff, int len, BOOL *interrupt,
         {
         restored_temp = FALSE;
         histpos++;
-        newline = list_get (history, histpos); 
+        newline = vector_get (history, histpos); 
         }
 
-      int oldlen = string_length (sbuff);
-      int newlen = strlen (newline);
-      // Move to the start of the line 
-       for (int i = 0; i < pos; i++)
-          term_write_char (O_BACKSPACE);
-      // Write the new line
-      for (int i = 0; i < newlen; i++)
-          term_write_char (newline[i]);
-        // Erase from the end of the new line to the end of the old 
-      for (int i = newlen; i < oldlen; i++)
-          term_write_char (' ');
-      for (int i = newlen; i < oldlen; i++)
-          term_write_char (O_BACKSPACE);
-      pos = newlen;
+      term_replace_line (pos, string_length (sbuff), newline);
+      pos = strlen (newline);
       string_destroy (sbuff);
       sbuff = string_create (newline);
       if (restored_temp)
@@ -591,19 +668,14 @@ BOOL term_get_line (char *buff, int len, BOOL *interrupt,
       }
     else if (c == VK_HOME)
       {
-      if (pos > 0)
-        {
-        for (int i = 0; i < pos; i++)
-          term_write_char (O_BACKSPACE);
-        pos = 0;
-        }
+      term_move_left (pos);
+      pos = 0;
       }
     else if (c == VK_END)
       {
       const char *s = string_cstr (sbuff);
       int l = string_length (sbuff);
-      for (int i = pos; i < l; i++)
-          term_write_char (s[i]);
+      term_move_right (s + pos, l - pos);
       pos = l;
       }
     else
@@ -616,22 +688,15 @@ BOOL term_get_line (char *buff, int len, BOOL *interrupt,
           {
           string_insert_c_at (sbuff, pos, (char)c);
           pos++;
-          int l = string_length (sbuff);
-          if (pos >= l - 1)
-            term_write_char ((char)c); 
-          else
-            {
-            const char *s = string_cstr (sbuff);
-            for (int i = pos - 1; i < l; i++)
-              term_write_char (s[i]); 
-            for (int i = pos; i < l; i++)
-              term_write_char (O_BACKSPACE); 
-            }
+          if (pos < string_length (sbuff))
+            term_put_string (TERM_INSERT_CHAR);
+          term_put_char ((char)c); 
           }
         }
       }
     }
 
+  term_flush ();
   strncpy (buff, string_cstr(sbuff), len);
   string_destroy (sbuff);
    //printf ("buff='%s'\n", buff);
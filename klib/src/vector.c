@@ -0,0 +1,122 @@
+/*============================================================================
+
+  klib
+  vector.c
+  Copyright (c)2021 Kevin Boone, GPL v3.0
+
+  Methods for maintaining a growable array of pointers.
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/klib/vector.h"
+
+// The array starts with this many slots, and doubles in size each time
+//   it fills up
+#define VECTOR_INITIAL_SIZE 8
+
+struct _Vector
+  {
+  VectorItemFreeFn free_fn; 
+  void **items;
+  int length;
+  int size; // Number of slots allocated 
+  };
+
+/*==========================================================================
+  vector_create
+*==========================================================================*/
+Vector *vector_create (VectorItemFreeFn free_fn)
+  {
+  Vector *self = malloc (sizeof (Vector));
+  if (self)
+    {
+    memset (self, 0, sizeof (Vector));
+    self->free_fn = free_fn;
+    }
+  return self;
+  }
+
+/*==========================================================================
+  vector_create_strings
+*==========================================================================*/
+Vector *vector_create_strings (void)
+  {
+  return vector_create (free);
+  }
+
+/*==========================================================================
+  vector_destroy
+*==========================================================================*/
+void vector_destroy (Vector *self)
+  {
+  if (self) 
+    {
+    if (self->free_fn)
+      {
+      for (int i = 0; i < self->length; i++)
+        self->free_fn (self->items[i]);
+      }
+    free (self->items);
+    free (self);
+    }
+  }
+
+/*==========================================================================
+  vector_append
+*==========================================================================*/
+BOOL vector_append (Vector *self, void *item)
+  {
+  if (self->length == self->size)
+    {
+    int size = self->size ? self->size * 2 : VECTOR_INITIAL_SIZE;
+    void **items = realloc (self->items, (size_t)size * sizeof (void *));
+    if (!items) return FALSE;
+    self->items = items;
+    self->size = size;
+    }
+  self->items[self->length++] = item;
+  return TRUE;
+  }
+
+/*==========================================================================
+  vector_get
+*==========================================================================*/
+void *vector_get (const Vector *self, int index)
+  {
+  return self->items[index];
+  }
+
+/*==========================================================================
+  vector_length
+*==========================================================================*/
+int vector_length (const Vector *self)
+  {
+  return self->length;
+  }
+
+/*==========================================================================
+  vector_remove
+*==========================================================================*/
+void vector_remove (Vector *self, int index)
+  {
+  if (self->free_fn)
+    self->free_fn (self->items[index]);
+  memmove (self->items + index, self->items + index + 1, 
+    (size_t)(self->length - index - 1) * sizeof (void *));
+  self->length--;
+  }
+
+/*==========================================================================
+  vector_sort
+*==========================================================================*/
+void vector_sort (Vector *self, VectorSortFn fn, void *user_data)
+  {
+  if (self->length > 1)
+    qsort_r (self->items, (size_t)self->length, sizeof (void *), fn, 
+      user_data); 
+  }
+
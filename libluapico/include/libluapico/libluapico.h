@@ -10,6 +10,16 @@
 #include <lua/lauxlib.h>
 #include <klib/defs.h>
 
+// A Lua state that is running something -- a program, or a command it
+//   registered -- must not be closed, even if it has no commands left.
+//   A hold, which lives on the C stack of whatever is running it, says
+//   so. Holds are released in the reverse order they were taken.
+typedef struct _LuapicoHold
+  {
+  lua_State *L;
+  struct _LuapicoHold *next;
+  } LuapicoHold;
+
 BEGIN_DECLS
 
 extern int luapico_ls (lua_State *L); 
@@ -38,9 +48,18 @@ extern int luapico_i2c_init (lua_State *L);
 extern int luapico_i2c_write_read (lua_State *L);
 extern int luapico_ysend (lua_State *L);
 extern int luapico_execute (lua_State *L);
+extern int luapico_register_command (lua_State *L);
+extern int luapico_measure (lua_State *L);
 
 /* Function exported to lua/loadlib.c, for initializing this library. */
 LUAMOD_API int luaopen_pico (lua_State *L);
 extern void luapico_init_constants (lua_State *L);
 
+/** Hold a Lua state open while it runs something. */
+extern void luapico_hold (lua_State *L, LuapicoHold *hold);
+
+/** Release the newest hold, and close its state if nothing else holds 
+    it, and it has not registered any shell commands. */
+extern void luapico_release (LuapicoHold *hold);
+
 END_DECLS
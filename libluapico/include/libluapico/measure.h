@@ -0,0 +1,81 @@
+/*=========================================================================
+  picolua
+
+  libluapico/measure.h
+
+  Accounting of what a shell command, or a Lua function, costs: time,
+  Lua memory and garbage collection, flash operations, and terminal
+  traffic. Lua keeps the counts it's responsible for up to date as it
+  goes, through the counters and functions here, so that they survive
+  the Lua state that the command ran in. Time inside the Lua VM is
+  only counted while something is being measured.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <klib/defs.h>
+
+typedef struct _Measure
+  {
+  uint64_t wall_us;
+  uint64_t lua_us;        // Time spent running Lua code
+  uint32_t heap_peak;     // Most bytes in use by Lua at once
+  int32_t heap_net;       // Change in bytes in use by Lua
+  uint32_t gc_cycles;
+  uint32_t gc_steps;
+  uint32_t block_reads;
+  uint32_t block_progs;
+  uint32_t block_erases;
+  uint32_t bytes_in;
+  uint32_t bytes_out;
+  uint32_t outer_peak;    // Peak for any enclosing measurement
+  } Measure;
+
+BEGIN_DECLS
+
+// Counts kept by Lua
+extern size_t measure_heap;
+extern size_t measure_heap_peak;
+extern uint32_t measure_gc_cycles;
+extern uint32_t measure_gc_steps;
+extern BOOL measure_in_lua;
+extern int measure_depth;
+
+extern void measure_switch (BOOL in_lua);
+
+/** Start measuring. Measurements can be nested. */
+extern void measure_start (Measure *self);
+
+/** Stop measuring, leaving the results in self. */
+extern void measure_stop (Measure *self);
+
+extern void measure_print (const Measure *self);
+
+END_DECLS
+
+/** Called by Lua's allocator, when the bytes it has in use change. */
+static inline void measure_heap_change (size_t osize, size_t nsize)
+  {
+  measure_heap += nsize - osize;
+  if (measure_heap > measure_heap_peak) measure_heap_peak = measure_heap;
+  }
+
+/** Called by Lua when it starts or stops running Lua code, rather than
+    C. Returns what it was doing before, to be restored afterwards. */
+static inline BOOL measure_set_lua (BOOL in_lua)
+  {
+  BOOL was = measure_in_lua;
+  if (was != in_lua)
+    {
+    if (measure_depth > 0)
+      measure_switch (in_lua);
+    else
+      measure_in_lua = in_lua;
+    }
+  return was;
+  }
+
@@ -18,11 +18,20 @@
 #include <lua/lualib.h>
 #include <lua/lauxlib.h>
 #include <shell/shell.h>
+#include <shell/shell_registry.h>
 #include <storage/storage.h>
 #include <interface/interface.h>
 #include <klib/term.h> 
 #include <bute2/bute2.h>
 #include "libluapico/libluapico.h"
+#include "libluapico/measure.h"
+
+// The name of the table, in the Lua registry, that holds the functions
+//   registered as shell commands
+#define LUAPICO_COMMANDS "picolua.commands"
+
+// The Lua states that are running something, newest first
+static LuapicoHold *luapico_holds = NULL;
 
 BOOL adc_initialized = FALSE;
 
@@ -221,7 +230,7 @@ int luapico_mkdir (lua_State *L)
 =========================================================================*/
 int luapico_ls (lua_State *L) 
   {
-  List *list = list_create (free);
+  Vector *list = vector_create_strings ();
   if (list)
     {
     int t = lua_gettop (L);
@@ -237,10 +246,10 @@ int luapico_ls (lua_State *L)
     if (err == 0) 
       {
       lua_newtable (L);
-      int l = list_length (list);
+      int l = vector_length (list);
       for (int i = 0; i < l; i++)
 	{
-	const char *s = list_get (list, i);
+	const char *s = vector_get (list, i);
 	lua_pushnumber (L, i + 1);
 	lua_pushstring (L, s); 
 	lua_settable (L, -3);
@@ -251,7 +260,7 @@ int luapico_ls (lua_State *L)
       luaL_error (L, shell_strerror (err));
       }
 
-    list_destroy (list);
+    vector_destroy (list);
     }
   else
     {
@@ -608,6 +617,186 @@ int luapico_execute (lua_State *L)
   return 1;
   }
 
+/*=========================================================================
+
+  luapico_run_command
+
+  The handler for shell commands implemented in Lua. The function is
+  kept in a table in the registry of the Lua state that registered it,
+  which is the command's user data. The arguments are passed to the
+  function as strings; if it returns a number, that is the command's
+  error code.
+
+=========================================================================*/
+static ErrCode luapico_run_command (int argc, char **argv)
+  {
+  ErrCode ret = 0;
+  lua_State *L = shell_command_data ();
+  LuapicoHold hold;
+  luapico_hold (L, &hold);
+  int top = lua_gettop (L);
+  lua_getfield (L, LUA_REGISTRYINDEX, LUAPICO_COMMANDS);
+  lua_getfield (L, -1, argv[0]);
+  for (int i = 1; i < argc; i++)
+    lua_pushstring (L, argv[i]);
+  if (lua_pcall (L, argc - 1, 1, 0) == LUA_OK)
+    {
+    if (lua_isnumber (L, -1))
+      ret = (ErrCode)lua_tointeger (L, -1);
+    }
+  else
+    {
+    interface_write_string (lua_tostring (L, -1));
+    interface_write_endl();
+    ret = ERR_ABANDONED;
+    }
+  lua_settop (L, top);
+  luapico_release (&hold);
+  return ret;
+  }
+
+/*=========================================================================
+
+  luapico_is_held
+
+=========================================================================*/
+static BOOL luapico_is_held (const lua_State *L)
+  {
+  for (const LuapicoHold *hold = luapico_holds; hold; hold = hold->next)
+    if (hold->L == L) return TRUE;
+  return FALSE;
+  }
+
+/*=========================================================================
+
+  luapico_hold
+
+=========================================================================*/
+void luapico_hold (lua_State *L, LuapicoHold *hold)
+  {
+  hold->L = L;
+  hold->next = luapico_holds;
+  luapico_holds = hold;
+  }
+
+/*=========================================================================
+
+  luapico_release
+
+=========================================================================*/
+void luapico_release (LuapicoHold *hold)
+  {
+  luapico_holds = hold->next;
+  if (!luapico_is_held (hold->L) && shell_count_commands (hold->L) == 0)
+    lua_close (hold->L);
+  }
+
+/*=========================================================================
+
+  luapico_command_removed
+
+  A command that a Lua state registered has been removed. If it was
+  the state's last, and the state isn't running, nothing can use it
+  any more.
+
+=========================================================================*/
+static void luapico_command_removed (void *user_data)
+  {
+  lua_State *L = user_data;
+  if (!luapico_is_held (L) && shell_count_commands (L) == 0)
+    lua_close (L);
+  }
+
+/*=========================================================================
+
+  luapico_register_command
+
+=========================================================================*/
+int luapico_register_command (lua_State *L)
+  {
+  const char *name = luaL_checkstring (L, 1);
+  const char *help = luaL_optstring (L, 3, NULL);
+  ErrCode err = 0;
+
+  // Only commands that this state registered can be replaced or removed
+  const ShellCommand *old = shell_find_command (name);
+  if (old && (!(old->flags & SHELL_CMD_LUA) || old->user_data != L))
+    err = ERR_EXIST;
+  else if (lua_isnoneornil (L, 2))
+    {
+    err = shell_unregister_command (name);
+    }
+  else
+    {
+    luaL_checktype (L, 2, LUA_TFUNCTION);
+    err = shell_register_command (name, luapico_run_command, help, 
+      SHELL_CMD_LUA, L, luapico_command_removed);
+    }
+  if (err)
+    luaL_error (L, "%s: %s", name, shell_strerror (err));
+
+  if (lua_getfield (L, LUA_REGISTRYINDEX, LUAPICO_COMMANDS) != LUA_TTABLE)
+    {
+    lua_pop (L, 1);
+    lua_newtable (L);
+    lua_pushvalue (L, -1);
+    lua_setfield (L, LUA_REGISTRYINDEX, LUAPICO_COMMANDS);
+    }
+  lua_pushvalue (L, 2);
+  lua_setfield (L, -2, name);
+  lua_pop (L, 1);
+  return 0;
+  }
+
+/*=========================================================================
+
+  luapico_measure
+
+  Call a function with any further arguments, and return a table of
+  what it cost, followed by whatever the function returned. An error
+  in the function is passed on, without the table.
+
+=========================================================================*/
+int luapico_measure (lua_State *L)
+  {
+  luaL_checktype (L, 1, LUA_TFUNCTION);
+  int nargs = lua_gettop (L) - 1;
+  Measure measure;
+  measure_start (&measure);
+  int status = lua_pcall (L, nargs, LUA_MULTRET, 0);
+  measure_stop (&measure);
+  if (status != LUA_OK) lua_error (L);
+
+  // The function may have filled the stack with results, leaving no
+  //   room for the table and each value put in it
+  int nresults = lua_gettop (L);
+  luaL_checkstack (L, 2, NULL);
+  lua_createtable (L, 0, 11);
+  lua_pushinteger (L, (lua_Integer)measure.wall_us);
+  lua_setfield (L, -2, "wall_us");
+  lua_pushinteger (L, (lua_Integer)measure.lua_us);
+  lua_setfield (L, -2, "lua_us");
+  lua_pushinteger (L, measure.heap_peak);
+  lua_setfield (L, -2, "heap_peak");
+  lua_pushinteger (L, measure.heap_net);
+  lua_setfield (L, -2, "heap_net");
+  lua_pushinteger (L, measure.gc_cycles);
+  lua_setfield (L, -2, "gc_cycles");
+  lua_pushinteger (L, measure.gc_steps);
+  lua_setfield (L, -2, "gc_steps");
+  lua_pushinteger (L, measure.block_reads);
+  lua_setfield (L, -2, "block_reads");
+  lua_pushinteger (L, measure.block_progs);
+  lua_setfield (L, -2, "block_progs");
+  lua_pushinteger (L, measure.block_erases);
+  lua_setfield (L, -2, "block_erases");
+  lua_pushinteger (L, measure.bytes_in);
+  lua_setfield (L, -2, "bytes_in");
+  lua_pushinteger (L, measure.bytes_out);
+  lua_setfield (L, -2, "bytes_out");
+  lua_insert (L, 1);
+  return nresults + 1;
+  }
 
 /*=========================================================================
 
@@ -679,6 +868,8 @@ static const luaL_Reg picolib[] =
   {"i2c_write_read", luapico_i2c_write_read},
   {"readline", luapico_readline},
   {"execute", luapico_execute},
+  {"register_command", luapico_register_command},
+  {"measure", luapico_measure},
   {NULL, NULL}
   };
 
@@ -0,0 +1,134 @@
+/*=========================================================================
+
+  picolua
+
+  libluapico/measure.c
+
+  See measure.h. Time inside the Lua VM is counted by noting the time
+  whenever Lua starts or stops running Lua code, while at least one
+  measurement is in progress. The peak of Lua's memory use is reset
+  when a measurement starts, and put back afterwards to the higher of
+  its old value and the new one, so that an enclosing measurement
+  still sees the right peak.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+#include <stdio.h>
+#include <string.h>
+#include <interface/interface.h>
+#include "libluapico/measure.h"
+
+size_t measure_heap = 0;
+size_t measure_heap_peak = 0;
+uint32_t measure_gc_cycles = 0;
+uint32_t measure_gc_steps = 0;
+BOOL measure_in_lua = FALSE;
+int measure_depth = 0;
+
+// Time spent running Lua code during measurements, and when it was
+//   last brought up to date
+static uint64_t measure_lua_us = 0;
+static uint64_t measure_since = 0;
+
+/*=========================================================================
+
+  measure_update
+
+=========================================================================*/
+static void measure_update (void)
+  {
+  uint64_t now = interface_time_us ();
+  if (measure_in_lua) measure_lua_us += now - measure_since;
+  measure_since = now;
+  }
+
+/*=========================================================================
+
+  measure_switch
+
+=========================================================================*/
+void measure_switch (BOOL in_lua)
+  {
+  measure_update ();
+  measure_in_lua = in_lua;
+  }
+
+/*=========================================================================
+
+  measure_start
+
+=========================================================================*/
+void measure_start (Measure *self)
+  {
+  if (measure_depth++ == 0)
+    measure_since = interface_time_us ();
+  else
+    measure_update ();
+  self->lua_us = measure_lua_us;
+  self->outer_peak = measure_heap_peak;
+  measure_heap_peak = measure_heap;
+  self->heap_net = (int32_t)measure_heap;
+  self->gc_cycles = measure_gc_cycles;
+  self->gc_steps = measure_gc_steps;
+  interface_block_counts (&self->block_reads, &self->block_progs,
+    &self->block_erases);
+  self->bytes_in = interface_bytes_in ();
+  self->bytes_out = interface_bytes_out ();
+  self->wall_us = interface_time_us ();
+  }
+
+/*=========================================================================
+
+  measure_stop
+
+=========================================================================*/
+void measure_stop (Measure *self)
+  {
+  self->wall_us = interface_time_us () - self->wall_us;
+  measure_update ();
+  measure_depth--;
+  self->lua_us = measure_lua_us - self->lua_us;
+  self->heap_peak = measure_heap_peak;
+  if (measure_heap_peak < self->outer_peak)
+    measure_heap_peak = self->outer_peak;
+  self->heap_net = (int32_t)measure_heap - self->heap_net;
+  self->gc_cycles = measure_gc_cycles - self->gc_cycles;
+  self->gc_steps = measure_gc_steps - self->gc_steps;
+  uint32_t reads, progs, erases;
+  interface_block_counts (&reads, &progs, &erases);
+  self->block_reads = reads - self->block_reads;
+  self->block_progs = progs - self->block_progs;
+  self->block_erases = erases - self->block_erases;
+  self->bytes_in = interface_bytes_in () - self->bytes_in;
+  self->bytes_out = interface_bytes_out () - self->bytes_out;
+  }
+
+/*=========================================================================
+
+  measure_print
+
+=========================================================================*/
+void measure_print (const Measure *self)
+  {
+  printf ("real   %lu.%03lu ms", (unsigned long)(self->wall_us / 1000),
+    (unsigned long)(self->wall_us % 1000));
+  interface_write_endl ();
+  printf ("lua    %lu.%03lu ms", (unsigned long)(self->lua_us / 1000),
+    (unsigned long)(self->lua_us % 1000));
+  interface_write_endl ();
+  printf ("heap   %lu peak, %+ld net", (unsigned long)self->heap_peak,
+    (long)self->heap_net);
+  interface_write_endl ();
+  printf ("gc     %lu cycles, %lu steps", (unsigned long)self->gc_cycles,
+    (unsigned long)self->gc_steps);
+  interface_write_endl ();
+  printf ("flash  %lu reads, %lu progs, %lu erases",
+    (unsigned long)self->block_reads, (unsigned long)self->block_progs,
+    (unsigned long)self->block_erases);
+  interface_write_endl ();
+  printf ("term   %lu in, %lu out", (unsigned long)self->bytes_in,
+    (unsigned long)self->bytes_out);
+  interface_write_endl ();
+  }
+
@@ -16,6 +16,7 @@
 #include <shell/shell.h> // KB 
 #include <klib/string.h> // KB 
 #include <storage/storage.h> // KB
+#include <libluapico/measure.h> // KB
 
 /*
 ** This file uses only the official API of Lua.
@@ -751,21 +752,46 @@ static int skipcomment (LoadF *lf, int *cp) {
 }
 
 
+/* KB: Lua source is read from storage a piece at a time, rather than
+   being loaded into memory in one go. This saves memory, and means that 
+   compressed files are decompressed as they are parsed. */
+typedef struct LoadStorage {
+  StorageFile *file;
+  ErrCode err;
+  char buff[256];
+} LoadStorage;
+
+static const char *getStorage (lua_State *L, void *ud, size_t *size) {
+  LoadStorage *ls = (LoadStorage *)ud;
+  int n = 0;
+  (void)L;  /* not used */
+  ls->err = storage_file_read(ls->file, ls->buff, sizeof(ls->buff), &n);
+  *size = (size_t)n;
+  return (n > 0) ? ls->buff : NULL;
+}
+
+
 LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
                                              const char *mode) {
   // KB
-  uint8_t *buffer;
-  int n = 0;
-  ErrCode err = storage_read_file (filename, &buffer, &n);
+  LoadStorage ls;
+  ErrCode err = storage_file_open (filename, STORAGE_OPEN_READ, &ls.file);
   if (err == 0)
     {
-    int ret = luaL_loadbuffer (L, (const char *)buffer, n, filename);
-    free (buffer);
+    ls.err = 0;
+    int ret = lua_load (L, getStorage, &ls, filename, mode);
+    storage_file_close (ls.file);
+    if (ls.err != 0)
+      {
+      lua_pop (L, 1);
+      luaL_error (L, "%s", shell_strerror (ls.err));
+      return -1;
+      }
     return ret;
     }
   else
     {
-    luaL_error (L, shell_strerror (err));
+    luaL_error (L, "%s", shell_strerror (err));
     return -1;
     }
 
@@ -1030,13 +1056,18 @@ LUALIB_API const char *luaL_gsub (lua_State *L, const char *s,
 
 
 static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
-  (void)ud; (void)osize;  /* not used */
+  (void)ud;  /* not used */
+  if (ptr == NULL) osize = 0;  /* osize is the type of object -- KB */
   if (nsize == 0) {
     free(ptr);
+    measure_heap_change(osize, 0); // KB
     return NULL;
   }
-  else
-    return realloc(ptr, nsize);
+  else {
+    void *p = realloc(ptr, nsize);
+    if (p) measure_heap_change(osize, nsize); // KB
+    return p;
+  }
 }
 
 
@@ -33,6 +33,8 @@
 #include "lvm.h"
 #include "lzio.h"
 
+#include <libluapico/measure.h> // KB
+
 
 
 #define errorstatus(s)	((s) > LUA_YIELD)
@@ -140,6 +142,7 @@ l_noret luaD_throw (lua_State *L, int errcode) {
 
 int luaD_rawrunprotected (lua_State *L, Pfunc f, void *ud) {
   l_uint32 oldnCcalls = L->nCcalls;
+  BOOL in_lua = measure_in_lua; // KB
   struct lua_longjmp lj;
   lj.status = LUA_OK;
   lj.previous = L->errorJmp;  /* chain new error handler */
@@ -149,6 +152,7 @@ int luaD_rawrunprotected (lua_State *L, Pfunc f, void *ud) {
   );
   L->errorJmp = lj.previous;  /* restore old error handler */
   L->nCcalls = oldnCcalls;
+  measure_set_lua(in_lua);  /* in case of an error -- KB */
   return lj.status;
 }
 
@@ -487,6 +491,7 @@ CallInfo *luaD_precall (lua_State *L, StkId func, int nresults) {
       f = fvalue(s2v(func));
      Cfunc: {
       int n;  /* number of returns */
+      BOOL in_lua; // KB
       CallInfo *ci;
       checkstackGCp(L, LUA_MINSTACK, func);  /* ensure minimum stack size */
       L->ci = ci = next_ci(L);
@@ -500,7 +505,9 @@ CallInfo *luaD_precall (lua_State *L, StkId func, int nresults) {
         luaD_hook(L, LUA_HOOKCALL, -1, 1, narg);
       }
       lua_unlock(L);
+      in_lua = measure_set_lua(FALSE); // KB
       n = (*f)(L);  /* do the actual call */
+      measure_set_lua(in_lua); // KB
       lua_lock(L);
       api_checknelems(L, n);
       luaD_poscall(L, ci, n);
@@ -544,8 +551,10 @@ static void ccall (lua_State *L, StkId func, int nResults, int inc) {
   if (unlikely(getCcalls(L) >= LUAI_MAXCCALLS))
     luaE_checkcstack(L);
   if ((ci = luaD_precall(L, func, nResults)) != NULL) {  /* Lua function? */
+    BOOL in_lua = measure_set_lua(TRUE); // KB
     ci->callstatus = CIST_FRESH;  /* mark that it is a "fresh" execute */
     luaV_execute(L, ci);  /* call it */
+    measure_set_lua(in_lua); // KB
   }
   L->nCcalls -= inc;
 }
@@ -609,8 +618,10 @@ static void unroll (lua_State *L, void *ud) {
     if (!isLua(ci))  /* C function? */
       finishCcall(L, LUA_YIELD);  /* complete its execution */
     else {  /* Lua function */
+      BOOL in_lua = measure_set_lua(TRUE); // KB
       luaV_finishOp(L);  /* finish interrupted instruction */
       luaV_execute(L, ci);  /* execute down to higher C 'boundary' */
+      measure_set_lua(in_lua); // KB
     }
   }
 }
@@ -683,8 +694,11 @@ static void resume (lua_State *L, void *ud) {
     lua_assert(L->status == LUA_YIELD);
     L->status = LUA_OK;  /* mark that it is running (again) */
     luaE_incCstack(L);  /* control the C stack */
-    if (isLua(ci))  /* yielded inside a hook? */
+    if (isLua(ci)) {  /* yielded inside a hook? */
+      BOOL in_lua = measure_set_lua(TRUE); // KB
       luaV_execute(L, ci);  /* just continue running Lua code */
+      measure_set_lua(in_lua); // KB
+    }
     else {  /* 'common' yield */
       if (ci->u.c.k != NULL) {  /* does it have a continuation function? */
         lua_unlock(L);
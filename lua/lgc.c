@@ -26,6 +26,8 @@
 #include "ltable.h"
 #include "ltm.h"
 
+#include <libluapico/measure.h> // KB
+
 
 /*
 ** Maximum number of elements to sweep in each single step.
@@ -1516,6 +1518,7 @@ void luaC_freeallobjects (lua_State *L) {
 static lu_mem atomic (lua_State *L) {
   global_State *g = G(L);
   lu_mem work = 0;
+  measure_gc_cycles++; // KB
   GCObject *origweak, *origall;
   GCObject *grayagain = g->grayagain;  /* save original list */
   g->grayagain = NULL;
@@ -1667,6 +1670,7 @@ void luaC_step (lua_State *L) {
   global_State *g = G(L);
   lua_assert(!g->gcemergency);
   if (g->gcrunning) {  /* running? */
+    measure_gc_steps++; // KB
     if(isdecGCmodegen(g))
       genstep(L, g);
     else
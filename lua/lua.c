@@ -21,6 +21,7 @@
 
 #include <interface/interface.h> // KB
 #include <shell/shell.h> // KB
+#include <shell/shell_registry.h> // KB
 #include <klib/term.h> // KB
 #include <libluapico/libluapico.h> // KB
 
@@ -83,7 +84,7 @@ extern lua_State *global_L; // KB
 
 static lua_State *globalL = NULL; // KB
 static uint8_t rl_interrupt = FALSE; // KB
-List *history = NULL;
+Vector *history = NULL;
 
 static const char *progname = LUA_PROGNAME;
 
@@ -594,8 +595,11 @@ int lua_main (int argc, char **argv) { // KB
     return EXIT_FAILURE;
   }
 
-  history = list_create (free);
+  history = vector_create_strings ();
+  lua_State *outer_L = global_L; // KB
   global_L = L;
+  LuapicoHold hold; // KB
+  luapico_hold (L, &hold); // KB
   luapico_init_constants (L); // KB
 
   lua_pushcfunction(L, &pmain);  /* to call 'pmain' in protected mode */
@@ -604,9 +608,12 @@ int lua_main (int argc, char **argv) { // KB
   status = lua_pcall(L, 2, 1, 0);  /* do the call */
   result = lua_toboolean(L, -1);  /* get result */
   report(L, status);
-  lua_close(L);
+  // KB: if the program registered shell commands, the state has to
+  //   stay alive, so that they can run in it 
+  luapico_release (&hold);
   L = NULL;
-  list_destroy (history);
+  global_L = outer_L; // KB: don't leave it pointing at a closed state
+  vector_destroy (history);
   return (result && status == LUA_OK) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -30,6 +30,7 @@ typedef uint8_t ErrCode;
 #define ERR_NOTIMPLEMENTED  107
 #define ERR_BADPIN          108
 #define ERR_NOTEXECUTABLE   109
+#define ERR_BUSY            110
 
 
 
@@ -3,9 +3,39 @@
 #include <klib/defs.h>
 #include <shell/errcodes.h>
 
+// Longest line that fileutil_read_lines() passes in one piece
+#define FILEUTIL_LINE_MAX 256
+
+/** Called by fileutil_read_lines() for each line, without its newline,
+    but with a terminating zero. If partial is TRUE, this is only a 
+    piece of a longer line, and the rest follows in the next call or
+    calls; the last piece has partial FALSE. Should return 0 to carry 
+    on, or an error code to stop. */
+typedef ErrCode (*FileutilLineFn)(char *line, int len, BOOL partial, 
+                 void *user_data);
+
 BEGIN_DECLS
 
 extern ErrCode fileutil_copy (const char *source, const char *target);
+
+/** Rename a file or directory. A directory that is moved to another
+    filesystem is copied, and then removed. */
 extern ErrCode fileutil_rename (const char *source, const char *target);
 
+/** Copy a file, or a directory and everything in it. Directories that 
+    already exist in the target are merged into. */
+extern ErrCode fileutil_copy_tree (const char *source, const char *target,
+                 BOOL verbose);
+
+/** Delete a file, or a directory and everything in it. */
+extern ErrCode fileutil_remove_tree (const char *path, BOOL verbose);
+
+/** Read a file a line at a time, through a fixed buffer, so that the 
+    file need not fit in memory. A line longer than FILEUTIL_LINE_MAX
+    is passed in pieces, all but the last marked as partial. Returns 0,
+    an error opening or reading the file, ERR_INTERRUPTED, or the first
+    error from fn. */
+extern ErrCode fileutil_read_lines (const char *path, FileutilLineFn fn,
+                 void *user_data);
+
 END_DECLS
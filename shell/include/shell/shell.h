@@ -14,6 +14,7 @@
 
 #include <klib/defs.h>
 #include "shell/errcodes.h"
+#include <lua/lua.h>
 
 BEGIN_DECLS
 
@@ -56,10 +57,23 @@ extern BOOL    shell_get_interrupt (void);
     running a Lua script from inside the editor. */
 extern void    shell_runlua (const char *filename);
 
+/** Run a Lua program whose text is supplied by reader, as for 
+    lua_load(), without it having to be in a file. This is used to run 
+    the text in the editor without saving it. The chunk name is 
+    "@" followed by the name errors should be reported against. If
+    the program fails at a line of its own, rather than in some code it
+    called, the line number is returned; otherwise 0. */
+extern int     shell_runlua_reader (lua_Reader reader, void *data, 
+                 const char *chunkname);
+
 /** Run a single line using the shell. This function returns an error code
     but, on the whole, it will have signalled any problems to the console. */
 extern ErrCode shell_do_line (const char *buff);
 
+/** Run a command that has already been split into arguments, as
+    shell_do_line() does after splitting the line. */
+extern ErrCode shell_do_line_argv (int argc, char **argv);
+
 /** After formatting storage, this method creates the basic directories. */
 extern void shell_init_storage (void);
 
@@ -23,10 +23,26 @@ extern ErrCode shell_cmd_echo (int argc, char **argv);
 extern ErrCode shell_cmd_cat (int argc, char **argv);
 extern ErrCode shell_cmd_yrecv (int argc, char **argv);
 extern ErrCode shell_cmd_ysend (int argc, char **argv);
+extern ErrCode shell_cmd_sync (int argc, char **argv);
+extern ErrCode shell_cmd_sync_recv (int argc, char **argv);
+extern ErrCode shell_cmd_compress (int argc, char **argv);
 extern ErrCode shell_cmd_cp (int argc, char **argv);
 extern ErrCode shell_cmd_mv (int argc, char **argv);
 extern ErrCode shell_cmd_format (int argc, char **argv);
 extern ErrCode shell_cmd_i2cdetect (int argc, char **argv);
+extern ErrCode shell_cmd_mount (int argc, char **argv);
+extern ErrCode shell_cmd_umount (int argc, char **argv);
+extern ErrCode shell_cmd_du (int argc, char **argv);
+extern ErrCode shell_cmd_edit (int argc, char **argv);
+extern ErrCode shell_cmd_lua (int argc, char **argv);
+extern ErrCode shell_cmd_help (int argc, char **argv);
+extern ErrCode shell_cmd_grep (int argc, char **argv);
+extern ErrCode shell_cmd_wc (int argc, char **argv);
+extern ErrCode shell_cmd_head (int argc, char **argv);
+extern ErrCode shell_cmd_tail (int argc, char **argv);
+extern ErrCode shell_cmd_find (int argc, char **argv);
+extern ErrCode shell_cmd_replay (int argc, char **argv);
+extern ErrCode shell_cmd_time (int argc, char **argv);
 
 END_DECLS
 
@@ -0,0 +1,79 @@
+/*=========================================================================
+
+  picolua
+
+  shell/shell_registry.h
+
+  The table of commands that the shell runs itself, rather than looking
+  for a file on the PATH. The built-in commands are fixed, but more can 
+  be added at run time, by C code or by Lua (pico.register_command). 
+  Commands are found by hashing their names, so the cost of a lookup 
+  does not depend on how many commands there are.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+
+#pragma once
+
+#include <klib/defs.h> 
+#include "shell/errcodes.h"
+
+// The most commands there can be, built-in and registered together 
+#define SHELL_MAX_COMMANDS 48
+
+// Flags for ShellCommand
+// The command was registered at run time, and can be removed
+#define SHELL_CMD_RUNTIME  0x0001
+// The command is implemented in Lua
+#define SHELL_CMD_LUA      0x0002
+
+typedef ErrCode (*ShellCommandFn) (int argc, char **argv);
+typedef void (*ShellCommandDestroyFn) (void *user_data);
+
+typedef struct _ShellCommand
+  {
+  const char *name;
+  ShellCommandFn fn;
+  /** A one-line description, for the "help" command. May be NULL. */
+  const char *help;
+  int flags;
+  /** Whatever the command's implementation needs. The handler can
+      get it using shell_command_data(). */
+  void *user_data;
+  /** Called with user_data after the command has been removed or
+      replaced, so that its owner can let go of it. May be NULL. */
+  ShellCommandDestroyFn destroy;
+  } ShellCommand;
+
+BEGIN_DECLS
+
+/** Find the command with the given name, or return NULL. */
+extern const ShellCommand *shell_find_command (const char *name);
+
+/** Run a command found by shell_find_command(). */
+extern ErrCode shell_run_command (const ShellCommand *cmd, int argc, 
+          char **argv);
+
+/** Add a command. name and help are copied, so the caller need not
+    keep them. A command registered earlier with the same name
+    is replaced, but a built-in one cannot be, and the result is 
+    ERR_EXIST. Returns ERR_NOSPC if there are already SHELL_MAX_COMMANDS 
+    commands. */
+extern ErrCode shell_register_command (const char *name, ShellCommandFn fn, 
+          const char *help, int flags, void *user_data, 
+          ShellCommandDestroyFn destroy);
+
+/** Remove a command that was added by shell_register_command(), and
+    then call its destroy function, if it has one. */
+extern ErrCode shell_unregister_command (const char *name);
+
+/** Count the registered commands whose user_data is the one given. Lua
+    uses this to decide whether it has to keep its state alive. */
+extern int     shell_count_commands (const void *user_data);
+
+/** Get the user_data of the command that is running. */
+extern void   *shell_command_data (void);
+
+END_DECLS
+
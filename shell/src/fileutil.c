@@ -8,6 +8,7 @@
 
 =========================================================================*/
 #include <stdio.h> 
+#include <string.h> 
 #include <getopt.h> 
 #include <klib/defs.h> 
 #include <interface/interface.h>
@@ -16,6 +17,15 @@
 #include "shell/errcodes.h"
 #include "shell/shell.h"
 #include "shell/shell_commands.h"
+#include "shell/fileutil.h"
+
+typedef struct _FileutilTree
+  {
+  const char *source;
+  const char *target; // Only for copying
+  BOOL verbose;
+  BOOL reported;      // Set when an error has been displayed
+  } FileutilTree;
 
 /*=========================================================================
 
@@ -28,31 +38,43 @@ ErrCode fileutil_copy (const char *source, const char *target)
 
   uint8_t buff[256];
 
-  ret = storage_write_file (target, "", 0); 
+  StorageFile *from;
+  StorageFile *to;
+  ret = storage_file_open (source, STORAGE_OPEN_READ, &from);
+  if (ret)
+    {
+    shell_write_error_filename (ret, source);
+    return ret;
+    }
+
+  ret = storage_file_open (target, STORAGE_OPEN_WRITE, &to); 
   if (ret == 0)
      {
-     int offset = 0;
      int n = 0;
      do
        {
-       ret = storage_read_partial (source, offset, sizeof (buff), 
-               buff, &n); 
+       ret = storage_file_read (from, buff, sizeof (buff), &n); 
        if (ret == 0)
          {
-         ret = storage_append_file (target, buff, n);
+         if (n > 0) ret = storage_file_write (to, buff, n);
          if (ret)
            shell_write_error_filename (ret, target);
          }
        else
          shell_write_error_filename (ret, source);
-
-       offset += sizeof (buff);
-       } while (n == sizeof (buff) && ret == 0 && !shell_get_interrupt());
+       } while (n > 0 && ret == 0 && !shell_get_interrupt());
+     ErrCode err = storage_file_close (to);
+     if (ret == 0 && err)
+       {
+       ret = err;
+       shell_write_error_filename (ret, target);
+       }
      }
   else
      {
      shell_write_error_filename (ret, target);
      }
+  storage_file_close (from);
   if (shell_get_interrupt())
     {
     shell_write_error (ERR_INTERRUPTED);
@@ -69,8 +91,190 @@ ErrCode fileutil_rename (const char *source, const char *target)
   {
   ErrCode ret = 0;
   ret = storage_rename (source, target);
+  if (ret == ERR_NOTIMPLEMENTED)
+    {
+    // A directory can only be moved to another filesystem by copying
+    //   it. Errors have already been reported by then
+    ret = fileutil_copy_tree (source, target, FALSE);
+    if (ret == 0)
+      ret = fileutil_remove_tree (source, FALSE);
+    return ret;
+    }
+  if (ret)
+    shell_write_error_filename (ret, source);
+  return ret;
+  }
+
+/*=========================================================================
+
+  fileutil_copy_tree_fn
+
+=========================================================================*/
+static ErrCode fileutil_copy_tree_fn (const char *path, 
+     const FileInfo *info, StorageWalkEvent event, void *user_data)
+  {
+  (void)info;
+  FileutilTree *copy = user_data;
+  if (shell_get_interrupt()) return ERR_INTERRUPTED;
+  if (event == STORAGE_WALK_DIR_POST) return 0;
+
+  char target[MAX_PATH + 1];
+  const char *rel = path + strlen (copy->source);
+  if (strlen (copy->target) + strlen (rel) > MAX_PATH)
+    return ERR_NAMETOOLONG;
+  strcpy (target, copy->target);
+  strcat (target, rel);
+
+  if (copy->verbose)
+    interface_write_stringln (path); 
+  ErrCode ret;
+  if (event == STORAGE_WALK_DIR_PRE)
+    {
+    FileInfo existing;
+    ret = storage_mkdir (target);
+    if (ret == ERR_EXIST && storage_info (target, &existing) == 0
+        && existing.type == STORAGE_TYPE_DIR)
+      ret = 0;
+    if (ret)
+      shell_write_error_filename (ret, target);
+    }
+  else
+    {
+    // fileutil_copy() reports its own errors, including interruption
+    ret = fileutil_copy (path, target);
+    if (ret == 0 && shell_get_interrupt()) ret = ERR_INTERRUPTED;
+    }
+  copy->reported = (ret != 0);
+  return ret;
+  }
+
+/*=========================================================================
+
+  fileutil_copy_tree
+
+=========================================================================*/
+ErrCode fileutil_copy_tree (const char *source, const char *target, 
+     BOOL verbose)
+  {
+  char s[MAX_PATH + 1];
+  strncpy (s, source, MAX_PATH);
+  s[MAX_PATH] = 0;
+  size_t len = strlen (s);
+  while (len > 1 && s[len - 1] == '/') s[--len] = 0;
+
+  // Copying a directory into itself would never finish
+  if (strcmp (s, "/") == 0 || (strncmp (s, target, len) == 0 
+      && (target[len] == '/' || target[len] == 0)))
+    {
+    shell_write_error_filename (ERR_INVAL, target);
+    return ERR_INVAL;
+    }
+
+  FileutilTree copy = { s, target, verbose, FALSE };
+  ErrCode ret = storage_walk (s, fileutil_copy_tree_fn, &copy);
+  if (ret == ERR_INTERRUPTED && !copy.reported)
+    shell_write_error (ret);
+  else if (ret && !copy.reported)
+    shell_write_error_filename (ret, source);
+  return ret;
+  }
+
+/*=========================================================================
+
+  fileutil_remove_tree_fn
+
+=========================================================================*/
+static ErrCode fileutil_remove_tree_fn (const char *path, 
+     const FileInfo *info, StorageWalkEvent event, void *user_data)
+  {
+  (void)info;
+  FileutilTree *remove = user_data;
+  if (shell_get_interrupt()) return ERR_INTERRUPTED;
+  if (event == STORAGE_WALK_DIR_PRE) return 0;
+  if (remove->verbose)
+    interface_write_stringln (path); 
+  ErrCode ret = storage_rm (path);
   if (ret)
+    {
+    shell_write_error_filename (ret, path);
+    remove->reported = TRUE;
+    }
+  return ret;
+  }
+
+/*=========================================================================
+
+  fileutil_remove_tree
+
+=========================================================================*/
+ErrCode fileutil_remove_tree (const char *path, BOOL verbose)
+  {
+  FileutilTree remove = { path, NULL, verbose, FALSE };
+  ErrCode ret = storage_walk (path, fileutil_remove_tree_fn, &remove);
+  if (ret == ERR_INTERRUPTED && !remove.reported)
     shell_write_error (ret);
+  else if (ret && !remove.reported)
+    shell_write_error_filename (ret, path);
+  return ret;
+  }
+
+
+/*=========================================================================
+
+  fileutil_read_lines
+
+=========================================================================*/
+ErrCode fileutil_read_lines (const char *path, FileutilLineFn fn,
+     void *user_data)
+  {
+  StorageFile *file;
+  ErrCode ret = storage_file_open (path, STORAGE_OPEN_READ, &file);
+  if (ret) return ret;
+
+  char buff[FILEUTIL_LINE_MAX + 1];
+  int len = 0;
+  BOOL partial = FALSE; // The last piece passed was part of a line
+  int n;
+  do
+    {
+    ret = storage_file_read (file, buff + len, FILEUTIL_LINE_MAX - len, &n);
+    if (ret == 0 && shell_get_interrupt()) ret = ERR_INTERRUPTED;
+    if (ret) break;
+
+    int end = len + n;
+    int start = 0;
+    for (int i = len; i < end && ret == 0; i++)
+      {
+      if (buff[i] == '\n')
+        {
+        buff[i] = 0;
+        ret = fn (buff + start, i - start, FALSE, user_data);
+        partial = FALSE;
+        start = i + 1;
+        }
+      }
+    len = end - start;
+    if (ret == 0 && len == FILEUTIL_LINE_MAX)
+      {
+      // The line is too long to hold, so pass what we have, and
+      //   carry on with the rest of it
+      buff[len] = 0;
+      ret = fn (buff, len, TRUE, user_data);
+      partial = TRUE;
+      len = 0;
+      }
+    else if (ret == 0 && n == 0 && (len > 0 || partial))
+      {
+      // The last line has no newline
+      buff[start + len] = 0;
+      ret = fn (buff + start, len, FALSE, user_data);
+      len = 0;
+      }
+    else if (start > 0)
+      memmove (buff, buff + start, len);
+    } while (ret == 0 && n > 0);
+
+  storage_file_close (file);
   return ret;
   }
 
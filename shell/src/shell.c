@@ -14,7 +14,6 @@
 #include <string.h> 
 #include <stdlib.h> 
 #include <getopt.h> 
-#include <fnmatch.h> 
 #include <libluapico/libluapico.h>
 #include "shell/shell.h" 
 #include "pico/stdlib.h" 
@@ -23,16 +22,23 @@
 #include <lua/lauxlib.h>
 #include <klib/defs.h> 
 #include <klib/string.h> 
+#include <klib/arena.h> 
 #include <interface/interface.h>
 #include <interface/compat.h>
 #include <klib/term.h> 
 #include <storage/storage.h>
+#include <storage/glob.h>
 #include <config.h>
 #include <bute2/bute2.h>
 #include "shell/errcodes.h"
 #include "shell/shell_commands.h"
+#include "shell/shell_registry.h"
 
 #define SHELL_RC_FILE "/etc/shellrc.sh"
+// The arena that holds a command line's arguments starts with this 
+//   many bytes, which is enough for most lines
+#define SHELL_ARENA_CHUNK 512
+#define SHELL_ARGV_INITIAL 16
 #define LUA_RC_FILE "/etc/luarc.lua"
 
 extern char *file_bin_blink_lua;
@@ -41,6 +47,16 @@ extern char *file_etc_shellrc_sh;
 
 extern int lua_main (int argc, char **argv);
 
+// The arguments of a command line, as they are collected
+typedef struct _ShellArgs
+  {
+  Arena *arena;
+  char **argv;
+  int argc;
+  int size;
+  BOOL nomem;
+  } ShellArgs;
+
 BOOL interrupted = FALSE;
 lua_State *global_L = NULL;
 
@@ -79,6 +95,7 @@ const char *shell_strerror (ErrCode err)
     case ERR_NOTIMPLEMENTED: return "Feature not implemented";  
     case ERR_BADPIN: return "Bad pin number";  
     case ERR_NOTEXECUTABLE: return "Not executable";  
+    case ERR_BUSY: return "Filesystem in use";  
     }
   return "Unknown error";
   }
@@ -152,22 +169,53 @@ BOOL shell_get_interrupt (void)
 
 /*=========================================================================
 
-  shell_runlua
+  shell_open_lua
 
-  This funtion is called by the screen editor, when invoked from the
-  shell, to run a Lua program. It creates a new Lua context for the
-  duration of execution. 
+  Make sure there is a Lua context to run a program in, creating one
+  if the shell isn't running in one already, and hold it open. Returns
+  TRUE if it created one. 
 
 =========================================================================*/
-extern void shell_runlua (const char *filename)
+static BOOL shell_open_lua (LuapicoHold *hold)
   {
   BOOL did_init_lua = FALSE;
-  if (!global_L)
+  if (!global_L) 
     {
     global_L = luaL_newstate();  
     luaL_openlibs (global_L);  
     did_init_lua = TRUE;
     }
+  luapico_hold (global_L, hold);
+  return did_init_lua;
+  }
+
+/*=========================================================================
+
+  shell_close_lua
+
+  The context is closed if nothing else is running in it, unless the 
+  program registered shell commands, as for the lua command.
+
+=========================================================================*/
+static void shell_close_lua (BOOL did_init_lua, LuapicoHold *hold)
+  {
+  luapico_release (hold);
+  if (did_init_lua) global_L = NULL;
+  }
+
+/*=========================================================================
+
+  shell_runlua
+
+  This funtion is called by the screen editor, when invoked from the
+  shell, to run a Lua program. It creates a new Lua context for the
+  duration of execution. 
+
+=========================================================================*/
+extern void shell_runlua (const char *filename)
+  {
+  LuapicoHold hold;
+  BOOL did_init_lua = shell_open_lua (&hold);
   lua_getglobal (global_L, "dofile");
   lua_pushstring (global_L, filename);
   if (lua_pcall (global_L, 1, 0, 0) != 0)
@@ -175,11 +223,38 @@ extern void shell_runlua (const char *filename)
     interface_write_string (lua_tostring (global_L, -1));
     interface_write_endl();
     }
-  if (did_init_lua)
+  shell_close_lua (did_init_lua, &hold);
+  }
+
+/*=========================================================================
+
+  shell_runlua_reader
+
+  Like shell_runlua(), but the program comes from a reader rather than
+  a file. Lua prefixes its messages about errors in the program with
+  "name:line:", where name is the chunk name without its leading '@',
+  and that's where the line number comes from. 
+
+=========================================================================*/
+int shell_runlua_reader (lua_Reader reader, void *data, const char *chunkname)
+  {
+  int line = 0;
+  LuapicoHold hold;
+  BOOL did_init_lua = shell_open_lua (&hold);
+  if (lua_load (global_L, reader, data, chunkname, NULL) != LUA_OK
+       || lua_pcall (global_L, 0, 0, 0) != LUA_OK)
     {
-    lua_close (global_L);
-    global_L = NULL;
+    const char *msg = lua_tostring (global_L, -1);
+    if (!msg) msg = "(error object is not a string)";
+    int len = strlen (chunkname + 1);
+    if (strncmp (msg, chunkname + 1, len) == 0 && msg[len] == ':')
+      line = atoi (msg + len + 1);
+    interface_write_string (msg);
+    interface_write_endl();
+    lua_pop (global_L, 1);
     }
+  shell_close_lua (did_init_lua, &hold);
+  return line;
   }
 
 /*=========================================================================
@@ -187,12 +262,24 @@ extern void shell_runlua (const char *filename)
   shell_cmd_edit
 
 =========================================================================*/
-void shell_cmd_edit (int argc, char **argv)
+ErrCode shell_cmd_edit (int argc, char **argv)
   {
   if (argc >= 2)
     bute_run (argv[1]);
   else
     bute_run (NULL);
+  return 0;
+  }
+
+/*=========================================================================
+
+  shell_cmd_lua
+
+=========================================================================*/
+ErrCode shell_cmd_lua (int argc, char **argv)
+  {
+  lua_main (argc, argv);
+  return 0;
   }
 
 /*=========================================================================
@@ -381,150 +468,133 @@ ErrCode shell_do_line_argv (int argc, char **argv)
     { 
     shell_do_variable (argv[0]);
     }
-  else if (strcmp (argv[0], "lua") == 0)
-    lua_main (argc, argv);
-  else if (strcmp (argv[0], "edit") == 0)
-    shell_cmd_edit (argc, argv);
-  else if (strcmp (argv[0], "df") == 0)
-    ret = shell_cmd_df (argc, argv);
-  else if (strcmp (argv[0], "ls") == 0)
-    ret = shell_cmd_ls (argc, argv);
-  else if (strcmp (argv[0], "mkdir") == 0)
-    ret = shell_cmd_mkdir (argc, argv);
-  else if (strcmp (argv[0], "rmdir") == 0)
-    ret = shell_cmd_rm (argc, argv);
-  else if (strcmp (argv[0], "rm") == 0)
-    ret = shell_cmd_rm (argc, argv);
-  else if (strcmp (argv[0], "echo") == 0)
-    ret = shell_cmd_echo (argc, argv);
-  else if (strcmp (argv[0], "cat") == 0)
-    ret = shell_cmd_cat (argc, argv);
-  else if (strcmp (argv[0], "yrecv") == 0)
-    ret = shell_cmd_yrecv (argc, argv);
-  else if (strcmp (argv[0], "ysend") == 0)
-    ret = shell_cmd_ysend (argc, argv);
-  else if (strcmp (argv[0], "cp") == 0)
-    ret = shell_cmd_cp (argc, argv);
-  else if (strcmp (argv[0], "mv") == 0)
-    ret = shell_cmd_cp (argc, argv);
-  else if (strcmp (argv[0], "format") == 0)
-    ret = shell_cmd_format (argc, argv);
-  else if (strcmp (argv[0], "i2cdetect") == 0)
-    ret = shell_cmd_i2cdetect (argc, argv);
   else 
-    ret = shell_find_and_execute (argc, argv);
+    {
+    const ShellCommand *cmd = shell_find_command (argv[0]);
+    if (cmd)
+      ret = shell_run_command (cmd, argc, argv);
+    else
+      ret = shell_find_and_execute (argc, argv);
+    }
     
   return ret;
   }
 
 /*=========================================================================
 
-  shell_do_line
+  shell_add_arg
 
-=========================================================================*/
-ErrCode shell_do_line (const char *buff)
-  { 
-  ErrCode ret = 0;
-  String *sbuff = string_create (buff);
-  List *args = string_tokenize (sbuff);
-  int l = list_length (args);  
-  char **argv = malloc ((l + 1) * sizeof (char *));
+  Add an argument to the argv array, which is kept NULL-terminated. 
+  The array lives in the arena, so when it fills up we just take a 
+  bigger one, and abandon the old one.
 
-  if (argv)
+=========================================================================*/
+static void shell_add_arg (ShellArgs *args, char *arg)
+  {
+  if (!arg)
     {
-    for (int i = 0; i < l; i++)
-      {
-      const String *arg = list_get (args, i);
-      argv[i] = strdup (string_cstr (arg));
-      }
-    argv[l] = NULL;
-
-    int argc = l;
-    ret = shell_do_line_argv (argc, argv);
-
-    for (int i = 0; i < l; i++)
+    args->nomem = TRUE;
+    return;
+    }
+  if (args->argc + 1 >= args->size)
+    {
+    int size = args->size ? args->size * 2 : SHELL_ARGV_INITIAL;
+    char **argv = arena_alloc (args->arena, size * sizeof (char *));
+    if (!argv)
       {
-      free (argv[i]);
+      args->nomem = TRUE;
+      return;
       }
-
-    free (argv);
-    } 
-  else
-    {
-    shell_write_error (ERR_NOMEM);
+    if (args->argc) memcpy (argv, args->argv, args->argc * sizeof (char *));
+    args->argv = argv;
+    args->size = size;
     }
-
-  list_destroy (args);
-  string_destroy (sbuff);
-  return ret;
+  args->argv[args->argc++] = arg;
+  args->argv[args->argc] = NULL;
   }
 
 /*=========================================================================
 
-  shell_glob_match
+  shell_glob_add
 
 =========================================================================*/
-BOOL shell_glob_match (const char *filename, const char *match)
+static ErrCode shell_glob_add (const char *path, const FileInfo *info, 
+    void *user_data)
   {
-  return !my_fnmatch (match, filename, 0);
+  (void)info;
+  ShellArgs *args = user_data;
+  shell_add_arg (args, arena_strdup (args->arena, path)); 
+  return args->nomem ? ERR_NOMEM : 0;
   }
 
 /*=========================================================================
 
   shell_globber
 
+  Called by the tokenizer for each token. If the token is unquoted, 
+  and contains wildcards, replace it with the matching filenames, if 
+  there are any.
+
 =========================================================================*/
-static void shell_globber  (String *token, List *list)
+static void shell_globber (const char *token, BOOL quoted, void *user_data)
   {
-  char basename[MAX_FNAME + 1];
-  char dir[MAX_PATH + 1];
-  const char *c_token = string_cstr (token);
-  if (!(strchr (c_token, '*') || strchr (c_token, '?')))
+  ShellArgs *args = user_data;
+  if (quoted || !glob_has_wildcards (token))
     {
-    list_append (list, token);
+    // The token is already in the arena, and needs no copy
+    shell_add_arg (args, (char *)token);
     return;
     }
 
-  storage_get_basename (c_token, basename);
-  storage_get_dir (string_cstr (token), dir);
-  //printf ("basename=%s\n", basename);
-  //printf ("dir=%s\n", dir);
-  BOOL matched = FALSE;
-
-  List *list2 = list_create (free);
-  if (list2)
+  int argc = args->argc;
+  Glob *glob;
+  if (glob_compile (token, &glob) == 0)
     {
-    if (storage_list_dir (dir, list2) == 0)
-      {
-      int l = list_length (list2);
-      for (int i = 0; i < l; i++)
-        {
-        const char *fname = list_get (list2, i);
-	if (fname[0] == '.') continue;
-        if (shell_glob_match (fname, basename))
-          {
-          char newpath[MAX_PATH + 1];
-	  storage_join_path (dir, fname, newpath);
-          list_append (list, string_create (newpath)); 
-	  matched = TRUE;
-          }
-	}
-      }
-    else
-      {
-      // Silently swallow error
-      }
-    list_destroy (list2);
+    glob_run (glob, shell_glob_add, args);
+    glob_destroy (glob);
     }
   else
     {
     // Silently swallow error
     }
   
-  if (matched)
-    string_destroy (token);
-  else
-    list_append (list, token);
+  if (args->argc == argc)
+    shell_add_arg (args, (char *)token);
+  }
+
+/*=========================================================================
+
+  shell_do_line
+
+  Everything needed to split the line into arguments -- the tokens, 
+  the results of globbing, and argv itself -- comes from an arena, 
+  so running a line costs only a couple of heap operations, apart
+  from whatever the command itself does. 
+
+=========================================================================*/
+ErrCode shell_do_line (const char *buff)
+  { 
+  ErrCode ret = 0;
+  ShellArgs args;
+  memset (&args, 0, sizeof (args));
+  args.arena = arena_create (SHELL_ARENA_CHUNK);
+  char *tokens = NULL;
+  if (args.arena)
+    tokens = arena_alloc (args.arena, strlen (buff) + 1);
+
+  if (tokens)
+    string_tokenize_fn (buff, tokens, shell_globber, &args);
+
+  if (!tokens || args.nomem)
+    {
+    ret = ERR_NOMEM; 
+    shell_write_error (ret);
+    }
+  else if (args.argc > 0)
+    ret = shell_do_line_argv (args.argc, args.argv);
+
+  arena_destroy (args.arena);
+  return ret;
   }
 
 /*=========================================================================
@@ -566,6 +636,41 @@ void shell_init_storage (void)
     }
   }
 
+/*=========================================================================
+
+  shell_idle
+
+  Called when nothing has been typed at the prompt for a while. A Pico
+  is usually reset rather than shut down, so this is the best chance
+  to save the map of blocks in use, if it has changed. Doing it after
+  every command would cost a scan of the filesystem, and a flash 
+  write, each time.
+
+=========================================================================*/
+static void shell_idle (void)
+  {
+  storage_sync ();
+  }
+
+/*=========================================================================
+
+  shell_read_command
+
+  Read a command at the prompt
+
+=========================================================================*/
+static BOOL shell_read_command (char *buff, int len, BOOL *interrupted,
+     Vector *history)
+  {
+#if SHELL_SYNC_IDLE > 0
+  interface_set_idle (shell_idle, SHELL_SYNC_IDLE);
+#endif
+  BOOL ret = term_get_line (buff, len, interrupted, 
+      READLINE_MAX_HISTORY, history);
+  interface_set_idle (NULL, 0);
+  return ret;
+  }
+
 /*=========================================================================
 
   shell_main
@@ -585,8 +690,7 @@ void shell_main()
  //   printf ("key=%d\n", key);
  //   }
   
-  List *history = list_create (free);
-  string_tok_globber = shell_globber;
+  Vector *history = vector_create_strings ();
 
   if (storage_file_exists (SHELL_RC_FILE))
     {
@@ -596,8 +700,7 @@ void shell_main()
 
   char buff [READLINE_MAXINPUT + 1];
   while (interface_write_buff ("$ ", 2), 
-      term_get_line (buff, sizeof (buff), &interrupted, 
-      READLINE_MAX_HISTORY, history))
+      shell_read_command (buff, sizeof (buff), &interrupted, history))
     {
     if (interrupted)
       {
@@ -609,7 +712,7 @@ void shell_main()
     interrupted = FALSE;
     }
 
-  list_destroy (history);
+  vector_destroy (history);
 
   storage_cleanup();
   interface_cleanup ();
@@ -28,6 +28,33 @@ static void shell_cmd_cat_usage (void)
   interface_write_stringln ("Usage: cat {files...}");
   }
 
+/*=========================================================================
+
+  shell_cmd_cat_file
+
+  Copy the file to the terminal a piece at a time, so we don't need 
+  to hold it all in memory.
+
+=========================================================================*/
+static ErrCode shell_cmd_cat_file (const char *filename)
+  {
+  StorageFile *file;
+  ErrCode ret = storage_file_open (filename, STORAGE_OPEN_READ, &file);
+  if (ret == 0)
+    {
+    char buff[256];
+    int n;
+    do
+      {
+      ret = storage_file_read (file, buff, sizeof (buff), &n);
+      if (ret == 0 && n > 0)
+        interface_write_buff (buff, n);
+      } while (ret == 0 && n > 0 && !shell_get_interrupt());
+    storage_file_close (file);
+    }
+  return ret;
+  }
+
 /*=========================================================================
 
   shell_cmd_cat
@@ -63,16 +90,9 @@ ErrCode shell_cmd_cat (int argc, char **argv)
       {
       for (int i = optind; i < argc && ret == 0; i++)
         {
-	uint8_t *buff;
-	int len;
-	ret = storage_read_file (argv[i], &buff, &len);
-	if (ret == 0)
-	  {
-          interface_write_buff ((char *)buff, len);
-	  free (buff);
-	  }
-	else
-	  shell_write_error_filename (ret, argv[i]);
+        ret = shell_cmd_cat_file (argv[i]);
+        if (ret)
+          shell_write_error_filename (ret, argv[i]);
         }
       }
     }
@@ -0,0 +1,121 @@
+/*=========================================================================
+
+  picolua
+
+  shell/shell_cmd_compress.c
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+#include <stdio.h> 
+#include <string.h> 
+#include <getopt.h> 
+#include "shell/shell.h" 
+#include <klib/defs.h> 
+#include <interface/interface.h>
+#include <storage/storage.h>
+#include <config.h>
+#include "shell/errcodes.h"
+#include "shell/shell.h"
+#include "shell/shell_commands.h"
+
+/*=========================================================================
+
+  shell_cmd_compress_usage
+
+=========================================================================*/
+static void shell_cmd_compress_usage (void)
+  {
+  interface_write_stringln ("Usage: compress [-d] {files...}");
+  interface_write_stringln ("       compress -w {on | off}");
+  }
+
+/*=========================================================================
+
+  shell_cmd_compress_file
+
+=========================================================================*/
+static ErrCode shell_cmd_compress_file (const char *path, BOOL compress)
+  {
+  FileInfo before;
+  FileInfo after;
+  ErrCode ret = storage_info (path, &before);
+  if (ret == 0)
+    ret = storage_compress_file (path, compress);
+  if (ret == 0)
+    ret = storage_info (path, &after);
+  if (ret == 0)
+    {
+    char s[40];
+    interface_write_string (path);
+    snprintf (s, sizeof (s), ": %lu -> %lu bytes", 
+      (unsigned long)before.stored_size, (unsigned long)after.stored_size);
+    interface_write_stringln (s);
+    }
+  else
+    shell_write_error_filename (ret, path);
+  return ret;
+  }
+
+/*=========================================================================
+
+  shell_cmd_compress
+
+=========================================================================*/
+ErrCode shell_cmd_compress (int argc, char **argv)
+  {
+  int opt;
+  optind = 0;
+  ErrCode ret = 0;
+  BOOL usage = FALSE;
+  BOOL compress = TRUE;
+  const char *setting = NULL;
+  while (ret == 0 && (opt = getopt (argc, argv, "hdw:")) != -1) 
+    {
+    switch (opt)
+      { 
+      case 'd':
+        compress = FALSE;
+        break;
+      case 'w':
+        setting = optarg;
+        break;
+      case 'h':
+        usage = TRUE;
+        // Fall through
+      default:
+        shell_cmd_compress_usage();
+        ret = ERR_USAGE;
+      }
+    }
+
+  if (ret == 0)
+    {
+    if (setting)
+      {
+      if (strcmp (setting, "on") == 0)
+        storage_set_compression (TRUE);
+      else if (strcmp (setting, "off") == 0)
+        storage_set_compression (FALSE);
+      else
+        {
+        shell_cmd_compress_usage();
+        ret = ERR_USAGE;
+        }
+      }
+    else if (optind == argc)
+      {
+      interface_write_stringln (storage_get_compression() ? 
+        "New files are compressed" : "New files are not compressed");
+      }
+
+    for (int i = optind; i < argc && ret == 0; i++)
+      {
+      ret = shell_cmd_compress_file (argv[i], compress);
+      }
+    }
+
+  if (usage) ret = 0;
+  return ret;
+  }
+
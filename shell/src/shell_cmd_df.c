@@ -37,14 +37,21 @@ ErrCode shell_cmd_df (int argc, char **argv)
         human = TRUE;
         break;
       default:
-        interface_write_stringln ("Usage: df [-k]");
+        interface_write_stringln ("Usage: df [-k] [directory]");
         ret = ERR_USAGE;
       }
     }
 
+  if (ret == 0 && argc - optind > 1)
+    {
+    interface_write_stringln ("Usage: df [-k] [directory]");
+    ret = ERR_USAGE;
+    }
+
   if (ret == 0)
     {
-    ErrCode err = storage_df (NULL, &used, &total);
+    ErrCode err = storage_df (optind < argc ? argv[optind] : NULL, 
+      &used, &total);
     if (err == 0)
       {
       if (human)
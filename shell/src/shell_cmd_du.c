@@ -0,0 +1,135 @@
+/*=========================================================================
+
+  picolua
+
+  shell/shell_cmd_du.c
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+#include <stdio.h> 
+#include <getopt.h> 
+#include "shell/shell.h" 
+#include <klib/defs.h> 
+#include <interface/interface.h>
+#include <storage/storage.h>
+#include <config.h>
+#include "shell/errcodes.h"
+#include "shell/shell_commands.h"
+
+// Totals for each directory that the walk is in. The one for level 0
+//   is for the whole tree.
+typedef struct _DuState
+  {
+  uint32_t totals[STORAGE_WALK_DEPTH + 1];
+  int depth;
+  BOOL summary;
+  BOOL human;
+  } DuState;
+
+/*=========================================================================
+
+  shell_cmd_du_print
+
+=========================================================================*/
+static void shell_cmd_du_print (const DuState *state, uint32_t size,
+     const char *path)
+  {
+  if (state->human)
+    printf ("%-7lu %s", (unsigned long)(size + 1023) / 1024, path);
+  else
+    printf ("%-7lu %s", (unsigned long)size, path);
+  interface_write_endl();
+  }
+
+/*=========================================================================
+
+  shell_cmd_du_fn
+
+=========================================================================*/
+static ErrCode shell_cmd_du_fn (const char *path, const FileInfo *info,
+     StorageWalkEvent event, void *user_data)
+  {
+  DuState *state = user_data;
+  if (shell_get_interrupt()) return ERR_INTERRUPTED;
+  switch (event)
+    {
+    case STORAGE_WALK_FILE:
+      state->totals[state->depth] += info->stored_size;
+      // A file given on the command line gets a line of its own
+      if (state->depth == 0)
+        shell_cmd_du_print (state, info->stored_size, path);
+      break;
+    case STORAGE_WALK_DIR_PRE:
+      // storage_walk() goes no deeper than this, but there's no room
+      //   for the total if it does
+      if (state->depth >= STORAGE_WALK_DEPTH) return ERR_NAMETOOLONG;
+      state->depth++;
+      state->totals[state->depth] = 0;
+      break;
+    case STORAGE_WALK_DIR_POST:
+      if (!state->summary || state->depth == 1)
+        shell_cmd_du_print (state, state->totals[state->depth], path);
+      state->totals[state->depth - 1] += state->totals[state->depth];
+      state->depth--;
+      break;
+    }
+  return 0;
+  }
+
+/*=========================================================================
+
+  shell_cmd_du
+
+=========================================================================*/
+ErrCode shell_cmd_du (int argc, char **argv)
+  {
+  int opt;
+  optind = 0;
+  ErrCode ret = 0;
+  BOOL usage = FALSE;
+  DuState state;
+  state.summary = FALSE;
+  state.human = FALSE;
+  while ((opt = getopt (argc, argv, "hks")) != -1) 
+    {
+    switch (opt)
+      { 
+      case 'k':
+        state.human = TRUE;
+        break;
+      case 's':
+        state.summary = TRUE;
+        break;
+      case 'h':
+        usage = TRUE;
+        // Fall through
+      default:
+        interface_write_stringln ("Usage: du [-ks] {paths...}");
+        ret = ERR_USAGE;
+      }
+    }
+
+  if (ret == 0)
+    {
+    // With no arguments, report the whole filesystem
+    const char *root = "/";
+    const char **paths = optind < argc ? (const char **)argv + optind 
+      : &root;
+    int count = optind < argc ? argc - optind : 1;
+    for (int i = 0; i < count && ret == 0; i++)
+      {
+      state.depth = 0;
+      state.totals[0] = 0;
+      ret = storage_walk (paths[i], shell_cmd_du_fn, &state);
+      if (ret == ERR_INTERRUPTED)
+        shell_write_error (ret);
+      else if (ret)
+        shell_write_error_filename (ret, paths[i]);
+      }
+    }
+
+  if (usage) ret = 0;
+  return ret;
+  }
+
@@ -0,0 +1,113 @@
+/*=========================================================================
+
+  picolua
+
+  shell/shell_cmd_find.c
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+#include <stdio.h>
+#include <string.h>
+#include "shell/shell.h"
+#include <klib/defs.h>
+#include <interface/interface.h>
+#include <storage/storage.h>
+#include <storage/glob.h>
+#include <config.h>
+#include "shell/errcodes.h"
+#include "shell/shell_commands.h"
+
+typedef struct _FindState
+  {
+  const char *name; // Pattern, or NULL to match everything
+  char type;        // 'f', 'd', or 0 for either
+  } FindState;
+
+/*=========================================================================
+
+  shell_cmd_find_usage
+
+=========================================================================*/
+static void shell_cmd_find_usage (void)
+  {
+  interface_write_stringln
+    ("Usage: find [paths...] [-name pattern] [-type f|d]");
+  }
+
+/*=========================================================================
+
+  shell_cmd_find_fn
+
+=========================================================================*/
+static ErrCode shell_cmd_find_fn (const char *path, const FileInfo *info,
+     StorageWalkEvent event, void *user_data)
+  {
+  FindState *state = user_data;
+  if (shell_get_interrupt()) return ERR_INTERRUPTED;
+  if (event == STORAGE_WALK_DIR_POST) return 0;
+  if (state->type == 'f' && info->type != STORAGE_TYPE_REG) return 0;
+  if (state->type == 'd' && info->type != STORAGE_TYPE_DIR) return 0;
+  if (state->name)
+    {
+    char name[MAX_FNAME + 1];
+    storage_get_basename (path, name);
+    if (!glob_match (state->name, name)) return 0;
+    }
+  interface_write_stringln (path);
+  return 0;
+  }
+
+/*=========================================================================
+
+  shell_cmd_find
+
+  The options come after the paths, as in Unix find, and are
+  words rather than letters, so we can't use getopt here.
+
+=========================================================================*/
+ErrCode shell_cmd_find (int argc, char **argv)
+  {
+  ErrCode ret = 0;
+  FindState state;
+  state.name = NULL;
+  state.type = 0;
+
+  int npaths = 1;
+  while (npaths < argc && argv[npaths][0] != '-') npaths++;
+  for (int i = npaths; i < argc && ret == 0; i += 2)
+    {
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strcmp (argv[i], "-name") == 0 && value)
+      state.name = value;
+    else if (strcmp (argv[i], "-type") == 0 && value
+         && (strcmp (value, "f") == 0 || strcmp (value, "d") == 0))
+      state.type = value[0];
+    else
+      {
+      shell_cmd_find_usage ();
+      // -h asks for usage, and is not an error
+      ret = strcmp (argv[i], "-h") == 0 ? ERR_ABANDONED : ERR_USAGE;
+      }
+    }
+  if (ret == ERR_ABANDONED) return 0;
+
+  if (ret == 0)
+    {
+    // With no paths, search the whole filesystem
+    const char *root = "/";
+    const char **paths = npaths > 1 ? (const char **)argv + 1 : &root;
+    int count = npaths > 1 ? npaths - 1 : 1;
+    for (int i = 0; i < count && ret == 0; i++)
+      {
+      ret = storage_walk (paths[i], shell_cmd_find_fn, &state);
+      if (ret == ERR_INTERRUPTED)
+        shell_write_error (ret);
+      else if (ret)
+        shell_write_error_filename (ret, paths[i]);
+      }
+    }
+
+  return ret;
+  }
+
@@ -0,0 +1,329 @@
+/*=========================================================================
+
+  picolua
+
+  shell/shell_cmd_grep.c
+
+  The pattern is either a fixed string, or a small regular expression:
+  '.' matches any character, [...] one of a set, and '*', '+' or '?'
+  after any of these repeats it; '^' and '$' anchor the match to the
+  start or end of the line, and a backslash makes the next character
+  literal. There is no grouping or alternation.
+
+  Files are read a line at a time, through fileutil_read_lines(). A
+  line too long for it to pass in one piece is put together on the
+  heap, so that it is matched, counted, and printed as one line.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <getopt.h>
+#include "shell/shell.h"
+#include <klib/defs.h>
+#include <interface/interface.h>
+#include <storage/storage.h>
+#include <config.h>
+#include "shell/errcodes.h"
+#include "shell/shell_commands.h"
+#include "shell/fileutil.h"
+
+typedef struct _GrepState
+  {
+  const char *pattern;
+  const char *filename; // NULL unless there is more than one file
+  BOOL fixed;
+  BOOL icase;
+  BOOL invert;
+  BOOL numbers;
+  BOOL count_only;
+  BOOL list_only;
+  int line;
+  int count;
+  char *long_line;      // A line too long to be read in one piece
+  int long_len;         //   is put together here, so it can be 
+  int long_size;        //   matched as a whole
+  } GrepState;
+
+/*=========================================================================
+
+  shell_cmd_grep_usage
+
+=========================================================================*/
+static void shell_cmd_grep_usage (void)
+  {
+  interface_write_stringln ("Usage: grep [-Fcilnv] {pattern} {files...}");
+  }
+
+/*=========================================================================
+
+  shell_cmd_grep_elem_len
+
+  The number of pattern characters in the element at the start of re
+
+=========================================================================*/
+static int shell_cmd_grep_elem_len (const char *re)
+  {
+  if (re[0] == '\\' && re[1]) return 2;
+  if (re[0] == '[')
+    {
+    const char *q = re + 1;
+    if (*q == '^') q++;
+    if (*q == ']') q++;
+    while (*q && *q != ']') q++;
+    if (*q) return q + 1 - re;
+    }
+  return 1;
+  }
+
+/*=========================================================================
+
+  shell_cmd_grep_chars_equal
+
+=========================================================================*/
+static BOOL shell_cmd_grep_chars_equal (char c1, char c2, BOOL icase)
+  {
+  if (icase)
+    return tolower ((unsigned char)c1) == tolower ((unsigned char)c2);
+  return c1 == c2;
+  }
+
+/*=========================================================================
+
+  shell_cmd_grep_match_elem
+
+  Match the character c against the len-character element at re
+
+=========================================================================*/
+static BOOL shell_cmd_grep_match_elem (const char *re, int len, char c,
+    BOOL icase)
+  {
+  if (len == 2) return shell_cmd_grep_chars_equal (re[1], c, icase);
+  if (re[0] == '.') return TRUE;
+  if (re[0] != '[' || len == 1)
+    return shell_cmd_grep_chars_equal (re[0], c, icase);
+
+  const char *q = re + 1;
+  const char *end = re + len - 1;
+  BOOL negate = (*q == '^');
+  if (negate) q++;
+  int lc = tolower ((unsigned char)c);
+  int uc = toupper ((unsigned char)c);
+  BOOL matched = FALSE;
+  while (q < end)
+    {
+    int lo = (unsigned char)*q++;
+    int hi = lo;
+    if (q + 1 < end && *q == '-')
+      {
+      hi = (unsigned char)q[1];
+      q += 2;
+      }
+    if (((unsigned char)c >= lo && (unsigned char)c <= hi)
+         || (icase && ((lc >= lo && lc <= hi) || (uc >= lo && uc <= hi))))
+      matched = TRUE;
+    }
+  return matched != negate;
+  }
+
+/*=========================================================================
+
+  shell_cmd_grep_match_here
+
+  Match the regular expression re at the start of text. Repeats take
+  as many characters as they can, and then give them back one at a
+  time until the rest of the pattern matches.
+
+=========================================================================*/
+static BOOL shell_cmd_grep_match_here (const char *re, const char *text,
+     BOOL icase)
+  {
+  while (*re)
+    {
+    if (re[0] == '$' && re[1] == 0) return *text == 0;
+    int len = shell_cmd_grep_elem_len (re);
+    char rep = re[len];
+    if (rep == '*' || rep == '+' || rep == '?')
+      {
+      int min = (rep == '+');
+      int max = (rep == '?') ? 1 : INT_MAX;
+      int count = 0;
+      while (text[count] && count < max
+           && shell_cmd_grep_match_elem (re, len, text[count], icase))
+        count++;
+      for (; count >= min; count--)
+        {
+        if (shell_cmd_grep_match_here (re + len + 1, text + count, icase))
+          return TRUE;
+        }
+      return FALSE;
+      }
+    if (!*text || !shell_cmd_grep_match_elem (re, len, *text, icase))
+      return FALSE;
+    re += len;
+    text++;
+    }
+  return TRUE;
+  }
+
+/*=========================================================================
+
+  shell_cmd_grep_match
+
+=========================================================================*/
+static BOOL shell_cmd_grep_match (const GrepState *state, const char *line)
+  {
+  const char *p = state->pattern;
+  if (state->fixed)
+    {
+    if (!state->icase) return strstr (line, p) != NULL;
+    int plen = strlen (p);
+    for (const char *s = line; *s; s++)
+      {
+      int i = 0;
+      while (i < plen && shell_cmd_grep_chars_equal (s[i], p[i], TRUE))
+        i++;
+      if (i == plen) return TRUE;
+      }
+    return plen == 0;
+    }
+
+  if (p[0] == '^')
+    return shell_cmd_grep_match_here (p + 1, line, state->icase);
+  do
+    {
+    if (shell_cmd_grep_match_here (p, line, state->icase)) return TRUE;
+    } while (*line++);
+  return FALSE;
+  }
+
+/*=========================================================================
+
+  shell_cmd_grep_line
+
+=========================================================================*/
+static ErrCode shell_cmd_grep_line (char *line, int len, BOOL partial,
+     void *user_data)
+  {
+  GrepState *state = user_data;
+  if (partial || state->long_len > 0)
+    {
+    if (state->long_len + len + 1 > state->long_size)
+      {
+      int size = state->long_size ? state->long_size * 2 
+        : 2 * FILEUTIL_LINE_MAX;
+      while (size < state->long_len + len + 1) size *= 2;
+      char *p = realloc (state->long_line, size);
+      if (!p) return ERR_NOMEM;
+      state->long_line = p;
+      state->long_size = size;
+      }
+    memcpy (state->long_line + state->long_len, line, len + 1);
+    state->long_len += len;
+    if (partial) return 0;
+    line = state->long_line;
+    len = state->long_len;
+    state->long_len = 0;
+    }
+
+  state->line++;
+  if (shell_cmd_grep_match (state, line) == state->invert) return 0;
+  state->count++;
+  if (state->list_only) return ERR_ABANDONED; // No need to read further
+  if (state->count_only) return 0;
+
+  if (state->filename) printf ("%s:", state->filename);
+  if (state->numbers) printf ("%d:", state->line);
+  interface_write_buff (line, len);
+  interface_write_endl ();
+  return 0;
+  }
+
+/*=========================================================================
+
+  shell_cmd_grep
+
+=========================================================================*/
+ErrCode shell_cmd_grep (int argc, char **argv)
+  {
+  int opt;
+  optind = 0;
+  ErrCode ret = 0;
+  BOOL usage = FALSE;
+  GrepState state;
+  memset (&state, 0, sizeof (state));
+  while ((opt = getopt (argc, argv, "hFcilnv")) != -1)
+    {
+    switch (opt)
+      {
+      case 'F':
+        state.fixed = TRUE;
+        break;
+      case 'c':
+        state.count_only = TRUE;
+        break;
+      case 'i':
+        state.icase = TRUE;
+        break;
+      case 'l':
+        state.list_only = TRUE;
+        break;
+      case 'n':
+        state.numbers = TRUE;
+        break;
+      case 'v':
+        state.invert = TRUE;
+        break;
+      case 'h':
+        usage = TRUE;
+        // Fall through
+      default:
+        shell_cmd_grep_usage ();
+        ret = ERR_USAGE;
+      }
+    }
+
+  if (ret == 0 && argc - optind < 2)
+    {
+    shell_cmd_grep_usage ();
+    ret = ERR_USAGE;
+    }
+
+  if (ret == 0)
+    {
+    state.pattern = argv[optind];
+    BOOL several = (argc - optind > 2);
+    for (int i = optind + 1; i < argc && ret == 0; i++)
+      {
+      state.filename = several ? argv[i] : NULL;
+      state.line = 0;
+      state.count = 0;
+      state.long_len = 0;
+      ret = fileutil_read_lines (argv[i], shell_cmd_grep_line, &state);
+      if (ret == ERR_ABANDONED) ret = 0;
+      if (ret == ERR_INTERRUPTED)
+        shell_write_error (ret);
+      else if (ret)
+        shell_write_error_filename (ret, argv[i]);
+      else if (state.list_only)
+        {
+        if (state.count) interface_write_stringln (argv[i]);
+        }
+      else if (state.count_only)
+        {
+        if (state.filename) printf ("%s:", state.filename);
+        printf ("%d", state.count);
+        interface_write_endl ();
+        }
+      }
+    }
+
+  free (state.long_line);
+  if (usage) ret = 0;
+  return ret;
+  }
+
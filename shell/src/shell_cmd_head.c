@@ -0,0 +1,256 @@
+/*=========================================================================
+
+  picolua
+
+  shell/shell_cmd_head.c
+
+  The head and tail commands. tail reads backwards from the end of the
+  file, a block at a time, until it has found enough lines, so it
+  takes no longer on a large file than on a small one. A compressed
+  file can only be read from the start, so for one of those we read
+  forward, remembering where each of the last few lines began.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include "shell/shell.h"
+#include <klib/defs.h>
+#include <interface/interface.h>
+#include <storage/storage.h>
+#include <config.h>
+#include "shell/errcodes.h"
+#include "shell/shell_commands.h"
+#include "shell/fileutil.h"
+
+#define SHELL_HEAD_LINES 10
+#define SHELL_HEAD_BLOCK 256
+
+typedef struct _HeadState
+  {
+  int lines;
+  int count;
+  } HeadState;
+
+/*=========================================================================
+
+  shell_cmd_head_line
+
+=========================================================================*/
+static ErrCode shell_cmd_head_line (char *line, int len, BOOL partial,
+     void *user_data)
+  {
+  HeadState *state = user_data;
+  if (state->count == state->lines) return ERR_ABANDONED;
+  interface_write_buff (line, len);
+  if (partial) return 0;
+  interface_write_endl ();
+  state->count++;
+  return state->count == state->lines ? ERR_ABANDONED : 0;
+  }
+
+/*=========================================================================
+
+  shell_cmd_tail_find_back
+
+  Find the offset of the start of the last lines lines of an
+  uncompressed file, by reading blocks backwards from the end. A
+  newline at the very end of the file doesn't start a new line.
+
+=========================================================================*/
+static ErrCode shell_cmd_tail_find_back (StorageFile *file, int lines,
+     int *start)
+  {
+  int size = storage_file_size (file);
+  if (size < 0) return ERR_IO;
+  char buff[SHELL_HEAD_BLOCK];
+  int pos = size;
+  int found = 0;
+  *start = 0;
+  while (pos > 0)
+    {
+    int n = pos < SHELL_HEAD_BLOCK ? pos : SHELL_HEAD_BLOCK;
+    pos -= n;
+    int got;
+    ErrCode ret = storage_file_seek (file, pos);
+    if (ret == 0) ret = storage_file_read (file, buff, n, &got);
+    if (ret) return ret;
+    for (int i = got - 1; i >= 0; i--)
+      {
+      if (buff[i] == '\n' && pos + i != size - 1 && ++found == lines)
+        {
+        *start = pos + i + 1;
+        return 0;
+        }
+      }
+    }
+  return 0;
+  }
+
+/*=========================================================================
+
+  shell_cmd_tail_find_forward
+
+  Find the offset of the start of the last lines lines, by reading
+  the whole file, and keeping the start of the last lines lines in
+  a ring.
+
+=========================================================================*/
+static ErrCode shell_cmd_tail_find_forward (StorageFile *file, int lines,
+     int *start)
+  {
+  uint32_t *ring = malloc (lines * sizeof (uint32_t));
+  if (!ring) return ERR_NOMEM;
+  char buff[SHELL_HEAD_BLOCK];
+  uint32_t pos = 0;
+  int count = 1; // Lines started so far; the first starts at 0
+  ring[0] = 0;
+  BOOL pending = FALSE; // Last byte read was a newline
+  ErrCode ret = 0;
+  int n;
+  do
+    {
+    ret = storage_file_read (file, buff, sizeof (buff), &n);
+    if (ret == 0 && shell_get_interrupt()) ret = ERR_INTERRUPTED;
+    for (int i = 0; i < n && ret == 0; i++)
+      {
+      if (pending)
+        ring[count++ % lines] = pos + i;
+      pending = (buff[i] == '\n');
+      }
+    pos += n;
+    } while (ret == 0 && n > 0);
+  *start = count > lines ? (int)ring[count % lines] : 0;
+  free (ring);
+  return ret;
+  }
+
+/*=========================================================================
+
+  shell_cmd_tail_file
+
+=========================================================================*/
+static ErrCode shell_cmd_tail_file (const char *filename, int lines)
+  {
+  FileInfo info;
+  ErrCode ret = storage_info (filename, &info);
+  if (ret) return ret;
+  if (info.type == STORAGE_TYPE_DIR) return ERR_ISDIR;
+  if (lines <= 0) return 0;
+
+  StorageFile *file;
+  ret = storage_file_open (filename, STORAGE_OPEN_READ, &file);
+  if (ret) return ret;
+  int start;
+  if (info.compressed)
+    ret = shell_cmd_tail_find_forward (file, lines, &start);
+  else
+    ret = shell_cmd_tail_find_back (file, lines, &start);
+  if (ret == 0) ret = storage_file_seek (file, start);
+  if (ret == 0)
+    {
+    char buff[SHELL_HEAD_BLOCK];
+    int n;
+    do
+      {
+      ret = storage_file_read (file, buff, sizeof (buff), &n);
+      if (ret == 0 && n > 0)
+        interface_write_buff (buff, n);
+      } while (ret == 0 && n > 0 && !shell_get_interrupt());
+    }
+  storage_file_close (file);
+  return ret;
+  }
+
+/*=========================================================================
+
+  shell_cmd_head_main
+
+  head and tail take the same arguments
+
+=========================================================================*/
+static ErrCode shell_cmd_head_main (int argc, char **argv, BOOL tail)
+  {
+  int opt;
+  optind = 0;
+  ErrCode ret = 0;
+  BOOL usage = FALSE;
+  int lines = SHELL_HEAD_LINES;
+  while ((opt = getopt (argc, argv, "hn:")) != -1)
+    {
+    switch (opt)
+      {
+      case 'n':
+        lines = atoi (optarg);
+        break;
+      case 'h':
+        usage = TRUE;
+        // Fall through
+      default:
+        printf ("Usage: %s [-n lines] {files...}", argv[0]);
+        interface_write_endl ();
+        ret = ERR_USAGE;
+      }
+    }
+
+  if (ret == 0 && optind == argc)
+    {
+    printf ("Usage: %s [-n lines] {files...}", argv[0]);
+    interface_write_endl ();
+    ret = ERR_USAGE;
+    }
+
+  if (ret == 0)
+    {
+    BOOL several = (argc - optind > 1);
+    for (int i = optind; i < argc && ret == 0; i++)
+      {
+      if (several)
+        {
+        printf ("==> %s <==", argv[i]);
+        interface_write_endl ();
+        }
+      if (tail)
+        ret = shell_cmd_tail_file (argv[i], lines);
+      else if (lines > 0)
+        {
+        HeadState state;
+        state.lines = lines;
+        state.count = 0;
+        ret = fileutil_read_lines (argv[i], shell_cmd_head_line, &state);
+        if (ret == ERR_ABANDONED) ret = 0;
+        }
+      if (ret == 0 && shell_get_interrupt()) ret = ERR_INTERRUPTED;
+      if (ret == ERR_INTERRUPTED)
+        shell_write_error (ret);
+      else if (ret)
+        shell_write_error_filename (ret, argv[i]);
+      }
+    }
+
+  if (usage) ret = 0;
+  return ret;
+  }
+
+/*=========================================================================
+
+  shell_cmd_head
+
+=========================================================================*/
+ErrCode shell_cmd_head (int argc, char **argv)
+  {
+  return shell_cmd_head_main (argc, argv, FALSE);
+  }
+
+/*=========================================================================
+
+  shell_cmd_tail
+
+=========================================================================*/
+ErrCode shell_cmd_tail (int argc, char **argv)
+  {
+  return shell_cmd_head_main (argc, argv, TRUE);
+  }
+
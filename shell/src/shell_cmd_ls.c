@@ -23,18 +23,18 @@
   shell_cmd_ls
 
 =========================================================================*/
-static void shell_cmd_dols (const char *path, const List *list, 
+static void shell_cmd_dols (const char *path, const Vector *list, 
      BOOL lng)
   {
   char result [MAX_PATH + 1];
   char s[20]; // For converting numbers
-  int l = list_length (list);
+  int l = vector_length (list);
   uint max_name = 0;
   uint32_t max_size = 0;
 
   for (int i = 0; i < l; i++)
     {
-    const char *fname = list_get (list, i);
+    const char *fname = vector_get (list, i);
     uint l = strlen (fname);
     if (l > max_name) max_name = l;
    
@@ -53,7 +53,7 @@ static void shell_cmd_dols (const char *path, const List *list,
     {
     for (int i = 0; i < l; i++)
       {
-      const char *fname = list_get (list, i);
+      const char *fname = vector_get (list, i);
       storage_join_path (path, fname, result); 
       FileInfo info;
       if (storage_info (result, &info) == 0)
@@ -89,7 +89,7 @@ static void shell_cmd_dols (const char *path, const List *list,
     int n = 0;
     for (int i = 0; i < l; i++)
       {
-      const char *fname = list_get (list, i);
+      const char *fname = vector_get (list, i);
       for (int j = 0; j < (int)(1 + max_name - strlen (fname)); j++)
         {
         pad[j] = ' ';
@@ -116,7 +116,7 @@ static void shell_cmd_dols (const char *path, const List *list,
 ErrCode shell_cmd_lsone (const char *path, BOOL lng, BOOL show_dir)
   {
   ErrCode ret = 0;
-  List *list = list_create (free);
+  Vector *list = vector_create_strings ();
   if (list)
     {
     FileInfo info;
@@ -159,7 +159,7 @@ ErrCode shell_cmd_lsone (const char *path, BOOL lng, BOOL show_dir)
       }
     else
       shell_write_error_filename (ret, path);
-    list_destroy (list);
+    vector_destroy (list);
     }
   else
     {
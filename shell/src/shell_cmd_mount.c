@@ -0,0 +1,127 @@
+/*=========================================================================
+
+  picolua
+
+  shell/shell_cmd_mount.c
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+#include <stdio.h> 
+#include <stdlib.h> 
+#include <getopt.h> 
+#include "shell/shell.h" 
+#include <klib/defs.h> 
+#include <klib/vector.h> 
+#include <interface/interface.h>
+#include <storage/storage.h>
+#include <config.h>
+#include "shell/errcodes.h"
+#include "shell/shell_commands.h"
+
+/*=========================================================================
+
+  shell_cmd_mount_list
+
+=========================================================================*/
+static void shell_cmd_mount_list (void)
+  {
+  Vector *list = vector_create_strings ();
+  storage_list_mounts (list);
+  int n = vector_length (list);
+  for (int i = 0; i < n; i++)
+    {
+    const char *dir = vector_get (list, i);
+    uint32_t used, total;
+    if (storage_df (dir, &used, &total) == 0)
+      printf ("%s: RAM, used %ldk of %ldk", dir, (long)used / 1024, 
+        (long)total / 1024);
+    else
+      printf ("%s: RAM", dir);
+    interface_write_endl();
+    }
+  vector_destroy (list);
+  }
+
+/*=========================================================================
+
+  shell_cmd_mount
+
+=========================================================================*/
+ErrCode shell_cmd_mount (int argc, char **argv)
+  {
+  int opt;
+  optind = 0;
+  ErrCode ret = 0;
+  BOOL usage = FALSE;
+  while ((opt = getopt (argc, argv, "h")) != -1) 
+    {
+    switch (opt)
+      { 
+      case 'h':
+        usage = TRUE;
+        // Fall through
+      default:
+        ret = ERR_USAGE;
+      }
+    }
+
+  if (ret == 0)
+    {
+    if (argc - optind == 0)
+      shell_cmd_mount_list ();
+    else if (argc - optind == 2 && atoi (argv[optind + 1]) > 0)
+      {
+      ret = storage_mount_ram (argv[optind], 
+        atoi (argv[optind + 1]) * 1024);
+      if (ret) 
+        shell_write_error_filename (ret, argv[optind]);
+      }
+    else
+      ret = ERR_USAGE;
+    }
+
+  if (ret == ERR_USAGE)
+    interface_write_stringln ("Usage: mount [{directory} {size_kB}]");
+  if (usage) ret = 0;
+  return ret;
+  }
+
+/*=========================================================================
+
+  shell_cmd_umount
+
+=========================================================================*/
+ErrCode shell_cmd_umount (int argc, char **argv)
+  {
+  int opt;
+  optind = 0;
+  ErrCode ret = 0;
+  BOOL usage = FALSE;
+  while ((opt = getopt (argc, argv, "h")) != -1) 
+    {
+    switch (opt)
+      { 
+      case 'h':
+        usage = TRUE;
+        // Fall through
+      default:
+        interface_write_stringln ("Usage: umount {directories...}");
+        ret = ERR_USAGE;
+      }
+    }
+
+  if (ret == 0)
+    {
+    for (int i = optind; i < argc && ret == 0; i++)
+      {
+      ret = storage_unmount (argv[i]); 
+      if (ret) 
+        shell_write_error_filename (ret, argv[i]);
+      }
+    }
+
+  if (usage) ret = 0;
+  return ret;
+  }
+
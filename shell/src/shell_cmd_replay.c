@@ -0,0 +1,420 @@
+/*=========================================================================
+
+  picolua
+
+  shell/shell_cmd_replay.c
+
+  Replay a script of keystrokes into the shell, as if they had been
+  typed, and report how many bytes were sent to the terminal after
+  each one, and how long it took to deal with.
+
+  Each line of a script is a run of keys, except that lines that
+  start with '#' are comments, and lines that start with '%' are
+  directives:
+
+  %delay N     -- type each of the keys that follow N msec after the
+                  one before it (the default is 0)
+  %wait N      -- wait another N msec before typing the next key
+  %section S   -- start a new section of the report, called S
+
+  The end of a line is not a key. Escapes in keys are \n for the
+  terminal's Enter key, \b for its Backspace key, \e for Escape, \r,
+  \t, \\ and \xHH for any other byte.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <getopt.h>
+#include "shell/shell.h"
+#include <klib/defs.h>
+#include <klib/term.h>
+#include <interface/interface.h>
+#include <storage/storage.h>
+#include <config.h>
+#include "shell/errcodes.h"
+#include "shell/shell_commands.h"
+
+#define REPLAY_MAX_SECTION 15
+
+typedef struct _ReplaySection
+  {
+  char name[REPLAY_MAX_SECTION + 1];
+  int first;          // The first key in the section
+  } ReplaySection;
+
+typedef struct _ReplayScript
+  {
+  InterfaceKey *keys;
+  int count;
+  int size;
+  ReplaySection *sections;
+  int nsections;
+  uint32_t delay;     // Delay for each key, from %delay
+  uint32_t wait;      // Extra delay for the next key, from %wait
+  } ReplayScript;
+
+/*=========================================================================
+
+  shell_cmd_replay_add_key
+
+=========================================================================*/
+static ErrCode shell_cmd_replay_add_key (ReplayScript *script, int c)
+  {
+  if (script->count == script->size)
+    {
+    int size = script->size ? script->size * 2 : 256;
+    InterfaceKey *keys = realloc (script->keys, size * sizeof (InterfaceKey));
+    if (!keys) return ERR_NOMEM;
+    script->keys = keys;
+    script->size = size;
+    }
+  uint32_t delay = script->delay + script->wait;
+  if (delay > 0xFFFF) delay = 0xFFFF;
+  script->keys[script->count].c = (uint8_t)c;
+  script->keys[script->count].delay = (uint16_t)delay;
+  script->count++;
+  script->wait = 0;
+  return 0;
+  }
+
+/*=========================================================================
+
+  shell_cmd_replay_add_section
+
+=========================================================================*/
+static ErrCode shell_cmd_replay_add_section (ReplayScript *script,
+     const char *name)
+  {
+  // A section with no keys yet is just renamed
+  if (script->nsections == 0
+       || script->sections[script->nsections - 1].first < script->count)
+    {
+    ReplaySection *sections = realloc (script->sections,
+      (script->nsections + 1) * sizeof (ReplaySection));
+    if (!sections) return ERR_NOMEM;
+    script->sections = sections;
+    script->nsections++;
+    }
+  ReplaySection *section = &script->sections[script->nsections - 1];
+  strncpy (section->name, name, REPLAY_MAX_SECTION);
+  section->name[REPLAY_MAX_SECTION] = 0;
+  section->first = script->count;
+  return 0;
+  }
+
+/*=========================================================================
+
+  shell_cmd_replay_hex
+
+=========================================================================*/
+static int shell_cmd_replay_hex (char c)
+  {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+  }
+
+/*=========================================================================
+
+  shell_cmd_replay_parse_keys
+
+=========================================================================*/
+static ErrCode shell_cmd_replay_parse_keys (ReplayScript *script,
+     const char *line)
+  {
+  ErrCode ret = 0;
+  while (*line && ret == 0)
+    {
+    int c = (unsigned char)*line++;
+    if (c == '\\')
+      {
+      switch (*line++)
+        {
+        case 'n': c = I_EOL; break;
+        case 'b': c = I_BACKSPACE; break;
+        case 'e': c = 27; break;
+        case 'r': c = 13; break;
+        case 't': c = 9; break;
+        case '\\': c = '\\'; break;
+        case 'x':
+          {
+          int h = shell_cmd_replay_hex (line[0]);
+          int l = h < 0 ? -1 : shell_cmd_replay_hex (line[1]);
+          if (l < 0) return ERR_INVAL;
+          c = h * 16 + l;
+          line += 2;
+          }
+          break;
+        default:
+          return ERR_INVAL;
+        }
+      }
+    ret = shell_cmd_replay_add_key (script, c);
+    }
+  return ret;
+  }
+
+/*=========================================================================
+
+  shell_cmd_replay_parse_line
+
+=========================================================================*/
+static ErrCode shell_cmd_replay_parse_line (ReplayScript *script,
+     char *line)
+  {
+  int len = strlen (line);
+  if (len > 0 && line[len - 1] == '\r') line[len - 1] = 0;
+
+  if (line[0] == '#') return 0;
+  if (line[0] != '%') return shell_cmd_replay_parse_keys (script, line);
+
+  char *arg = line + 1;
+  while (*arg && !isspace ((unsigned char)*arg)) arg++;
+  if (*arg) *arg++ = 0;
+  while (isspace ((unsigned char)*arg)) arg++;
+  if (!*arg) return ERR_INVAL;
+
+  if (strcmp (line + 1, "section") == 0)
+    return shell_cmd_replay_add_section (script, arg);
+  if (strcmp (line + 1, "delay") == 0)
+    script->delay = (uint32_t)atol (arg);
+  else if (strcmp (line + 1, "wait") == 0)
+    script->wait += (uint32_t)atol (arg);
+  else
+    return ERR_INVAL;
+  return 0;
+  }
+
+/*=========================================================================
+
+  shell_cmd_replay_load
+
+=========================================================================*/
+static ErrCode shell_cmd_replay_load (const char *filename,
+     ReplayScript *script)
+  {
+  int n;
+  char *buff;
+  ErrCode ret = storage_read_file (filename, (uint8_t **)&buff, &n);
+  if (ret)
+    {
+    shell_write_error_filename (ret, filename);
+    return ret;
+    }
+  char *p = realloc (buff, n + 1);
+  if (!p)
+    {
+    free (buff);
+    shell_write_error (ERR_NOMEM);
+    return ERR_NOMEM;
+    }
+  buff = p;
+  buff[n] = 0;
+
+  ret = shell_cmd_replay_add_section (script, "");
+  char *line = buff;
+  int lineno = 1;
+  while (line && ret == 0)
+    {
+    char *next = strchr (line, '\n');
+    if (next) *next++ = 0;
+    ret = shell_cmd_replay_parse_line (script, line);
+    if (ret == 0) lineno++;
+    line = next;
+    }
+  free (buff);
+
+  if (ret)
+    {
+    printf ("%s: line %d: ", filename, lineno);
+    shell_write_error (ret);
+    }
+  return ret;
+  }
+
+/*=========================================================================
+
+  shell_cmd_replay_run
+
+  Run shell commands, reading them as usual, until the script has
+  been read. If the keys run out while something else is reading
+  them, such as the editor, it reads from the terminal after that.
+
+=========================================================================*/
+static void shell_cmd_replay_run (void)
+  {
+  char buff [READLINE_MAXINPUT + 1];
+  BOOL interrupted = FALSE;
+  while (interface_replay_remaining () > 0)
+    {
+    interface_write_buff ("$ ", 2);
+    if (!term_get_line (buff, sizeof (buff), &interrupted, 0, NULL)) break;
+    if (!interrupted)
+      shell_do_line (buff);
+    interrupted = FALSE;
+    }
+  }
+
+/*=========================================================================
+
+  shell_cmd_replay_print_key
+
+=========================================================================*/
+static void shell_cmd_replay_print_key (int i, const InterfaceKey *key,
+     const InterfaceKeyStats *stats)
+  {
+  if (key->c >= 32 && key->c < 127)
+    printf ("%6d  '%c'  ", i, key->c);
+  else
+    printf ("%6d  \\x%02X ", i, key->c);
+  printf ("%7lu %9lu", (unsigned long)stats->bytes,
+    (unsigned long)stats->us);
+  interface_write_endl ();
+  }
+
+/*=========================================================================
+
+  shell_cmd_replay_print_row
+
+=========================================================================*/
+static void shell_cmd_replay_print_row (const char *name,
+     const InterfaceKeyStats *stats, int first, int last)
+  {
+  uint32_t bytes = 0;
+  uint64_t us = 0;
+  uint32_t most = 0;
+  for (int i = first; i < last; i++)
+    {
+    bytes += stats[i].bytes;
+    us += stats[i].us;
+    if (stats[i].us > most) most = stats[i].us;
+    }
+  int n = last - first;
+  printf ("%-15s %6d %8lu %9lu %8lu %8lu %8lu", name, n, 
+    (unsigned long)bytes, (unsigned long)(n ? bytes / n : 0), 
+    (unsigned long)(us / 1000), (unsigned long)(n ? us / n : 0),
+    (unsigned long)most);
+  interface_write_endl ();
+  }
+
+/*=========================================================================
+
+  shell_cmd_replay_report
+
+=========================================================================*/
+static void shell_cmd_replay_report (const ReplayScript *script,
+     const InterfaceKeyStats *stats, int typed, BOOL verbose)
+  {
+  if (verbose)
+    {
+    interface_write_stringln ("   Key          Bytes      usec");
+    for (int i = 0; i < typed; i++)
+      shell_cmd_replay_print_key (i, &script->keys[i], &stats[i]);
+    }
+  interface_write_stringln
+    ("Section           Keys    Bytes Bytes/key     msec usec/key usec max");
+  for (int i = 0; i < script->nsections; i++)
+    {
+    const ReplaySection *section = &script->sections[i];
+    int first = section->first;
+    int last = i + 1 < script->nsections
+      ? script->sections[i + 1].first : script->count;
+    if (first >= typed) break;
+    if (last > typed) last = typed;
+    if (first < last)
+      shell_cmd_replay_print_row (section->name[0]
+        ? section->name : "-", stats, first, last);
+    }
+  shell_cmd_replay_print_row ("total", stats, 0, typed);
+  if (typed < script->count)
+    {
+    printf ("Stopped after %d keys of %d", typed, script->count);
+    interface_write_endl ();
+    }
+  }
+
+/*=========================================================================
+
+  shell_cmd_replay
+
+=========================================================================*/
+ErrCode shell_cmd_replay (int argc, char **argv)
+  {
+  int opt;
+  optind = 0;
+  ErrCode ret = 0;
+  BOOL usage = FALSE;
+  BOOL verbose = FALSE;
+  const char *capture_file = NULL;
+  while ((opt = getopt (argc, argv, "hvo:")) != -1)
+    {
+    switch (opt)
+      {
+      case 'v':
+        verbose = TRUE;
+        break;
+      case 'o':
+        capture_file = optarg;
+        break;
+      case 'h':
+        usage = TRUE;
+        // Fall through
+      default:
+        interface_write_stringln ("Usage: replay [-v] [-o file] {script}");
+        ret = ERR_USAGE;
+      }
+    }
+
+  if (ret == 0 && optind != argc - 1)
+    {
+    interface_write_stringln ("Usage: replay [-v] [-o file] {script}");
+    ret = ERR_USAGE;
+    }
+
+  ReplayScript script;
+  memset (&script, 0, sizeof (script));
+  if (ret == 0)
+    ret = shell_cmd_replay_load (argv[optind], &script);
+
+  InterfaceKeyStats *stats = NULL;
+  char *capture = NULL;
+  if (ret == 0)
+    {
+    stats = calloc (script.count + 1, sizeof (InterfaceKeyStats));
+    if (capture_file) capture = malloc (REPLAY_CAPTURE_SIZE);
+    if (!stats || (capture_file && !capture))
+      {
+      ret = ERR_NOMEM;
+      shell_write_error (ret);
+      }
+    }
+
+  if (ret == 0)
+    {
+    if (capture) interface_capture_start (capture, REPLAY_CAPTURE_SIZE);
+    interface_replay_start (script.keys, script.count, stats);
+    shell_cmd_replay_run ();
+    int typed = interface_replay_stop ();
+    int captured = capture ? interface_capture_stop () : 0;
+    interface_write_endl ();
+    shell_cmd_replay_report (&script, stats, typed, verbose);
+    if (capture)
+      {
+      ret = storage_write_file (capture_file, capture, captured);
+      if (ret) shell_write_error_filename (ret, capture_file);
+      }
+    }
+
+  free (capture);
+  free (stats);
+  free (script.keys);
+  free (script.sections);
+  if (usage) ret = 0;
+  return ret;
+  }
+
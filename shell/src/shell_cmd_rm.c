@@ -16,6 +16,7 @@
 #include <config.h>
 #include "shell/errcodes.h"
 #include "shell/shell_commands.h"
+#include "shell/fileutil.h"
 
 /*=========================================================================
 
@@ -28,15 +29,19 @@ ErrCode shell_cmd_rm (int argc, char **argv)
   optind = 0;
   ErrCode ret = 0;
   BOOL usage = FALSE;
-  while ((opt = getopt (argc, argv, "h")) != -1) 
+  BOOL recursive = FALSE;
+  while ((opt = getopt (argc, argv, "hr")) != -1) 
     {
     switch (opt)
       { 
+      case 'r':
+        recursive = TRUE;
+        break;
       case 'h':
         usage = TRUE;
         // Fall through
       default:
-        interface_write_stringln ("Usage: rm {files... dirs...}");
+        interface_write_stringln ("Usage: rm [-r] {files... dirs...}");
         ret = ERR_USAGE;
       }
     }
@@ -45,6 +50,11 @@ ErrCode shell_cmd_rm (int argc, char **argv)
     {
     for (int i = optind; i < argc && ret == 0; i++)
       {
+      if (recursive)
+        {
+        ret = fileutil_remove_tree (argv[i], FALSE);
+        continue;
+        }
       ret = storage_rm (argv[i]); 
       if (ret) 
         shell_write_error_filename (ret, argv[i]);
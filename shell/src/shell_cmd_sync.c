@@ -0,0 +1,62 @@
+/*=========================================================================
+
+  picolua
+
+  shell/shell_cmd_sync.c
+
+  Save the map of blocks in use now, rather than waiting for the shell
+  to be idle. See storage_sync().
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+#include <stdio.h>
+#include <getopt.h>
+#include "shell/shell.h"
+#include <klib/defs.h>
+#include <interface/interface.h>
+#include <storage/storage.h>
+#include <config.h>
+#include "shell/errcodes.h"
+#include "shell/shell_commands.h"
+
+/*=========================================================================
+
+  shell_cmd_sync
+
+=========================================================================*/
+ErrCode shell_cmd_sync (int argc, char **argv)
+  {
+  int opt;
+  optind = 0;
+  ErrCode ret = 0;
+  BOOL usage = FALSE;
+  while ((opt = getopt (argc, argv, "h")) != -1)
+    {
+    switch (opt)
+      {
+      case 'h':
+        usage = TRUE;
+        // Fall through
+      default:
+        interface_write_stringln ("Usage: sync");
+        ret = ERR_USAGE;
+      }
+    }
+
+  if (ret == 0 && optind != argc)
+    {
+    interface_write_stringln ("Usage: sync");
+    ret = ERR_USAGE;
+    }
+
+  if (ret == 0)
+    {
+    ret = storage_sync ();
+    if (ret) shell_write_error (ret);
+    }
+
+  if (usage) ret = 0;
+  return ret;
+  }
+
@@ -0,0 +1,121 @@
+/*=========================================================================
+
+  picolua
+
+  shell/shell_cmd_sync_recv.c
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+#include <stdio.h> 
+#include <getopt.h> 
+#include "shell/shell.h" 
+#include "pico/stdlib.h" 
+#include <klib/defs.h> 
+#include <interface/interface.h>
+#include <storage/storage.h>
+#include <ymodem/ymodem.h>
+#include <ymodem/ysync.h>
+#include <config.h>
+#include "shell/errcodes.h"
+#include "shell/shell.h"
+#include "shell/shell_commands.h"
+
+/*=========================================================================
+
+  shell_cmd_sync_recv_usage
+
+=========================================================================*/
+static void shell_cmd_sync_recv_usage (void)
+  {
+  interface_write_stringln ("Usage: sync-recv [directory]");
+  }
+
+/*=========================================================================
+
+  shell_cmd_sync_recv_do_sync
+
+=========================================================================*/
+static ErrCode shell_cmd_sync_recv_do_sync (const char *dir)
+  {
+  ErrCode ret = 0;
+  FileInfo info;
+  if (dir[0])
+    {
+    ret = storage_info (dir, &info);
+    if (ret == 0 && info.type != STORAGE_TYPE_DIR)
+      ret = ERR_NOTDIR;
+    if (ret)
+      {
+      shell_write_error_filename (ret, dir);
+      return ret;
+      }
+    }
+
+  int updated;
+#if PICO_ON_DEVICE
+  stdio_set_translate_crlf (&stdio_usb, false);
+#endif
+  YmodemErr err = ysync_receive (dir, &updated); 
+#if PICO_ON_DEVICE
+  stdio_set_translate_crlf (&stdio_usb, true);
+#endif
+  if (err != 0)
+    {
+    interface_write_stringln (ymodem_strerror (err));
+    ret = ERR_YMODEM;
+    }
+  else
+    {
+    char s[40];
+    snprintf (s, sizeof (s), "%d file(s) updated", updated);
+    interface_write_stringln (s);
+    }
+  return ret;
+  }
+
+/*=========================================================================
+
+  shell_cmd_sync_recv
+
+=========================================================================*/
+ErrCode shell_cmd_sync_recv (int argc, char **argv)
+  {
+  int opt;
+  optind = 0;
+  ErrCode ret = 0;
+  BOOL usage = FALSE;
+  while ((opt = getopt (argc, argv, "h")) != -1) 
+    {
+    switch (opt)
+      { 
+      case 'h':
+        usage = TRUE;
+        // Fall through
+      default:
+        shell_cmd_sync_recv_usage();
+        ret = ERR_USAGE;
+      }
+    }
+
+  if (ret == 0)
+    {
+    if (optind == argc)
+      {
+      ret = shell_cmd_sync_recv_do_sync ("");
+      }
+    else if (argc - optind == 1)
+      {
+      ret = shell_cmd_sync_recv_do_sync (argv[optind]);
+      }
+    else 
+      {
+      shell_cmd_sync_recv_usage();
+      ret = ERR_USAGE;
+      }
+    }
+
+  if (usage) ret = 0;
+  return ret;
+  }
+
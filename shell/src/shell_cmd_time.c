@@ -0,0 +1,44 @@
+/*=========================================================================
+
+  picolua
+
+  shell/shell_cmd_time.c
+
+  Run a command -- built-in, shell script, or Lua program -- and then
+  report what it cost. See libluapico/measure.h for what is counted.
+  There are no options, so that any options after the command's name
+  belong to the command.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+#include <stdio.h>
+#include "shell/shell.h"
+#include <klib/defs.h>
+#include <interface/interface.h>
+#include <libluapico/measure.h>
+#include <config.h>
+#include "shell/errcodes.h"
+#include "shell/shell_commands.h"
+
+/*=========================================================================
+
+  shell_cmd_time
+
+=========================================================================*/
+ErrCode shell_cmd_time (int argc, char **argv)
+  {
+  if (argc < 2)
+    {
+    interface_write_stringln ("Usage: time {command} [args...]");
+    return ERR_USAGE;
+    }
+
+  Measure measure;
+  measure_start (&measure);
+  ErrCode ret = shell_do_line_argv (argc - 1, argv + 1);
+  measure_stop (&measure);
+  measure_print (&measure);
+  return ret;
+  }
+
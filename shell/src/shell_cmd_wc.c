@@ -0,0 +1,150 @@
+/*=========================================================================
+
+  picolua
+
+  shell/shell_cmd_wc.c
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+#include <stdio.h>
+#include <ctype.h>
+#include <getopt.h>
+#include "shell/shell.h"
+#include <klib/defs.h>
+#include <interface/interface.h>
+#include <storage/storage.h>
+#include <config.h>
+#include "shell/errcodes.h"
+#include "shell/shell_commands.h"
+
+typedef struct _WcCounts
+  {
+  uint32_t lines;
+  uint32_t words;
+  uint32_t bytes;
+  } WcCounts;
+
+/*=========================================================================
+
+  shell_cmd_wc_print
+
+=========================================================================*/
+static void shell_cmd_wc_print (const WcCounts *counts, BOOL lines,
+     BOOL words, BOOL bytes, const char *name)
+  {
+  if (lines) printf ("%7lu ", (unsigned long)counts->lines);
+  if (words) printf ("%7lu ", (unsigned long)counts->words);
+  if (bytes) printf ("%7lu ", (unsigned long)counts->bytes);
+  interface_write_stringln (name);
+  }
+
+/*=========================================================================
+
+  shell_cmd_wc_file
+
+  Count a piece at a time, so we don't need to hold the file in memory.
+
+=========================================================================*/
+static ErrCode shell_cmd_wc_file (const char *filename, WcCounts *counts)
+  {
+  StorageFile *file;
+  ErrCode ret = storage_file_open (filename, STORAGE_OPEN_READ, &file);
+  if (ret == 0)
+    {
+    char buff[256];
+    BOOL in_word = FALSE;
+    int n;
+    do
+      {
+      ret = storage_file_read (file, buff, sizeof (buff), &n);
+      if (ret == 0 && shell_get_interrupt()) ret = ERR_INTERRUPTED;
+      for (int i = 0; i < n && ret == 0; i++)
+        {
+        if (buff[i] == '\n') counts->lines++;
+        if (isspace ((unsigned char)buff[i]))
+          in_word = FALSE;
+        else if (!in_word)
+          {
+          in_word = TRUE;
+          counts->words++;
+          }
+        }
+      counts->bytes += n;
+      } while (ret == 0 && n > 0);
+    storage_file_close (file);
+    }
+  return ret;
+  }
+
+/*=========================================================================
+
+  shell_cmd_wc
+
+=========================================================================*/
+ErrCode shell_cmd_wc (int argc, char **argv)
+  {
+  int opt;
+  optind = 0;
+  ErrCode ret = 0;
+  BOOL usage = FALSE;
+  BOOL lines = FALSE;
+  BOOL words = FALSE;
+  BOOL bytes = FALSE;
+  while ((opt = getopt (argc, argv, "hlwc")) != -1)
+    {
+    switch (opt)
+      {
+      case 'l':
+        lines = TRUE;
+        break;
+      case 'w':
+        words = TRUE;
+        break;
+      case 'c':
+        bytes = TRUE;
+        break;
+      case 'h':
+        usage = TRUE;
+        // Fall through
+      default:
+        interface_write_stringln ("Usage: wc [-lwc] {files...}");
+        ret = ERR_USAGE;
+      }
+    }
+
+  if (ret == 0 && optind == argc)
+    {
+    interface_write_stringln ("Usage: wc [-lwc] {files...}");
+    ret = ERR_USAGE;
+    }
+
+  if (ret == 0)
+    {
+    if (!lines && !words && !bytes)
+      lines = words = bytes = TRUE;
+    WcCounts total = {0, 0, 0};
+    for (int i = optind; i < argc && ret == 0; i++)
+      {
+      WcCounts counts = {0, 0, 0};
+      ret = shell_cmd_wc_file (argv[i], &counts);
+      if (ret == ERR_INTERRUPTED)
+        shell_write_error (ret);
+      else if (ret)
+        shell_write_error_filename (ret, argv[i]);
+      else
+        {
+        shell_cmd_wc_print (&counts, lines, words, bytes, argv[i]);
+        total.lines += counts.lines;
+        total.words += counts.words;
+        total.bytes += counts.bytes;
+        }
+      }
+    if (ret == 0 && argc - optind > 1)
+      shell_cmd_wc_print (&total, lines, words, bytes, "total");
+    }
+
+  if (usage) ret = 0;
+  return ret;
+  }
+
@@ -26,18 +26,32 @@
 =========================================================================*/
 static void shell_cmd_yrecv_usage (void)
   {
-  interface_write_stringln ("Usage: yrecv [file]");
+  interface_write_stringln ("Usage: yrecv [-g] [file | directory]");
   }
 
 /*=========================================================================
 
   shell_cmd_yrecv_do_recv
 
+  If the argument is an existing directory, receive all the files
+  the sender offers into that directory. Otherwise, the argument
+  (if any) is the name for the first file.
+
 =========================================================================*/
-static ErrCode shell_cmd_yrecv_do_receive (const char *filename)
+static ErrCode shell_cmd_yrecv_do_receive (const char *filename, 
+          BOOL streaming)
   {
   ErrCode ret = 0;
-  YmodemErr err = ymodem_receive (filename, XMODEM_MAX); 
+  YmodemErr err;
+  FileInfo info;
+  if (filename && storage_info (filename, &info) == 0 
+       && info.type == STORAGE_TYPE_DIR)
+    {
+    int count;
+    err = ymodem_receive_batch (filename, XMODEM_MAX, streaming, &count); 
+    }
+  else
+    err = ymodem_receive (filename, XMODEM_MAX, streaming); 
   if (err != 0)
     {
     interface_write_stringln (ymodem_strerror (err));
@@ -57,10 +71,14 @@ ErrCode shell_cmd_yrecv (int argc, char **argv)
   optind = 0;
   ErrCode ret = 0;
   BOOL usage = FALSE;
-  while ((opt = getopt (argc, argv, "h")) != -1) 
+  BOOL streaming = FALSE;
+  while (ret == 0 && (opt = getopt (argc, argv, "gh")) != -1) 
     {
     switch (opt)
       { 
+      case 'g':
+        streaming = TRUE;
+        break;
       case 'h':
         usage = TRUE;
         // Fall through
@@ -74,12 +92,12 @@ ErrCode shell_cmd_yrecv (int argc, char **argv)
     {
     if (optind == argc)
       {
-      ret = shell_cmd_yrecv_do_receive (NULL);
+      ret = shell_cmd_yrecv_do_receive (NULL, streaming);
       }
     else if (argc - optind == 1)
       {
       // One arg
-      ret = shell_cmd_yrecv_do_receive (argv[optind]);
+      ret = shell_cmd_yrecv_do_receive (argv[optind], streaming);
       }
     else 
       {
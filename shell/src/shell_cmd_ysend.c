@@ -27,21 +27,36 @@
 =========================================================================*/
 static void shell_cmd_ysend_usage (void)
   {
-  interface_write_stringln ("Usage: ysend [file]");
+  interface_write_stringln ("Usage: ysend {files...}");
   }
 
 /*=========================================================================
 
   shell_cmd_ysend_do_send
 
+  Send all the files in one session. We check that they are all
+  regular files first, because there's no way to skip a file
+  once the transfer has started. 
+
 =========================================================================*/
-static ErrCode shell_cmd_ysend_do_send (const char *filename)
+static ErrCode shell_cmd_ysend_do_send (int count, char **filenames)
   {
   ErrCode ret = 0;
+  for (int i = 0; i < count && ret == 0; i++)
+    {
+    FileInfo info;
+    ret = storage_info (filenames[i], &info);
+    if (ret == 0 && info.type == STORAGE_TYPE_DIR)
+      ret = ERR_ISDIR;
+    if (ret)
+      shell_write_error_filename (ret, filenames[i]);
+    }
+  if (ret) return ret;
+
 #if PICO_ON_DEVICE
   stdio_set_translate_crlf (&stdio_usb, false);
 #endif
-  YmodemErr err = ymodem_send (filename); 
+  YmodemErr err = ymodem_send_files (count, filenames); 
 #if PICO_ON_DEVICE
   stdio_set_translate_crlf (&stdio_usb, true);
 #endif
@@ -79,10 +94,9 @@ ErrCode shell_cmd_ysend (int argc, char **argv)
 
   if (ret == 0)
     {
-    if (argc - optind == 1)
+    if (argc - optind >= 1)
       {
-      // One arg
-      ret = shell_cmd_ysend_do_send (argv[optind]);
+      ret = shell_cmd_ysend_do_send (argc - optind, argv + optind);
       }
     else 
       {
@@ -0,0 +1,321 @@
+/*=========================================================================
+
+  picolua
+
+  shell/shell_registry.c
+
+  Built-in commands, and commands registered at run time, are indexed
+  by an open-addressed hash table of their names. The table has more
+  slots than there can be commands, so a search always finds a free
+  slot, and usually finds the command in the first slot it tries. 
+  The built-in commands are in a constant table, so they take no RAM 
+  beyond their index entries. 
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+#include <stdio.h> 
+#include <stdlib.h> 
+#include <string.h> 
+#include <stdint.h> 
+#include "shell/shell.h" 
+#include <klib/defs.h> 
+#include <klib/vector.h> 
+#include <interface/interface.h>
+#include "shell/errcodes.h"
+#include "shell/shell_commands.h"
+#include "shell/shell_registry.h"
+
+// Number of slots in the hash table -- must be a power of two, and 
+//   larger than SHELL_MAX_COMMANDS
+#define SHELL_COMMAND_SLOTS 64
+
+static const ShellCommand shell_builtins[] =
+  {
+  {"cat", shell_cmd_cat, "Show the contents of files", 0, NULL, NULL},
+  {"compress", shell_cmd_compress, "Compress or expand files", 0, NULL, NULL},
+  {"cp", shell_cmd_cp, "Copy files or directories", 0, NULL, NULL},
+  {"df", shell_cmd_df, "Show free space", 0, NULL, NULL},
+  {"du", shell_cmd_du, "Show space used by files", 0, NULL, NULL},
+  {"echo", shell_cmd_echo, "Print arguments", 0, NULL, NULL},
+  {"edit", shell_cmd_edit, "Run the editor", 0, NULL, NULL},
+  {"find", shell_cmd_find, "Find files by name", 0, NULL, NULL},
+  {"format", shell_cmd_format, "Format the filesystem", 0, NULL, NULL},
+  {"grep", shell_cmd_grep, "Search files for text", 0, NULL, NULL},
+  {"head", shell_cmd_head, "Show the start of files", 0, NULL, NULL},
+  {"help", shell_cmd_help, "List commands", 0, NULL, NULL},
+  {"i2cdetect", shell_cmd_i2cdetect, "Scan for I2C devices", 0, NULL, NULL},
+  {"ls", shell_cmd_ls, "List files", 0, NULL, NULL},
+  {"lua", shell_cmd_lua, "Run Lua", 0, NULL, NULL},
+  {"mkdir", shell_cmd_mkdir, "Make directories", 0, NULL, NULL},
+  {"mount", shell_cmd_mount, "Mount a filesystem in RAM", 0, NULL, NULL},
+  {"mv", shell_cmd_mv, "Move or rename files", 0, NULL, NULL},
+  {"replay", shell_cmd_replay, "Replay keystrokes from a script", 0, NULL, 
+    NULL},
+  {"rm", shell_cmd_rm, "Remove files", 0, NULL, NULL},
+  {"rmdir", shell_cmd_rm, "Remove directories", 0, NULL, NULL},
+  {"sync", shell_cmd_sync, "Save the map of blocks in use", 0, NULL, NULL},
+  {"sync-recv", shell_cmd_sync_recv, "Receive files with picosync", 0, NULL,
+    NULL},
+  {"tail", shell_cmd_tail, "Show the end of files", 0, NULL, NULL},
+  {"time", shell_cmd_time, "Measure what a command costs", 0, NULL, NULL},
+  {"umount", shell_cmd_umount, "Unmount a filesystem in RAM", 0, NULL, NULL},
+  {"wc", shell_cmd_wc, "Count lines, words and bytes", 0, NULL, NULL},
+  {"yrecv", shell_cmd_yrecv, "Receive files using YModem", 0, NULL, NULL},
+  {"ysend", shell_cmd_ysend, "Send files using YModem", 0, NULL, NULL},
+  };
+
+#define SHELL_NUM_BUILTINS \
+  ((int)(sizeof (shell_builtins) / sizeof (shell_builtins[0])))
+
+static const ShellCommand *shell_index[SHELL_COMMAND_SLOTS];
+static BOOL shell_index_built = FALSE;
+// Commands added by shell_register_command, as ShellCommand*
+static Vector *shell_registered = NULL;
+static const ShellCommand *shell_current = NULL;
+
+/*=========================================================================
+
+  shell_command_hash
+
+  FNV-1a
+
+=========================================================================*/
+static uint32_t shell_command_hash (const char *name)
+  {
+  uint32_t h = 2166136261u;
+  while (*name)
+    {
+    h ^= (uint8_t)*name++;
+    h *= 16777619u;
+    }
+  return h;
+  }
+
+/*=========================================================================
+
+  shell_index_slot
+
+  Return the slot that holds the named command or, if it isn't there,
+  the empty slot where it would go.
+
+=========================================================================*/
+static int shell_index_slot (const char *name)
+  {
+  int slot = shell_command_hash (name) & (SHELL_COMMAND_SLOTS - 1);
+  while (shell_index[slot] && strcmp (shell_index[slot]->name, name) != 0)
+    slot = (slot + 1) & (SHELL_COMMAND_SLOTS - 1);
+  return slot;
+  }
+
+/*=========================================================================
+
+  shell_index_build
+
+  Fill the index from scratch. This is done the first time a command
+  is looked up, and again when one is removed, because an entry can't
+  simply be deleted from an open-addressed table.
+
+=========================================================================*/
+static void shell_index_build (void)
+  {
+  memset (shell_index, 0, sizeof (shell_index));
+  for (int i = 0; i < SHELL_NUM_BUILTINS; i++)
+    shell_index[shell_index_slot (shell_builtins[i].name)] = 
+      &shell_builtins[i];
+  if (shell_registered)
+    {
+    int l = vector_length (shell_registered);
+    for (int i = 0; i < l; i++)
+      {
+      const ShellCommand *cmd = vector_get (shell_registered, i);
+      shell_index[shell_index_slot (cmd->name)] = cmd;
+      }
+    }
+  shell_index_built = TRUE;
+  }
+
+/*=========================================================================
+
+  shell_find_command
+
+=========================================================================*/
+const ShellCommand *shell_find_command (const char *name)
+  {
+  if (!shell_index_built) shell_index_build();
+  return shell_index[shell_index_slot (name)];
+  }
+
+/*=========================================================================
+
+  shell_run_command
+
+=========================================================================*/
+ErrCode shell_run_command (const ShellCommand *cmd, int argc, char **argv)
+  {
+  // Commands can run other commands, so we have to put back the 
+  //   one that was running before
+  const ShellCommand *save = shell_current;
+  shell_current = cmd;
+  ErrCode ret = cmd->fn (argc, argv);
+  shell_current = save;
+  return ret;
+  }
+
+/*=========================================================================
+
+  shell_command_data
+
+=========================================================================*/
+void *shell_command_data (void)
+  {
+  return shell_current ? shell_current->user_data : NULL;
+  }
+
+/*=========================================================================
+
+  shell_command_free
+
+=========================================================================*/
+static void shell_command_free (void *p)
+  {
+  ShellCommand *cmd = p;
+  free ((char *)cmd->name);
+  free ((char *)cmd->help);
+  free (cmd);
+  }
+
+/*=========================================================================
+
+  shell_find_registered
+
+  Returns the position of the named command in shell_registered, 
+  or -1.
+
+=========================================================================*/
+static int shell_find_registered (const char *name)
+  {
+  if (!shell_registered) return -1;
+  int l = vector_length (shell_registered);
+  for (int i = 0; i < l; i++)
+    {
+    const ShellCommand *cmd = vector_get (shell_registered, i);
+    if (strcmp (cmd->name, name) == 0) return i;
+    }
+  return -1;
+  }
+
+/*=========================================================================
+
+  shell_register_command
+
+=========================================================================*/
+ErrCode shell_register_command (const char *name, ShellCommandFn fn, 
+          const char *help, int flags, void *user_data, 
+          ShellCommandDestroyFn destroy)
+  {
+  if (!name[0] || strchr (name, '=') || strchr (name, '/')) 
+    return ERR_INVAL;
+  const ShellCommand *old = shell_find_command (name);
+  if (old && !(old->flags & SHELL_CMD_RUNTIME)) return ERR_EXIST;
+
+  if (!shell_registered)
+    {
+    shell_registered = vector_create (shell_command_free);
+    if (!shell_registered) return ERR_NOMEM;
+    }
+  if (SHELL_NUM_BUILTINS + vector_length (shell_registered) 
+       - (old ? 1 : 0) >= SHELL_MAX_COMMANDS)
+    return ERR_NOSPC;
+  if (old)
+    {
+    ErrCode err = shell_unregister_command (name);
+    if (err) return err;
+    }
+
+  ShellCommand *cmd = malloc (sizeof (ShellCommand));
+  if (!cmd) return ERR_NOMEM;
+  cmd->name = strdup (name);
+  cmd->help = help ? strdup (help) : NULL;
+  cmd->fn = fn;
+  cmd->flags = flags | SHELL_CMD_RUNTIME;
+  cmd->user_data = user_data;
+  cmd->destroy = destroy;
+  if (!cmd->name || (help && !cmd->help) 
+       || !vector_append (shell_registered, cmd))
+    {
+    shell_command_free (cmd);
+    return ERR_NOMEM;
+    }
+
+  shell_index[shell_index_slot (name)] = cmd;
+  return 0;
+  }
+
+/*=========================================================================
+
+  shell_unregister_command
+
+=========================================================================*/
+ErrCode shell_unregister_command (const char *name)
+  {
+  int i = shell_find_registered (name);
+  if (i < 0) return ERR_NOENT;
+  const ShellCommand *cmd = vector_get (shell_registered, i);
+  if (shell_current == cmd) return ERR_BUSY;
+  // The owner is told only once the command is gone, so that it can 
+  //   count what it has left
+  ShellCommandDestroyFn destroy = cmd->destroy;
+  void *user_data = cmd->user_data;
+  vector_remove (shell_registered, i);
+  shell_index_build ();
+  if (destroy) destroy (user_data);
+  return 0;
+  }
+
+/*=========================================================================
+
+  shell_count_commands
+
+=========================================================================*/
+int shell_count_commands (const void *user_data)
+  {
+  int n = 0;
+  if (shell_registered)
+    {
+    int l = vector_length (shell_registered);
+    for (int i = 0; i < l; i++)
+      {
+      const ShellCommand *cmd = vector_get (shell_registered, i);
+      if (cmd->user_data == user_data) n++;
+      }
+    }
+  return n;
+  }
+
+/*=========================================================================
+
+  shell_cmd_help
+
+=========================================================================*/
+static void shell_cmd_help_one (const ShellCommand *cmd)
+  {
+  printf ("%-10s %s%s", cmd->name, cmd->help ? cmd->help : "",
+    (cmd->flags & SHELL_CMD_LUA) ? " (Lua)" : "");
+  interface_write_endl();
+  }
+
+ErrCode shell_cmd_help (int argc, char **argv)
+  {
+  (void)argc; (void)argv;
+  for (int i = 0; i < SHELL_NUM_BUILTINS; i++)
+    shell_cmd_help_one (&shell_builtins[i]);
+  if (shell_registered)
+    {
+    int l = vector_length (shell_registered);
+    for (int i = 0; i < l; i++)
+      shell_cmd_help_one (vector_get (shell_registered, i));
+    }
+  return 0;
+  }
+
@@ -0,0 +1,59 @@
+/*============================================================================
+ * glob.h
+ *
+ * Filename wildcard expansion. A pattern is a path, any component of
+ * which may contain wildcards: '*' matches any run of characters, '?'
+ * any one character, and [abc], [a-z] or [!abc] one of a set. A
+ * backslash makes the next character literal. A component that is
+ * exactly "**" matches any number of directories, including none.
+ * Names that start with a '.' are only matched by a component that
+ * also starts with one, and "**" does not go into such directories.
+ * A pattern that ends in '/' matches only directories.
+ *
+ * The pattern is compiled once, and the directory tree is then
+ * searched one component at a time, going only into directories that
+ * can lead to a match. Only the matching entries of the directories
+ * currently being searched are held in memory, never a whole tree,
+ * and the matches are reported in alphabetical order.
+ *
+ * Copyright (c)2021 Kevin Boone.
+ * =========================================================================*/
+
+#pragma once
+
+#include <klib/defs.h>
+#include <storage/storage.h>
+
+// Most components a pattern can have
+#define GLOB_MAX_COMPONENTS 31
+
+/** Called by glob_run() for each match. The path is absolute if the
+    pattern was. Should return 0 to continue, or an error code to stop
+    the search. */
+typedef ErrCode (*GlobFn)(const char *path, const FileInfo *info,
+    void *user_data);
+
+struct _Glob;
+typedef struct _Glob Glob;
+
+BEGIN_DECLS
+
+/** Compile a pattern. Returns ERR_NOMEM, or ERR_BADARGS if the pattern
+    has too many components. */
+extern ErrCode glob_compile (const char *pattern, Glob **glob);
+
+/** Call fn for each file or directory that matches. A directory that
+    cannot be read has no matches, and is not an error. Returns 0,
+    or the first error from fn, or ERR_NOMEM. */
+extern ErrCode glob_run (const Glob *self, GlobFn fn, void *user_data);
+
+extern void    glob_destroy (Glob *self);
+
+/** Returns TRUE if s contains any unescaped wildcard characters. */
+extern BOOL    glob_has_wildcards (const char *s);
+
+/** Returns TRUE if name matches a single-component pattern. */
+extern BOOL    glob_match (const char *pattern, const char *name);
+
+END_DECLS
+
@@ -413,6 +413,25 @@ typedef struct lfs {
     lfs_size_t file_max;
     lfs_size_t attr_max;
 
+    // Net number of metadata blocks allocated since mount. Added for
+    //   picolua, so storage can keep a count of used blocks without
+    //   traversing the filesystem.
+    lfs_ssize_t meta_blocks;
+
+    // Also added for picolua: an optional index of which metadata pair
+    //   of a directory holds each name, for directories that span 
+    //   several pairs. dir is the directory's first pair. name_lookup
+    //   returns true, and sets pair, if it has an entry for the name. 
+    //   Entries are checked before they are used, but a pair can only
+    //   be trusted to belong to the same directory while meta_epoch is
+    //   unchanged. meta_epoch changes whenever a metadata pair is 
+    //   allocated, dropped or relocated.
+    bool (*name_lookup)(struct lfs *lfs, const lfs_block_t dir[2],
+            const char *name, lfs_size_t len, lfs_block_t pair[2]);
+    void (*name_update)(struct lfs *lfs, const lfs_block_t dir[2],
+            const char *name, lfs_size_t len, const lfs_block_t pair[2]);
+    uint32_t meta_epoch;
+
 #ifdef LFS_MIGRATE
     struct lfs1 *lfs1;
 #endif
@@ -670,6 +689,18 @@ lfs_ssize_t lfs_fs_size(lfs_t *lfs);
 // Returns a negative error code on failure.
 int lfs_fs_traverse(lfs_t *lfs, int (*cb)(void*, lfs_block_t), void *data);
 
+#ifndef LFS_READONLY
+// Set up the block allocator from a map of the blocks in use, with bit
+// (n % 32) of map[n / 32] set if block n is in use. This saves the
+// traversal that the first allocation after mounting would otherwise do.
+// Added for picolua.
+//
+// The map must be current -- for example, saved at the end of the
+// previous session, with nothing written since. Fails with LFS_ERR_INVAL
+// if lookahead_size is too small to cover every block.
+int lfs_alloc_prime(lfs_t *lfs, const uint32_t *map);
+#endif
+
 #ifndef LFS_READONLY
 #ifdef LFS_MIGRATE
 // Attempts to migrate a previous version of littlefs
@@ -0,0 +1,79 @@
+/*============================================================================
+ * lzss.h
+ *
+ * A small LZSS compressor and decompressor, used for compressed files
+ * in storage. Both work a piece at a time, so neither the original nor
+ * the compressed data need ever be held in memory all at once. The
+ * decompressor needs LZSS_WINDOW bytes of RAM, plus a small input
+ * buffer; the compressor needs about five times as much.
+ *
+ * The compressed data is a sequence of groups. Each group starts with a
+ * flag byte, whose bits (least significant first) describe the following
+ * eight items. A zero bit means the item is a literal byte; a one means
+ * it is a two-byte reference to earlier data, holding
+ * (offset - 1) << LZSS_LEN_BITS | (length - LZSS_MIN_MATCH),
+ * most significant byte first. There is no end marker -- the caller
+ * has to know how much data to expect.
+ *
+ * Copyright (c)2021 Kevin Boone.
+ * =========================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include <klib/defs.h>
+
+#define LZSS_OFFSET_BITS 11
+#define LZSS_LEN_BITS    5
+#define LZSS_WINDOW      (1 << LZSS_OFFSET_BITS)
+#define LZSS_MIN_MATCH   3
+#define LZSS_MAX_MATCH   (LZSS_MIN_MATCH + (1 << LZSS_LEN_BITS) - 1)
+
+/** Sink for compressed data. Should return 0, or an error code that
+    will be passed back to the caller of the encoder. */
+typedef int (*LzssWriteFn) (const uint8_t *buf, int len, void *user_data);
+
+/** Source of compressed data. Should return the number of bytes
+    copied into buf, zero at end of data, or -1 on error. */
+typedef int (*LzssReadFn) (uint8_t *buf, int len, void *user_data);
+
+struct _LzssEncoder;
+typedef struct _LzssEncoder LzssEncoder;
+struct _LzssDecoder;
+typedef struct _LzssDecoder LzssDecoder;
+
+BEGIN_DECLS
+
+/** Create an encoder, which will pass its output to fn. Returns NULL
+    if there isn't enough memory. */
+extern LzssEncoder *lzss_encoder_new (LzssWriteFn fn, void *user_data);
+
+/** Compress len bytes. Returns zero, or the first non-zero value
+    returned by the sink. */
+extern int lzss_encoder_write (LzssEncoder *self, const uint8_t *buf,
+          int len);
+
+/** Compress and write out any data that is still buffered. */
+extern int lzss_encoder_finish (LzssEncoder *self);
+
+extern void lzss_encoder_destroy (LzssEncoder *self);
+
+/** Create a decoder that will read compressed data from fn, and
+    produce size bytes of output. Returns NULL if there isn't
+    enough memory. */
+extern LzssDecoder *lzss_decoder_new (LzssReadFn fn, void *user_data,
+          uint32_t size);
+
+/** Decompress up to len bytes into buf. Returns the number of bytes
+    produced, zero at the end of the data, or -1 if the compressed
+    data could not be read, or is corrupt. */
+extern int lzss_decoder_read (LzssDecoder *self, uint8_t *buf, int len);
+
+/** Start again from the beginning. The caller is responsible
+    for rewinding the source. */
+extern void lzss_decoder_reset (LzssDecoder *self);
+
+extern void lzss_decoder_destroy (LzssDecoder *self);
+
+END_DECLS
+
@@ -7,11 +7,19 @@
 #pragma once
 
 #include <klib/defs.h>
-#include <klib/list.h>
+#include <klib/vector.h>
 #include <config.h>
 
 #define STORAGE_NAME_MAX MAX_FNAME 
 
+// Most filesystems that can be mounted in RAM, and the longest name
+//   of the directory they are mounted on
+#define STORAGE_MAX_MOUNTS 2
+#define STORAGE_MOUNT_NAME_MAX 15
+
+// Deepest directory tree that storage_walk() will go into
+#define STORAGE_WALK_DEPTH 16
+
 typedef ErrCode (*StorageEnumBytesFn)(uint8_t byte, void *user_data);
 
 typedef enum _FileType
@@ -23,15 +31,51 @@ typedef enum _FileType
 typedef struct _FileInfo
   {
   FileType type;
-  uint32_t size;
+  uint32_t size;         // Size of the data, after any decompression
+  uint32_t stored_size;  // Size actually stored 
+  BOOL compressed;
   char name[STORAGE_NAME_MAX + 1];
   } FileInfo;
 
+typedef enum _StorageOpenMode
+  {
+  STORAGE_OPEN_READ = 0,
+  STORAGE_OPEN_WRITE = 1, // Create or truncate
+  STORAGE_OPEN_APPEND = 2 // Create if necessary 
+  } StorageOpenMode;
+
+typedef enum _StorageWalkEvent
+  {
+  STORAGE_WALK_FILE = 0,
+  STORAGE_WALK_DIR_PRE = 1, // Before the directory's contents
+  STORAGE_WALK_DIR_POST = 2 // After them
+  } StorageWalkEvent;
+
+/** Called by storage_walk() for each entry in a tree. Should return 0
+    to continue, or an error code to stop the walk. */
+typedef ErrCode (*StorageWalkFn)(const char *path, const FileInfo *info,
+                 StorageWalkEvent event, void *user_data);
+
+// An open file. The implementation is private to storage.c 
+struct _StorageFile;
+typedef struct _StorageFile StorageFile;
+
+// An open directory
+struct _StorageDir;
+typedef struct _StorageDir StorageDir;
+
 BEGIN_DECLS
 
 extern void    storage_init (void);
 extern void    storage_cleanup (void);
 
+/** Save the map of blocks in use, so the next boot does not have to
+    scan the filesystem. Does nothing if the filesystem has not changed
+    since the last call. Called by storage_cleanup(), by the sync 
+    command, and by the shell when it has been idle at its prompt for
+    a while. */
+extern ErrCode storage_sync (void);
+
 extern ErrCode storage_read_file (const char *filemame, uint8_t **buff,
                   int *n);
 
@@ -48,7 +92,11 @@ extern ErrCode storage_append_file (const char *filename,
 
 extern ErrCode storage_format (void);
 
-/** Get total and used storage in bytes. */
+/** Get total and used storage in bytes, for the filesystem that holds
+    path, or for flash if path is NULL. On flash, the used figure comes
+    from a running count of blocks, so this is quick, except the first 
+    time it is called, and after an error writing a file. Then the 
+    count has to be worked out by reading the whole filesystem. */
 extern ErrCode storage_df (const char *path, 
           uint32_t *used, uint32_t *total);
 
@@ -68,9 +116,31 @@ extern ErrCode storage_enumerate_bytes (const char *path,
 /** Delete a file or an empty directory. */
 extern ErrCode storage_rm (const char *path);
 
-/** Write the directory contents into a List of char* (which must already have
+/** Write the directory contents into a Vector of char* (which must already have
     been initialized. */
-extern ErrCode storage_list_dir (const char *path, List *list);
+extern ErrCode storage_list_dir (const char *path, Vector *list);
+
+/** Open a directory, to read its entries one at a time, without 
+    having to hold the whole list in memory. */
+extern ErrCode storage_dir_open (const char *path, StorageDir **dir);
+
+/** Read the next entry from a directory into info, returning FALSE at
+    the end of the directory, or if it can't be read. Entries come in 
+    the order the filesystem keeps them, which is not quite alphabetical;
+    "." and ".." are skipped. As with storage_info(), the size of a
+    compressed file is its size after decompression. */
+extern BOOL    storage_dir_read (StorageDir *dir, FileInfo *info);
+
+extern void    storage_dir_close (StorageDir *dir);
+
+/** Call fn for everything in the tree starting at path, which can be
+    a file or a directory, in directory order. Each directory is 
+    reported both before and after its contents, so the callback can 
+    remove entries as it goes. The walk does not recurse, and uses a
+    fixed amount of memory, but stops with ERR_NAMETOOLONG if the tree
+    is more than STORAGE_WALK_DEPTH directories deep. */
+extern ErrCode storage_walk (const char *path, StorageWalkFn fn, 
+                 void *user_data);
 
 /** Copy a file. Both arguments must be filenames, not directories. */
 extern ErrCode storage_copy_file (const char *from, const char *to);
@@ -100,5 +170,58 @@ extern void storage_get_dir (const char *path,
 
 extern ErrCode storage_rename (const char *source, const char *target);
 
+/** Open a file for streaming access, so that callers need not hold the
+    whole file in memory. On success, *file must eventually be passed
+    to storage_file_close(). */
+extern ErrCode storage_file_open (const char *path, StorageOpenMode mode,
+                  StorageFile **file);
+
+/** Read up to count bytes from the current position. *n is set to 
+    the number of bytes actually read, which will be zero at 
+    end-of-file. */
+extern ErrCode storage_file_read (StorageFile *file, void *buff, 
+                  int count, int *n);
+
+extern ErrCode storage_file_write (StorageFile *file, const void *buff, 
+                  int count);
+
+/** Set the read/write position, measured from the start of the file. 
+    In a compressed file, only reading is supported, and seeking
+    backwards means decompressing again from the start; a file being
+    written compressed returns ERR_NOTIMPLEMENTED. */
+extern ErrCode storage_file_seek (StorageFile *file, int offset);
+
+/** Returns the size of the file, or -1 if it can't be determined. */
+extern int     storage_file_size (StorageFile *file);
+
+extern ErrCode storage_file_close (StorageFile *file);
+
+/** Turn on or off compression of files created from now on. Compressed
+    files are decompressed transparently when they are read, whatever 
+    this setting. */
+extern void storage_set_compression (BOOL compress);
+
+extern BOOL storage_get_compression (void);
+
+/** Compress, or decompress, an existing file in place. */
+extern ErrCode storage_compress_file (const char *path, BOOL compress);
+
+/** Create an empty filesystem of size bytes in RAM, and mount it on
+    dir, which must be a single directory in the root (e.g., "/tmp"). 
+    The directory is created on flash if it doesn't exist; anything
+    in it is hidden until the filesystem is unmounted. All the 
+    storage_xxx functions work on files in any mounted filesystem,
+    except that storage_rename() can only move a file, not a
+    directory, between filesystems -- it returns ERR_NOTIMPLEMENTED.*/
+extern ErrCode storage_mount_ram (const char *dir, int size);
+
+/** Unmount a filesystem in RAM, discarding its contents. Fails with
+    ERR_BUSY if any file in it is open. */
+extern ErrCode storage_unmount (const char *dir);
+
+/** Add the directories on which filesystems are mounted to list, 
+    as char*. */
+extern void storage_list_mounts (Vector *list);
+
 END_DECLS
 
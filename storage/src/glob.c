@@ -0,0 +1,526 @@
+/*=========================================================================
+
+  picolua
+
+  storage/glob.c
+
+  Filename wildcard expansion. See glob.h for the pattern syntax.
+
+  A compiled pattern is a list of components, each of which is a
+  literal name, a wildcard pattern, or "**". The search is a small
+  state machine: the state at each directory is the set of components
+  that the next name could match, held as a bitmask. "**" can match
+  no directories at all, so whenever it is in the set, the component
+  after it is too. A directory entry that leaves the set empty can
+  never lead to a match, and is dropped as soon as it is read. When
+  the only component that can match is a literal name, we don't read
+  the directory at all, but just look the name up.
+
+  The search doesn't recurse: it keeps a stack of the directories it
+  is in, each with the sorted list of its entries still to visit, so 
+  the C stack it uses doesn't grow with the depth of the tree.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <config.h>
+#include <shell/errcodes.h>
+#include <klib/vector.h>
+#include "storage/storage.h"
+#include "storage/glob.h"
+
+typedef enum _GlobCompType
+  {
+  GLOB_LITERAL = 0,
+  GLOB_WILD = 1,
+  GLOB_DSTAR = 2
+  } GlobCompType;
+
+typedef struct _GlobComp
+  {
+  GlobCompType type;
+  BOOL dot; // Component may match names that start with '.'
+  const char *text;
+  } GlobComp;
+
+struct _Glob
+  {
+  int ncomp;
+  BOOL absolute;
+  BOOL dirs_only;
+  GlobComp comp[GLOB_MAX_COMPONENTS];
+  char text[];
+  };
+
+// A directory entry that is still of interest, and the set of
+//   components that could match the entry after it
+typedef struct _GlobEntry
+  {
+  uint32_t states;
+  uint32_t size;
+  uint32_t stored_size;
+  BOOL compressed;
+  FileType type;
+  char name[];
+  } GlobEntry;
+
+// A directory being searched: the entries still to visit, and the 
+//   length of the directory's path
+typedef struct _GlobLevel
+  {
+  Vector *entries;
+  int next;
+  int path_len;
+  } GlobLevel;
+
+// The state of a search. There is a level for each directory from the 
+//   start of the search, down to STORAGE_WALK_DEPTH directories below it
+typedef struct _GlobRun
+  {
+  const Glob *glob;
+  GlobFn fn;
+  void *user_data;
+  char path[MAX_PATH + 2];
+  GlobLevel levels[STORAGE_WALK_DEPTH + 1];
+  } GlobRun;
+
+/*=========================================================================
+
+  glob_match_char
+
+  Match the single character c against the start of the pattern p.
+  Returns the number of pattern characters used, or zero if c does
+  not match.
+
+=========================================================================*/
+static int glob_match_char (const char *p, unsigned char c)
+  {
+  switch (*p)
+    {
+    case 0:
+      return 0;
+    case '?':
+      return 1;
+    case '\\':
+      if (p[1] == 0) return c == '\\';
+      return (unsigned char)p[1] == c ? 2 : 0;
+    case '[':
+      {
+      const char *q = p + 1;
+      BOOL negate = (*q == '!' || *q == '^');
+      if (negate) q++;
+      BOOL matched = FALSE;
+      BOOL first = TRUE;
+      while (*q && (first || *q != ']'))
+        {
+        first = FALSE;
+        if (*q == '\\' && q[1]) q++;
+        unsigned char lo = (unsigned char)*q++;
+        unsigned char hi = lo;
+        if (q[0] == '-' && q[1] && q[1] != ']')
+          {
+          q++;
+          if (*q == '\\' && q[1]) q++;
+          hi = (unsigned char)*q++;
+          }
+        if (c >= lo && c <= hi) matched = TRUE;
+        }
+      // A '[' with no ']' is just a '['
+      if (*q != ']') return c == '[';
+      return matched != negate ? (int)(q + 1 - p) : 0;
+      }
+    default:
+      return (unsigned char)*p == c;
+    }
+  }
+
+/*=========================================================================
+
+  glob_match
+
+  When a '*' is followed by something that doesn't match, we only
+  ever need to go back to the most recent '*', and let it take one
+  more character. So there's no recursion, and the time taken is
+  at worst the product of the two lengths.
+
+=========================================================================*/
+BOOL glob_match (const char *pattern, const char *name)
+  {
+  const char *p = pattern;
+  const char *n = name;
+  const char *star_p = NULL;
+  const char *star_n = NULL;
+  while (*n)
+    {
+    if (*p == '*')
+      {
+      star_p = ++p;
+      star_n = n;
+      continue;
+      }
+    int len = glob_match_char (p, (unsigned char)*n);
+    if (len)
+      {
+      p += len;
+      n++;
+      }
+    else if (star_p)
+      {
+      p = star_p;
+      n = ++star_n;
+      }
+    else
+      return FALSE;
+    }
+  while (*p == '*') p++;
+  return *p == 0;
+  }
+
+/*=========================================================================
+
+  glob_has_wildcards
+
+=========================================================================*/
+BOOL glob_has_wildcards (const char *s)
+  {
+  for (; *s; s++)
+    {
+    if (*s == '\\')
+      {
+      if (s[1]) s++;
+      }
+    else if (*s == '*' || *s == '?' || *s == '[')
+      return TRUE;
+    }
+  return FALSE;
+  }
+
+/*=========================================================================
+
+  glob_unescape
+
+=========================================================================*/
+static void glob_unescape (char *s)
+  {
+  char *out = s;
+  for (; *s; s++)
+    {
+    if (*s == '\\' && s[1]) s++;
+    *out++ = *s;
+    }
+  *out = 0;
+  }
+
+/*=========================================================================
+
+  glob_compile
+
+=========================================================================*/
+ErrCode glob_compile (const char *pattern, Glob **glob)
+  {
+  int len = strlen (pattern);
+  Glob *self = malloc (sizeof (Glob) + len + 1);
+  if (!self) return ERR_NOMEM;
+  strcpy (self->text, pattern);
+  self->ncomp = 0;
+  self->absolute = (pattern[0] == '/');
+  self->dirs_only = (len > 1 && pattern[len - 1] == '/');
+
+  char *s = self->text;
+  while (*s)
+    {
+    if (*s == '/')
+      {
+      *s++ = 0;
+      continue;
+      }
+    char *comp = s;
+    while (*s && *s != '/') s++;
+    if (*s) *s++ = 0;
+
+    GlobComp *c = &self->comp[self->ncomp];
+    if (strcmp (comp, "**") == 0)
+      {
+      // "**/**" is the same as "**"
+      if (self->ncomp > 0 && c[-1].type == GLOB_DSTAR) continue;
+      c->type = GLOB_DSTAR;
+      }
+    else if (glob_has_wildcards (comp))
+      c->type = GLOB_WILD;
+    else
+      {
+      c->type = GLOB_LITERAL;
+      glob_unescape (comp);
+      }
+    c->dot = (comp[0] == '.' || (comp[0] == '\\' && comp[1] == '.'));
+    c->text = comp;
+
+    if (++self->ncomp == GLOB_MAX_COMPONENTS && *s)
+      {
+      free (self);
+      return ERR_BADARGS;
+      }
+    }
+
+  *glob = self;
+  return 0;
+  }
+
+/*=========================================================================
+
+  glob_destroy
+
+=========================================================================*/
+void glob_destroy (Glob *self)
+  {
+  free (self);
+  }
+
+/*=========================================================================
+
+  glob_closure
+
+  Add the component after each "**" in the set.
+
+=========================================================================*/
+static uint32_t glob_closure (const Glob *self, uint32_t states)
+  {
+  for (int i = 0; i < self->ncomp; i++)
+    {
+    if ((states & (1u << i)) && self->comp[i].type == GLOB_DSTAR)
+      states |= 1u << (i + 1);
+    }
+  return states;
+  }
+
+/*=========================================================================
+
+  glob_step
+
+  Work out the set of components that could match the entry after
+  name, given the set that could match name. Bit ncomp in the result
+  means that name completes a match.
+
+=========================================================================*/
+static uint32_t glob_step (const Glob *self, uint32_t states,
+    const char *name)
+  {
+  BOOL hidden = (name[0] == '.');
+  uint32_t next = 0;
+  for (int i = 0; i < self->ncomp; i++)
+    {
+    if (!(states & (1u << i))) continue;
+    const GlobComp *c = &self->comp[i];
+    switch (c->type)
+      {
+      case GLOB_LITERAL:
+        if (strcmp (c->text, name) == 0) next |= 1u << (i + 1);
+        break;
+      case GLOB_WILD:
+        if ((!hidden || c->dot) && glob_match (c->text, name))
+          next |= 1u << (i + 1);
+        break;
+      case GLOB_DSTAR:
+        if (!hidden) next |= 1u << i;
+        break;
+      }
+    }
+  return glob_closure (self, next);
+  }
+
+/*=========================================================================
+
+  glob_wanted
+
+  Returns TRUE if an entry either matches, or is a directory that
+  might contain matches.
+
+=========================================================================*/
+static BOOL glob_wanted (const Glob *self, uint32_t states, FileType type)
+  {
+  uint32_t done = 1u << self->ncomp;
+  if (type == STORAGE_TYPE_DIR) return states != 0;
+  return (states & done) && !self->dirs_only;
+  }
+
+/*=========================================================================
+
+  glob_compare_entries
+
+=========================================================================*/
+static int glob_compare_entries (const void *i1, const void *i2,
+    void *user_data)
+  {
+  (void)user_data;
+  const GlobEntry *e1 = *(const GlobEntry **)i1;
+  const GlobEntry *e2 = *(const GlobEntry **)i2;
+  return strcmp (e1->name, e2->name);
+  }
+
+/*=========================================================================
+
+  glob_add_entry
+
+=========================================================================*/
+static ErrCode glob_add_entry (Vector *entries, const char *name,
+    const FileInfo *info, uint32_t states)
+  {
+  GlobEntry *e = malloc (sizeof (GlobEntry) + strlen (name) + 1);
+  if (!e || !vector_append (entries, e))
+    {
+    free (e);
+    return ERR_NOMEM;
+    }
+  e->states = states;
+  e->size = info->size;
+  e->stored_size = info->stored_size;
+  e->compressed = info->compressed;
+  e->type = info->type;
+  strcpy (e->name, name);
+  return 0;
+  }
+
+/*=========================================================================
+
+  glob_list
+
+  List the entries of interest in the directory in run->path, given 
+  the set of components that could match them, sorted by name. The
+  directory is closed before any of the entries is visited, so only 
+  one directory is ever open. A directory that can't be read has no
+  entries of interest.
+
+=========================================================================*/
+static ErrCode glob_list (GlobRun *run, uint32_t states, Vector **list)
+  {
+  const Glob *self = run->glob;
+  uint32_t live = states & ((1u << self->ncomp) - 1);
+  FileInfo info;
+
+  Vector *entries = vector_create (free);
+  *list = entries;
+  if (!entries) return ERR_NOMEM;
+
+  if (live != 0 && (live & (live - 1)) == 0)
+    {
+    int i = 0;
+    while (!(live & (1u << i))) i++;
+    const GlobComp *c = &self->comp[i];
+    if (c->type == GLOB_LITERAL)
+      {
+      // Just one name to look for
+      char path[MAX_PATH + 1];
+      storage_join_path (run->path, c->text, path);
+      if (storage_info (path, &info) != 0) return 0;
+      return glob_add_entry (entries, c->text, &info,
+        glob_closure (self, 1u << (i + 1)));
+      }
+    }
+
+  StorageDir *dir;
+  if (storage_dir_open (run->path[0] ? run->path : "/", &dir) != 0)
+    return 0;
+
+  ErrCode ret = 0;
+  while (ret == 0 && storage_dir_read (dir, &info))
+    {
+    uint32_t next = glob_step (self, live, info.name);
+    if (glob_wanted (self, next, info.type))
+      ret = glob_add_entry (entries, info.name, &info, next);
+    }
+  storage_dir_close (dir);
+
+  vector_sort (entries, glob_compare_entries, NULL);
+  return ret;
+  }
+
+/*=========================================================================
+
+  glob_search
+
+  Visit each entry of interest in turn, reporting it if it matches, 
+  and going into it if it's a directory that might contain matches. 
+  Each entry's name is added to the path of its directory, which is
+  cut back again before the next entry.
+
+=========================================================================*/
+static ErrCode glob_search (GlobRun *run, uint32_t states)
+  {
+  const Glob *self = run->glob;
+  uint32_t done = 1u << self->ncomp;
+  GlobLevel *levels = run->levels;
+  levels[0].next = 0;
+  levels[0].path_len = strlen (run->path);
+  ErrCode ret = glob_list (run, states, &levels[0].entries);
+  int depth = 1;
+
+  while (depth > 0)
+    {
+    GlobLevel *level = &levels[depth - 1];
+    if (ret != 0 || !level->entries 
+         || level->next == vector_length (level->entries))
+      {
+      if (level->entries) vector_destroy (level->entries);
+      run->path[level->path_len] = 0;
+      depth--;
+      continue;
+      }
+    const GlobEntry *e = vector_get (level->entries, level->next++);
+
+    int len = level->path_len;
+    int nlen = strlen (e->name);
+    BOOL sep = (len > 0 && run->path[len - 1] != '/');
+    if (len + sep + nlen + self->dirs_only > MAX_PATH) continue;
+    if (sep) run->path[len] = '/';
+    strcpy (run->path + len + sep, e->name);
+
+    FileInfo info;
+    strcpy (info.name, e->name);
+    info.type = e->type;
+    info.size = e->size;
+    info.stored_size = e->stored_size;
+    info.compressed = e->compressed;
+    BOOL is_dir = (info.type == STORAGE_TYPE_DIR);
+    if ((e->states & done) && (is_dir || !self->dirs_only))
+      {
+      if (self->dirs_only) strcat (run->path, "/");
+      ret = run->fn (run->path, &info, run->user_data);
+      run->path[len + sep + nlen] = 0;
+      }
+
+    if (ret == 0 && is_dir && (e->states & (done - 1))
+         && depth <= STORAGE_WALK_DEPTH)
+      {
+      GlobLevel *sub = &levels[depth];
+      sub->next = 0;
+      sub->path_len = len + sep + nlen;
+      ret = glob_list (run, e->states, &sub->entries);
+      depth++;
+      }
+    }
+
+  return ret;
+  }
+
+/*=========================================================================
+
+  glob_run
+
+=========================================================================*/
+ErrCode glob_run (const Glob *self, GlobFn fn, void *user_data)
+  {
+  if (self->ncomp == 0) return 0;
+  GlobRun *run = malloc (sizeof (GlobRun));
+  if (!run) return ERR_NOMEM;
+  run->glob = self;
+  run->fn = fn;
+  run->user_data = user_data;
+  strcpy (run->path, self->absolute ? "/" : "");
+  ErrCode ret = glob_search (run, glob_closure (self, 1));
+  free (run);
+  return ret;
+  }
+
@@ -578,6 +578,30 @@ static int lfs_alloc(lfs_t *lfs, lfs_block_t *block) {
 }
 #endif
 
+#ifndef LFS_READONLY
+// Added for picolua: fill the lookahead buffer from a map of the blocks in
+// use, rather than by traversing the filesystem. The map must be exactly
+// what a traversal would find now, or blocks in use could be allocated
+// again. Only possible if the lookahead buffer covers every block.
+int lfs_alloc_prime(lfs_t *lfs, const uint32_t *map) {
+    if (8*lfs->cfg->lookahead_size < lfs->cfg->block_count) {
+        return LFS_ERR_INVAL;
+    }
+
+    lfs->free.size = lfs->cfg->block_count;
+    lfs->free.i = 0;
+    lfs_alloc_ack(lfs);
+    memset(lfs->free.buffer, 0, lfs->cfg->lookahead_size);
+    for (lfs_block_t block = 0; block < lfs->cfg->block_count; block++) {
+        if (map[block / 32] & (1U << (block % 32))) {
+            lfs_alloc_lookahead(lfs, block);
+        }
+    }
+
+    return 0;
+}
+#endif
+
 /// Metadata pair and directory operations ///
 static lfs_stag_t lfs_dir_getslice(lfs_t *lfs, const lfs_mdir_t *dir,
         lfs_tag_t gmask, lfs_tag_t gtag,
@@ -1235,8 +1259,30 @@ nextname:
             lfs_pair_fromle32(dir->tail);
         }
 
+        // picolua: if the name index knows which pair of the directory
+        // holds this name, look there first
+        lfs_block_t head[2] = {dir->tail[0], dir->tail[1]};
+        lfs_block_t hint[2];
+        tag = 0;
+        if (lfs->name_lookup &&
+                lfs->name_lookup(lfs, head, name, namelen, hint)) {
+            tag = lfs_dir_fetchmatch(lfs, dir, hint,
+                    LFS_MKTAG(0x780, 0, 0),
+                    LFS_MKTAG(LFS_TYPE_NAME, 0, namelen),
+                    (strchr(name, '/') == NULL) ? id : NULL,
+                    lfs_dir_find_match, &(struct lfs_dir_find_match){
+                        lfs, name, namelen});
+            if (tag <= 0) {
+                // not there after all, start again from the beginning
+                tag = 0;
+                dir->tail[0] = head[0];
+                dir->tail[1] = head[1];
+            }
+        }
+
         // find entry matching name
-        while (true) {
+        int pairs = 0;
+        while (!tag) {
             tag = lfs_dir_fetchmatch(lfs, dir, dir->tail,
                     LFS_MKTAG(0x780, 0, 0),
                     LFS_MKTAG(LFS_TYPE_NAME, 0, namelen),
@@ -1249,12 +1295,17 @@ nextname:
             }
 
             if (tag) {
+                // only worth remembering if it wasn't in the first pair
+                if (pairs > 0 && lfs->name_update) {
+                    lfs->name_update(lfs, head, name, namelen, dir->pair);
+                }
                 break;
             }
 
             if (!dir->split) {
                 return LFS_ERR_NOENT;
             }
+            pairs += 1;
         }
 
         // to next name
@@ -1477,6 +1528,8 @@ static int lfs_dir_alloc(lfs_t *lfs, lfs_mdir_t *dir) {
     dir->tail[1] = LFS_BLOCK_NULL;
     dir->erased = false;
     dir->split = false;
+    lfs->meta_blocks += 2;
+    lfs->meta_epoch += 1;
 
     // don't write out yet, let caller take care of that
     return 0;
@@ -1500,6 +1553,8 @@ static int lfs_dir_drop(lfs_t *lfs, lfs_mdir_t *dir, lfs_mdir_t *tail) {
         return err;
     }
 
+    lfs->meta_blocks -= 2;
+    lfs->meta_epoch += 1;
     return 0;
 }
 #endif
@@ -1785,6 +1840,7 @@ static int lfs_dir_compact(lfs_t *lfs,
 relocate:
         // commit was corrupted, drop caches and prepare to relocate block
         relocated = true;
+        lfs->meta_epoch += 1;
         lfs_cache_drop(lfs, &lfs->pcache);
         if (!tired) {
             LFS_DEBUG("Bad block at 0x%"PRIx32, dir->pair[1]);
@@ -3577,6 +3633,8 @@ static int lfs_init(lfs_t *lfs, const struct lfs_config *cfg) {
     lfs->gdisk = (lfs_gstate_t){0};
     lfs->gstate = (lfs_gstate_t){0};
     lfs->gdelta = (lfs_gstate_t){0};
+    lfs->meta_blocks = 0;
+    lfs->meta_epoch = 0;
 #ifdef LFS_MIGRATE
     lfs->lfs1 = NULL;
 #endif
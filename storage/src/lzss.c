@@ -0,0 +1,398 @@
+/*=========================================================================
+
+  picolua
+
+  storage/lzss.c
+
+  LZSS compression for stored files. See lzss.h for the data format.
+
+  The encoder keeps two windows' worth of data in a buffer: the
+  history that matches can refer back to, and the data still to be
+  compressed. Matches are found using hash chains on the first three
+  bytes, limited in length so that compressing a file is never too
+  slow. When the buffer fills, the oldest window is discarded.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "storage/lzss.h"
+
+#define LZSS_BUF_SIZE    (2 * LZSS_WINDOW)
+#define LZSS_HASH_BITS   10
+#define LZSS_HASH_SIZE   (1 << LZSS_HASH_BITS)
+#define LZSS_NIL         0xFFFF
+#define LZSS_MAX_CHAIN   32
+#define LZSS_IN_SIZE     128
+
+struct _LzssEncoder
+  {
+  LzssWriteFn fn;
+  void *user_data;
+  int err;
+  int start; // Position in buf of the next byte to compress
+  int end;   // Number of bytes in buf
+  uint8_t buf[LZSS_BUF_SIZE];
+  uint16_t head[LZSS_HASH_SIZE];
+  uint16_t prev[LZSS_WINDOW];
+  uint8_t out[1 + 2 * 8];
+  int out_len;
+  int items;
+  };
+
+struct _LzssDecoder
+  {
+  LzssReadFn fn;
+  void *user_data;
+  uint32_t size;
+  uint32_t produced;
+  BOOL err;
+  uint8_t flags;
+  int flag_count;
+  int match_offset;
+  int match_len;
+  int in_pos;
+  int in_len;
+  uint16_t wpos;
+  uint8_t in[LZSS_IN_SIZE];
+  uint8_t window[LZSS_WINDOW];
+  };
+
+/*=========================================================================
+
+  lzss_encoder_new
+
+=========================================================================*/
+LzssEncoder *lzss_encoder_new (LzssWriteFn fn, void *user_data)
+  {
+  LzssEncoder *self = malloc (sizeof (LzssEncoder));
+  if (self)
+    {
+    self->fn = fn;
+    self->user_data = user_data;
+    self->err = 0;
+    self->start = 0;
+    self->end = 0;
+    self->out_len = 1;
+    self->out[0] = 0;
+    self->items = 0;
+    memset (self->head, 0xFF, sizeof (self->head));
+    }
+  return self;
+  }
+
+/*=========================================================================
+
+  lzss_encoder_destroy
+
+=========================================================================*/
+void lzss_encoder_destroy (LzssEncoder *self)
+  {
+  free (self);
+  }
+
+/*=========================================================================
+
+  lzss_hash
+
+=========================================================================*/
+static inline int lzss_hash (const uint8_t *p)
+  {
+  return ((p[0] << 6) ^ (p[1] << 3) ^ p[2]) & (LZSS_HASH_SIZE - 1);
+  }
+
+/*=========================================================================
+
+  lzss_insert
+
+  Add the string at position pos to the hash chains. We need three
+  bytes to work out the hash.
+
+=========================================================================*/
+static inline void lzss_insert (LzssEncoder *self, int pos)
+  {
+  if (pos + LZSS_MIN_MATCH > self->end) return;
+  int h = lzss_hash (self->buf + pos);
+  self->prev[pos & (LZSS_WINDOW - 1)] = self->head[h];
+  self->head[h] = (uint16_t)pos;
+  }
+
+/*=========================================================================
+
+  lzss_emit
+
+  Add a literal (if len is zero) or a match to the current group, and
+  send the group to the sink when it's complete.
+
+=========================================================================*/
+static void lzss_emit (LzssEncoder *self, int c, int offset, int len)
+  {
+  if (len == 0)
+    {
+    self->out[self->out_len++] = (uint8_t)c;
+    }
+  else
+    {
+    int v = ((offset - 1) << LZSS_LEN_BITS) | (len - LZSS_MIN_MATCH);
+    self->out[0] |= (uint8_t)(1 << self->items);
+    self->out[self->out_len++] = (uint8_t)(v >> 8);
+    self->out[self->out_len++] = (uint8_t)(v & 0xFF);
+    }
+  self->items++;
+  if (self->items == 8)
+    {
+    if (self->err == 0)
+      self->err = self->fn (self->out, self->out_len, self->user_data);
+    self->out[0] = 0;
+    self->out_len = 1;
+    self->items = 0;
+    }
+  }
+
+/*=========================================================================
+
+  lzss_compress
+
+  Compress as much of the buffer as we can. Unless we're finishing, we
+  stop when there's less than a maximum-length match left, because
+  the next block of data might extend the match.
+
+=========================================================================*/
+static void lzss_compress (LzssEncoder *self, BOOL finish)
+  {
+  int limit = finish ? self->end : self->end - LZSS_MAX_MATCH;
+  while (self->start < limit)
+    {
+    int pos = self->start;
+    int max_len = self->end - pos;
+    if (max_len > LZSS_MAX_MATCH) max_len = LZSS_MAX_MATCH;
+    int best_len = 0;
+    int best_offset = 0;
+
+    if (max_len >= LZSS_MIN_MATCH)
+      {
+      const uint8_t *p = self->buf + pos;
+      int cand = self->head[lzss_hash (p)];
+      int chain = 0;
+      while (cand != LZSS_NIL && cand < pos && pos - cand <= LZSS_WINDOW
+           && chain++ < LZSS_MAX_CHAIN)
+        {
+        const uint8_t *q = self->buf + cand;
+        if (q[best_len] == p[best_len])
+          {
+          int len = 0;
+          while (len < max_len && q[len] == p[len]) len++;
+          if (len > best_len)
+            {
+            best_len = len;
+            best_offset = pos - cand;
+            if (len == max_len) break;
+            }
+          }
+        cand = self->prev[cand & (LZSS_WINDOW - 1)];
+        }
+      }
+
+    if (best_len >= LZSS_MIN_MATCH)
+      {
+      lzss_emit (self, 0, best_offset, best_len);
+      for (int i = 0; i < best_len; i++)
+        lzss_insert (self, pos + i);
+      self->start += best_len;
+      }
+    else
+      {
+      lzss_emit (self, self->buf[pos], 0, 0);
+      lzss_insert (self, pos);
+      self->start++;
+      }
+    }
+  }
+
+/*=========================================================================
+
+  lzss_slide
+
+  Discard the oldest window of data, and adjust the hash chains to
+  match.
+
+=========================================================================*/
+static void lzss_slide (LzssEncoder *self)
+  {
+  memmove (self->buf, self->buf + LZSS_WINDOW, self->end - LZSS_WINDOW);
+  self->end -= LZSS_WINDOW;
+  self->start -= LZSS_WINDOW;
+  for (int i = 0; i < LZSS_HASH_SIZE; i++)
+    {
+    int v = self->head[i];
+    self->head[i] = (v == LZSS_NIL || v < LZSS_WINDOW)
+      ? LZSS_NIL : v - LZSS_WINDOW;
+    }
+  for (int i = 0; i < LZSS_WINDOW; i++)
+    {
+    int v = self->prev[i];
+    self->prev[i] = (v == LZSS_NIL || v < LZSS_WINDOW)
+      ? LZSS_NIL : v - LZSS_WINDOW;
+    }
+  }
+
+/*=========================================================================
+
+  lzss_encoder_write
+
+=========================================================================*/
+int lzss_encoder_write (LzssEncoder *self, const uint8_t *buf, int len)
+  {
+  while (len > 0 && self->err == 0)
+    {
+    if (self->end == LZSS_BUF_SIZE) lzss_slide (self);
+    int n = LZSS_BUF_SIZE - self->end;
+    if (n > len) n = len;
+    memcpy (self->buf + self->end, buf, n);
+    self->end += n;
+    buf += n;
+    len -= n;
+    lzss_compress (self, FALSE);
+    }
+  return self->err;
+  }
+
+/*=========================================================================
+
+  lzss_encoder_finish
+
+=========================================================================*/
+int lzss_encoder_finish (LzssEncoder *self)
+  {
+  lzss_compress (self, TRUE);
+  if (self->items > 0 && self->err == 0)
+    self->err = self->fn (self->out, self->out_len, self->user_data);
+  self->items = 0;
+  self->out_len = 1;
+  return self->err;
+  }
+
+/*=========================================================================
+
+  lzss_decoder_new
+
+=========================================================================*/
+LzssDecoder *lzss_decoder_new (LzssReadFn fn, void *user_data,
+      uint32_t size)
+  {
+  LzssDecoder *self = malloc (sizeof (LzssDecoder));
+  if (self)
+    {
+    self->fn = fn;
+    self->user_data = user_data;
+    self->size = size;
+    lzss_decoder_reset (self);
+    }
+  return self;
+  }
+
+/*=========================================================================
+
+  lzss_decoder_reset
+
+=========================================================================*/
+void lzss_decoder_reset (LzssDecoder *self)
+  {
+  self->produced = 0;
+  self->err = FALSE;
+  self->flag_count = 0;
+  self->match_len = 0;
+  self->in_pos = 0;
+  self->in_len = 0;
+  self->wpos = 0;
+  }
+
+/*=========================================================================
+
+  lzss_decoder_destroy
+
+=========================================================================*/
+void lzss_decoder_destroy (LzssDecoder *self)
+  {
+  free (self);
+  }
+
+/*=========================================================================
+
+  lzss_get_byte
+
+=========================================================================*/
+static int lzss_get_byte (LzssDecoder *self)
+  {
+  if (self->in_pos == self->in_len)
+    {
+    int n = self->fn (self->in, LZSS_IN_SIZE, self->user_data);
+    if (n <= 0)
+      {
+      self->err = TRUE;
+      return -1;
+      }
+    self->in_len = n;
+    self->in_pos = 0;
+    }
+  return self->in[self->in_pos++];
+  }
+
+/*=========================================================================
+
+  lzss_decoder_read
+
+=========================================================================*/
+int lzss_decoder_read (LzssDecoder *self, uint8_t *buf, int len)
+  {
+  int n = 0;
+  const int mask = LZSS_WINDOW - 1;
+  while (n < len && self->produced < self->size && !self->err)
+    {
+    int c;
+    if (self->match_len > 0)
+      {
+      c = self->window[(self->wpos - self->match_offset) & mask];
+      self->match_len--;
+      }
+    else
+      {
+      if (self->flag_count == 0)
+        {
+        int f = lzss_get_byte (self);
+        if (f < 0) break;
+        self->flags = (uint8_t)f;
+        self->flag_count = 8;
+        }
+      int is_match = self->flags & 1;
+      self->flags >>= 1;
+      self->flag_count--;
+      if (is_match)
+        {
+        int hi = lzss_get_byte (self);
+        int lo = lzss_get_byte (self);
+        if (lo < 0) break;
+        int v = (hi << 8) | lo;
+        self->match_offset = (v >> LZSS_LEN_BITS) + 1;
+        self->match_len = (v & ((1 << LZSS_LEN_BITS) - 1)) + LZSS_MIN_MATCH;
+        if ((uint32_t)self->match_offset > self->produced)
+          {
+          self->err = TRUE;
+          break;
+          }
+        continue;
+        }
+      c = lzss_get_byte (self);
+      if (c < 0) break;
+      }
+    self->window[self->wpos] = (uint8_t)c;
+    self->wpos = (self->wpos + 1) & mask;
+    buf[n++] = (uint8_t)c;
+    self->produced++;
+    }
+  if (n == 0 && self->err) return -1;
+  return n;
+  }
+
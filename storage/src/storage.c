@@ -10,24 +10,149 @@
 #include <stdio.h> 
 #include <string.h> 
 #include <stdlib.h> 
+#include <stddef.h> 
 #include <config.h>
 #include <interface/interface.h>
 #include <shell/errcodes.h>
-#include <klib/list.h>
+#include <klib/vector.h>
 #include <shell/shell.h>
 #include "storage/storage.h"
 #include "storage/lfs.h"
+#include "storage/lzss.h"
 
 extern char *itoa (int n, char *buff, int base);
 
+// Every file written through StorageFile carries this littlefs attribute.
+//   The first byte is the codec (STORAGE_CODEC_XXX), and the next four
+//   the uncompressed size, little-endian. Files without the attribute
+//   (e.g., written by an older version) are not compressed.
+#define STORAGE_ATTR_CODEC 0x5A 
+#define STORAGE_ATTR_SIZE  8 
+#define STORAGE_CODEC_NONE 0
+#define STORAGE_CODEC_LZSS 1
+
+// The blocks after the end of the filesystem hold allocator 
+//   checkpoints, one per program page, so that the map of blocks in use
+//   need not be worked out again at boot. See storage_sync(). Each 
+//   checkpoint has a generation number, which is also stored in this
+//   attribute of the root directory; the checkpoint is only used if 
+//   the two match. The checkpoints go round all the slots in all the
+//   blocks, so each block is erased once in STORAGE_CP_SLOTS 
+//   checkpoints -- at 100,000 erases, that's over six million.
+#define STORAGE_CP_BLOCK   INTERFACE_STORAGE_BLOCK_COUNT
+#define STORAGE_CP_BLOCKS  4
+#define STORAGE_CP_PAGE    256
+#define STORAGE_CP_BLOCK_SLOTS (INTERFACE_STORAGE_BLOCK_SIZE / STORAGE_CP_PAGE)
+#define STORAGE_CP_SLOTS   (STORAGE_CP_BLOCKS * STORAGE_CP_BLOCK_SLOTS)
+#define STORAGE_CP_MAGIC   0x50434C50 
+#define STORAGE_ATTR_GEN   0x5B 
+#define STORAGE_MAP_WORDS  ((INTERFACE_STORAGE_BLOCK_COUNT + 31) / 32)
+
+// Filesystems in RAM use smaller blocks than flash, since small files
+//   take at least one block.
+#define STORAGE_RAM_BLOCK_SIZE 512
+
+typedef struct _StorageCheckpoint
+  {
+  uint32_t magic;
+  uint32_t generation;
+  uint32_t block_count;
+  uint32_t map[STORAGE_MAP_WORDS]; // Bit set for each block in use
+  uint32_t crc;   // Of all the above
+  uint32_t valid; // All ones, until the filesystem is written to
+  } StorageCheckpoint;
+
+struct _StorageDir
+  {
+  lfs_dir_t dir;
+  lfs_t *fs;
+  char path[MAX_PATH + 1]; // The directory's path within fs
+  size_t path_len;
+  };
+
+struct _StorageFile
+  {
+  lfs_file_t file;
+  struct lfs_file_config config;
+  struct lfs_attr attr;
+  uint8_t attr_value[STORAGE_ATTR_SIZE];
+  LzssEncoder *encoder; // Set if writing a compressed file
+  LzssDecoder *decoder; // Set if reading a compressed file
+  uint32_t size;        // Uncompressed size of a compressed file
+  uint32_t pos;         // Position in the uncompressed data
+  lfs_t *fs;            // The filesystem that holds the file
+  BOOL writing;         // Open for writing, on flash
+  int old_blocks;       // Blocks used by the file before it was opened,
+                        //   or -1 if not known
+  };
+
+// A filesystem in RAM, mounted on a directory in the root of the 
+//   flash filesystem. Files are routed to it by the first element of
+//   their paths, so mounts can't be nested.
+typedef struct _StorageMount
+  {
+  char name[STORAGE_MOUNT_NAME_MAX + 1]; // Without the leading "/"
+  uint8_t *blocks;      // NULL if this entry is not in use
+  int open_files;       // It can't be unmounted while this is non-zero
+  lfs_t lfs;
+  struct lfs_config cfg;
+  } StorageMount;
+
 lfs_t lfs;
 BOOL mounted = FALSE;
+static BOOL compress_writes = FALSE;
+static StorageMount mounts[STORAGE_MAX_MOUNTS];
+
+// Number of blocks in use, or -1 if it has to be counted again. 
+//   Counting means walking every block in the filesystem, so we only
+//   do it when the count is first needed, and then keep it up to date 
+//   as files are written and removed. littlefs itself keeps track of
+//   the blocks that it allocates for directory metadata;
+//   meta_blocks is its count at the time used_blocks was last updated.
+static int used_blocks = -1;
+static lfs_ssize_t meta_blocks = 0;
+
+// The last checkpoint read or written, and its slot.
+//   It's live if nothing has been written to the filesystem since.
+static StorageCheckpoint checkpoint;
+static int cp_slot = -1;
+static BOOL cp_live = FALSE;
+
+#if STORAGE_NAME_INDEX
+// The name index is a hash table of filenames in large directories, 
+//   giving the metadata pair in which each name was last found. littlefs
+//   checks that the name really is in that pair before using it. Block
+//   numbers are stored in 16 bits, to save RAM.
+typedef struct _StorageNameEntry
+  {
+  uint32_t hash; // Of the name and directory, or 0 if the entry is empty
+  uint16_t pair[2];
+  } StorageNameEntry;
+
+static StorageNameEntry *name_index = NULL;
+static uint32_t name_index_epoch = 0;
+#endif
+
+static int storage_block_prog (const struct lfs_config *c, 
+    lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size);
+static int storage_block_erase (const struct lfs_config *c, 
+    lfs_block_t block);
+
+/*=========================================================================
+
+  storage_get_u32
+
+=========================================================================*/
+static uint32_t storage_get_u32 (const uint8_t *p)
+  {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+  }
 
 const struct lfs_config cfg = {
     // block device operations
     .read  = interface_block_read,
-    .prog  = interface_block_prog,
-    .erase = interface_block_erase,
+    .prog  = storage_block_prog,
+    .erase = storage_block_erase,
     .sync  = interface_block_sync,
 
     // block device configuration
@@ -40,6 +165,520 @@ const struct lfs_config cfg = {
     .block_cycles = 500,
 };
 
+/*=========================================================================
+
+  storage_file_blocks
+
+  The number of blocks that littlefs uses to store a file of the
+  given size. Small files are stored inline, in their directory's
+  metadata; larger ones in a list of blocks, each of which except 
+  the first starts with some back-pointers. This follows
+  lfs_ctz_index() in lfs.c.
+
+=========================================================================*/
+static int storage_file_blocks (uint32_t size)
+  {
+  uint32_t inline_max = lfs_min (0x3fe, lfs_min (cfg.cache_size, 
+    cfg.block_size / 8));
+  if (size <= inline_max) return 0;
+  uint32_t off = size - 1;
+  uint32_t b = cfg.block_size - 2 * 4;
+  uint32_t i = off / b;
+  if (i == 0) return 1;
+  i = (off - 4 * (lfs_popc (i - 1) + 2)) / b;
+  return (int)i + 1;
+  }
+
+/*=========================================================================
+
+  storage_entry_blocks
+
+  The number of data blocks used by an existing file. Returns zero 
+  if the path does not exist, or is a directory -- littlefs counts
+  directory blocks itself. Also returns zero if we aren't keeping
+  count yet, to save looking the file up.
+
+=========================================================================*/
+static int storage_entry_blocks (const char *path)
+  {
+  if (used_blocks < 0) return 0;
+  struct lfs_info info;
+  if (lfs_stat (&lfs, path, &info) != 0) return 0;
+  if (info.type == LFS_TYPE_DIR) return 0;
+  return storage_file_blocks (info.size);
+  }
+
+/*=========================================================================
+
+  storage_adjust_used
+
+=========================================================================*/
+static void storage_adjust_used (int delta)
+  {
+  if (used_blocks >= 0) used_blocks += delta;
+  }
+
+/*=========================================================================
+
+  storage_checkpoint_write
+
+=========================================================================*/
+static int storage_checkpoint_write (void)
+  {
+  uint8_t page[STORAGE_CP_PAGE];
+  memset (page, 0xFF, sizeof (page));
+  memcpy (page, &checkpoint, sizeof (checkpoint));
+  return interface_block_prog (&cfg, 
+    STORAGE_CP_BLOCK + cp_slot / STORAGE_CP_BLOCK_SLOTS, 
+    (lfs_off_t)(cp_slot % STORAGE_CP_BLOCK_SLOTS) * STORAGE_CP_PAGE, 
+    page, sizeof (page));
+  }
+
+/*=========================================================================
+
+  storage_checkpoint_invalidate
+
+  Called before anything is written to the filesystem. Flash bits can
+  be cleared without an erase, so we just rewrite the checkpoint with
+  the valid flag cleared. If that fails, the write to the filesystem
+  must not go ahead.
+
+=========================================================================*/
+static int storage_checkpoint_invalidate (void)
+  {
+  if (!cp_live) return 0;
+  checkpoint.valid = 0;
+  int err = storage_checkpoint_write ();
+  if (err == 0) cp_live = FALSE;
+  return err;
+  }
+
+/*=========================================================================
+
+  storage_block_prog
+
+=========================================================================*/
+static int storage_block_prog (const struct lfs_config *c, 
+    lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size)
+  {
+  int err = storage_checkpoint_invalidate ();
+  if (err) return err;
+  return interface_block_prog (c, block, off, buffer, size);
+  }
+
+/*=========================================================================
+
+  storage_block_erase
+
+=========================================================================*/
+static int storage_block_erase (const struct lfs_config *c, 
+    lfs_block_t block)
+  {
+  int err = storage_checkpoint_invalidate ();
+  if (err) return err;
+  return interface_block_erase (c, block);
+  }
+
+/*=========================================================================
+
+  storage_checkpoint_crc
+
+=========================================================================*/
+static uint32_t storage_checkpoint_crc (const StorageCheckpoint *cp)
+  {
+  return lfs_crc (0xFFFFFFFF, cp, offsetof (StorageCheckpoint, crc));
+  }
+
+/*=========================================================================
+
+  storage_checkpoint_use
+
+  Give the map of used blocks to the allocator, and take the count of
+  used blocks from it.
+
+=========================================================================*/
+static void storage_checkpoint_use (void)
+  {
+  if (lfs_alloc_prime (&lfs, checkpoint.map) != 0) return;
+  used_blocks = 0;
+  for (int i = 0; i < STORAGE_MAP_WORDS; i++)
+    used_blocks += (int)lfs_popc (checkpoint.map[i]);
+  meta_blocks = lfs.meta_blocks;
+  }
+
+/*=========================================================================
+
+  storage_checkpoint_load
+
+  Find the latest checkpoint, and use it if nothing has been written
+  since it was made. If not, the allocator will scan the filesystem 
+  when it first needs a block, as usual. Checkpoints are written to 
+  the slots in order, with increasing generation numbers, so the 
+  latest is the one with the highest; the slots of a block are filled
+  from the start, so the first empty one ends the block.
+
+=========================================================================*/
+static void storage_checkpoint_load (void)
+  {
+  cp_slot = -1;
+  cp_live = FALSE;
+  for (int i = 0; i < STORAGE_CP_SLOTS; i++)
+    {
+    StorageCheckpoint cp;
+    memset (&cp, 0, sizeof (cp));
+    if (interface_block_read (&cfg, 
+        STORAGE_CP_BLOCK + i / STORAGE_CP_BLOCK_SLOTS, 
+        (lfs_off_t)(i % STORAGE_CP_BLOCK_SLOTS) * STORAGE_CP_PAGE, 
+        &cp, sizeof (cp)) != 0
+        || cp.magic != STORAGE_CP_MAGIC 
+        || cp.block_count != INTERFACE_STORAGE_BLOCK_COUNT
+        || cp.crc != storage_checkpoint_crc (&cp))
+      {
+      i += STORAGE_CP_BLOCK_SLOTS - 1 - i % STORAGE_CP_BLOCK_SLOTS;
+      continue;
+      }
+    if (cp_slot >= 0 
+        && (int32_t)(cp.generation - checkpoint.generation) <= 0)
+      continue;
+    checkpoint = cp;
+    cp_slot = i;
+    }
+  if (cp_slot < 0 || checkpoint.valid != 0xFFFFFFFF) return;
+
+  uint32_t generation;
+  lfs_ssize_t n = lfs_getattr (&lfs, "/", STORAGE_ATTR_GEN, 
+    &generation, sizeof (generation));
+  if (n != sizeof (generation) || generation != checkpoint.generation) 
+    return;
+
+  cp_live = TRUE;
+  storage_checkpoint_use ();
+  }
+
+/*=========================================================================
+
+  storage_checkpoint_mark
+
+=========================================================================*/
+static int storage_checkpoint_mark (void *data, lfs_block_t block)
+  {
+  uint32_t *map = data;
+  if (block < INTERFACE_STORAGE_BLOCK_COUNT)
+    map[block / 32] |= 1U << (block % 32);
+  return 0;
+  }
+
+#if STORAGE_NAME_INDEX
+/*=========================================================================
+
+  storage_name_hash
+
+  FNV-1a hash of the directory's first block, and the name. We
+  use the lower-numbered of the pair, as littlefs may swap them.
+  Different names can have the same hash, but that only costs us
+  a wasted look in the wrong metadata pair.
+
+=========================================================================*/
+static uint32_t storage_name_hash (const lfs_block_t dir[2], 
+    const char *name, lfs_size_t len)
+  {
+  uint32_t hash = 2166136261u ^ lfs_min (dir[0], dir[1]);
+  for (lfs_size_t i = 0; i < len; i++)
+    {
+    hash ^= (uint8_t)name[i];
+    hash *= 16777619u;
+    }
+  return hash ? hash : 1;
+  }
+
+/*=========================================================================
+
+  storage_name_index_check
+
+  Empty the index if the directory structure has changed since the 
+  entries were made. 
+
+=========================================================================*/
+static void storage_name_index_check (void)
+  {
+  if (name_index && name_index_epoch != lfs.meta_epoch)
+    memset (name_index, 0, STORAGE_NAME_INDEX * sizeof (StorageNameEntry));
+  name_index_epoch = lfs.meta_epoch;
+  }
+
+/*=========================================================================
+
+  storage_name_lookup
+
+=========================================================================*/
+static bool storage_name_lookup (lfs_t *l, const lfs_block_t dir[2],
+    const char *name, lfs_size_t len, lfs_block_t pair[2])
+  {
+  (void)l;
+  if (!name_index) return false;
+  storage_name_index_check ();
+  uint32_t hash = storage_name_hash (dir, name, len);
+  StorageNameEntry *e = &name_index[hash % STORAGE_NAME_INDEX];
+  if (e->hash != hash) return false;
+  pair[0] = e->pair[0];
+  pair[1] = e->pair[1];
+  return true;
+  }
+
+/*=========================================================================
+
+  storage_name_update
+
+  Called by littlefs when it finds a name outside the first metadata
+  pair of a directory. If another name is using the same slot, it 
+  gets replaced.
+
+=========================================================================*/
+static void storage_name_update (lfs_t *l, const lfs_block_t dir[2],
+    const char *name, lfs_size_t len, const lfs_block_t pair[2])
+  {
+  (void)l;
+  if (!name_index)
+    {
+    name_index = calloc (STORAGE_NAME_INDEX, sizeof (StorageNameEntry));
+    if (!name_index) return;
+    }
+  storage_name_index_check ();
+  uint32_t hash = storage_name_hash (dir, name, len);
+  StorageNameEntry *e = &name_index[hash % STORAGE_NAME_INDEX];
+  e->hash = hash;
+  e->pair[0] = (uint16_t)pair[0];
+  e->pair[1] = (uint16_t)pair[1];
+  }
+
+/*=========================================================================
+
+  storage_name_index_reset
+
+  Called after mounting, since block numbers in the index are only 
+  meaningful for a particular filesystem.
+
+=========================================================================*/
+static void storage_name_index_reset (void)
+  {
+  free (name_index);
+  name_index = NULL;
+  name_index_epoch = lfs.meta_epoch;
+  lfs.name_lookup = storage_name_lookup;
+  lfs.name_update = storage_name_update;
+  }
+#endif
+
+/*=========================================================================
+
+  storage_ram_read
+
+  Block device operations for a filesystem in RAM. cfg->context is 
+  the StorageMount. There's no need to do anything to erase a block.
+
+=========================================================================*/
+static int storage_ram_read (const struct lfs_config *c, 
+    lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size)
+  {
+  const StorageMount *m = c->context;
+  memcpy (buffer, m->blocks + block * c->block_size + off, size);
+  return 0;
+  }
+
+/*=========================================================================
+
+  storage_ram_prog
+
+=========================================================================*/
+static int storage_ram_prog (const struct lfs_config *c, 
+    lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size)
+  {
+  StorageMount *m = c->context;
+  memcpy (m->blocks + block * c->block_size + off, buffer, size);
+  return 0;
+  }
+
+/*=========================================================================
+
+  storage_ram_erase
+
+=========================================================================*/
+static int storage_ram_erase (const struct lfs_config *c, 
+    lfs_block_t block)
+  {
+  (void)c; (void)block;
+  return 0;
+  }
+
+/*=========================================================================
+
+  storage_ram_sync
+
+=========================================================================*/
+static int storage_ram_sync (const struct lfs_config *c)
+  {
+  (void)c;
+  return 0;
+  }
+
+/*=========================================================================
+
+  storage_find_mount
+
+  Returns the mount whose name matches the first len characters of 
+  name, or NULL.
+
+=========================================================================*/
+static StorageMount *storage_find_mount (const char *name, size_t len)
+  {
+  for (int i = 0; i < STORAGE_MAX_MOUNTS; i++)
+    {
+    StorageMount *m = &mounts[i];
+    if (m->blocks && strlen (m->name) == len 
+        && strncmp (m->name, name, len) == 0)
+      return m;
+    }
+  return NULL;
+  }
+
+/*=========================================================================
+
+  storage_route
+
+  Find the filesystem that holds a path, and set *sub to the path 
+  within that filesystem. Only the first element of the path is
+  looked at so, for example, "/tmp/../x" is not on flash, but in the
+  root of the filesystem mounted on /tmp.
+
+=========================================================================*/
+static lfs_t *storage_route (const char *path, const char **sub)
+  {
+  const char *p = path;
+  while (*p == '/') p++;
+  const char *end = strchr (p, '/');
+  size_t len = end ? (size_t)(end - p) : strlen (p);
+  StorageMount *m = len > 0 ? storage_find_mount (p, len) : NULL;
+  if (m)
+    {
+    *sub = p[len] ? p + len : "/";
+    return &m->lfs;
+    }
+  *sub = path;
+  return &lfs;
+  }
+
+/*=========================================================================
+
+  storage_mount_of
+
+=========================================================================*/
+static StorageMount *storage_mount_of (const lfs_t *fs)
+  {
+  for (int i = 0; i < STORAGE_MAX_MOUNTS; i++)
+    if (fs == &mounts[i].lfs) return &mounts[i];
+  return NULL;
+  }
+
+/*=========================================================================
+
+  storage_mount_ram
+
+=========================================================================*/
+ErrCode storage_mount_ram (const char *dir, int size)
+  {
+  while (*dir == '/') dir++;
+  size_t len = strlen (dir);
+  if (len == 0 || strchr (dir, '/')) return ERR_INVAL;
+  if (len > STORAGE_MOUNT_NAME_MAX) return ERR_NAMETOOLONG;
+  if (storage_find_mount (dir, len)) return ERR_EXIST;
+  if (!mounted) return ERR_IO;
+  int block_count = size / STORAGE_RAM_BLOCK_SIZE;
+  if (block_count < 4) return ERR_INVAL;
+
+  StorageMount *m = NULL;
+  for (int i = 0; i < STORAGE_MAX_MOUNTS && !m; i++)
+    if (!mounts[i].blocks) m = &mounts[i];
+  if (!m) return ERR_NOSPC;
+
+  // The mount point is a real directory on flash, so that it shows
+  //   up when the root is listed
+  struct lfs_info info;
+  int err = lfs_stat (&lfs, dir, &info);
+  if (err == LFS_ERR_NOENT)
+    err = lfs_mkdir (&lfs, dir);
+  else if (err == 0 && info.type != LFS_TYPE_DIR)
+    err = LFS_ERR_NOTDIR;
+  if (err) return (ErrCode) -err;
+
+  memset (m, 0, sizeof (StorageMount));
+  m->blocks = malloc ((size_t)block_count * STORAGE_RAM_BLOCK_SIZE);
+  if (!m->blocks) return ERR_NOMEM;
+  strcpy (m->name, dir);
+  m->cfg.context = m;
+  m->cfg.read = storage_ram_read;
+  m->cfg.prog = storage_ram_prog;
+  m->cfg.erase = storage_ram_erase;
+  m->cfg.sync = storage_ram_sync;
+  m->cfg.read_size = 16;
+  m->cfg.prog_size = 16;
+  m->cfg.block_size = STORAGE_RAM_BLOCK_SIZE;
+  m->cfg.block_count = (lfs_size_t)block_count;
+  m->cfg.cache_size = 64;
+  m->cfg.lookahead_size = (lfs_size_t)((block_count + 63) / 64 * 8);
+  m->cfg.block_cycles = -1; // No wear to level
+
+  err = lfs_format (&m->lfs, &m->cfg);
+  if (err == 0) 
+    err = lfs_mount (&m->lfs, &m->cfg);
+  if (err)
+    {
+    free (m->blocks);
+    m->blocks = NULL;
+    return (ErrCode) -err;
+    }
+  return 0;
+  }
+
+/*=========================================================================
+
+  storage_unmount
+
+=========================================================================*/
+ErrCode storage_unmount (const char *dir)
+  {
+  while (*dir == '/') dir++;
+  StorageMount *m = storage_find_mount (dir, strlen (dir));
+  if (!m) return ERR_NOENT;
+  if (m->open_files > 0) return ERR_BUSY;
+  lfs_unmount (&m->lfs);
+  free (m->blocks);
+  m->blocks = NULL;
+  return 0;
+  }
+
+/*=========================================================================
+
+  storage_list_mounts
+
+=========================================================================*/
+void storage_list_mounts (Vector *list)
+  {
+  for (int i = 0; i < STORAGE_MAX_MOUNTS; i++)
+    {
+    if (mounts[i].blocks)
+      {
+      char *s = malloc (strlen (mounts[i].name) + 2);
+      if (!s) return;
+      s[0] = '/';
+      strcpy (s + 1, mounts[i].name);
+      if (!vector_append (list, s))
+        {
+        free (s);
+        return;
+        }
+      }
+    }
+  }
 
 /*=========================================================================
 
@@ -65,6 +704,15 @@ void storage_init (void)
     }
   else
     mounted = TRUE;
+  if (mounted)
+    storage_checkpoint_load ();
+#if STORAGE_NAME_INDEX
+  storage_name_index_reset ();
+#endif
+#if STORAGE_TMP_SIZE
+  if (mounted)
+    storage_mount_ram ("/tmp", STORAGE_TMP_SIZE);
+#endif
   }
 
 /*=========================================================================
@@ -74,11 +722,74 @@ void storage_init (void)
 =========================================================================*/
 void storage_cleanup (void)
   {
+  for (int i = 0; i < STORAGE_MAX_MOUNTS; i++)
+    {
+    if (mounts[i].blocks)
+      {
+      lfs_unmount (&mounts[i].lfs);
+      free (mounts[i].blocks);
+      mounts[i].blocks = NULL;
+      }
+    }
   if (mounted)
+    {
+    storage_sync ();
     lfs_unmount (&lfs);
+    }
   interface_block_cleanup ();
   }
 
+/*=========================================================================
+
+  storage_sync
+
+  Save a checkpoint, unless nothing has changed since the last one. The 
+  generation number is stored in the filesystem first, since doing so
+  might itself allocate blocks. The checkpoints are written in turn to
+  each page of the checkpoint blocks, and a block is erased only when
+  the turn comes back to its first page.
+
+=========================================================================*/
+ErrCode storage_sync (void)
+  {
+  if (!mounted || cp_live) return 0;
+
+  // The first generation number is arbitrary, so that a filesystem 
+  //   image from elsewhere is unlikely to match our checkpoint
+  uint32_t generation = cp_slot >= 0 ? checkpoint.generation + 1 : lfs.seed;
+  int err = lfs_setattr (&lfs, "/", STORAGE_ATTR_GEN, 
+    &generation, sizeof (generation));
+  if (err) return (ErrCode) -err;
+
+  StorageCheckpoint cp;
+  memset (&cp, 0, sizeof (cp));
+  err = lfs_fs_traverse (&lfs, storage_checkpoint_mark, cp.map);
+  if (err) return (ErrCode) -err;
+  cp.magic = STORAGE_CP_MAGIC;
+  cp.generation = generation;
+  cp.block_count = INTERFACE_STORAGE_BLOCK_COUNT;
+  cp.crc = storage_checkpoint_crc (&cp);
+  cp.valid = 0xFFFFFFFF;
+  checkpoint = cp;
+
+  int slot = (cp_slot + 1) % STORAGE_CP_SLOTS;
+  if (slot % STORAGE_CP_BLOCK_SLOTS == 0)
+    {
+    err = interface_block_erase (&cfg, 
+      STORAGE_CP_BLOCK + slot / STORAGE_CP_BLOCK_SLOTS);
+    if (err) return (ErrCode) -err;
+    }
+  cp_slot = slot;
+  err = storage_checkpoint_write ();
+  if (err) return (ErrCode) -err;
+
+  // The map is as good as a fresh scan, so the allocator might as well
+  //   have it
+  cp_live = TRUE;
+  storage_checkpoint_use ();
+  return 0;
+  }
+
 /*=========================================================================
 
   storage_write_file
@@ -86,67 +797,277 @@ void storage_cleanup (void)
 =========================================================================*/
 ErrCode storage_write_file (const char *filename, const void *buf, int len)
   {
-  lfs_file_t file;
-  int err = lfs_file_open (&lfs, &file, filename, 
-       LFS_O_RDWR | LFS_O_CREAT | LFS_O_TRUNC);
+  StorageFile *file;
+  ErrCode ret = storage_file_open (filename, STORAGE_OPEN_WRITE, &file);
+  if (ret == 0)
+    {
+    ret = storage_file_write (file, buf, len);
+    ErrCode err = storage_file_close (file);
+    if (ret == 0) ret = err;
+    }
+  return ret;
+  }
+
+/*=========================================================================
+
+  storage_append_file
+
+=========================================================================*/
+ErrCode storage_append_file (const char *filename, const void *buf, int len)
+  {
+  StorageFile *file;
+  ErrCode ret = storage_file_open (filename, STORAGE_OPEN_APPEND, &file);
+  if (ret == 0)
+    {
+    ret = storage_file_write (file, buf, len);
+    ErrCode err = storage_file_close (file);
+    if (ret == 0) ret = err;
+    }
+  return ret;
+  }
+
+/*=========================================================================
+
+  storage_list_dir
+
+=========================================================================*/
+ErrCode storage_list_dir (const char *path, Vector *list)
+  {
+  lfs_dir_t dir;
+  lfs_t *fs = storage_route (path, &path);
+
+  int err = lfs_dir_open (fs, &dir, path);
   if (err)
     return (ErrCode) -err;
 
-  lfs_ssize_t n = lfs_file_write (&lfs, &file, buf, (lfs_size_t)len);
-  lfs_file_close (&lfs, &file);
+  ErrCode ret = 0;
+  struct lfs_info info;
+  while (ret == 0 && lfs_dir_read (fs, &dir, &info) > 0)
+    {
+    char *s = strdup (info.name);
+    if (!s || !vector_append (list, s))
+      {
+      free (s);
+      ret = ERR_NOMEM;
+      }
+    }
 
-  if (n != len)
-    return (ErrCode) -n;
-  else 
-    return 0;
+  lfs_dir_close (fs, &dir);
+
+  return ret;
+  }
+
+/*=========================================================================
+
+  storage_get_codec
+
+  Set compressed, and the size after decompression, from the codec 
+  attribute of a regular file, whose stored size is already in info.
+
+=========================================================================*/
+static void storage_get_codec (lfs_t *fs, const char *path, FileInfo *info)
+  {
+  uint8_t attr[STORAGE_ATTR_SIZE];
+  if (lfs_getattr (fs, path, STORAGE_ATTR_CODEC, attr, sizeof (attr)) 
+        == sizeof (attr) && attr[0] == STORAGE_CODEC_LZSS)
+    {
+    info->compressed = TRUE;
+    info->size = storage_get_u32 (attr + 4);
+    }
+  }
+
+/*=========================================================================
+
+  storage_dir_open
+
+=========================================================================*/
+ErrCode storage_dir_open (const char *path, StorageDir **dir)
+  {
+  StorageDir *self = malloc (sizeof (StorageDir));
+  if (!self) return ERR_NOMEM;
+  self->fs = storage_route (path, &path);
+  strncpy (self->path, path, MAX_PATH);
+  self->path[MAX_PATH] = 0;
+  self->path_len = strlen (self->path);
+  int err = lfs_dir_open (self->fs, &self->dir, path);
+  if (err)
+    {
+    free (self);
+    return (ErrCode) -err;
+    }
+  *dir = self;
+  return 0;
   }
 
 /*=========================================================================
 
-  storage_append_file
+  storage_dir_read
 
 =========================================================================*/
-ErrCode storage_append_file (const char *filename, const void *buf, int len)
+BOOL storage_dir_read (StorageDir *self, FileInfo *info)
   {
-  lfs_file_t file;
-  int err = lfs_file_open (&lfs, &file, filename, 
-     LFS_O_RDWR | LFS_O_APPEND | LFS_O_CREAT);
-  if (err)
-    return (ErrCode) -err;
+  struct lfs_info linfo;
+  do
+    {
+    if (lfs_dir_read (self->fs, &self->dir, &linfo) <= 0) return FALSE;
+    } while (strcmp (linfo.name, ".") == 0 || strcmp (linfo.name, "..") == 0);
+
+  strcpy (info->name, linfo.name);
+  info->type = linfo.type == LFS_TYPE_DIR ? STORAGE_TYPE_DIR : STORAGE_TYPE_REG;
+  info->size = linfo.type == LFS_TYPE_REG ? linfo.size : 0;
+  info->stored_size = info->size;
+  info->compressed = FALSE;
+  if (linfo.type == LFS_TYPE_REG)
+    {
+    // The directory's path is extended by the name just long enough 
+    //   to look up the attribute
+    size_t sep = self->path_len > 0 && self->path[self->path_len - 1] != '/';
+    if (self->path_len + sep + strlen (linfo.name) <= MAX_PATH)
+      {
+      self->path[self->path_len] = '/';
+      strcpy (self->path + self->path_len + sep, linfo.name);
+      storage_get_codec (self->fs, self->path, info);
+      self->path[self->path_len] = 0;
+      }
+    }
+  return TRUE;
+  }
+
+/*=========================================================================
 
-  lfs_ssize_t n = lfs_file_write (&lfs, &file, buf, (lfs_size_t)len);
-  lfs_file_close (&lfs, &file);
+  storage_dir_close
 
-  if (n != len)
-    return (ErrCode) -n;
-  else 
-    return 0;
+=========================================================================*/
+void storage_dir_close (StorageDir *self)
+  {
+  if (self)
+    {
+    lfs_dir_close (self->fs, &self->dir);
+    free (self);
+    }
   }
 
 /*=========================================================================
 
-  storage_list_dir
+  storage_walk
+
+  The walk keeps one open directory for each level of the tree, and
+  builds the path of each entry in a single buffer, by adding names to
+  the end and chopping them off again. Entries can safely be removed 
+  from the directory being read -- littlefs adjusts the position of 
+  any open directory when that happens.
 
 =========================================================================*/
-ErrCode storage_list_dir (const char *path, List *list)
+typedef struct _StorageWalkLevel
   {
   lfs_dir_t dir;
+  lfs_t *fs;
+  size_t path_len; // Length of the directory's path
+  } StorageWalkLevel;
 
-  int err = lfs_dir_open (&lfs, &dir, path);
-  if (err)
-    return (ErrCode) -err;
-
-  struct lfs_info info;
-  int ret = lfs_dir_read (&lfs, &dir, &info);
-  while (ret > 0)
+ErrCode storage_walk (const char *path, StorageWalkFn fn, void *user_data)
+  {
+  FileInfo info;
+  ErrCode ret = storage_info (path, &info);
+  if (ret) return ret;
+  if (info.type != STORAGE_TYPE_DIR)
+    return fn (path, &info, STORAGE_WALK_FILE, user_data);
+
+  char *full = malloc (MAX_PATH + 1);
+  StorageWalkLevel *levels = malloc 
+    (STORAGE_WALK_DEPTH * sizeof (StorageWalkLevel));
+  if (!full || !levels)
+    {
+    free (full);
+    free (levels);
+    return ERR_NOMEM;
+    }
+  strncpy (full, path, MAX_PATH);
+  full[MAX_PATH] = 0;
+  size_t len = strlen (full);
+  while (len > 1 && full[len - 1] == '/') full[--len] = 0;
+
+  int depth = 0;
+  ret = fn (full, &info, STORAGE_WALK_DIR_PRE, user_data);
+  if (ret == 0)
     {
-    list_append (list, strdup (info.name));
-    ret = lfs_dir_read (&lfs, &dir, &info);
+    const char *sub;
+    levels[0].fs = storage_route (full, &sub);
+    levels[0].path_len = len;
+    ret = (ErrCode) -lfs_dir_open (levels[0].fs, &levels[0].dir, sub);
+    if (ret == 0) depth = 1;
     }
 
-  lfs_dir_close (&lfs, &dir);
+  while (depth > 0)
+    {
+    StorageWalkLevel *level = &levels[depth - 1];
+    struct lfs_info linfo;
+    int res = ret ? 0 : lfs_dir_read (level->fs, &level->dir, &linfo);
+    if (res < 0) ret = (ErrCode) -res;
+    if (res <= 0)
+      {
+      // End of this directory, or giving up 
+      lfs_dir_close (level->fs, &level->dir);
+      full[level->path_len] = 0;
+      depth--;
+      if (ret == 0)
+        {
+        ret = storage_info (full, &info);
+        if (ret == 0) 
+          ret = fn (full, &info, STORAGE_WALK_DIR_POST, user_data);
+        }
+      continue;
+      }
+    if (strcmp (linfo.name, ".") == 0 || strcmp (linfo.name, "..") == 0)
+      continue;
 
-  return 0;
+    size_t name_len = strlen (linfo.name);
+    size_t sep = level->path_len > 0 && full[level->path_len - 1] != '/';
+    if (level->path_len + sep + name_len > MAX_PATH)
+      {
+      ret = ERR_NAMETOOLONG;
+      continue;
+      }
+    full[level->path_len] = '/';
+    strcpy (full + level->path_len + sep, linfo.name);
+
+    strcpy (info.name, linfo.name);
+    info.size = linfo.type == LFS_TYPE_REG ? linfo.size : 0;
+    info.stored_size = info.size;
+    info.compressed = FALSE;
+    if (linfo.type != LFS_TYPE_DIR)
+      {
+      info.type = STORAGE_TYPE_REG;
+      const char *sub;
+      storage_route (full, &sub);
+      storage_get_codec (level->fs, sub, &info);
+      ret = fn (full, &info, STORAGE_WALK_FILE, user_data);
+      continue;
+      }
+
+    // Give up before the callback sees a directory that can't be 
+    //   walked, so it is never told of more than STORAGE_WALK_DEPTH 
+    //   levels, and doesn't act on one it will never be given the 
+    //   contents of
+    if (depth == STORAGE_WALK_DEPTH)
+      {
+      ret = ERR_NAMETOOLONG;
+      continue;
+      }
+    info.type = STORAGE_TYPE_DIR;
+    ret = fn (full, &info, STORAGE_WALK_DIR_PRE, user_data);
+    if (ret) continue;
+    StorageWalkLevel *next = &levels[depth];
+    const char *sub;
+    next->fs = storage_route (full, &sub);
+    next->path_len = strlen (full);
+    ret = (ErrCode) -lfs_dir_open (next->fs, &next->dir, sub);
+    if (ret == 0) depth++;
+    }
+
+  free (levels);
+  free (full);
+  return ret;
   }
 
 /*=========================================================================
@@ -156,17 +1077,41 @@ ErrCode storage_list_dir (const char *path, List *list)
 =========================================================================*/
 ErrCode storage_df (const char *path, uint32_t *used, uint32_t *total)
   {
-  (void)path; // TODO
-  ErrCode ret = 0;
-  int res = (int)lfs_fs_size (&lfs);
-  if (res >= 0) 
+  lfs_t *fs = path ? storage_route (path, &path) : &lfs;
+  if (fs != &lfs)
+    {
+    // Filesystems in RAM are small, so they can be counted every time
+    const struct lfs_config *c = fs->cfg;
+    lfs_ssize_t res = lfs_fs_size (fs);
+    if (res < 0) 
+      return (ErrCode) -res;
+    *used = (uint32_t)res * c->block_size;
+    *total = c->block_count * c->block_size;
+    return 0;
+    }
+
+  if (used_blocks < 0)
     {
-    *used = (uint32_t)res * INTERFACE_STORAGE_BLOCK_SIZE;
-    *total = INTERFACE_STORAGE_BLOCK_SIZE * INTERFACE_STORAGE_BLOCK_COUNT;
+    lfs_ssize_t res = lfs_fs_size (&lfs);
+    if (res < 0) 
+      return (ErrCode) -res;
+    used_blocks = (int)res;
     }
   else
-    ret = (ErrCode) -res;
-  return ret;
+    used_blocks += (int)(lfs.meta_blocks - meta_blocks);
+  meta_blocks = lfs.meta_blocks;
+#if STORAGE_CHECK_DF
+  lfs_ssize_t check = lfs_fs_size (&lfs);
+  if (check >= 0 && (int)check != used_blocks)
+    {
+    printf ("df: counted %ld blocks, expected %ld\n", (long)check, 
+      (long)used_blocks);
+    used_blocks = (int)check;
+    }
+#endif
+  *used = (uint32_t)used_blocks * INTERFACE_STORAGE_BLOCK_SIZE;
+  *total = INTERFACE_STORAGE_BLOCK_SIZE * INTERFACE_STORAGE_BLOCK_COUNT;
+  return 0;
   }
 
 /*=========================================================================
@@ -180,6 +1125,7 @@ ErrCode storage_format (void)
   if (mounted)
     lfs_unmount (&lfs); // Continue whether this succeeds or not
   mounted = FALSE;
+  used_blocks = -1;
   int err = lfs_format (&lfs, &cfg);
   if (err == 0)
     {
@@ -188,6 +1134,15 @@ ErrCode storage_format (void)
     }
   else
     ret = (ErrCode) -err;
+#if STORAGE_NAME_INDEX
+  storage_name_index_reset ();
+#endif
+  if (ret == 0)
+    {
+    mounted = TRUE;
+    for (int i = 0; i < STORAGE_MAX_MOUNTS; i++)
+      if (mounts[i].blocks) lfs_mkdir (&lfs, mounts[i].name);
+    }
   return ret;
   }
 
@@ -200,10 +1155,11 @@ BOOL storage_file_exists (const char *path)
   {
   BOOL ret = FALSE;
   lfs_file_t file;
-  int err = lfs_file_open (&lfs, &file, path, LFS_O_RDONLY);
+  lfs_t *fs = storage_route (path, &path);
+  int err = lfs_file_open (fs, &file, path, LFS_O_RDONLY);
   if (err == 0)
     {
-    lfs_file_close (&lfs, &file);
+    lfs_file_close (fs, &file);
     ret = TRUE;
     }
   else
@@ -230,35 +1186,25 @@ ErrCode storage_enumerate_bytes (const char *path,
                  StorageEnumBytesFn fn, void *user_data)
   {
   ErrCode ret = 0;
-  lfs_file_t file;
+  StorageFile *file;
 
   char *buff = malloc (INTERFACE_STORAGE_BLOCK_SIZE);
   if (!buff) 
     return ERR_NOMEM;
 
-  int err = lfs_file_open (&lfs, &file, path, 
-       LFS_O_RDONLY);
-
-  if (err == 0)
+  ret = storage_file_open (path, STORAGE_OPEN_READ, &file);
+  if (ret == 0)
     {
-    lfs_ssize_t n = 0; 
+    int n = 0; 
     do
       {
-      lfs_ssize_t n = lfs_file_read (&lfs, &file, buff, 
-         INTERFACE_STORAGE_BLOCK_SIZE);
-      if ((int)n > 0)
+      ret = storage_file_read (file, buff, INTERFACE_STORAGE_BLOCK_SIZE, &n);
+      for (int i = 0; i < n && ret == 0; i++)
         {
-        for (int i = 0; i < n; i++)
-          {
-	  fn ((uint8_t)buff[i], user_data);
-          }
+        ret = fn ((uint8_t)buff[i], user_data);
         }
-      } while (n > 0);
-    lfs_file_close (&lfs, &file);
-    }
-  else
-    {
-    ret = (ErrCode) -err;
+      } while (n > 0 && ret == 0);
+    storage_file_close (file);
     }
   free (buff);
   return ret;
@@ -271,8 +1217,13 @@ ErrCode storage_enumerate_bytes (const char *path,
 =========================================================================*/
 extern ErrCode storage_rm (const char *path)
   {
+  lfs_t *fs = storage_route (path, &path);
+  if (fs != &lfs)
+    return (ErrCode) -lfs_remove (fs, path);
+  int blocks = storage_entry_blocks (path);
   int err = lfs_remove (&lfs, path);
-  
+  if (err == 0) 
+    storage_adjust_used (-blocks);
   return (ErrCode)-err;
   }
 
@@ -284,33 +1235,42 @@ extern ErrCode storage_rm (const char *path)
 ErrCode storage_read_file (const char *path, 
          uint8_t **buff, int *n)
   {
-  ErrCode ret = 0;
-  lfs_file_t file;
-  int err = lfs_file_open (&lfs, &file, path, LFS_O_RDONLY);
-  if (err == 0)
+  StorageFile *file;
+  ErrCode ret = storage_file_open (path, STORAGE_OPEN_READ, &file);
+  if (ret == 0)
     {
-    int size = (int)lfs_file_size (&lfs, &file);
+    int size = storage_file_size (file);
     if (size >= 0)
       {
-      *buff = malloc ((unsigned)size);
+      // Allocate at least one byte, so an empty file isn't taken
+      //   to be a lack of memory
+      *buff = malloc ((unsigned)size + 1);
       if (*buff)
         {
-	lfs_file_read (&lfs, &file, *buff, (unsigned)size);
-	*n = size;
-	}
+        int total = 0;
+        int count = 0;
+        do 
+          {
+          ret = storage_file_read (file, *buff + total, size - total, 
+            &count);
+          total += count;
+          } while (ret == 0 && count > 0 && total < size);
+        if (ret == 0)
+          *n = total;
+        else
+          free (*buff);
+        }
       else
         {
-	ret = ERR_NOMEM;
-	}
+        ret = ERR_NOMEM;
+        }
       }
     else 
       {
-      ret = (ErrCode)-size;
+      ret = ERR_IO;
       }
-    lfs_file_close (&lfs, &file);
+    storage_file_close (file);
     }
-  else
-    ret = (ErrCode)-err;
   return ret;
   }
 
@@ -322,20 +1282,14 @@ ErrCode storage_read_file (const char *path,
 ErrCode storage_read_partial (const char *filename, int offset, 
                   int count, uint8_t *buff, int *n)
   {
-  ErrCode ret = 0;
-  lfs_file_t file;
-  int err = lfs_file_open (&lfs, &file, filename, LFS_O_RDONLY);
-  if (err == 0)
+  StorageFile *file;
+  ErrCode ret = storage_file_open (filename, STORAGE_OPEN_READ, &file);
+  if (ret == 0)
     {
-    if (lfs_file_seek (&lfs, &file, offset, LFS_SEEK_SET) >= 0)
-      {
-      *n = lfs_file_read (&lfs, &file, buff, count);
-      if (*n < 0) 
-        ret = (ErrCode)-err;
-      }
-    else
-      return ERR_INVAL;
-    lfs_file_close (&lfs, &file);
+    ret = storage_file_seek (file, offset);
+    if (ret == 0)
+      ret = storage_file_read (file, buff, count, n);
+    storage_file_close (file);
     }
   return ret;
   }
@@ -344,48 +1298,45 @@ ErrCode storage_read_partial (const char *filename, int offset,
 
   storage_copy_file
 
+  The copy is compressed, or not, according to the current setting, not
+  according to whether the original is compressed.
+
 =========================================================================*/
 ErrCode storage_copy_file (const char *from, const char *to)
   {
-  ErrCode ret = 0;
-  lfs_file_t file_from;
-  lfs_file_t file_to;
-  int err = lfs_file_open (&lfs, &file_from, from, LFS_O_RDONLY);
-  if (err == 0)
+  StorageFile *file_from;
+  StorageFile *file_to;
+  ErrCode ret = storage_file_open (from, STORAGE_OPEN_READ, &file_from);
+  if (ret == 0)
     {
     char *buff = malloc (INTERFACE_STORAGE_BLOCK_SIZE);
     if (buff) 
       {
-      int err = lfs_file_open (&lfs, &file_to, to, 
-         LFS_O_RDWR | LFS_O_CREAT | LFS_O_TRUNC);
-      if (err == 0)
+      ret = storage_file_open (to, STORAGE_OPEN_WRITE, &file_to);
+      if (ret == 0)
         {
-        lfs_ssize_t n = 0;
+        int n = 0;
         do 
           {
-          n = lfs_file_read (&lfs, &file_from, buff, 
-            INTERFACE_STORAGE_BLOCK_SIZE);
-          if ((int)n > 0)
-            {
-            lfs_file_write (&lfs, &file_to, buff, (unsigned)n);
-            }
-          } while (n > 0  && shell_get_interrupt() == FALSE);
-        lfs_file_close (&lfs, &file_to);
+          ret = storage_file_read (file_from, buff, 
+            INTERFACE_STORAGE_BLOCK_SIZE, &n);
+          if (ret == 0 && n > 0)
+            ret = storage_file_write (file_to, buff, n);
+          } while (n > 0 && ret == 0 && shell_get_interrupt() == FALSE);
+        ErrCode err = storage_file_close (file_to);
+        if (ret == 0) ret = err;
         if (shell_get_interrupt())
           {
           storage_rm (to);
           }
         }
-      else
-        ret = (ErrCode)-err;
+      free (buff);
       }
     else
       ret = ERR_NOMEM;
 
-    lfs_file_close (&lfs, &file_from);
+    storage_file_close (file_from);
     }
-  else 
-    ret = (ErrCode)-err;
   return ret;
   }
 
@@ -397,13 +1348,21 @@ ErrCode storage_copy_file (const char *from, const char *to)
 ErrCode storage_info (const char *path, FileInfo *info)
   {
   struct lfs_info linfo;
-  int err = lfs_stat (&lfs, path, &linfo);
+  const char *full_path = path;
+  lfs_t *fs = storage_route (path, &path);
+  int err = lfs_stat (fs, path, &linfo);
   if (err == 0)
     {
-    strncpy (info->name, linfo.name, STORAGE_NAME_MAX);
+    if (fs != &lfs && strcmp (path, "/") == 0)
+      storage_get_basename (full_path, info->name); 
+    else
+      strncpy (info->name, linfo.name, STORAGE_NAME_MAX);
     info->type = linfo.type == LFS_TYPE_DIR ? STORAGE_TYPE_DIR 
       : STORAGE_TYPE_REG;
     info->size = linfo.type == LFS_TYPE_REG ? linfo.size : 0; 
+    info->stored_size = info->size;
+    info->compressed = FALSE;
+    if (linfo.type == LFS_TYPE_REG) storage_get_codec (fs, path, info);
     return 0;
     }
   else
@@ -417,7 +1376,8 @@ ErrCode storage_info (const char *path, FileInfo *info)
 =========================================================================*/
 ErrCode storage_mkdir (const char *path)
   {
-  int err = lfs_mkdir (&lfs, path);
+  lfs_t *fs = storage_route (path, &path);
+  int err = lfs_mkdir (fs, path);
   if (err == 0)
     {
     return 0;
@@ -500,9 +1460,415 @@ void storage_get_dir (const char *path, char result[MAX_PATH + 1])
 =========================================================================*/
 ErrCode storage_rename (const char *source, const char *target)
   {
-  return (ErrCode) -lfs_rename (&lfs, source, target);
+  // littlefs doesn't stop a directory being moved into itself, which
+  //   would cut it off from the rest of the filesystem
+  size_t len = strlen (source);
+  while (len > 1 && source[len - 1] == '/') len--;
+  if (strncmp (source, target, len) == 0 && target[len] == '/')
+    return ERR_INVAL;
+
+  const char *sub_source, *sub_target;
+  lfs_t *fs = storage_route (source, &sub_source);
+  if (storage_route (target, &sub_target) != fs)
+    {
+    // Between filesystems, a file has to be copied
+    FileInfo info;
+    ErrCode ret = storage_info (source, &info);
+    if (ret == 0 && info.type == STORAGE_TYPE_DIR) 
+      ret = ERR_NOTIMPLEMENTED;
+    if (ret == 0) ret = storage_copy_file (source, target);
+    if (ret == 0) ret = storage_rm (source);
+    return ret;
+    }
+  if (fs != &lfs)
+    return (ErrCode) -lfs_rename (fs, sub_source, sub_target);
+
+  // Anything that the source replaces is freed
+  int blocks = 0;
+  if (strcmp (source, target) != 0)
+    blocks = storage_entry_blocks (target);
+  int err = lfs_rename (&lfs, source, target);
+  if (err == 0)
+    storage_adjust_used (-blocks);
+  return (ErrCode) -err;
+  }
+
+
+
+
+
+/*=========================================================================
+
+  storage_lzss_write
+
+  Sink for the compressor, which writes to the underlying file.
+
+=========================================================================*/
+static int storage_lzss_write (const uint8_t *buf, int len, void *user_data)
+  {
+  StorageFile *self = user_data;
+  lfs_ssize_t res = lfs_file_write (self->fs, &self->file, buf, 
+    (lfs_size_t)len);
+  if (res < 0)
+    return -res;
+  if (res != len)
+    return ERR_NOSPC;
+  return 0;
+  }
+
+/*=========================================================================
+
+  storage_lzss_read
+
+  Source for the decompressor, which reads the underlying file.
+
+=========================================================================*/
+static int storage_lzss_read (uint8_t *buf, int len, void *user_data)
+  {
+  StorageFile *self = user_data;
+  lfs_ssize_t res = lfs_file_read (self->fs, &self->file, buf, 
+    (lfs_size_t)len);
+  return res < 0 ? -1 : (int)res;
+  }
+
+/*=========================================================================
+
+  storage_file_open_codec
+
+  Open a file, and say whether to compress it, if it's being
+  created.
+
+=========================================================================*/
+static ErrCode storage_file_open_codec (const char *path, 
+          StorageOpenMode mode, BOOL compress, StorageFile **file)
+  {
+  int flags;
+  switch (mode)
+    {
+    case STORAGE_OPEN_WRITE: 
+      flags = LFS_O_RDWR | LFS_O_CREAT | LFS_O_TRUNC; 
+      break;
+    case STORAGE_OPEN_APPEND: 
+      flags = LFS_O_RDWR | LFS_O_APPEND | LFS_O_CREAT; 
+      break;
+    default: 
+      flags = LFS_O_RDONLY;
+    }
+
+  if (mode == STORAGE_OPEN_APPEND)
+    {
+    // We can't add to the end of a compressed file, so it has
+    //   to be expanded first
+    FileInfo info;
+    if (storage_info (path, &info) == 0 && info.compressed)
+      {
+      ErrCode err = storage_compress_file (path, FALSE);
+      if (err) return err;
+      }
+    }
+
+  StorageFile *self = calloc (1, sizeof (StorageFile));
+  if (!self)
+    return ERR_NOMEM;
+  self->fs = storage_route (path, &path);
+
+  if (mode != STORAGE_OPEN_READ && self->fs == &lfs)
+    {
+    self->writing = TRUE;
+    self->old_blocks = used_blocks < 0 ? -1 : storage_entry_blocks (path);
+    }
+
+  self->attr.type = STORAGE_ATTR_CODEC;
+  self->attr.buffer = self->attr_value;
+  self->attr.size = STORAGE_ATTR_SIZE;
+  self->config.attrs = &self->attr;
+  self->config.attr_count = 1;
+
+  int err = lfs_file_opencfg (self->fs, &self->file, path, flags, 
+    &self->config);
+  if (err)
+    {
+    free (self);
+    return (ErrCode) -err;
+    }
+  StorageMount *m = storage_mount_of (self->fs);
+  if (m) m->open_files++;
+
+  ErrCode ret = 0;
+  if (mode == STORAGE_OPEN_WRITE)
+    {
+    memset (self->attr_value, 0, STORAGE_ATTR_SIZE);
+    if (compress)
+      {
+      self->attr_value[0] = STORAGE_CODEC_LZSS;
+      self->encoder = lzss_encoder_new (storage_lzss_write, self);
+      if (!self->encoder) ret = ERR_NOMEM;
+      }
+    }
+  else if (mode == STORAGE_OPEN_READ 
+      && self->attr_value[0] == STORAGE_CODEC_LZSS)
+    {
+    self->size = storage_get_u32 (self->attr_value + 4);
+    self->decoder = lzss_decoder_new (storage_lzss_read, self, self->size);
+    if (!self->decoder) ret = ERR_NOMEM;
+    }
+
+  if (ret)
+    {
+    lfs_file_close (self->fs, &self->file);
+    if (self->writing) used_blocks = -1;
+    if (m) m->open_files--;
+    free (self);
+    return ret;
+    }
+
+  *file = self;
+  return 0;
+  }
+
+/*=========================================================================
+
+  storage_file_open
+
+=========================================================================*/
+ErrCode storage_file_open (const char *path, StorageOpenMode mode,
+          StorageFile **file)
+  {
+  return storage_file_open_codec (path, mode, compress_writes, file);
+  }
+
+/*=========================================================================
+
+  storage_file_read
+
+=========================================================================*/
+ErrCode storage_file_read (StorageFile *self, void *buff, int count, int *n)
+  {
+  if (self->decoder)
+    {
+    int res = lzss_decoder_read (self->decoder, buff, count);
+    if (res < 0)
+      {
+      *n = 0;
+      return ERR_CORRUPT;
+      }
+    self->pos += (uint32_t)res;
+    *n = res;
+    return 0;
+    }
+
+  lfs_ssize_t res = lfs_file_read (self->fs, &self->file, buff, 
+    (lfs_size_t)count);
+  if (res < 0)
+    {
+    *n = 0;
+    return (ErrCode) -res;
+    }
+  *n = (int)res;
+  return 0;
+  }
+
+/*=========================================================================
+
+  storage_file_write
+
+=========================================================================*/
+ErrCode storage_file_write (StorageFile *self, const void *buff, int count)
+  {
+  ErrCode ret = 0;
+  if (self->encoder)
+    {
+    self->size += (uint32_t)count;
+    ret = (ErrCode) lzss_encoder_write (self->encoder, buff, count);
+    }
+  else
+    {
+    lfs_ssize_t res = lfs_file_write (self->fs, &self->file, buff, 
+      (lfs_size_t)count);
+    if (res < 0)
+      ret = (ErrCode) -res;
+    else if (res != count)
+      ret = ERR_NOSPC;
+    }
+  // littlefs won't store a file that could not be written, so
+  //   we can't tell from its size how many blocks it uses
+  if (ret) self->old_blocks = -1;
+  return ret;
+  }
+
+/*=========================================================================
+
+  storage_file_seek
+
+  A compressed file can only be read from the start so, to seek
+  backwards, we have to go back to the start and decompress
+  up to the new position. A file being compressed can only be
+  written from start to end, so it can't seek at all.
+
+=========================================================================*/
+ErrCode storage_file_seek (StorageFile *self, int offset)
+  {
+  if (self->encoder) return ERR_NOTIMPLEMENTED;
+
+  if (self->decoder)
+    {
+    if ((uint32_t)offset < self->pos)
+      {
+      lfs_soff_t res = lfs_file_seek (self->fs, &self->file, 0, 
+        LFS_SEEK_SET);
+      if (res < 0)
+        return (ErrCode) -res;
+      lzss_decoder_reset (self->decoder);
+      self->pos = 0;
+      }
+    uint8_t skip[64];
+    while (self->pos < (uint32_t)offset)
+      {
+      int count = offset - (int)self->pos;
+      if (count > (int)sizeof (skip)) count = sizeof (skip);
+      int n;
+      ErrCode err = storage_file_read (self, skip, count, &n);
+      if (err) return err;
+      if (n == 0) break;
+      }
+    return 0;
+    }
+
+  lfs_soff_t res = lfs_file_seek (self->fs, &self->file, offset, 
+    LFS_SEEK_SET);
+  if (res < 0)
+    return (ErrCode) -res;
+  return 0;
+  }
+
+/*=========================================================================
+
+  storage_file_size
+
+=========================================================================*/
+int storage_file_size (StorageFile *self)
+  {
+  if (self->encoder || self->decoder)
+    return (int)self->size;
+
+  lfs_soff_t res = lfs_file_size (self->fs, &self->file);
+  if (res < 0)
+    return -1;
+  return (int)res;
+  }
+
+/*=========================================================================
+
+  storage_file_close
+
+  For a compressed file, the uncompressed size is written into the
+  attribute here, and littlefs stores it when the file is closed.
+  Closing a file that has been written also updates the count of 
+  used blocks, from the file's old and new sizes.
+
+=========================================================================*/
+ErrCode storage_file_close (StorageFile *self)
+  {
+  ErrCode ret = 0;
+  if (self->encoder)
+    {
+    ret = (ErrCode) lzss_encoder_finish (self->encoder);
+    lzss_encoder_destroy (self->encoder);
+    self->attr_value[4] = self->size & 0xFF;
+    self->attr_value[5] = (self->size >> 8) & 0xFF;
+    self->attr_value[6] = (self->size >> 16) & 0xFF;
+    self->attr_value[7] = (self->size >> 24) & 0xFF;
+    }
+  if (self->decoder)
+    lzss_decoder_destroy (self->decoder);
+  int new_blocks = 0;
+  if (self->writing)
+    {
+    lfs_soff_t size = lfs_file_size (&lfs, &self->file);
+    new_blocks = storage_file_blocks (size < 0 ? 0 : (uint32_t)size);
+    }
+  int err = lfs_file_close (self->fs, &self->file);
+  StorageMount *m = storage_mount_of (self->fs);
+  if (m) m->open_files--;
+  if (self->writing)
+    {
+    // If the file could not be written, we don't know what state
+    //   it's in, so the blocks will have to be counted again. The
+    //   same applies if we weren't keeping count when it was opened
+    if (ret == 0 && err == 0 && self->old_blocks >= 0)
+      storage_adjust_used (new_blocks - self->old_blocks);
+    else
+      used_blocks = -1;
+    }
+  free (self);
+  if (ret == 0) ret = (ErrCode) -err;
+  return ret;
+  }
+
+/*=========================================================================
+
+  storage_set_compression
+
+=========================================================================*/
+void storage_set_compression (BOOL compress)
+  {
+  compress_writes = compress;
+  }
+
+/*=========================================================================
+
+  storage_get_compression
+
+=========================================================================*/
+BOOL storage_get_compression (void)
+  {
+  return compress_writes;
   }
 
+/*=========================================================================
+
+  storage_compress_file
+
+  Rewrite the file into a temporary file, then replace the original. 
 
+=========================================================================*/
+ErrCode storage_compress_file (const char *path, BOOL compress)
+  {
+  FileInfo info;
+  ErrCode ret = storage_info (path, &info);
+  if (ret) return ret;
+  if (info.type == STORAGE_TYPE_DIR) return ERR_ISDIR;
+  if (info.compressed == compress) return 0;
+
+  char temp[MAX_PATH + 1];
+  if (strlen (path) + 1 > MAX_PATH) return ERR_NAMETOOLONG;
+  strcpy (temp, path);
+  strcat (temp, "~");
+
+  StorageFile *from;
+  StorageFile *to;
+  ret = storage_file_open_codec (path, STORAGE_OPEN_READ, FALSE, &from);
+  if (ret) return ret;
+  ret = storage_file_open_codec (temp, STORAGE_OPEN_WRITE, compress, &to);
+  if (ret == 0)
+    {
+    uint8_t buff[256];
+    int n;
+    do
+      {
+      ret = storage_file_read (from, buff, sizeof (buff), &n);
+      if (ret == 0 && n > 0)
+        ret = storage_file_write (to, buff, n);
+      } while (ret == 0 && n > 0);
+    ErrCode err = storage_file_close (to);
+    if (ret == 0) ret = err;
+    }
+  storage_file_close (from);
 
+  if (ret == 0)
+    ret = storage_rename (temp, path);
+  if (ret)
+    storage_rm (temp);
+  return ret;
+  }
 
@@ -0,0 +1,373 @@
+#!/usr/bin/env python3
+#
+# picosync.py
+#
+# Host side of the picolua delta-sync protocol. Copies a file or a
+# directory tree to the device, sending only the parts of each file
+# that differ from the copy that is already there. See
+# ymodem/include/ymodem/ysync.h for a description of the protocol.
+#
+# Usage: picosync.py [-p /dev/ttyACM0] {local file or dir} [device dir]
+#
+# This runs the sync-recv command on the device itself, so the device
+# should be at the shell prompt.
+#
+# (c)2021 Kevin Boone, GPLv3.0
+
+import os
+import select
+import struct
+import sys
+import termios
+import time
+import tty
+import zlib
+
+SOH, STX, EOT, ACK, NAK, CAN = 0x01, 0x02, 0x04, 0x06, 0x15, 0x18
+FRAME_SIZE = 1024
+SHORT_FRAME_SIZE = 128
+FRAME_DATA = FRAME_SIZE - 2
+TIMEOUT = 2.0
+MAX_ERRORS = 5
+MAX_LITERAL = 0xFFFF
+
+
+def crc16(data):
+    crc = 0
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+class SyncError(Exception):
+    pass
+
+
+class Link:
+    """Message channel over YModem 1K packets. Bytes written are
+    collected until flush(); reads block until enough packets
+    have arrived."""
+
+    def __init__(self, fd):
+        self.fd = fd
+        self.rx = b''
+        self.out = b''
+        self.out_block = 1
+        self.inbuf = b''
+        self.in_seq = 1
+        self.bytes_sent = 0
+        self.bytes_received = 0
+
+    def _read(self, timeout):
+        r, _, _ = select.select([self.fd], [], [], timeout)
+        if not r:
+            return False
+        d = os.read(self.fd, 65536)
+        self.bytes_received += len(d)
+        self.rx += d
+        return True
+
+    def getc(self, timeout=TIMEOUT):
+        end = time.time() + timeout
+        while not self.rx:
+            left = end - time.time()
+            if left <= 0 or not self._read(left):
+                return None
+        c = self.rx[0]
+        self.rx = self.rx[1:]
+        return c
+
+    def getn(self, n, timeout=TIMEOUT):
+        end = time.time() + timeout
+        while len(self.rx) < n:
+            left = end - time.time()
+            if left <= 0 or not self._read(left):
+                return None
+        d = self.rx[:n]
+        self.rx = self.rx[n:]
+        return d
+
+    def write(self, data):
+        self.bytes_sent += len(data)
+        while data:
+            n = os.write(self.fd, data)
+            data = data[n:]
+
+    def wait_ready(self, timeout=10):
+        """Discard the command echo, then wait for the device to
+        send 'C'"""
+        end = time.time() + timeout
+        while time.time() < end:
+            if self.getc(end - time.time()) == ord('\n'):
+                break
+        while time.time() < end:
+            if self.getc(end - time.time()) == ord('C'):
+                # Drop any other 'C's that are already waiting
+                while self.rx[:1] == b'C':
+                    self.rx = self.rx[1:]
+                return
+        raise SyncError('device did not start sync-recv')
+
+    def _send_frame(self, payload):
+        # Most requests are short, so they go in 128-byte packets
+        size = SHORT_FRAME_SIZE if len(payload) <= SHORT_FRAME_SIZE - 2 else FRAME_SIZE
+        data = struct.pack('>H', len(payload)) + payload
+        data += b'\0' * (size - len(data))
+        seq = self.out_block & 0xFF
+        c = crc16(data)
+        pkt = bytes([SOH if size == SHORT_FRAME_SIZE else STX, seq, 0xFF - seq]) \
+            + data + bytes([c >> 8, c & 0xFF])
+        for _ in range(MAX_ERRORS):
+            self.write(pkt)
+            while True:
+                c = self.getc()
+                if c in (ACK, NAK, CAN, None):
+                    break
+                # Stray 'C' from the device before it saw our first packet
+            if c == ACK:
+                self.out_block += 1
+                return
+            if c == CAN:
+                raise SyncError('cancelled by device')
+        raise SyncError('too many errors sending to device')
+
+    def put(self, data):
+        self.out += data
+        while len(self.out) >= FRAME_DATA:
+            self._send_frame(self.out[:FRAME_DATA])
+            self.out = self.out[FRAME_DATA:]
+
+    def flush(self):
+        if self.out:
+            self._send_frame(self.out)
+            self.out = b''
+
+    def _recv_frame(self):
+        errors = 0
+        while errors < MAX_ERRORS:
+            c = self.getc(TIMEOUT * 5)
+            if c is None:
+                raise SyncError('timeout waiting for device')
+            if c == CAN:
+                raise SyncError('cancelled by device')
+            if c != STX:
+                continue
+            pkt = self.getn(FRAME_SIZE + 4)
+            if pkt is None or pkt[0] != 0xFF - pkt[1] or crc16(pkt[2:]) != 0:
+                errors += 1
+                self.rx = b''
+                self.write(bytes([NAK]))
+                continue
+            self.write(bytes([ACK]))
+            if pkt[0] != self.in_seq & 0xFF:
+                # Repeat of a packet we already have
+                continue
+            self.in_seq += 1
+            n = struct.unpack('>H', pkt[2:4])[0]
+            self.inbuf += pkt[4:4 + n]
+            return
+        raise SyncError('too many errors receiving from device')
+
+    def get(self, n):
+        while len(self.inbuf) < n:
+            self._recv_frame()
+        d = self.inbuf[:n]
+        self.inbuf = self.inbuf[n:]
+        return d
+
+    def get_u8(self):
+        return self.get(1)[0]
+
+    def get_u16(self):
+        return struct.unpack('<H', self.get(2))[0]
+
+    def get_u32(self):
+        return struct.unpack('<I', self.get(4))[0]
+
+
+def weak_sum(block):
+    a = sum(block) & 0xFFFF
+    n = len(block)
+    b = sum((n - i) * x for i, x in enumerate(block)) & 0xFFFF
+    return a | (b << 16)
+
+
+def compute_delta(data, bs, hashes):
+    """Returns a list of ops: ('C', index) or ('L', bytes)"""
+    table = {}
+    tail = None
+    for i, (weak, strong, length) in enumerate(hashes):
+        if length == bs:
+            table.setdefault(weak, []).append((i, strong))
+        else:
+            tail = (i, strong, length)
+
+    ops = []
+    lit_start = 0
+    n = len(data)
+
+    def emit_literal(end):
+        for s in range(lit_start, end, MAX_LITERAL):
+            ops.append(('L', data[s:min(end, s + MAX_LITERAL)]))
+
+    k = 0
+    if n >= bs and table:
+        a = sum(data[0:bs]) & 0xFFFF
+        b = sum((bs - i) * x for i, x in enumerate(data[0:bs])) & 0xFFFF
+        while True:
+            match = None
+            cands = table.get(a | (b << 16))
+            if cands:
+                strong = zlib.crc32(data[k:k + bs])
+                for idx, s in cands:
+                    if s == strong:
+                        match = idx
+                        break
+            if match is not None:
+                emit_literal(k)
+                ops.append(('C', match))
+                k += bs
+                lit_start = k
+                if k + bs > n:
+                    break
+                a = sum(data[k:k + bs]) & 0xFFFF
+                b = sum((bs - i) * x for i, x in enumerate(data[k:k + bs])) & 0xFFFF
+                continue
+            if k + bs >= n:
+                break
+            out, inn = data[k], data[k + bs]
+            a = (a - out + inn) & 0xFFFF
+            b = (b - bs * out + a) & 0xFFFF
+            k += 1
+
+    # The device's last block is usually short, so it can only match the
+    # end of the new file
+    if tail is not None:
+        idx, strong, length = tail
+        if n - lit_start >= length and zlib.crc32(data[n - length:]) == strong:
+            emit_literal(n - length)
+            ops.append(('C', idx))
+            lit_start = n
+    emit_literal(n)
+    return ops
+
+
+def put_path(link, path):
+    p = path.encode()
+    link.put(struct.pack('<H', len(p)) + p)
+
+
+def sync_file(link, local, remote, verbose=True):
+    """Returns the number of bytes of file data sent, or -1 if the
+    file was already up to date"""
+    with open(local, 'rb') as f:
+        data = f.read()
+    crc = zlib.crc32(data)
+
+    link.put(b'H')
+    put_path(link, remote)
+    link.flush()
+    status = link.get_u8()
+    size = link.get_u32()
+    bs = link.get_u16()
+    nblocks = link.get_u32()
+    file_crc = link.get_u32()
+    hashes = []
+    for i in range(nblocks):
+        weak = link.get_u32()
+        strong = link.get_u32()
+        hashes.append((weak, strong, min(bs, size - i * bs)))
+
+    if status == ord('K') and size == len(data) and file_crc == crc:
+        if verbose:
+            print('%s: up to date' % remote)
+        return -1
+
+    ops = compute_delta(data, bs, hashes)
+    link.put(b'D')
+    put_path(link, remote)
+    link.put(struct.pack('<II', len(data), crc))
+    literal = 0
+    for op, arg in ops:
+        if op == 'C':
+            link.put(b'C' + struct.pack('<I', arg))
+        else:
+            link.put(b'L' + struct.pack('<H', len(arg)) + arg)
+            literal += len(arg)
+    link.put(b'E')
+    link.flush()
+    if link.get_u8() != ord('K'):
+        raise SyncError('%s: device could not write file' % remote)
+    if verbose:
+        print('%s: sent %d of %d bytes' % (remote, literal, len(data)))
+    return literal
+
+
+def sync_tree(link, local, verbose=True):
+    """Sync a file or directory tree into the directory that sync-recv
+    was started in (see start()). Returns (files updated, bytes sent)"""
+    pairs = []
+    if os.path.isdir(local):
+        for root, dirs, files in os.walk(local):
+            dirs.sort()
+            for name in sorted(files):
+                path = os.path.join(root, name)
+                pairs.append((path, os.path.relpath(path, local).replace(os.sep, '/')))
+    else:
+        pairs.append((local, os.path.basename(local)))
+
+    updated = 0
+    sent = 0
+    for path, rel in pairs:
+        n = sync_file(link, path, rel, verbose)
+        if n >= 0:
+            updated += 1
+            sent += n
+    link.put(b'Q')
+    link.flush()
+    link.get_u8()
+    return updated, sent
+
+
+def start(fd, remote_dir, eol='\r'):
+    """Run sync-recv on the device, and wait for it to be ready. The
+    device shell expects CR at the end of a line; the host build
+    (used for testing over a pty) expects LF."""
+    link = Link(fd)
+    link.write(('sync-recv %s%s' % (remote_dir, eol)).encode())
+    link.wait_ready()
+    return link
+
+
+def main():
+    args = sys.argv[1:]
+    port = '/dev/ttyACM0'
+    if len(args) >= 2 and args[0] == '-p':
+        port = args[1]
+        args = args[2:]
+    if len(args) not in (1, 2):
+        print('Usage: picosync.py [-p port] {local file or dir} [device dir]')
+        return 1
+    fd = os.open(port, os.O_RDWR | os.O_NOCTTY)
+    old = termios.tcgetattr(fd)
+    tty.setraw(fd)
+    try:
+        t = time.time()
+        link = start(fd, args[1] if len(args) == 2 else '')
+        updated, sent = sync_tree(link, args[0])
+        print('%d file(s) updated, %d bytes of data sent, %.1fs' %
+              (updated, sent, time.time() - t))
+    except SyncError as e:
+        print(e)
+        return 1
+    finally:
+        termios.tcsetattr(fd, termios.TCSADRAIN, old)
+        os.close(fd)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+#
+# ymodem_keys.py
+#
+# Write a script for the shell's replay command that uploads files to
+# the device with YModem, without a terminal program. The script runs
+# yrecv, then supplies every byte that a sender would, in order. The
+# receiver never has reason to ask for anything again, so what it
+# sends back doesn't matter. See shell/src/shell_cmd_replay.c for the
+# format of the script.
+#
+# Usage: ymodem_keys.py [-g] [-d device dir] {files...} > upload.keys
+#
+# -g makes yrecv use streaming mode (YModem-g).
+#
+# (c)2021 Kevin Boone, GPLv3.0
+
+import getopt
+import os
+import sys
+
+SOH, STX, EOT = 0x01, 0x02, 0x04
+PACKET_SIZE = 128
+PACKET_1K_SIZE = 1024
+
+
+def crc16(data):
+    crc = 0
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def packet(seq, data):
+    size = PACKET_SIZE if len(data) <= PACKET_SIZE else PACKET_1K_SIZE
+    data = data.ljust(size, b'\x1a' if seq else b'\0')
+    crc = crc16(data)
+    return bytes([SOH if size == PACKET_SIZE else STX,
+                  seq & 0xFF, 0xFF - (seq & 0xFF)]) \
+        + data + bytes([crc >> 8, crc & 0xFF])
+
+
+def keys(data):
+    out = ''
+    for i, b in enumerate(data):
+        c = chr(b)
+        if c == '\\' or b < 32 or b >= 127 or (i == 0 and c in '#%'):
+            out += '\\x%02X' % b
+        else:
+            out += c
+    return out
+
+
+def main():
+    opts, args = getopt.getopt(sys.argv[1:], 'gd:')
+    opts = dict(opts)
+    if not args:
+        sys.exit('Usage: ymodem_keys.py [-g] [-d device dir] {files...}')
+    streaming = '-g' in opts
+    target = opts.get('-d', '/tmp')
+
+    print('# Upload %s to %s with YModem%s' %
+          (', '.join(os.path.basename(f) for f in args), target,
+           '-g' if streaming else ''))
+    print('# Made by tools/ymodem_keys.py')
+    print('%section start')
+    print('yrecv %s%s\\n' % ('-g ' if streaming else '', target))
+    for filename in args:
+        with open(filename, 'rb') as f:
+            body = f.read()
+        name = os.path.basename(filename)
+        print('%%section %s' % name[:15])
+        print(keys(packet(0, name.encode() + b'\0'
+                          + str(len(body)).encode())))
+        seq = 1
+        for off in range(0, len(body), PACKET_1K_SIZE):
+            chunk = body[off:off + PACKET_1K_SIZE]
+            print(keys(packet(seq, chunk)))
+            seq += 1
+        print(keys(bytes([EOT])))
+    print('%section end')
+    print(keys(packet(0, b'')))
+
+
+if __name__ == '__main__':
+    main()
@@ -14,7 +14,9 @@
 #pragma once
 
 #include <stdlib.h>
+#include <stdint.h>
 #include "../config.h" 
+#include <klib/defs.h>
 
 typedef enum _YmodemErr
   {
@@ -25,23 +27,54 @@ typedef enum _YmodemErr
   YmodemChecksum,
   YmodemCancelled,
   YmodemBadPacket,
-  YmodemNoCRC
+  YmodemNoCRC,
+  YmodemNoMem
   } YmodemErr;
 
 BEGIN_DECLS
 
 /** Receive to the specified filename. If this is NULL, use the
-  filename in the ymodem header. And if there's nothing there, either,
-  use "untitled.txt". Of course, it makes no sense to use transmit
-  multiples files and _not_ supply filenames. Similarly, it makes no
-  sense to invoke this method with a filename, when we expect multiple
-  files. */
-extern YmodemErr ymodem_receive (const char *filename, uint32_t max_size);
-
+  filename in the ymodem header. If the sender sends a batch of files,
+  the filename applies only to the first; the others get the names
+  in their headers. If streaming is TRUE, ask the sender not to wait
+  for an ACK after each packet (YModem-g). This is much faster, but
+  any error ends the transfer, so it's only suitable for reliable 
+  links, like USB. */
+extern YmodemErr ymodem_receive (const char *filename, uint32_t max_size,
+          BOOL streaming);
+
+/** Receive a batch of files into the directory dir, which must exist.
+  Names in the headers may include directories, which are created 
+  under dir as necessary. max_size applies to each file. On return,
+  *count is the number of files received completely. */
+extern YmodemErr ymodem_receive_batch (const char *dir, uint32_t max_size,
+          BOOL streaming, int *count);
+
+/** Send a file from storage. The file is read a block at a time as 
+    the transfer proceeds, so it need not fit into memory. */
 extern YmodemErr ymodem_send (const char *filename);
+
+/** Send a number of files from storage in one session. The
+    receiver decides whether to use streaming mode. */
+extern YmodemErr ymodem_send_files (int count, char * const *filenames);
+
 extern YmodemErr ymodem_send_data (uint8_t *data, uint32_t size, 
           const char *filename);
 
+/** Send one packet. Block zero is a 128-byte packet, all others are 1K,
+    and txdata must contain that many bytes. The low-level packet 
+    functions are exported so that other protocols (ysync) can use the
+    same framing. */
+extern void ymodem_send_packet (const uint8_t *txdata, int32_t block_nbr);
+
+/** Receive one packet, including its header and CRC, into rxdata, which
+    must have room for a 1K packet plus five bytes of overhead. Returns 0 
+    on success, with *rxlen set to the data size, or to 0 if 
+    the sender sent EOT, or to -1 if it cancelled. Returns -1 on a timeout
+    and 1 on a corrupt packet. */
+extern int32_t ymodem_rx_packet (uint8_t *rxdata, int32_t *rxlen,
+          uint32_t packets_rxed, uint32_t timeout_ms);
+
 /** Get an English string corresponding to the error code. */
 extern const char *ymodem_strerror (YmodemErr err);
 
@@ -0,0 +1,61 @@
+/*=========================================================================
+
+  Ymodem
+
+  ymodem/ysync.h
+
+  A simple delta-sync protocol, for updating files that are already
+  on the device when only part of them has changed. The device reports
+  a checksum for each block of the existing file; the host works out
+  which of these blocks it can reuse, and sends only the regions that
+  are different. The host-side implementation is tools/picosync.py.
+
+  All messages are carried in YModem packets, with the usual
+  sequence numbers, CRC, and ACK/NAK. The host may use 128-byte 
+  packets for short messages. Within each packet, the first
+  two bytes (big-endian) give the number of bytes of message data that
+  follow. Messages may span packets. Multi-byte integers in messages
+  are little-endian.
+
+  Requests from the host, and the device's responses:
+
+  'H' path -- block hashes
+     Response: status ('K' or 'N' if the file does not exist),
+     file size (u32), block size (u16), block count (u32),
+     CRC32 of the whole file (u32), then for each block the weak
+     (rolling) checksum and the CRC32 (u32 each).
+
+  'D' path size(u32) crc32(u32) ops... 'E' -- apply delta
+     Each op is either 'C' followed by a block index (u32), to copy
+     a block from the existing file, or 'L' followed by a length
+     (u16) and that many bytes of new data. The new file is built
+     alongside the existing one, and replaces it only if its
+     size and CRC match.
+     Response: 'K', or 'F' if the file could not be written.
+
+  'Q' -- end the session
+     Response: 'K'
+
+  A path is a u16 length followed by that many bytes, with no
+  terminator. It is relative to the directory given to
+  ysync_receive(), and may not contain "..".
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include <klib/defs.h>
+#include <ymodem/ymodem.h>
+
+BEGIN_DECLS
+
+/** Serve delta-sync requests from the host, until it ends the session.
+    Files are created and updated relative to dir, which must exist.
+    *updated is set to the number of files written. */
+extern YmodemErr ysync_receive (const char *dir, int *updated);
+
+END_DECLS
+
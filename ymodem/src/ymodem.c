@@ -10,6 +10,7 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <interface/interface.h>
 #include <config.h>
 #include <storage/storage.h> 
@@ -37,8 +38,15 @@
 #define YM_NAK                     (0x15) 
 #define YM_CAN                     (0x18) 
 #define YM_CRC                     (0x43) 
+#define YM_STREAM                  (0x47) 
 #define YM_ABT1                    (0x41) 
 #define YM_ABT2                    (0x61) 
+#define YM_CPMEOF                  (0x1A) 
+
+/* Source of data to send. The function should copy up to len bytes 
+   into buf, and return the number copied, zero at the end of the data, 
+   or -1 on error. */
+typedef int (*YmodemReadFn) (uint8_t *buf, int len, void *user_data);
 
 /*=========================================================================
 
@@ -95,10 +103,10 @@ static void ymodem_read_32 (const uint8_t* buf, uint32_t *val)
        1: abort by user / corrupt packet
 
 =========================================================================*/
-static int32_t ymodem_rx_packet (uint8_t *rxdata,
-                            int32_t *rxlen,
-                            uint32_t packets_rxed,
-                            uint32_t timeout_ms)
+int32_t ymodem_rx_packet (uint8_t *rxdata,
+                       int32_t *rxlen,
+                       uint32_t packets_rxed,
+                       uint32_t timeout_ms)
   {
   *rxlen = 0;
 
@@ -195,197 +203,271 @@ static int32_t ymodem_rx_packet (uint8_t *rxdata,
 
 /*=========================================================================
 
-  ymodem_receive
+  ymodem_make_path
+
+  Work out where to store a file whose name came from a header packet.
+  If out_filename is set, it is used as-is. Otherwise the name in the
+  header is taken relative to dir (which may be empty). Senders are
+  allowed to include directories in the name, so we create any that
+  don't exist yet. We don't allow the header name to escape from dir.
 
 =========================================================================*/
-YmodemErr ymodem_receive (const char *out_filename, uint32_t maxsize)
+static YmodemErr ymodem_make_path (const char *out_filename, 
+          const char *dir, const char *name, char path[MAX_PATH + 1])
   {
-  YmodemErr err = 0;
-
-  // Ensure we can write the output file, if specified. Although it
-  //   will get created later, it's better to find out now, rather
-  //   than in the middle of a long upload, that we can't write the
-  //   file.
   if (out_filename)
     {
-    if (storage_write_file (out_filename, "", 0) != 0)
+    strncpy (path, out_filename, MAX_PATH);
+    path[MAX_PATH] = 0;
+    return 0;
+    }
+
+  while (*name == '/') name++;
+  if (name[0] == 0 || strstr (name, "..")) 
+    return YmodemWriteFile;
+
+  storage_join_path (dir, name, path);
+
+  // Create the intermediate directories, if there are any, one 
+  //   path component at a time.
+  char *p = path;
+  if (*p == '/') p++;
+  while ((p = strchr (p, '/')) != NULL)
+    {
+    *p = 0;
+    ErrCode err = storage_mkdir (path);
+    *p = '/';
+    if (err != 0 && err != ERR_EXIST) 
       return YmodemWriteFile;
+    p++;
     }
+  return 0;
+  }
 
-  /* alloc 1k on stack, ok? */
-  uint8_t rx_packet_data[YM_PACKET_1K_SIZE + YM_PACKET_OVERHEAD];
-  int32_t rx_packet_len;
+/*=========================================================================
 
-  uint8_t filesize_asc[YM_FILE_SIZE_LENGTH];
-  uint32_t filesize = 0;
+  ymodem_parse_header
 
-  BOOL first_try = TRUE;
-  BOOL session_done = FALSE;
+  Extract the filename and size from a block 0. Returns FALSE if the
+  block is the empty header that marks the end of the session. If 
+  the sender did not include a size, *size_known is set to FALSE, and
+  we'll have to write whole packets, padding and all.
+
+=========================================================================*/
+static BOOL ymodem_parse_header (const uint8_t *data, char *filename, 
+          uint32_t *filesize, BOOL *size_known)
+  {
+  /* The spec suggests that the whole data section should
+     be zeroed, but some senders might not do this.
+     If we have a NULL filename and the first few digits of
+     the file length are zero, then call it empty. */
+  int i;
+  for (i = 0; i < 4; i++) 
+    {
+    if (data[i] != 0) break;
+    }
+  if (i == 4) return FALSE;
+
+  const uint8_t *file_ptr = data;
+  i = 0;
+  while (*file_ptr && (i < MAX_FNAME) && 
+      (file_ptr - data < YM_PACKET_SIZE - 1)) 
+    {
+    filename[i++] = *file_ptr++;
+    }
+  filename[i] = '\0';
+  file_ptr++;
+
+  uint8_t filesize_asc[YM_FILE_SIZE_LENGTH + 1];
+  i = 0;
+  while ((*file_ptr >= '0' && *file_ptr <= '9') 
+       && (i < YM_FILE_SIZE_LENGTH)) 
+    {
+    filesize_asc[i++] = *file_ptr++;
+    }
+  filesize_asc[i] = '\0';
+  *size_known = (i > 0);
+  ymodem_read_32 (filesize_asc, filesize);
+  return TRUE;
+  }
+
+/*=========================================================================
 
-  char filename [MAX_FNAME]; 
-  strcpy (filename, "untitled.txt");
+  ymodem_receive_file_data
 
+  Receive the data packets of one file, up to and including the EOT,
+  and write them to the open file. In streaming mode there are no 
+  ACKs, and any error is fatal -- the sender has no way to go back.
+  A file whose size the sender didn't give is only found to be too
+  big as it arrives, so the transfer stops once it grows beyond
+  maxsize.
+
+=========================================================================*/
+static YmodemErr ymodem_receive_file_data (StorageFile *file, 
+          uint32_t filesize, BOOL size_known, uint32_t maxsize, 
+          BOOL streaming, uint8_t *rx_packet_data)
+  {
   uint32_t nbr_errors = 0;
+  uint32_t total_written = 0;
+  uint8_t expected = 1;
 
-  /* z-term string */
-  filename[0] = 0;
-  
-  /* receive files */
-  do 
-    { /* ! session done */
-    if (first_try) 
+  while (TRUE)
+    {
+    int32_t rx_packet_len;
+    int32_t res = ymodem_rx_packet (rx_packet_data, &rx_packet_len,
+                                 1, YM_PACKET_RX_TIMEOUT_MS);
+    if (res == 0 && rx_packet_len == -1)
       {
-      /* initiate transfer */
-      interface_write_char(YM_CRC);
+      /* aborted by sender */
+      interface_write_char (YM_ACK);
+      return YmodemCancelled;
       }
-    first_try = FALSE;
 
-    BOOL crc_nak = TRUE;
-    BOOL file_done = FALSE;
-    uint32_t packets_rxed = 0;
+    if (res == 0 && rx_packet_len == 0)
+      {
+      /* EOT - End Of Transmission */
+      interface_write_char (YM_ACK);
+      return 0;
+      }
 
-    uint32_t total_written = 0;
-    do 
-      { /* ! file_done */
-      /* receive packets */
-      int32_t res = ymodem_rx_packet (rx_packet_data,
-                                 &rx_packet_len,
-                                 packets_rxed,
-                                 YM_PACKET_RX_TIMEOUT_MS);
-      switch (res) 
+    if (res != 0)
+      {
+      if (streaming) return YmodemBadPacket;
+      nbr_errors++;
+      if (nbr_errors >= YM_PACKET_ERROR_MAX_NBR) 
+        return YmodemBadPacket;
+      interface_write_char (YM_NAK);
+      continue;
+      }
+
+    uint8_t seq_nbr = rx_packet_data[YM_PACKET_SEQNO_INDEX];
+    if (seq_nbr != expected) 
+      {
+      if (streaming) return YmodemBadPacket;
+      if (seq_nbr == (uint8_t)(expected - 1))
         {
-        case 0: 
-          {
-          /* packet received, clear packet error counter */
-          nbr_errors = 0;
-          switch (rx_packet_len) 
-            {
-            case -1: 
-              {
-              /* aborted by sender */
-              interface_write_char (YM_ACK);
-              return YmodemCancelled;
-              }
-            case 0: 
-              {
-              /* EOT - End Of Transmission */
-              interface_write_char (YM_ACK);
-              /* TODO: Add some sort of sanity check on the number of
-                 packets received and the advertised file length. */
-              file_done = TRUE;
-              /* TODO: set first_try here to resend C ? */
-              break;
-              }
-            default: 
-              {
-              /* normal packet, check seq nbr */
-              uint8_t seq_nbr = rx_packet_data[YM_PACKET_SEQNO_INDEX];
-              if (seq_nbr != (packets_rxed & 0xff)) 
-                {
-                /* wrong seq number */
-                interface_write_char(YM_NAK);
-                } 
-              else 
-                {
-                if (packets_rxed == 0) 
-                  {
-              /* The spec suggests that the whole data section should
-                 be zeroed, but some senders might not do this.
-                 If we have a NULL filename and the first few digits of
-                 the file length are zero, then call it empty. */
-                  int32_t i;
-                  for (i = YM_PACKET_HEADER; i < YM_PACKET_HEADER + 4; i++) 
-                    {
-                    if (rx_packet_data[i] != 0) 
-                      {
-                      break;
-                      }
-                    }
-                  /* non-zero bytes found in header, filename packet has data */
-                  if (i < YM_PACKET_HEADER + 4) 
-                    {
-                    /* read file name */
-                    uint8_t *file_ptr = (uint8_t*)(rx_packet_data + YM_PACKET_HEADER);
-                    i = 0;
-                    while (*file_ptr && (i < MAX_FNAME)) 
-                      {
-                      filename[i++] = *file_ptr++;
-                      }
-                    filename[i++] = '\0';
-                    file_ptr++;
-                    /* read file size */
-                    i = 0;
-                    while ((*file_ptr != ' ') && (i < YM_FILE_SIZE_LENGTH)) 
-                      {
-                      filesize_asc[i++] = *file_ptr++;
-                      }
-                    filesize_asc[i++] = '\0';
-                    /* convert file size */
-                    ymodem_read_32 (filesize_asc, &filesize);
-                    /* check file size */
-                    if (filesize > maxsize) 
-                      {
-		      err = YmodemTooBig;
-                      goto rx_err_handler;
-                      }
-                    interface_write_char (YM_ACK);
-                    interface_write_char (crc_nak ? YM_CRC : YM_NAK);
-                    crc_nak = FALSE;
-                    }
-                  else 
-                    {
-                    /* filename packet is empty, end session */
-                    // TODO -- carry on if no filename
-                    interface_write_char (YM_ACK);
-                    file_done = TRUE;
-                    session_done = TRUE;
-                    break;
-                    }
-                  }
-                else 
-                  {
-                  int to_write = rx_packet_len;
-                  if (total_written + rx_packet_len > filesize)
-                    to_write = filesize - total_written;
-		  const char *current_filename;
-		  if (out_filename)
-		    current_filename = out_filename;
-		  else
-		    current_filename = filename;
-                  err = storage_append_file (current_filename, 
-                    rx_packet_data + YM_PACKET_HEADER, to_write); 
-		  if (err) goto rx_err_handler;
-                  interface_write_char (YM_ACK);
-                  total_written += rx_packet_len;
-                  }
-                packets_rxed++;
-                }  /* sequence number check ok */
-              } /* default */
-            } /* inner switch */
-          break;
-          } /* case 0 */
-        default: 
-	  {
-          /* ym_rx_packet() returned error */
-          if (packets_rxed > 0) 
-	    {
-            nbr_errors++;
-            if (nbr_errors >= YM_PACKET_ERROR_MAX_NBR) 
-	      {
-	      err = YmodemBadPacket;
-              goto rx_err_handler;
-              }
-            }
-          interface_write_char(YM_CRC);
-          break;
-          } /* default */
-        } /* switch */
-      
-      /* check end of receive packets */
-      } while (! file_done);
-
-    /* check end of receive files */
-    } while (! session_done);
+        /* the sender didn't see our ACK, and has sent the same
+           packet again. */
+        interface_write_char (YM_ACK);
+        }
+      else
+        interface_write_char (YM_NAK);
+      continue;
+      }
+
+    nbr_errors = 0;
+    uint32_t to_write = (uint32_t)rx_packet_len;
+    if (size_known && total_written + to_write > filesize)
+      to_write = filesize - total_written;
+    if (total_written + to_write > maxsize)
+      return YmodemTooBig;
+    if (to_write > 0)
+      {
+      if (storage_file_write (file, rx_packet_data + YM_PACKET_HEADER, 
+           (int)to_write) != 0)
+        return YmodemWriteFile;
+      }
+    total_written += to_write;
+    expected++;
+    if (!streaming) 
+      interface_write_char (YM_ACK);
+    }
+  }
+
+/*=========================================================================
+
+  ymodem_receive_session
+
+  Receive a batch of files. The session ends when the sender sends
+  an empty header packet. 
+
+=========================================================================*/
+static YmodemErr ymodem_receive_session (const char *out_filename,
+          const char *dir, uint32_t maxsize, BOOL streaming, int *count)
+  {
+  YmodemErr err = 0;
+  const char start_char = streaming ? YM_STREAM : YM_CRC;
+
+  /* alloc 1k on stack, ok? */
+  uint8_t rx_packet_data[YM_PACKET_1K_SIZE + YM_PACKET_OVERHEAD];
+  char filename [MAX_FNAME + 1]; 
+  char path [MAX_PATH + 1]; 
+
+  *count = 0;
+  BOOL session_done = FALSE;
+  do
+    {
+    /* Ask for the header. For the first file, we wait indefinitely, 
+       because the user has to start the sender by hand. */
+    int32_t rx_packet_len = 0;
+    int32_t res;
+    uint32_t nbr_errors = 0;
+    do
+      {
+      interface_write_char (start_char);
+      res = ymodem_rx_packet (rx_packet_data, &rx_packet_len,
+                                 0, YM_PACKET_RX_TIMEOUT_MS);
+      if (res == 0 && rx_packet_len == 0)
+        {
+        /* A stray EOT, perhaps because our last ACK got lost */
+        interface_write_char (YM_ACK);
+        res = -1;
+        }
+      else if (res == 0 && rx_packet_len > 0 && 
+           rx_packet_data[YM_PACKET_SEQNO_INDEX] != 0)
+        res = 1;
+      if (res != 0 && *count > 0 && ++nbr_errors >= YM_PACKET_ERROR_MAX_NBR)
+        {
+        err = YmodemBadPacket;
+        goto rx_err_handler;
+        }
+      } while (res != 0);
+
+    if (rx_packet_len == -1)
+      {
+      /* aborted by sender */
+      interface_write_char (YM_ACK);
+      return YmodemCancelled;
+      }
+
+    uint32_t filesize = 0;
+    BOOL size_known = FALSE;
+    if (!ymodem_parse_header (rx_packet_data + YM_PACKET_HEADER, filename,
+          &filesize, &size_known))
+      {
+      /* filename packet is empty, end session */
+      interface_write_char (YM_ACK);
+      session_done = TRUE;
+      break;
+      }
+
+    if (size_known && filesize > maxsize) 
+      {
+      err = YmodemTooBig;
+      goto rx_err_handler;
+      }
+
+    /* A filename given by the caller applies only to the first file */
+    err = ymodem_make_path (*count == 0 ? out_filename : NULL, 
+            dir, filename, path);
+    if (err) goto rx_err_handler;
+
+    StorageFile *file;
+    if (storage_file_open (path, STORAGE_OPEN_WRITE, &file) != 0)
+      {
+      err = YmodemWriteFile;
+      goto rx_err_handler;
+      }
+
+    interface_write_char (YM_ACK);
+    interface_write_char (start_char);
+    err = ymodem_receive_file_data (file, filesize, size_known, 
+            maxsize, streaming, rx_packet_data);
+    storage_file_close (file);
+    if (err == YmodemCancelled) return err;
+    if (err) goto rx_err_handler;
+    (*count)++;
+    } while (!session_done);
 
   return 0;
 
@@ -398,6 +480,41 @@ YmodemErr ymodem_receive (const char *out_filename, uint32_t maxsize)
   return err;
   }
 
+/*=========================================================================
+
+  ymodem_receive
+
+=========================================================================*/
+YmodemErr ymodem_receive (const char *out_filename, uint32_t maxsize,
+            BOOL streaming)
+  {
+  int count;
+
+  // Ensure we can write the output file, if specified. Although it
+  //   will get created later, it's better to find out now, rather
+  //   than in the middle of a long upload, that we can't write the
+  //   file.
+  if (out_filename)
+    {
+    if (storage_write_file (out_filename, "", 0) != 0)
+      return YmodemWriteFile;
+    }
+
+  return ymodem_receive_session (out_filename, "", maxsize, streaming, 
+    &count);
+  }
+
+/*=========================================================================
+
+  ymodem_receive_batch
+
+=========================================================================*/
+YmodemErr ymodem_receive_batch (const char *dir, uint32_t maxsize,
+            BOOL streaming, int *count)
+  {
+  return ymodem_receive_session (NULL, dir, maxsize, streaming, count);
+  }
+
 /*=========================================================================
 
   ymodem_writeU32
@@ -444,8 +561,13 @@ static uint32_t ymodem_writeU32 (uint32_t val, uint8_t *buf)
 
   ymodem_send_packet
 
+  Send one packet. Block zero is always a short (128-byte) packet; all
+  others are 1K, so txdata must have at least that many bytes. The
+  packet is assembled into a few writes, rather than being sent a 
+  character at a time.
+
 =========================================================================*/
-static void ymodem_send_packet (uint8_t *txdata, int32_t block_nbr)
+void ymodem_send_packet (const uint8_t *txdata, int32_t block_nbr)
   {
   int32_t tx_packet_size;
 
@@ -461,22 +583,21 @@ static void ymodem_send_packet (uint8_t *txdata, int32_t block_nbr)
 
   uint16_t crc16_val = ymodem_crc16 (txdata, tx_packet_size);
 
+  char header[YM_PACKET_HEADER];
+  char trailer[YM_PACKET_TRAILER];
+
   /* For 128 byte packets use SOH, for 1K use STX */
-  interface_write_char ( (block_nbr == 0) ? YM_SOH : YM_STX );
+  header[0] = (block_nbr == 0) ? YM_SOH : YM_STX;
   /* write seq numbers */
-  interface_write_char (block_nbr & 0xFF);
-  interface_write_char (~block_nbr & 0xFF);
-
-  /* write txdata */
-  int32_t i;
-  for (i = 0; i < tx_packet_size; i++) 
-    {
-    interface_write_char (txdata[i]);
-    }
-
+  header[YM_PACKET_SEQNO_INDEX] = block_nbr & 0xFF;
+  header[YM_PACKET_SEQNO_COMP_INDEX] = ~block_nbr & 0xFF;
   /* write crc16 */
-  interface_write_char ((crc16_val >> 8) & 0xFF);
-  interface_write_char (crc16_val & 0xFF);
+  trailer[0] = (crc16_val >> 8) & 0xFF;
+  trailer[1] = crc16_val & 0xFF;
+
+  interface_write_buff (header, YM_PACKET_HEADER);
+  interface_write_buff ((const char *)txdata, tx_packet_size);
+  interface_write_buff (trailer, YM_PACKET_TRAILER);
   }
 
 /*=========================================================================
@@ -514,141 +635,262 @@ static void ymodem_send_packet0 (const char* filename,
   ymodem_send_packet (block, 0);
   }
 
+/*=========================================================================
+
+  ymodem_fill_block
+
+  Fill a 1K data block from the source, padding any unused space at the
+  end with the CP/M EOF character, as the protocol expects. Returns
+  the number of bytes of real data, which will be zero at the end of the
+  data, or -1 if the source could not be read.
+
+=========================================================================*/
+static int ymodem_fill_block (YmodemReadFn read_fn, void *user_data, 
+             uint8_t *block)
+  {
+  int total = 0;
+  while (total < YM_PACKET_1K_SIZE)
+    {
+    int n = read_fn (block + total, YM_PACKET_1K_SIZE - total, user_data);
+    if (n < 0) return -1;
+    if (n == 0) break;
+    total += n;
+    }
+  if (total < YM_PACKET_1K_SIZE)
+    memset (block + total, YM_CPMEOF, YM_PACKET_1K_SIZE - total);
+  return total;
+  }
+
 /*=========================================================================
 
   ymodem_send_data_packets
 
+  Send the data packets, and the end-of-transmission sequence. We keep
+  two blocks of data in memory -- the one being sent, and the next one.
+  The next block is read from the source just after the current one
+  has been transmitted, while the receiver is still checking it. The
+  receiver's ACK will usually be waiting for us by the time the read
+  is complete. If the packet has to be resent, the block we prefetched
+  is kept for next time.
+
+  In streaming mode the receiver does not ACK data packets at all, so
+  we just send them back-to-back. We still look for a CAN between
+  packets, because that's the only way the receiver can report an
+  error.
+
 =========================================================================*/
-static void ymodem_send_data_packets (uint8_t* txdata,
-                                 uint32_t txlen,
+static YmodemErr ymodem_send_data_packets (YmodemReadFn read_fn,
+                                 void *user_data, BOOL streaming,
                                  uint32_t timeout_ms)
   {
+  YmodemErr err = 0;
+  uint8_t *current = malloc (YM_PACKET_1K_SIZE);
+  uint8_t *next = malloc (YM_PACKET_1K_SIZE);
+  if (!current || !next)
+    {
+    free (current);
+    free (next);
+    return YmodemNoMem;
+    }
+
   int32_t block_nbr = 1;
+  uint32_t nbr_errors = 0;
+  int current_len = ymodem_fill_block (read_fn, user_data, current);
+  int next_len = 0;
+  BOOL have_next = FALSE;
   
-  while (txlen > 0) 
+  while (current_len > 0 && err == 0) 
     {
-    /* check if send full 1k packet */
-    uint32_t send_size;
-    if (txlen > YM_PACKET_1K_SIZE) 
-      {
-      send_size = YM_PACKET_1K_SIZE;
-      } 
-    else 
+    /* send packet */
+    ymodem_send_packet (current, block_nbr);
+
+    /* prefetch while the receiver is busy */
+    if (!have_next)
       {
-      send_size = txlen;
+      next_len = ymodem_fill_block (read_fn, user_data, next);
+      have_next = TRUE;
       }
-    /* send packet */
-    ymodem_send_packet (txdata, block_nbr);
-    int32_t c = interface_get_char_timeout (timeout_ms);
+
+    int32_t c = streaming ? YM_ACK : interface_get_char_timeout (timeout_ms);
+    if (streaming && interface_get_char_timeout (0) == YM_CAN)
+      c = YM_CAN;
+
     switch (c) 
       {
       case YM_ACK: 
         {
-        txdata += send_size;
-        txlen -= send_size;
+        uint8_t *temp = current;
+        current = next;
+        next = temp;
+        current_len = next_len;
+        have_next = FALSE;
         block_nbr++;
+        nbr_errors = 0;
         break;
         }
-      case -1:
       case YM_CAN: 
         {
-        return;
+        err = YmodemCancelled;
+        break;
         }
       default:
+        /* NAK, timeout, or line noise -- send the same packet again */
+        nbr_errors++;
+        if (nbr_errors >= YM_PACKET_ERROR_MAX_NBR)
+          err = YmodemBadPacket;
         break;
       }
     }
+
+  free (current);
+  free (next);
+
+  if (err) return err;
+  if (current_len < 0) return YmodemReadFile;
   
   int32_t ch;
+  nbr_errors = 0;
   do 
     {
     interface_write_char (YM_EOT);
     ch = interface_get_char_timeout (timeout_ms);
-    } while ((ch != YM_ACK) && (ch != -1));
+    if (ch == YM_CAN) return YmodemCancelled;
+    } while (ch != YM_ACK && ++nbr_errors < YM_PACKET_ERROR_MAX_NBR);
   
-  /* send last data packet */
-  if (ch == YM_ACK) 
-    {
-    ch = interface_get_char_timeout(timeout_ms);
-    if (ch == YM_CRC) 
-      {
-      do 
-        {
-        ymodem_send_packet0 (0, 0);
-        ch = interface_get_char_timeout(timeout_ms);
-        } while ((ch != YM_ACK) && (ch != -1));
-      }
-    }
+  if (ch != YM_ACK) return YmodemBadPacket;
+  return 0;
   }
 
 /*=========================================================================
 
-  ymodem_send_data
+  ymodem_wait_receiver
+
+  Wait for the receiver to ask for a header packet. It does this by
+  sending 'C', or 'G' if it wants streaming mode. At the start of a
+  session, we wait for as long as it takes the user to start the 
+  receiver. 
 
 =========================================================================*/
-YmodemErr ymodem_send_data (uint8_t *txdata, uint32_t txsize, 
-          const char *filename)
+static YmodemErr ymodem_wait_receiver (BOOL first, BOOL *streaming)
   {
-  YmodemErr err = 0;
-  /* not in the specs, send CRC here just for balance */
-  int32_t ch = YM_CRC;
-  do 
+  int32_t ch;
+  if (first)
     {
-    interface_write_char (YM_CRC);
-    ch = interface_get_char_timeout (1000);
-    } while (ch < 0);
+    /* not in the specs, send CRC here just for balance */
+    do 
+      {
+      interface_write_char (YM_CRC);
+      ch = interface_get_char_timeout (1000);
+      } while (ch < 0);
+    }
+  else
+    ch = interface_get_char_timeout (YM_PACKET_RX_TIMEOUT_MS * 
+      YM_PACKET_ERROR_MAX_NBR);
 
-  /* we do require transfer with CRC */
-  if (ch != YM_CRC) 
+  switch (ch)
     {
-    err = YmodemNoCRC;
-    goto tx_err_handler;
-    } 
+    case YM_CRC: 
+      *streaming = FALSE;
+      return 0;
+    case YM_STREAM: 
+      *streaming = TRUE;
+      return 0;
+    case YM_CAN: 
+      return YmodemCancelled;
+    }
+  /* we do require transfer with CRC */
+  return YmodemNoCRC;
+  }
 
-  bool crc_nak = true;
-  bool file_done = false;
-  do 
+/*=========================================================================
+
+  ymodem_send_header
+
+  Send the header packet for a file, and wait for the receiver to 
+  accept it. 
+
+=========================================================================*/
+static YmodemErr ymodem_send_header (const char *filename, uint32_t size,
+          BOOL streaming)
+  {
+  const int32_t start_char = streaming ? YM_STREAM : YM_CRC;
+  uint32_t nbr_errors = 0;
+  do
     {
-    ymodem_send_packet0 (filename, txsize);
+    ymodem_send_packet0 (filename, size);
     /* When the receiving program receives this block and successfully
        opened the output file, it shall acknowledge this block with an ACK
        character and then proceed with a normal XMODEM file transfer
        beginning with a "C" or NAK tranmsitted by the receiver. */
-    ch = interface_get_char_timeout (YM_PACKET_RX_TIMEOUT_MS);
-
+    int32_t ch = interface_get_char_timeout (YM_PACKET_RX_TIMEOUT_MS);
     if (ch == YM_ACK) 
       {
       ch = interface_get_char_timeout (YM_PACKET_RX_TIMEOUT_MS);
-
-      if (ch == YM_CRC) 
-        {
-	storage_write_file ("foo.txt", "hello\n", 6);
-        ymodem_send_data_packets (txdata, txsize, YM_PACKET_RX_TIMEOUT_MS);
-        /* success */
-        file_done = true;
-        }
-      else if (ch == YM_CAN)
-        {
-	err = YmodemCancelled;
-	goto tx_err_handler;
-	}
-      }
-    else if ((ch == YM_CRC) && (crc_nak)) 
-      {
-      crc_nak = false;
-      continue;
-      }
-    else if ((ch != YM_NAK) || (crc_nak)) 
-      {
-      err = YmodemBadPacket;
-      goto tx_err_handler;
+      if (ch == start_char) 
+        return 0;
       }
-    } while (!file_done);
+    if (ch == YM_CAN) 
+      return YmodemCancelled;
+    /* Anything else -- a repeated 'C', a NAK, or a timeout -- means
+       the receiver didn't get the header. */
+    } while (++nbr_errors < YM_PACKET_ERROR_MAX_NBR);
+
+  return YmodemBadPacket;
+  }
 
+/*=========================================================================
+
+  ymodem_end_session
+
+  Send the empty header packet that tells the receiver there are no 
+  more files.
+
+=========================================================================*/
+static YmodemErr ymodem_end_session (void)
+  {
+  BOOL streaming;
+  YmodemErr err = ymodem_wait_receiver (FALSE, &streaming);
+  if (err) return err;
+
+  uint32_t nbr_errors = 0;
+  int32_t ch;
+  do 
+    {
+    ymodem_send_packet0 (0, 0);
+    ch = interface_get_char_timeout (YM_PACKET_RX_TIMEOUT_MS);
+    } while (ch != YM_ACK && ++nbr_errors < YM_PACKET_ERROR_MAX_NBR);
   return 0;
+  }
 
-  tx_err_handler:
+/*=========================================================================
 
+  ymodem_send_source
+
+  Send one file, within a session, whose data is supplied by read_fn. 
+  The size has to be known in advance, because it goes in the header 
+  packet.
+
+=========================================================================*/
+static YmodemErr ymodem_send_source (YmodemReadFn read_fn, void *user_data,
+          uint32_t txsize, const char *filename, BOOL first)
+  {
+  BOOL streaming;
+  YmodemErr err = ymodem_wait_receiver (first, &streaming);
+  if (err == 0)
+    err = ymodem_send_header (filename, txsize, streaming);
+  if (err == 0)
+    err = ymodem_send_data_packets (read_fn, user_data, streaming,
+      YM_PACKET_RX_TIMEOUT_MS);
+  return err;
+  }
+
+/*=========================================================================
+
+  ymodem_abort
+
+=========================================================================*/
+static YmodemErr ymodem_abort (YmodemErr err)
+  {
   interface_write_char (YM_CAN);
   interface_write_char (YM_CAN);
   interface_sleep_ms (1000);
@@ -657,23 +899,110 @@ YmodemErr ymodem_send_data (uint8_t *txdata, uint32_t txsize,
 
 /*=========================================================================
 
-  ymodem_send
+  ymodem_read_memory
+
+  YmodemReadFn that takes data from a memory buffer
 
 =========================================================================*/
-YmodemErr ymodem_send (const char *filename)
+typedef struct _YmodemMemSource
+  {
+  const uint8_t *data;
+  uint32_t remaining;
+  } YmodemMemSource;
+
+static int ymodem_read_memory (uint8_t *buf, int len, void *user_data)
+  {
+  YmodemMemSource *src = user_data;
+  if ((uint32_t)len > src->remaining) len = (int)src->remaining;
+  memcpy (buf, src->data, len);
+  src->data += len;
+  src->remaining -= len;
+  return len;
+  }
+
+/*=========================================================================
+
+  ymodem_read_storage
+
+  YmodemReadFn that takes data from an open file
+
+=========================================================================*/
+static int ymodem_read_storage (uint8_t *buf, int len, void *user_data)
+  {
+  int n;
+  if (storage_file_read ((StorageFile *)user_data, buf, len, &n) != 0)
+    return -1;
+  return n;
+  }
+
+/*=========================================================================
+
+  ymodem_send_data
+
+=========================================================================*/
+YmodemErr ymodem_send_data (uint8_t *txdata, uint32_t txsize, 
+          const char *filename)
+  {
+  YmodemMemSource src;
+  src.data = txdata;
+  src.remaining = txsize;
+  YmodemErr err = ymodem_send_source (ymodem_read_memory, &src, txsize, 
+    filename, TRUE);
+  if (err == 0) err = ymodem_end_session ();
+  if (err) return ymodem_abort (err);
+  return 0;
+  }
+
+/*=========================================================================
+
+  ymodem_send_files
+
+  Send a batch of files directly from storage. Only the blocks in transit
+  are held in memory, so the size of file we can send is not limited 
+  by the amount of free RAM.
+
+=========================================================================*/
+YmodemErr ymodem_send_files (int count, char * const *filenames)
   {
   YmodemErr err = 0;
-  uint8_t *buff;
-  int size;
-  if (storage_read_file (filename, &buff, &size) == 0)
+  for (int i = 0; i < count && err == 0; i++)
     {
-    // TODO -- split basename off filename
-    err = ymodem_send_data (buff, size, filename);
-    free (buff);
+    StorageFile *file;
+    if (storage_file_open (filenames[i], STORAGE_OPEN_READ, &file) == 0)
+      {
+      int size = storage_file_size (file);
+      if (size >= 0)
+        {
+        // The receiver will create the file in its own working
+        //   directory, so it should get only the filename part
+        char basename[MAX_FNAME + 1];
+        storage_get_basename (filenames[i], basename);
+        err = ymodem_send_source (ymodem_read_storage, file, 
+          (uint32_t)size, basename, i == 0);
+        }
+      else
+        err = YmodemReadFile;
+      storage_file_close (file);
+      }
+    else
+      err = YmodemReadFile;
     }
-  else
-    err = YmodemReadFile;
-  return err;
+
+  if (err == 0) err = ymodem_end_session ();
+  if (err) return ymodem_abort (err);
+  return 0;
+  }
+
+/*=========================================================================
+
+  ymodem_send
+
+=========================================================================*/
+YmodemErr ymodem_send (const char *filename)
+  {
+  char *filenames[1];
+  filenames[0] = (char *)filename;
+  return ymodem_send_files (1, filenames);
   }
 
 /*=========================================================================
@@ -693,7 +1022,7 @@ const char *ymodem_strerror (YmodemErr err)
     case YmodemCancelled: return "Transfer cancelled";
     case YmodemBadPacket: return "Corrupt packet";
     case YmodemNoCRC: return "Sender does not support CRC";
+    case YmodemNoMem: return "Out of memory";
     }
   return "OK";
   }
-
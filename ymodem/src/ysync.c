@@ -0,0 +1,559 @@
+/*=========================================================================
+
+  Ymodem
+
+  ymodem/ysync.c
+
+  Device side of the delta-sync protocol. See ysync.h for a
+  description of the messages.
+
+  (c)2021 Kevin Boone, GPLv3.0
+
+=========================================================================*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <interface/interface.h>
+#include <config.h>
+#include <storage/storage.h>
+#include <ymodem/ymodem.h>
+#include <ymodem/ysync.h>
+
+#define YS_FRAME_SIZE              (1024)
+#define YS_FRAME_OVERHEAD          (5)
+#define YS_FRAME_DATA              (YS_FRAME_SIZE - 2)
+#define YS_RX_TIMEOUT_MS           (1000)
+#define YS_ERROR_MAX_NBR           (5)
+/* How long to wait for the host to start, or to send its next request,
+   in units of YS_RX_TIMEOUT_MS */
+#define YS_IDLE_MAX                (60)
+#define YS_MIN_BLOCK               (256)
+#define YS_MAX_BLOCK               (1024)
+#define YS_TARGET_BLOCKS           (256)
+
+#define YS_ACK                     (0x06)
+#define YS_NAK                     (0x15)
+#define YS_CAN                     (0x18)
+#define YS_CRC                     (0x43)
+
+/* One end of the link. Outgoing data is collected into out until
+   there's a packet's worth, or the message is complete. Incoming
+   data is read from the last packet received. Errors are sticky:
+   once something has gone wrong, all reads return zeros and all writes
+   are discarded, so callers need only check at the end of a
+   message. */
+typedef struct _YsyncChannel
+  {
+  uint8_t *out;
+  int out_len;
+  int32_t out_block;
+  uint8_t *in;
+  int in_pos;
+  int in_len;
+  uint8_t in_seq;
+  BOOL started;
+  YmodemErr err;
+  } YsyncChannel;
+
+/*=========================================================================
+
+  ysync_crc32
+
+  Standard (zlib) CRC32, using a 16-entry table to save space.
+
+=========================================================================*/
+static uint32_t ysync_crc32 (uint32_t crc, const uint8_t *buf, int len)
+  {
+  static const uint32_t tab[16] =
+    {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+  crc = ~crc;
+  while (len--)
+    {
+    crc ^= *buf++;
+    crc = (crc >> 4) ^ tab[crc & 0x0F];
+    crc = (crc >> 4) ^ tab[crc & 0x0F];
+    }
+  return ~crc;
+  }
+
+/*=========================================================================
+
+  ysync_weak_sum
+
+  The rsync rolling checksum. The host can update this a byte at a time
+  as it slides a window along the new file, which is what makes it
+  cheap to find blocks that have moved.
+
+=========================================================================*/
+static uint32_t ysync_weak_sum (const uint8_t *buf, int len)
+  {
+  uint32_t a = 0, b = 0;
+  for (int i = 0; i < len; i++)
+    {
+    a += buf[i];
+    b += (uint32_t)(len - i) * buf[i];
+    }
+  return (a & 0xFFFF) | ((b & 0xFFFF) << 16);
+  }
+
+/*=========================================================================
+
+  ysync_flush
+
+  Send whatever is in the output buffer as one packet, and wait for
+  the host to acknowledge it.
+
+=========================================================================*/
+static void ysync_flush (YsyncChannel *ch)
+  {
+  if (ch->err) return;
+  ch->out[0] = (uint8_t)(ch->out_len >> 8);
+  ch->out[1] = (uint8_t)(ch->out_len & 0xFF);
+  memset (ch->out + 2 + ch->out_len, 0, YS_FRAME_DATA - ch->out_len);
+
+  int nbr_errors = 0;
+  while (TRUE)
+    {
+    ymodem_send_packet (ch->out, ch->out_block);
+    int c = interface_get_char_timeout (YS_RX_TIMEOUT_MS);
+    if (c == YS_ACK) break;
+    if (c == YS_CAN)
+      {
+      ch->err = YmodemCancelled;
+      return;
+      }
+    if (++nbr_errors >= YS_ERROR_MAX_NBR)
+      {
+      ch->err = YmodemBadPacket;
+      return;
+      }
+    }
+
+  ch->out_block++;
+  ch->out_len = 0;
+  }
+
+/*=========================================================================
+
+  ysync_put
+
+=========================================================================*/
+static void ysync_put (YsyncChannel *ch, const void *buf, int len)
+  {
+  const uint8_t *p = buf;
+  while (len > 0 && !ch->err)
+    {
+    int n = YS_FRAME_DATA - ch->out_len;
+    if (n > len) n = len;
+    memcpy (ch->out + 2 + ch->out_len, p, n);
+    ch->out_len += n;
+    p += n;
+    len -= n;
+    if (ch->out_len == YS_FRAME_DATA) ysync_flush (ch);
+    }
+  }
+
+/*=========================================================================
+
+  ysync_put_u8, etc
+
+=========================================================================*/
+static void ysync_put_u8 (YsyncChannel *ch, uint8_t v)
+  {
+  ysync_put (ch, &v, 1);
+  }
+
+static void ysync_put_u16 (YsyncChannel *ch, uint16_t v)
+  {
+  uint8_t b[2] = { v & 0xFF, v >> 8 };
+  ysync_put (ch, b, 2);
+  }
+
+static void ysync_put_u32 (YsyncChannel *ch, uint32_t v)
+  {
+  uint8_t b[4] = { v & 0xFF, (v >> 8) & 0xFF, (v >> 16) & 0xFF, v >> 24 };
+  ysync_put (ch, b, 4);
+  }
+
+/*=========================================================================
+
+  ysync_fill
+
+  Wait for the next packet from the host. Until the first packet
+  arrives, we keep sending 'C', so the host knows we're ready.
+  Duplicated packets (because the host missed our ACK) are
+  acknowledged and discarded.
+
+=========================================================================*/
+static void ysync_fill (YsyncChannel *ch)
+  {
+  int idle = 0;
+  int nbr_errors = 0;
+  while (!ch->err)
+    {
+    int32_t len;
+    if (!ch->started) interface_write_char (YS_CRC);
+    int32_t res = ymodem_rx_packet (ch->in, &len, ch->started,
+      YS_RX_TIMEOUT_MS);
+    if (res == 0 && len > 0)
+      {
+      uint8_t seq = ch->in[1];
+      if (seq == ch->in_seq)
+        {
+        interface_write_char (YS_ACK);
+        ch->in_len = (ch->in[3] << 8) | ch->in[4];
+        if (ch->in_len > len - 2) ch->in_len = len - 2;
+        ch->in_pos = 0;
+        ch->in_seq++;
+        ch->started = TRUE;
+        return;
+        }
+      interface_write_char (seq == (uint8_t)(ch->in_seq - 1)
+        ? YS_ACK : YS_NAK);
+      }
+    else if (res == 0)
+      {
+      /* EOT or CAN, or the user typing at the terminal */
+      ch->err = YmodemCancelled;
+      }
+    else if (res < 0)
+      {
+      if (++idle >= YS_IDLE_MAX) ch->err = YmodemCancelled;
+      }
+    else
+      {
+      if (ch->started) interface_write_char (YS_NAK);
+      if (++nbr_errors >= YS_ERROR_MAX_NBR) ch->err = YmodemBadPacket;
+      }
+    }
+  }
+
+/*=========================================================================
+
+  ysync_get
+
+=========================================================================*/
+static void ysync_get (YsyncChannel *ch, void *buf, int len)
+  {
+  uint8_t *p = buf;
+  while (len > 0)
+    {
+    if (!ch->err && ch->in_pos == ch->in_len) ysync_fill (ch);
+    if (ch->err)
+      {
+      memset (p, 0, len);
+      return;
+      }
+    int n = ch->in_len - ch->in_pos;
+    if (n > len) n = len;
+    memcpy (p, ch->in + 5 + ch->in_pos, n);
+    ch->in_pos += n;
+    p += n;
+    len -= n;
+    }
+  }
+
+/*=========================================================================
+
+  ysync_get_u8, etc
+
+=========================================================================*/
+static uint8_t ysync_get_u8 (YsyncChannel *ch)
+  {
+  uint8_t v;
+  ysync_get (ch, &v, 1);
+  return v;
+  }
+
+static uint16_t ysync_get_u16 (YsyncChannel *ch)
+  {
+  uint8_t b[2];
+  ysync_get (ch, b, 2);
+  return b[0] | (b[1] << 8);
+  }
+
+static uint32_t ysync_get_u32 (YsyncChannel *ch)
+  {
+  uint8_t b[4];
+  ysync_get (ch, b, 4);
+  return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+  }
+
+/*=========================================================================
+
+  ysync_get_path
+
+  Read a path from the host, and make it relative to dir. If the
+  path is not acceptable, path is set to an empty string (but the
+  message must still be read in full).
+
+=========================================================================*/
+static void ysync_get_path (YsyncChannel *ch, const char *dir,
+          char path[MAX_PATH + 1])
+  {
+  char name[MAX_PATH + 1];
+  int len = ysync_get_u16 (ch);
+  int keep = len > MAX_PATH ? MAX_PATH : len;
+  ysync_get (ch, name, keep);
+  name[keep] = 0;
+  for (int i = keep; i < len; i++) ysync_get_u8 (ch);
+
+  const char *p = name;
+  while (*p == '/') p++;
+  if (keep < len || p[0] == 0 || strstr (p, "..")
+       || strlen (dir) + strlen (p) + 1 > MAX_PATH)
+    path[0] = 0;
+  else
+    storage_join_path (dir, p, path);
+  }
+
+/*=========================================================================
+
+  ysync_block_size
+
+  Choose a block size for a file. Small blocks mean that less data has
+  to be sent for a small change, but there are more checksums to send.
+
+=========================================================================*/
+static int ysync_block_size (int size)
+  {
+  int bs = YS_MIN_BLOCK;
+  while (bs < YS_MAX_BLOCK && size / bs > YS_TARGET_BLOCKS) bs *= 2;
+  return bs;
+  }
+
+/*=========================================================================
+
+  ysync_do_hashes
+
+  Handle an 'H' request. The file is read twice -- once to get the
+  whole-file CRC, which comes first in the reply, and again to
+  checksum the blocks -- so we need only one block's worth of RAM.
+
+=========================================================================*/
+static void ysync_do_hashes (YsyncChannel *ch, const char *dir,
+          uint8_t *buff)
+  {
+  char path[MAX_PATH + 1];
+  ysync_get_path (ch, dir, path);
+  if (ch->err) return;
+
+  StorageFile *file = NULL;
+  int size = -1;
+  if (path[0] && storage_file_open (path, STORAGE_OPEN_READ, &file) == 0)
+    size = storage_file_size (file);
+
+  if (size < 0)
+    {
+    ysync_put_u8 (ch, 'N');
+    ysync_put_u32 (ch, 0);
+    ysync_put_u16 (ch, YS_MIN_BLOCK);
+    ysync_put_u32 (ch, 0);
+    ysync_put_u32 (ch, 0);
+    }
+  else
+    {
+    int bs = ysync_block_size (size);
+    int nblocks = (size + bs - 1) / bs;
+    uint32_t crc = 0;
+    int n;
+    while (storage_file_read (file, buff, bs, &n) == 0 && n > 0)
+      crc = ysync_crc32 (crc, buff, n);
+    storage_file_seek (file, 0);
+
+    ysync_put_u8 (ch, 'K');
+    ysync_put_u32 (ch, (uint32_t)size);
+    ysync_put_u16 (ch, (uint16_t)bs);
+    ysync_put_u32 (ch, (uint32_t)nblocks);
+    ysync_put_u32 (ch, crc);
+    for (int i = 0; i < nblocks; i++)
+      {
+      if (storage_file_read (file, buff, bs, &n) != 0) n = 0;
+      ysync_put_u32 (ch, ysync_weak_sum (buff, n));
+      ysync_put_u32 (ch, ysync_crc32 (0, buff, n));
+      }
+    }
+
+  if (file) storage_file_close (file);
+  ysync_flush (ch);
+  }
+
+/*=========================================================================
+
+  ysync_make_dirs
+
+  Create the directories leading up to path, if they don't exist.
+
+=========================================================================*/
+static ErrCode ysync_make_dirs (char *path)
+  {
+  char *p = path;
+  if (*p == '/') p++;
+  while ((p = strchr (p, '/')) != NULL)
+    {
+    *p = 0;
+    ErrCode err = storage_mkdir (path);
+    *p = '/';
+    if (err != 0 && err != ERR_EXIST) return err;
+    p++;
+    }
+  return 0;
+  }
+
+/*=========================================================================
+
+  ysync_do_delta
+
+  Handle a 'D' request. The new file is written to a temporary
+  file, which replaces the old one only when we know it's correct.
+  If anything goes wrong locally, we carry on reading the ops (so we
+  stay in step with the host), but discard them.
+
+=========================================================================*/
+static BOOL ysync_do_delta (YsyncChannel *ch, const char *dir,
+          uint8_t *buff)
+  {
+  char path[MAX_PATH + 1];
+  char temp[MAX_PATH + 1];
+  ysync_get_path (ch, dir, path);
+  uint32_t size = ysync_get_u32 (ch);
+  uint32_t crc = ysync_get_u32 (ch);
+
+  BOOL ok = FALSE;
+  StorageFile *old_file = NULL;
+  StorageFile *new_file = NULL;
+  int bs = YS_MIN_BLOCK;
+  if (path[0] && strlen (path) + 2 <= MAX_PATH)
+    {
+    strcpy (temp, path);
+    strcat (temp, "~");
+    if (storage_file_open (path, STORAGE_OPEN_READ, &old_file) == 0)
+      bs = ysync_block_size (storage_file_size (old_file));
+    else
+      old_file = NULL;
+    ok = (ysync_make_dirs (path) == 0 &&
+         storage_file_open (temp, STORAGE_OPEN_WRITE, &new_file) == 0);
+    }
+
+  uint32_t written = 0;
+  uint32_t new_crc = 0;
+  BOOL done = FALSE;
+  while (!done && !ch->err)
+    {
+    uint8_t op = ysync_get_u8 (ch);
+    switch (op)
+      {
+      case 'C':
+        {
+        uint32_t block = ysync_get_u32 (ch);
+        int n = 0;
+        if (ok)
+          {
+          ok = (old_file != NULL
+             && storage_file_seek (old_file, (int)(block * bs)) == 0
+             && storage_file_read (old_file, buff, bs, &n) == 0 && n > 0
+             && storage_file_write (new_file, buff, n) == 0);
+          }
+        new_crc = ysync_crc32 (new_crc, buff, n);
+        written += n;
+        break;
+        }
+      case 'L':
+        {
+        int len = ysync_get_u16 (ch);
+        while (len > 0 && !ch->err)
+          {
+          int n = len > YS_MAX_BLOCK ? YS_MAX_BLOCK : len;
+          ysync_get (ch, buff, n);
+          if (ok) ok = (storage_file_write (new_file, buff, n) == 0);
+          new_crc = ysync_crc32 (new_crc, buff, n);
+          written += n;
+          len -= n;
+          }
+        break;
+        }
+      case 'E':
+        done = TRUE;
+        break;
+      default:
+        ch->err = YmodemBadPacket;
+      }
+    }
+
+  if (old_file) storage_file_close (old_file);
+  if (new_file)
+    {
+    storage_file_close (new_file);
+    ok = ok && written == size && new_crc == crc && !ch->err
+           && storage_rename (temp, path) == 0;
+    if (!ok) storage_rm (temp);
+    }
+
+  ysync_put_u8 (ch, ok ? 'K' : 'F');
+  ysync_flush (ch);
+  return ok;
+  }
+
+/*=========================================================================
+
+  ysync_receive
+
+=========================================================================*/
+YmodemErr ysync_receive (const char *dir, int *updated)
+  {
+  YsyncChannel ch;
+  memset (&ch, 0, sizeof (ch));
+  ch.out = malloc (YS_FRAME_SIZE);
+  ch.in = malloc (YS_FRAME_SIZE + YS_FRAME_OVERHEAD);
+  ch.out_block = 1;
+  ch.in_seq = 1;
+  uint8_t *buff = malloc (YS_MAX_BLOCK);
+  *updated = 0;
+
+  if (ch.out && ch.in && buff)
+    {
+    BOOL session_done = FALSE;
+    while (!session_done && !ch.err)
+      {
+      uint8_t req = ysync_get_u8 (&ch);
+      if (ch.err) break;
+      switch (req)
+        {
+        case 'H':
+          ysync_do_hashes (&ch, dir, buff);
+          break;
+        case 'D':
+          if (ysync_do_delta (&ch, dir, buff)) (*updated)++;
+          break;
+        case 'Q':
+          ysync_put_u8 (&ch, 'K');
+          ysync_flush (&ch);
+          session_done = TRUE;
+          break;
+        default:
+          ch.err = YmodemBadPacket;
+        }
+      }
+    }
+  else
+    ch.err = YmodemNoMem;
+
+  free (ch.out);
+  free (ch.in);
+  free (buff);
+
+  if (ch.err && ch.err != YmodemCancelled)
+    {
+    interface_write_char (YS_CAN);
+    interface_write_char (YS_CAN);
+    interface_sleep_ms (1000);
+    }
+  return ch.err;
+  }
+